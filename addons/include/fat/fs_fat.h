@@ -89,6 +89,10 @@ int fs_fat_shutdown(void);
     the given block device and mount it only if there is actually an FAT
     filesystem.
 
+    Mounting read-write reads the whole FAT to find out which clusters are
+    free, so that writing files later doesn't have to. On a large card, that
+    can be a few megabytes to read.
+
     \param  mp          The path to mount the filesystem at.
     \param  dev         The block device containing the filesystem.
     \param  flags       Mount flags. Bitwise OR of values from fat_mount_flags
@@ -21,73 +21,24 @@
 
 static int initted = 0;
 
-/* This is basically the same as bgrad_cache from fs_iso9660 */
-static void make_mru(ext2_fs_t *fs, ext2_cache_t **cache, int block) {
-    int i;
-    ext2_cache_t *tmp;
-
-    /* Don't try it with the end block */
-    if(block < 0 || block >= fs->cache_size - 1)
-        return;
-
-    /* Make a copy and scoot everything down */
-    tmp = cache[block];
-
-    for(i = block; i < fs->cache_size - 1; ++i) {
-        cache[i] = cache[i + 1];
-    }
-
-    cache[fs->cache_size - 1] = tmp;
-}
-
-/* XXXX: This needs locking! */
 uint8_t *ext2_block_read(ext2_fs_t *fs, uint32_t bl, int *err) {
-    int i;
-    uint8_t *rv;
-    ext2_cache_t **cache = fs->bcache;
-
-    /* Look through the cache from the most recently used to the least recently
-       used entry. */
-    for(i = fs->cache_size - 1; i >= 0; --i) {
-        if(cache[i]->block == bl && cache[i]->flags) {
-            rv = cache[i]->data;
-            make_mru(fs, cache, i);
-            goto out;
-        }
-    }
-
-    /* If we didn't get anything, did we end up with an invalid entry or do we
-       need to boot someone out? */
-    if(i < 0) {
-        i = 0;
-
-        /* Make sure that if the block is dirty, we write it back out. */
-        if(cache[0]->flags & EXT2_CACHE_FLAG_DIRTY) {
-            if(ext2_block_write_nc(fs, cache[0]->block, cache[0]->data)) {
-                /* XXXX: Uh oh... */
-                *err = EIO;
-                return NULL;
-            }
-        }
-    }
-
-    /* Try to read the block in question. */
-    if(ext2_block_read_nc(fs, bl, cache[i]->data)) {
-        *err = EIO;
-        cache[i]->flags = 0;            /* Mark it as invalid... */
-        return NULL;
-    }
+    return blockcache_read(fs->bcache, bl, err);
+}
 
-    cache[i]->block = bl;
-    cache[i]->flags = EXT2_CACHE_FLAG_VALID;
-    rv = cache[i]->data;
-    make_mru(fs, cache, i);
+uint8_t *ext2_block_pin(ext2_fs_t *fs, uint32_t bl, int *err) {
+    return blockcache_pin(fs->bcache, bl, err);
+}
 
-out:
-    return rv;
+void ext2_block_unpin(ext2_fs_t *fs, const uint8_t *blk) {
+    blockcache_unpin(fs->bcache, blk);
 }
 
 int ext2_block_read_nc(ext2_fs_t *fs, uint32_t block_num, uint8_t *rv) {
+    return ext2_block_read_run_nc(fs, block_num, 1, rv);
+}
+
+int ext2_block_read_run_nc(ext2_fs_t *fs, uint32_t block_num, uint32_t count,
+                           uint8_t *buf) {
     int fs_per_block = fs->sb.s_log_block_size - fs->dev->l_block_size + 10;
 
     if(fs_per_block < 0)
@@ -95,11 +46,12 @@ int ext2_block_read_nc(ext2_fs_t *fs, uint32_t block_num, uint8_t *rv) {
            as large as the sector size of the block device itself. */
         return -EINVAL;
 
-    if(fs->sb.s_blocks_count <= block_num)
+    if(block_num + count < block_num ||
+       fs->sb.s_blocks_count < block_num + count)
         return -EINVAL;
 
-    if(fs->dev->read_blocks(fs->dev, block_num << fs_per_block,
-                            1 << fs_per_block, rv))
+    if(fs->dev->read_blocks(fs->dev, (uint64_t)block_num << fs_per_block,
+                            count << fs_per_block, buf))
         return -EIO;
 
     return 0;
@@ -124,40 +76,15 @@ int ext2_block_write_nc(ext2_fs_t *fs, uint32_t block_num, const uint8_t *blk) {
 }
 
 int ext2_block_mark_dirty(ext2_fs_t *fs, uint32_t block_num) {
-    int i;
-    ext2_cache_t **cache = fs->bcache;
-
-    /* Look through the cache from the most recently used to the least recently
-       used entry. */
-    for(i = fs->cache_size - 1; i >= 0; --i) {
-        if(cache[i]->block == block_num && cache[i]->flags) {
-            cache[i]->flags |= EXT2_CACHE_FLAG_DIRTY;
-            make_mru(fs, cache, i);
-            return 0;
-        }
-    }
-
-    return -EINVAL;
+    return blockcache_mark_dirty(fs->bcache, block_num);
 }
 
 int ext2_block_cache_wb(ext2_fs_t *fs) {
-    int i, err;
-    ext2_cache_t **cache = fs->bcache;
-
     /* Don't even bother if we're mounted read-only. */
     if(!(fs->mnt_flags & EXT2FS_MNT_FLAG_RW))
         return 0;
 
-    for(i = fs->cache_size - 1; i >= 0; --i) {
-        if(cache[i]->flags & EXT2_CACHE_FLAG_DIRTY) {
-            if((err = ext2_block_write_nc(fs, cache[i]->block, cache[i]->data)))
-                return err;
-
-            cache[i]->flags &= ~EXT2_CACHE_FLAG_DIRTY;
-        }
-    }
-    
-    return 0;
+    return blockcache_writeback(fs->bcache);
 }
 
 uint8_t *ext2_block_alloc(ext2_fs_t *fs, uint32_t bg, uint32_t *bn, int *err) {
@@ -260,6 +187,21 @@ uint32_t ext2_log_block_size(const ext2_fs_t *fs) {
     return fs->sb.s_log_block_size + 10;
 }
 
+uint32_t ext2_blocks_freed(const ext2_fs_t *fs) {
+    return fs->blocks_freed;
+}
+
+/* Glue between the block cache and the uncached block functions above. Any
+   failure at this level is reported as an I/O error to the upper layers. */
+static int ext2_bcache_read(void *ctx, uint32_t block_num, uint8_t *rv) {
+    return ext2_block_read_nc((ext2_fs_t *)ctx, block_num, rv) ? -EIO : 0;
+}
+
+static int ext2_bcache_write(void *ctx, uint32_t block_num,
+                             const uint8_t *blk) {
+    return ext2_block_write_nc((ext2_fs_t *)ctx, block_num, blk) ? -EIO : 0;
+}
+
 int ext2_init(void) {
     ext2_inode_init();
     initted = 1;
@@ -274,7 +216,6 @@ ext2_fs_t *ext2_fs_init(kos_blockdev_t *bd, uint32_t flags) {
 ext2_fs_t *ext2_fs_init_ex(kos_blockdev_t *bd, uint32_t flags, int cache_sz) {
     ext2_fs_t *rv;
     uint32_t bc;
-    int j;
     int block_size;
 
 #ifdef EXT2FS_DEBUG
@@ -297,6 +238,7 @@ ext2_fs_t *ext2_fs_init_ex(kos_blockdev_t *bd, uint32_t flags, int cache_sz) {
     }
 
     rv->dev = bd;
+    rv->blocks_freed = 0;
     rv->mnt_flags = flags & EXT2FS_MNT_VALID_FLAGS_MASK;
 
     if(rv->mnt_flags != flags) {
@@ -409,46 +351,15 @@ ext2_fs_t *ext2_fs_init_ex(kos_blockdev_t *bd, uint32_t flags, int cache_sz) {
 #endif /* EXT2FS_DEBUG */
 
     /* Make space for the block cache. */
-    if(!(rv->bcache = (ext2_cache_t **)malloc(sizeof(ext2_cache_t *) *
-                                              cache_sz))) {
+    if(!(rv->bcache = blockcache_create(cache_sz, block_size, &ext2_bcache_read,
+                                        &ext2_bcache_write, rv))) {
         free(rv->bg);
         free(rv);
         bd->shutdown(bd);
         return NULL;
     }
 
-    for(j = 0; j < cache_sz; ++j) {
-        if(!(rv->bcache[j] = (ext2_cache_t *)malloc(sizeof(ext2_cache_t))))
-            goto out_cache;
-    }
-
-    for(j = 0; j < cache_sz; ++j) {
-        if(!(rv->bcache[j]->data = (uint8_t *)malloc(block_size)))
-            goto out_bcache;
-
-        rv->bcache[j]->flags = 0;
-    }
-
-    rv->cache_size = cache_sz;
-
     return rv;
-
-out_bcache:
-    for(; j >= 0; --j) {
-        free(rv->bcache[j]->data);
-    }
-
-    j = cache_sz - 1;
-out_cache:
-    for(; j >= 0; --j) {
-        free(rv->bcache[j]);
-    }
-
-    free(rv->bcache);
-    free(rv->bg);
-    free(rv);
-    bd->shutdown(bd);
-    return NULL;
 }
 
 int ext2_fs_sync(ext2_fs_t *fs) {
@@ -499,17 +410,10 @@ int ext2_fs_sync(ext2_fs_t *fs) {
 }
 
 void ext2_fs_shutdown(ext2_fs_t *fs) {
-    int i;
-
     /* Sync the filesystem back to the block device, if needed. */
     ext2_fs_sync(fs);
 
-    for(i = 0; i < fs->cache_size; ++i) {
-        free(fs->bcache[i]->data);
-        free(fs->bcache[i]);
-    }
-
-    free(fs->bcache);
+    blockcache_destroy(fs->bcache);
     fs->dev->shutdown(fs->dev);
     free(fs->bg);
     free(fs);
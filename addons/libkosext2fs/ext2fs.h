@@ -50,6 +50,15 @@ __BEGIN_DECLS
 */
 #define EXT2_CACHE_BLOCKS       32
 
+/* Maximum size of a single read that bypasses the block cache, in device
+   sectors. Large reads of whole blocks that are contiguous on the device are
+   done straight into the caller's buffer with as few requests to the block
+   device as possible. This caps the size of each of those requests, which
+   bounds how long the filesystem is locked for while a read is in progress.
+   This must not be larger than 65535 (the most the G1 ATA DMA code can do in
+   one go). */
+#define EXT2_MAX_RUN_SECTORS    1024
+
 /* End tunable filesystem parameters. */
 
 /* Convenience stuff, for in case you want to use this outside of KOS. */
@@ -71,6 +80,11 @@ typedef struct kos_blockdev {
 #define SYMLOOP_MAX 16
 #endif
 
+/* Strict C99 mode on glibc hides this one. */
+#ifndef PATH_MAX
+#define PATH_MAX 4096
+#endif
+
 #endif /* EXT2_NOT_IN_KOS */
 
 /* Opaque ext2 filesystem type */
@@ -87,6 +101,12 @@ typedef struct ext2fs_struct ext2_fs_t;
 uint32_t ext2_block_size(const ext2_fs_t *fs);
 uint32_t ext2_log_block_size(const ext2_fs_t *fs);
 
+/* A count of the blocks that have been freed on the filesystem. Anything that
+   looks at a block's data without holding the lock that serializes access to
+   the filesystem can check this afterwards to see whether the block might have
+   been freed (and given to some other file) in the meantime. */
+uint32_t ext2_blocks_freed(const ext2_fs_t *fs);
+
 /* Initialize low-level structures (like the global inode cache). If you don't
    call this before calling ext2_fs_init(), it will be called for you before
    mounting the first filesystem. */
@@ -100,6 +120,18 @@ void ext2_fs_shutdown(ext2_fs_t *fs);
 int ext2_block_read_nc(ext2_fs_t *fs, uint32_t block_num, uint8_t *rv);
 uint8_t *ext2_block_read(ext2_fs_t *fs, uint32_t block_num, int *err);
 
+/* Read count blocks, starting at block_num, straight from the device. This
+   doesn't touch the block cache or any other state of the filesystem, so it
+   can be called without holding whatever serializes access to the rest of it
+   (as long as the device itself can take it). */
+int ext2_block_read_run_nc(ext2_fs_t *fs, uint32_t block_num, uint32_t count,
+                           uint8_t *buf);
+
+/* Read a block through the cache and keep it there until it's unpinned, so
+   its data can be copied out without holding the filesystem's lock. */
+uint8_t *ext2_block_pin(ext2_fs_t *fs, uint32_t block_num, int *err);
+void ext2_block_unpin(ext2_fs_t *fs, const uint8_t *blk);
+
 int ext2_block_write_nc(ext2_fs_t *fs, uint32_t block_num, const uint8_t *blk);
 
 int ext2_block_mark_dirty(ext2_fs_t *fs, uint32_t block_num);
@@ -15,6 +15,7 @@
 
 #include <kos/fs.h>
 #include <kos/mutex.h>
+#include <kos/lockstat.h>
 #include <kos/dbglog.h>
 
 #include <ext2/fs_ext2.h>
@@ -33,12 +34,29 @@ char *strdup(const char *);
 
 #define MAX_EXT2_FILES 16
 
+/* Locking rules:
+   ext2_mutex protects the list of mounted filesystems and the allocation of
+   slots in the file handle table. Each mounted filesystem has its own lock that
+   protects all of its metadata (the block cache, inode cache, bitmaps, and so
+   on). Each file handle has its own lock that protects the state of the handle
+   itself (mainly the file pointer). When more than one of these is needed, they
+   must be taken in the order: file handle lock, ext2_mutex, filesystem lock.
+
+   Reads copy data out of pinned cache blocks and read runs of blocks straight
+   from the device without holding the filesystem lock, so the block device is
+   wrapped in one that serializes everything sent to it with a device lock of
+   its own. That one is always taken last. */
 typedef struct fs_ext2_fs {
     LIST_ENTRY(fs_ext2_fs) entry;
 
     vfs_handler_t *vfsh;
     ext2_fs_t *fs;
     uint32_t mount_flags;
+    mutex_t lock;
+
+    kos_blockdev_t dev;                 /* What the filesystem is given */
+    kos_blockdev_t *real_dev;           /* What it wraps */
+    mutex_t dev_lock;
 } fs_ext2_fs_t;
 
 LIST_HEAD(ext2_list, fs_ext2_fs);
@@ -52,6 +70,7 @@ static struct {
     dirent_t dent;
     ext2_inode_t *inode;
     fs_ext2_fs_t *fs;
+    mutex_t lock;
 } fh[MAX_EXT2_FILES];
 
 static int create_empty_file(fs_ext2_fs_t *fs, const char *fn,
@@ -143,12 +162,15 @@ static void *fs_ext2_open(vfs_handler_t *vfs, const char *fn, int mode) {
         }
     }
 
+    mutex_unlock(&ext2_mutex);
+
     if(fd >= MAX_EXT2_FILES) {
         errno = ENFILE;
-        mutex_unlock(&ext2_mutex);
         return NULL;
     }
 
+    mutex_lock(&mnt->lock);
+
     /* Find the object in question */
     if((rv = ext2_inode_by_path(mnt->fs, fn, &fh[fd].inode,
                                 &fh[fd].inode_num, 1, NULL))) {
@@ -159,7 +181,7 @@ static void *fs_ext2_open(vfs_handler_t *vfs, const char *fn, int mode) {
                 if((rv = create_empty_file(mnt, fn, &fh[fd].inode,
                                            &fh[fd].inode_num))) {
                     fh[fd].inode_num = 0;
-                    mutex_unlock(&ext2_mutex);
+                    mutex_unlock(&mnt->lock);
                     errno = -rv;
                     return NULL;
                 }
@@ -174,7 +196,7 @@ static void *fs_ext2_open(vfs_handler_t *vfs, const char *fn, int mode) {
             errno = -rv;
         }
 
-        mutex_unlock(&ext2_mutex);
+        mutex_unlock(&mnt->lock);
         return NULL;
     }
 
@@ -184,7 +206,7 @@ static void *fs_ext2_open(vfs_handler_t *vfs, const char *fn, int mode) {
         errno = EISDIR;
         fh[fd].inode_num = 0;
         ext2_inode_put(fh[fd].inode);
-        mutex_unlock(&ext2_mutex);
+        mutex_unlock(&mnt->lock);
         return NULL;
     }
 
@@ -193,7 +215,7 @@ static void *fs_ext2_open(vfs_handler_t *vfs, const char *fn, int mode) {
         errno = ENOTDIR;
         fh[fd].inode_num = 0;
         ext2_inode_put(fh[fd].inode);
-        mutex_unlock(&ext2_mutex);
+        mutex_unlock(&mnt->lock);
         return NULL;
     }
 
@@ -205,7 +227,7 @@ created:
             errno = -rv;
             fh[fd].inode_num = 0;
             ext2_inode_put(fh[fd].inode);
-            mutex_unlock(&ext2_mutex);
+            mutex_unlock(&mnt->lock);
             return NULL;
         }
 
@@ -221,41 +243,58 @@ created:
     fh[fd].ptr = 0;
     fh[fd].fs = mnt;
 
-    mutex_unlock(&ext2_mutex);
+    mutex_unlock(&mnt->lock);
 
     return (void *)(fd + 1);
 }
 
 static int fs_ext2_close(void *h) {
     file_t fd = ((file_t)h) - 1;
+    fs_ext2_fs_t *mnt;
 
-    mutex_lock(&ext2_mutex);
+    if(fd >= MAX_EXT2_FILES)
+        return 0;
+
+    mutex_lock(&fh[fd].lock);
 
-    if(fd < MAX_EXT2_FILES && fh[fd].mode) {
+    if(fh[fd].mode) {
+        mnt = fh[fd].fs;
+
+        mutex_lock(&mnt->lock);
         ext2_inode_put(fh[fd].inode);
+        mutex_unlock(&mnt->lock);
+
+        mutex_lock(&ext2_mutex);
         fh[fd].inode_num = 0;
         fh[fd].mode = 0;
+        mutex_unlock(&ext2_mutex);
     }
 
-    mutex_unlock(&ext2_mutex);
+    mutex_unlock(&fh[fd].lock);
     return 0;
 }
 
 static ssize_t fs_ext2_read(void *h, void *buf, size_t cnt) {
     file_t fd = ((file_t)h) - 1;
+    fs_ext2_fs_t *mnt;
     ext2_fs_t *fs;
-    uint32_t bs, lbs, bo;
+    uint32_t bs, lbs, bo, len, first, freed;
     uint8_t *block;
     uint8_t *bbuf = (uint8_t *)buf;
     ssize_t rv;
     uint64_t sz;
-    int mode;
-
-    mutex_lock(&ext2_mutex);
+    int mode, n, err;
 
     /* Check that the fd is valid */
-    if(fd >= MAX_EXT2_FILES || !fh[fd].inode_num) {
-        mutex_unlock(&ext2_mutex);
+    if(fd >= MAX_EXT2_FILES) {
+        errno = EBADF;
+        return -1;
+    }
+
+    mutex_lock(&fh[fd].lock);
+
+    if(!fh[fd].inode_num) {
+        mutex_unlock(&fh[fd].lock);
         errno = EBADF;
         return -1;
     }
@@ -263,78 +302,105 @@ static ssize_t fs_ext2_read(void *h, void *buf, size_t cnt) {
     /* Make sure the fd is open for reading */
     mode = fh[fd].mode & O_MODE_MASK;
     if(mode != O_RDONLY && mode != O_RDWR) {
-        mutex_unlock(&ext2_mutex);
+        mutex_unlock(&fh[fd].lock);
         errno = EBADF;
         return -1;
     }
 
     /* Make sure we're not trying to read a directory with read */
     if(fh[fd].mode & O_DIR) {
-        mutex_unlock(&ext2_mutex);
+        mutex_unlock(&fh[fd].lock);
         errno = EISDIR;
         return -1;
     }
 
+    mnt = fh[fd].fs;
+    fs = mnt->fs;
+    bs = ext2_block_size(fs);
+    lbs = ext2_log_block_size(fs);
+
     /* Do we have enough left? */
+    mutex_lock(&mnt->lock);
     sz = ext2_inode_size(fh[fd].inode);
-    if((fh[fd].ptr + cnt) > sz)
+
+    if(fh[fd].ptr >= sz)
+        cnt = 0;
+    else if((fh[fd].ptr + cnt) > sz)
         cnt = sz - fh[fd].ptr;
 
-    fs = fh[fd].fs->fs;
-    bs = ext2_block_size(fs);
-    lbs = ext2_log_block_size(fs);
     rv = (ssize_t)cnt;
-    bo = fh[fd].ptr & ((1 << lbs) - 1);
 
-    /* Handle the first block specially if we are offset within it. */
-    if(bo) {
-        if(!(block = ext2_inode_read_block(fs, fh[fd].inode, fh[fd].ptr >> lbs,
-                                           NULL, &errno))) {
-            mutex_unlock(&ext2_mutex);
-            return -1;
+    /* Read one block (or run of contiguous blocks) at a time. The filesystem
+       lock is only held to find each piece. The data itself is read from the
+       device or copied out of the cache without it, so that reads of other
+       files on the same filesystem can go on in the meantime. If any blocks
+       were freed while the lock was let go of, the piece we just read might
+       have been handed to another file, so it gets read again. */
+    while(cnt) {
+        bo = fh[fd].ptr & (bs - 1);
+        freed = ext2_blocks_freed(fs);
+        n = 0;
+
+        /* If we're reading whole blocks into a suitably aligned buffer, read as
+           many as we can that are contiguous on the device directly into the
+           user's buffer, bypassing the cache. */
+        if(!bo && cnt >= bs && !((uintptr_t)bbuf & 31)) {
+            if((n = ext2_inode_map_run(fs, fh[fd].inode, fh[fd].ptr >> lbs,
+                                       cnt >> lbs, &first, &errno)) < 0)
+                goto out_err;
         }
 
-        if(cnt > bs - bo) {
-            memcpy(bbuf, block + bo, bs - bo);
-            fh[fd].ptr += bs - bo;
-            cnt -= bs - bo;
-            bbuf += bs - bo;
-        }
-        else {
-            memcpy(bbuf, block + bo, cnt);
-            fh[fd].ptr += cnt;
-            cnt = 0;
-        }
-    }
+        if(n > 0) {
+            len = (uint32_t)n << lbs;
 
-    /* While we still have more to read, do it. */
-    while(cnt) {
-        if(!(block = ext2_inode_read_block(fs, fh[fd].inode, fh[fd].ptr >> lbs,
-                                           NULL, &errno))) {
-            mutex_unlock(&ext2_mutex);
-            return -1;
-        }
+            mutex_unlock(&mnt->lock);
+            err = ext2_block_read_run_nc(fs, first, (uint32_t)n, bbuf);
+            mutex_lock(&mnt->lock);
 
-        if(cnt > bs) {
-            memcpy(bbuf, block, bs);
-            fh[fd].ptr += bs;
-            cnt -= bs;
-            bbuf += bs;
+            if(err) {
+                errno = -err;
+                goto out_err;
+            }
         }
         else {
-            memcpy(bbuf, block, cnt);
-            fh[fd].ptr += cnt;
-            cnt = 0;
+            len = bs - bo;
+
+            if(cnt < len)
+                len = cnt;
+
+            if(!(block = ext2_inode_pin_block(fs, fh[fd].inode,
+                                              fh[fd].ptr >> lbs, &errno)))
+                goto out_err;
+
+            mutex_unlock(&mnt->lock);
+            memcpy(bbuf, block + bo, len);
+            mutex_lock(&mnt->lock);
+
+            ext2_block_unpin(fs, block);
         }
+
+        if(ext2_blocks_freed(fs) != freed)
+            continue;
+
+        fh[fd].ptr += len;
+        cnt -= len;
+        bbuf += len;
     }
 
     /* We're done, clean up and return. */
-    mutex_unlock(&ext2_mutex);
+    mutex_unlock(&mnt->lock);
+    mutex_unlock(&fh[fd].lock);
     return rv;
+
+out_err:
+    mutex_unlock(&mnt->lock);
+    mutex_unlock(&fh[fd].lock);
+    return -1;
 }
 
 static ssize_t fs_ext2_write(void *h, const void *buf, size_t cnt) {
     file_t fd = ((file_t)h) - 1;
+    fs_ext2_fs_t *mnt;
     ext2_fs_t *fs;
     uint32_t bs, lbs, bo, bn;
     uint8_t *block;
@@ -343,11 +409,16 @@ static ssize_t fs_ext2_write(void *h, const void *buf, size_t cnt) {
     uint64_t sz;
     int err, mode;
 
-    mutex_lock(&ext2_mutex);
-
     /* Check that the fd is valid */
-    if(fd >= MAX_EXT2_FILES || !fh[fd].inode_num) {
-        mutex_unlock(&ext2_mutex);
+    if(fd >= MAX_EXT2_FILES) {
+        errno = EBADF;
+        return -1;
+    }
+
+    mutex_lock(&fh[fd].lock);
+
+    if(!fh[fd].inode_num) {
+        mutex_unlock(&fh[fd].lock);
         errno = EBADF;
         return -1;
     }
@@ -355,12 +426,17 @@ static ssize_t fs_ext2_write(void *h, const void *buf, size_t cnt) {
     /* Make sure the fd is open for writing */
     mode = fh[fd].mode & O_MODE_MASK;
     if(mode != O_WRONLY && mode != O_RDWR) {
-        mutex_unlock(&ext2_mutex);
+        mutex_unlock(&fh[fd].lock);
         errno = EBADF;
         return -1;
     }
 
-    fs = fh[fd].fs->fs;
+    /* Writing touches the block bitmaps and the inode, so hold the filesystem
+       lock for the whole operation. */
+    mnt = fh[fd].fs;
+    mutex_lock(&mnt->lock);
+
+    fs = mnt->fs;
     bs = ext2_block_size(fs);
     lbs = ext2_log_block_size(fs);
     rv = (ssize_t)cnt;
@@ -379,7 +455,8 @@ static ssize_t fs_ext2_write(void *h, const void *buf, size_t cnt) {
             if(!(block = ext2_inode_read_block(fs, fh[fd].inode,
                                                (fh[fd].ptr - 1) >> lbs, &bn,
                                                &errno))) {
-                mutex_unlock(&ext2_mutex);
+                mutex_unlock(&mnt->lock);
+                mutex_unlock(&fh[fd].lock);
                 return -1;
             }
 
@@ -393,7 +470,8 @@ static ssize_t fs_ext2_write(void *h, const void *buf, size_t cnt) {
                 if(!(block = ext2_inode_read_block(fs, fh[fd].inode,
                                                    (sz - 1) >> lbs,
                                                    &bn, &errno))) {
-                    mutex_unlock(&ext2_mutex);
+                    mutex_unlock(&mnt->lock);
+                    mutex_unlock(&fh[fd].lock);
                     return -1;
                 }
 
@@ -407,7 +485,8 @@ static ssize_t fs_ext2_write(void *h, const void *buf, size_t cnt) {
             while(sz < fh[fd].ptr) {
                 if(!(block = ext2_inode_alloc_block(fs, fh[fd].inode,
                                                     sz >> lbs, &errno))) {
-                    mutex_unlock(&ext2_mutex);
+                    mutex_unlock(&mnt->lock);
+                    mutex_unlock(&fh[fd].lock);
                     return -1;
                 }
 
@@ -423,7 +502,8 @@ static ssize_t fs_ext2_write(void *h, const void *buf, size_t cnt) {
     if((bo = fh[fd].ptr & ((1 << lbs) - 1))) {
         if(!(block = ext2_inode_read_block(fs, fh[fd].inode, fh[fd].ptr >> lbs,
                                            &bn, &errno))) {
-            mutex_unlock(&ext2_mutex);
+            mutex_unlock(&mnt->lock);
+            mutex_unlock(&fh[fd].lock);
             return -1;
         }
 
@@ -447,14 +527,16 @@ static ssize_t fs_ext2_write(void *h, const void *buf, size_t cnt) {
         if(!(block = ext2_inode_read_block(fs, fh[fd].inode, fh[fd].ptr >> lbs,
                                            &bn, &err))) {
             if(err != EINVAL) {
-                mutex_unlock(&ext2_mutex);
+                mutex_unlock(&mnt->lock);
+                mutex_unlock(&fh[fd].lock);
                 errno = err;
                 return -1;
             }
 
             if(!(block = ext2_inode_alloc_block(fs, fh[fd].inode,
                                                 fh[fd].ptr >> lbs, &errno))) {
-                mutex_unlock(&ext2_mutex);
+                mutex_unlock(&mnt->lock);
+                mutex_unlock(&fh[fd].lock);
                 return -1;
             }
         }
@@ -482,7 +564,8 @@ static ssize_t fs_ext2_write(void *h, const void *buf, size_t cnt) {
     fh[fd].inode->i_mtime = time(NULL);
     ext2_inode_mark_dirty(fh[fd].inode);
 
-    mutex_unlock(&ext2_mutex);
+    mutex_unlock(&mnt->lock);
+    mutex_unlock(&fh[fd].lock);
     return rv;
 }
 
@@ -490,11 +573,16 @@ static _off64_t fs_ext2_seek64(void *h, _off64_t offset, int whence) {
     file_t fd = ((file_t)h) - 1;
     off_t rv;
 
-    mutex_lock(&ext2_mutex);
-
     /* Check that the fd is valid */
-    if(fd >= MAX_EXT2_FILES || !fh[fd].inode_num || (fh[fd].mode & O_DIR)) {
-        mutex_unlock(&ext2_mutex);
+    if(fd >= MAX_EXT2_FILES) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    mutex_lock(&fh[fd].lock);
+
+    if(!fh[fd].inode_num || (fh[fd].mode & O_DIR)) {
+        mutex_unlock(&fh[fd].lock);
         errno = EINVAL;
         return -1;
     }
@@ -510,16 +598,18 @@ static _off64_t fs_ext2_seek64(void *h, _off64_t offset, int whence) {
             break;
 
         case SEEK_END:
+            mutex_lock(&fh[fd].fs->lock);
             fh[fd].ptr = ext2_inode_size(fh[fd].inode) + offset;
+            mutex_unlock(&fh[fd].fs->lock);
             break;
 
         default:
-            mutex_unlock(&ext2_mutex);
+            mutex_unlock(&fh[fd].lock);
             return -1;
     }
 
     rv = (_off64_t)fh[fd].ptr;
-    mutex_unlock(&ext2_mutex);
+    mutex_unlock(&fh[fd].lock);
     return rv;
 }
 
@@ -527,16 +617,21 @@ static _off64_t fs_ext2_tell64(void *h) {
     file_t fd = ((file_t)h) - 1;
     off_t rv;
 
-    mutex_lock(&ext2_mutex);
+    if(fd >= MAX_EXT2_FILES) {
+        errno = EINVAL;
+        return -1;
+    }
 
-    if(fd >= MAX_EXT2_FILES || !fh[fd].inode_num || (fh[fd].mode & O_DIR)) {
-        mutex_unlock(&ext2_mutex);
+    mutex_lock(&fh[fd].lock);
+
+    if(!fh[fd].inode_num || (fh[fd].mode & O_DIR)) {
+        mutex_unlock(&fh[fd].lock);
         errno = EINVAL;
         return -1;
     }
 
     rv = (_off64_t)fh[fd].ptr;
-    mutex_unlock(&ext2_mutex);
+    mutex_unlock(&fh[fd].lock);
     return rv;
 }
 
@@ -544,21 +639,30 @@ static uint64 fs_ext2_total64(void *h) {
     file_t fd = ((file_t)h) - 1;
     size_t rv;
 
-    mutex_lock(&ext2_mutex);
+    if(fd >= MAX_EXT2_FILES) {
+        errno = EINVAL;
+        return -1;
+    }
 
-    if(fd >= MAX_EXT2_FILES || !fh[fd].inode_num || (fh[fd].mode & O_DIR)) {
-        mutex_unlock(&ext2_mutex);
+    mutex_lock(&fh[fd].lock);
+
+    if(!fh[fd].inode_num || (fh[fd].mode & O_DIR)) {
+        mutex_unlock(&fh[fd].lock);
         errno = EINVAL;
         return -1;
     }
 
+    mutex_lock(&fh[fd].fs->lock);
     rv = ext2_inode_size(fh[fd].inode);
-    mutex_unlock(&ext2_mutex);
+    mutex_unlock(&fh[fd].fs->lock);
+
+    mutex_unlock(&fh[fd].lock);
     return rv;
 }
 
 static dirent_t *fs_ext2_readdir(void *h) {
     file_t fd = ((file_t)h) - 1;
+    fs_ext2_fs_t *mnt;
     ext2_fs_t *fs;
     uint32_t bs, lbs;
     uint8_t *block;
@@ -566,29 +670,39 @@ static dirent_t *fs_ext2_readdir(void *h) {
     ext2_inode_t *inode;
     int err;
 
-    mutex_lock(&ext2_mutex);
-
     /* Check that the fd is valid */
-    if(fd >= MAX_EXT2_FILES || !fh[fd].inode_num || !(fh[fd].mode & O_DIR)) {
-        mutex_unlock(&ext2_mutex);
+    if(fd >= MAX_EXT2_FILES) {
+        errno = EBADF;
+        return NULL;
+    }
+
+    mutex_lock(&fh[fd].lock);
+
+    if(!fh[fd].inode_num || !(fh[fd].mode & O_DIR)) {
+        mutex_unlock(&fh[fd].lock);
         errno = EBADF;
         return NULL;
     }
 
-    fs = fh[fd].fs->fs;
+    mnt = fh[fd].fs;
+    mutex_lock(&mnt->lock);
+
+    fs = mnt->fs;
     bs = ext2_block_size(fs);
     lbs = ext2_log_block_size(fs);
 
 retry:
     /* Make sure we're not at the end of the directory */
     if(fh[fd].ptr >= fh[fd].inode->i_size) {
-        mutex_unlock(&ext2_mutex);
+        mutex_unlock(&mnt->lock);
+        mutex_unlock(&fh[fd].lock);
         return NULL;
     }
 
     if(!(block = ext2_inode_read_block(fs, fh[fd].inode, fh[fd].ptr >> lbs,
                                        NULL, &errno))) {
-        mutex_unlock(&ext2_mutex);
+        mutex_unlock(&mnt->lock);
+        mutex_unlock(&fh[fd].lock);
         return NULL;
     }
 
@@ -597,7 +711,8 @@ retry:
 
     /* Make sure the directory entry is sane */
     if(!dent->rec_len) {
-        mutex_unlock(&ext2_mutex);
+        mutex_unlock(&mnt->lock);
+        mutex_unlock(&fh[fd].lock);
         errno = EBADF;
         return NULL;
     }
@@ -610,7 +725,8 @@ retry:
 
     /* Grab the inode of this entry */
     if(!(inode = ext2_inode_get(fs, dent->inode, &err))) {
-        mutex_unlock(&ext2_mutex);
+        mutex_unlock(&mnt->lock);
+        mutex_unlock(&fh[fd].lock);
         errno = EIO;
         return NULL;
     }
@@ -629,7 +745,8 @@ retry:
         fh[fd].dent.attr = 0;
 
     ext2_inode_put(inode);
-    mutex_unlock(&ext2_mutex);
+    mutex_unlock(&mnt->lock);
+    mutex_unlock(&fh[fd].lock);
     return &fh[fd].dent;
 }
 
@@ -885,11 +1002,11 @@ static int fs_ext2_rename(vfs_handler_t *vfs, const char *fn1,
     /* Split the string. */
     *ent++ = 0;
 
-    mutex_lock(&ext2_mutex);
+    mutex_lock(&fs->lock);
 
     /* Find the parent directory of the original object.*/
     if((irv = ext2_inode_by_path(fs->fs, cp, &pinode, &inode_num, 1, NULL))) {
-        mutex_unlock(&ext2_mutex);
+        mutex_unlock(&fs->lock);
         free(cp);
         errno = -irv;
         return -1;
@@ -898,7 +1015,7 @@ static int fs_ext2_rename(vfs_handler_t *vfs, const char *fn1,
     /* If the entry we get back is not a directory, then we've got problems. */
     if((pinode->i_mode & 0xF000) != EXT2_S_IFDIR) {
         ext2_inode_put(pinode);
-        mutex_unlock(&ext2_mutex);
+        mutex_unlock(&fs->lock);
         free(cp);
         errno = ENOTDIR;
         return -1;
@@ -907,7 +1024,7 @@ static int fs_ext2_rename(vfs_handler_t *vfs, const char *fn1,
     /* Grab the directory entry for the old filename. */
     if(!(dent = ext2_dir_entry(fs->fs, pinode, ent))) {
         ext2_inode_put(pinode);
-        mutex_unlock(&ext2_mutex);
+        mutex_unlock(&fs->lock);
         free(cp);
         errno = ENOENT;
         return -1;
@@ -915,7 +1032,8 @@ static int fs_ext2_rename(vfs_handler_t *vfs, const char *fn1,
 
     /* Find the inode of the entry we want to move. */
     if(!(inode = ext2_inode_get(fs->fs, dent->inode, &irv))) {
-        mutex_unlock(&ext2_mutex);
+        ext2_inode_put(pinode);
+        mutex_unlock(&fs->lock);
         free(cp);
         errno = EIO;
         return -1;
@@ -940,7 +1058,7 @@ static int fs_ext2_rename(vfs_handler_t *vfs, const char *fn1,
     free(cp);
     ext2_inode_put(pinode);
     ext2_inode_put(inode);
-    mutex_lock(&ext2_mutex);
+    mutex_unlock(&fs->lock);
     return irv;
 }
 
@@ -987,11 +1105,11 @@ static int fs_ext2_unlink(vfs_handler_t *vfs, const char *fn) {
     /* Split the string. */
     *ent++ = 0;
 
-    mutex_lock(&ext2_mutex);
+    mutex_lock(&fs->lock);
 
     /* Find the parent directory of the object in question.*/
     if((irv = ext2_inode_by_path(fs->fs, cp, &pinode, &inode_num, 1, NULL))) {
-        mutex_unlock(&ext2_mutex);
+        mutex_unlock(&fs->lock);
         free(cp);
         errno = -irv;
         return -1;
@@ -1000,7 +1118,7 @@ static int fs_ext2_unlink(vfs_handler_t *vfs, const char *fn) {
     /* If the entry we get back is not a directory, then we've got problems. */
     if((pinode->i_mode & 0xF000) != EXT2_S_IFDIR) {
         ext2_inode_put(pinode);
-        mutex_unlock(&ext2_mutex);
+        mutex_unlock(&fs->lock);
         free(cp);
         errno = ENOTDIR;
         return -1;
@@ -1009,7 +1127,7 @@ static int fs_ext2_unlink(vfs_handler_t *vfs, const char *fn) {
     /* Try to find the directory entry of the item we want to remove. */
     if(!(dent = ext2_dir_entry(fs->fs, pinode, ent))) {
         ext2_inode_put(pinode);
-        mutex_unlock(&ext2_mutex);
+        mutex_unlock(&fs->lock);
         free(cp);
         errno = ENOENT;
         return -1;
@@ -1018,7 +1136,7 @@ static int fs_ext2_unlink(vfs_handler_t *vfs, const char *fn) {
     /* Find the inode of the entry we want to remove. */
     if(!(inode = ext2_inode_get(fs->fs, dent->inode, &irv))) {
         ext2_inode_put(pinode);
-        mutex_unlock(&ext2_mutex);
+        mutex_unlock(&fs->lock);
         free(cp);
         errno = EIO;
         return -1;
@@ -1029,7 +1147,7 @@ static int fs_ext2_unlink(vfs_handler_t *vfs, const char *fn) {
     if((inode->i_mode & 0xF000) == EXT2_S_IFDIR) {
         ext2_inode_put(pinode);
         ext2_inode_put(inode);
-        mutex_unlock(&ext2_mutex);
+        mutex_unlock(&fs->lock);
         free(cp);
         errno = EPERM;
         return -1;
@@ -1042,7 +1160,7 @@ static int fs_ext2_unlink(vfs_handler_t *vfs, const char *fn) {
             if(fh[irv].inode_num == dent->inode) {
                 ext2_inode_put(pinode);
                 ext2_inode_put(inode);
-                mutex_unlock(&ext2_mutex);
+                mutex_unlock(&fs->lock);
                 free(cp);
                 errno = EBUSY;
                 return -1;
@@ -1054,7 +1172,7 @@ static int fs_ext2_unlink(vfs_handler_t *vfs, const char *fn) {
     if((irv = ext2_dir_rm_entry(fs->fs, pinode, ent, &in_num))) {
         ext2_inode_put(pinode);
         ext2_inode_put(inode);
-        mutex_unlock(&ext2_mutex);
+        mutex_unlock(&fs->lock);
         free(cp);
         errno = -irv;
         return -1;
@@ -1070,13 +1188,13 @@ static int fs_ext2_unlink(vfs_handler_t *vfs, const char *fn) {
 
     /* Free up the inode and all the data blocks. */
     if((irv = ext2_inode_deref(fs->fs, in_num, 0))) {
-        mutex_unlock(&ext2_mutex);
+        mutex_unlock(&fs->lock);
         errno = -irv;
         return -1;
     }
 
     /* And, we're done. Unlock the mutex. */
-    mutex_unlock(&ext2_mutex);
+    mutex_unlock(&fs->lock);
     return 0;
 }
 
@@ -1121,11 +1239,11 @@ static int fs_ext2_mkdir(vfs_handler_t *vfs, const char *fn) {
     /* Split the string. */
     *nd++ = 0;
 
-    mutex_lock(&ext2_mutex);
+    mutex_lock(&fs->lock);
 
     /* Find the parent of the directory we want to create. */
     if((irv = ext2_inode_by_path(fs->fs, cp, &inode, &inode_num, 1, NULL))) {
-        mutex_unlock(&ext2_mutex);
+        mutex_unlock(&fs->lock);
         free(cp);
         errno = -irv;
         return -1;
@@ -1134,7 +1252,7 @@ static int fs_ext2_mkdir(vfs_handler_t *vfs, const char *fn) {
     /* See if the directory contains the item we want to create */
     if(ext2_dir_entry(fs->fs, inode, nd)) {
         ext2_inode_put(inode);
-        mutex_unlock(&ext2_mutex);
+        mutex_unlock(&fs->lock);
         free(cp);
         errno = EEXIST;
         return -1;
@@ -1143,7 +1261,7 @@ static int fs_ext2_mkdir(vfs_handler_t *vfs, const char *fn) {
     /* Allocate a new inode for the new directory. */
     if(!(ninode = ext2_inode_alloc(fs->fs, inode_num, &irv, &ninode_num))) {
         ext2_inode_put(inode);
-        mutex_unlock(&ext2_mutex);
+        mutex_unlock(&fs->lock);
         free(cp);
         errno = irv;
         return -1;
@@ -1161,7 +1279,7 @@ static int fs_ext2_mkdir(vfs_handler_t *vfs, const char *fn) {
     if((irv = ext2_dir_create_empty(fs->fs, ninode, ninode_num, inode_num))) {
         ext2_inode_put(inode);
         ext2_inode_deref(fs->fs, ninode_num, 1);
-        mutex_unlock(&ext2_mutex);
+        mutex_unlock(&fs->lock);
         free(cp);
         errno = -irv;
         return -1;
@@ -1172,7 +1290,7 @@ static int fs_ext2_mkdir(vfs_handler_t *vfs, const char *fn) {
                                  NULL))) {
         ext2_inode_put(inode);
         ext2_inode_deref(fs->fs, ninode_num, 1);
-        mutex_unlock(&ext2_mutex);
+        mutex_unlock(&fs->lock);
         free(cp);
         errno = -irv;
         return -1;
@@ -1184,7 +1302,7 @@ static int fs_ext2_mkdir(vfs_handler_t *vfs, const char *fn) {
 
     ext2_inode_put(ninode);
     ext2_inode_put(inode);
-    mutex_unlock(&ext2_mutex);
+    mutex_unlock(&fs->lock);
     free(cp);
     return 0;
 }
@@ -1232,11 +1350,11 @@ static int fs_ext2_rmdir(vfs_handler_t *vfs, const char *fn) {
     /* Split the string. */
     *ent++ = 0;
 
-    mutex_lock(&ext2_mutex);
+    mutex_lock(&fs->lock);
 
     /* Find the parent directory of the object in question.*/
     if((irv = ext2_inode_by_path(fs->fs, cp, &pinode, &inode_num, 1, NULL))) {
-        mutex_unlock(&ext2_mutex);
+        mutex_unlock(&fs->lock);
         free(cp);
         errno = -irv;
         return -1;
@@ -1245,7 +1363,7 @@ static int fs_ext2_rmdir(vfs_handler_t *vfs, const char *fn) {
     /* If the entry we get back is not a directory, then we've got problems. */
     if((pinode->i_mode & 0xF000) != EXT2_S_IFDIR) {
         ext2_inode_put(pinode);
-        mutex_unlock(&ext2_mutex);
+        mutex_unlock(&fs->lock);
         free(cp);
         errno = ENOTDIR;
         return -1;
@@ -1254,7 +1372,7 @@ static int fs_ext2_rmdir(vfs_handler_t *vfs, const char *fn) {
     /* Try to find the directory entry of the item we want to remove. */
     if(!(dent = ext2_dir_entry(fs->fs, pinode, ent))) {
         ext2_inode_put(pinode);
-        mutex_unlock(&ext2_mutex);
+        mutex_unlock(&fs->lock);
         free(cp);
         errno = ENOENT;
         return -1;
@@ -1263,7 +1381,7 @@ static int fs_ext2_rmdir(vfs_handler_t *vfs, const char *fn) {
     /* Find the inode of the entry we want to remove. */
     if(!(inode = ext2_inode_get(fs->fs, dent->inode, &irv))) {
         ext2_inode_put(pinode);
-        mutex_unlock(&ext2_mutex);
+        mutex_unlock(&fs->lock);
         free(cp);
         errno = EIO;
         return -1;
@@ -1274,7 +1392,7 @@ static int fs_ext2_rmdir(vfs_handler_t *vfs, const char *fn) {
     if((inode->i_mode & 0xF000) != EXT2_S_IFDIR) {
         ext2_inode_put(pinode);
         ext2_inode_put(inode);
-        mutex_unlock(&ext2_mutex);
+        mutex_unlock(&fs->lock);
         free(cp);
         errno = EPERM;
         return -1;
@@ -1285,7 +1403,7 @@ static int fs_ext2_rmdir(vfs_handler_t *vfs, const char *fn) {
         if(fh[irv].inode_num == dent->inode) {
             ext2_inode_put(pinode);
             ext2_inode_put(inode);
-            mutex_unlock(&ext2_mutex);
+            mutex_unlock(&fs->lock);
             free(cp);
             errno = EBUSY;
             return -1;
@@ -1296,7 +1414,7 @@ static int fs_ext2_rmdir(vfs_handler_t *vfs, const char *fn) {
     if((irv = ext2_dir_rm_entry(fs->fs, pinode, ent, &in_num))) {
         ext2_inode_put(pinode);
         ext2_inode_put(inode);
-        mutex_unlock(&ext2_mutex);
+        mutex_unlock(&fs->lock);
         free(cp);
         errno = -irv;
         return -1;
@@ -1308,7 +1426,7 @@ static int fs_ext2_rmdir(vfs_handler_t *vfs, const char *fn) {
 
     /* Free up the inode and all the data blocks. */
     if((irv = ext2_inode_deref(fs->fs, in_num, 1))) {
-        mutex_unlock(&ext2_mutex);
+        mutex_unlock(&fs->lock);
         errno = -irv;
         return -1;
     }
@@ -1321,7 +1439,7 @@ static int fs_ext2_rmdir(vfs_handler_t *vfs, const char *fn) {
     ext2_inode_put(pinode);
 
     /* And, we're done. Unlock the mutex. */
-    mutex_unlock(&ext2_mutex);
+    mutex_unlock(&fs->lock);
     return 0;
 }
 
@@ -1331,10 +1449,15 @@ static int fs_ext2_fcntl(void *h, int cmd, va_list ap) {
 
     (void)ap;
 
-    mutex_lock(&ext2_mutex);
+    if(fd >= MAX_EXT2_FILES) {
+        errno = EBADF;
+        return -1;
+    }
 
-    if(fd >= MAX_EXT2_FILES || !fh[fd].inode_num) {
-        mutex_unlock(&ext2_mutex);
+    mutex_lock(&fh[fd].lock);
+
+    if(!fh[fd].inode_num) {
+        mutex_unlock(&fh[fd].lock);
         errno = EBADF;
         return -1;
     }
@@ -1354,7 +1477,7 @@ static int fs_ext2_fcntl(void *h, int cmd, va_list ap) {
             errno = EINVAL;
     }
 
-    mutex_unlock(&ext2_mutex);
+    mutex_unlock(&fh[fd].lock);
     return rv;
 }
 
@@ -1409,11 +1532,11 @@ static int fs_ext2_link(vfs_handler_t *vfs, const char *path1,
     /* Split the string. */
     *nd++ = 0;
 
-    mutex_lock(&ext2_mutex);
+    mutex_lock(&fs->lock);
 
     /* Find the object in question */
     if((rv = ext2_inode_by_path(fs->fs, path1, &inode, &inode_num, 2, NULL))) {
-        mutex_unlock(&ext2_mutex);
+        mutex_unlock(&fs->lock);
         free(cp);
         errno = -rv;
         return -1;
@@ -1422,7 +1545,7 @@ static int fs_ext2_link(vfs_handler_t *vfs, const char *path1,
     /* Make sure that the object in question isn't a directory. */
     if((inode->i_mode & 0xF000) == EXT2_S_IFDIR) {
         ext2_inode_put(inode);
-        mutex_unlock(&ext2_mutex);
+        mutex_unlock(&fs->lock);
         free(cp);
         errno = EPERM;
         return -1;
@@ -1431,7 +1554,7 @@ static int fs_ext2_link(vfs_handler_t *vfs, const char *path1,
     /* Find the parent directory of the new link */
     if((rv = ext2_inode_by_path(fs->fs, cp, &pinode, &pinode_num, 1, NULL))) {
         ext2_inode_put(inode);
-        mutex_unlock(&ext2_mutex);
+        mutex_unlock(&fs->lock);
         free(cp);
         errno = -rv;
         return -1;
@@ -1441,7 +1564,7 @@ static int fs_ext2_link(vfs_handler_t *vfs, const char *path1,
     if((pinode->i_mode & 0xF000) != EXT2_S_IFDIR) {
         ext2_inode_put(pinode);
         ext2_inode_put(inode);
-        mutex_unlock(&ext2_mutex);
+        mutex_unlock(&fs->lock);
         free(cp);
         errno = ENOTDIR;
         return -1;
@@ -1451,7 +1574,7 @@ static int fs_ext2_link(vfs_handler_t *vfs, const char *path1,
     if(ext2_dir_entry(fs->fs, pinode, nd)) {
         ext2_inode_put(pinode);
         ext2_inode_put(inode);
-        mutex_unlock(&ext2_mutex);
+        mutex_unlock(&fs->lock);
         free(cp);
         errno = EEXIST;
         return -1;
@@ -1461,7 +1584,7 @@ static int fs_ext2_link(vfs_handler_t *vfs, const char *path1,
     if((rv = ext2_dir_add_entry(fs->fs, pinode, nd, inode_num, inode, NULL))) {
         ext2_inode_put(pinode);
         ext2_inode_put(inode);
-        mutex_unlock(&ext2_mutex);
+        mutex_unlock(&fs->lock);
         free(cp);
         errno = -rv;
         return -1;
@@ -1478,7 +1601,7 @@ static int fs_ext2_link(vfs_handler_t *vfs, const char *path1,
 
     ext2_inode_put(pinode);
     ext2_inode_put(inode);
-    mutex_unlock(&ext2_mutex);
+    mutex_unlock(&fs->lock);
     return 0;
 }
 
@@ -1539,11 +1662,11 @@ static int fs_ext2_symlink(vfs_handler_t *vfs, const char *path1,
     /* Split the string. */
     *nd++ = 0;
 
-    mutex_lock(&ext2_mutex);
+    mutex_lock(&fs->lock);
 
     /* Find the parent directory of the new link */
     if((rv = ext2_inode_by_path(fs->fs, cp, &pinode, &pinode_num, 1, NULL))) {
-        mutex_unlock(&ext2_mutex);
+        mutex_unlock(&fs->lock);
         free(cp);
         errno = -rv;
         return -1;
@@ -1552,7 +1675,7 @@ static int fs_ext2_symlink(vfs_handler_t *vfs, const char *path1,
     /* If the entry we get back is not a directory, then we've got problems. */
     if((pinode->i_mode & 0xF000) != EXT2_S_IFDIR) {
         ext2_inode_put(pinode);
-        mutex_unlock(&ext2_mutex);
+        mutex_unlock(&fs->lock);
         free(cp);
         errno = ENOTDIR;
         return -1;
@@ -1561,7 +1684,7 @@ static int fs_ext2_symlink(vfs_handler_t *vfs, const char *path1,
     /* See if the new link already exists */
     if(ext2_dir_entry(fs->fs, pinode, nd)) {
         ext2_inode_put(pinode);
-        mutex_unlock(&ext2_mutex);
+        mutex_unlock(&fs->lock);
         free(cp);
         errno = EEXIST;
         return -1;
@@ -1570,7 +1693,7 @@ static int fs_ext2_symlink(vfs_handler_t *vfs, const char *path1,
     /* Allocate a new inode for the new symlink. */
     if(!(inode = ext2_inode_alloc(fs->fs, pinode_num, &rv, &inode_num))) {
         ext2_inode_put(pinode);
-        mutex_unlock(&ext2_mutex);
+        mutex_unlock(&fs->lock);
         free(cp);
         errno = rv;
         return -1;
@@ -1643,7 +1766,7 @@ static int fs_ext2_symlink(vfs_handler_t *vfs, const char *path1,
 
     ext2_inode_put(pinode);
     ext2_inode_put(inode);
-    mutex_unlock(&ext2_mutex);
+    mutex_unlock(&fs->lock);
     return 0;
 }
 
@@ -1656,12 +1779,12 @@ static ssize_t fs_ext2_readlink(vfs_handler_t *vfs, const char *path, char *buf,
     ext2_inode_t *inode;
 
     /* Find a free file handle */
-    mutex_lock(&ext2_mutex);
+    mutex_lock(&mnt->lock);
 
     /* Find the object in question */
     if((rv = ext2_inode_by_path(mnt->fs, path, &inode, &inode_num, 2, NULL))) {
         errno = -rv;
-        mutex_unlock(&ext2_mutex);
+        mutex_unlock(&mnt->lock);
         return -1;
     }
 
@@ -1670,13 +1793,13 @@ static ssize_t fs_ext2_readlink(vfs_handler_t *vfs, const char *path, char *buf,
     if((rv = ext2_resolve_symlink(mnt->fs, inode, buf, &len))) {
         errno = -rv;
         ext2_inode_put(inode);
-        mutex_unlock(&ext2_mutex);
+        mutex_unlock(&mnt->lock);
         return -1;
     }
 
     /* We're done with the inode, so release it and the lock. */
     ext2_inode_put(inode);
-    mutex_unlock(&ext2_mutex);
+    mutex_unlock(&mnt->lock);
 
     /* Figure out what we're going to return. */
     if(len > bufsize)
@@ -1712,11 +1835,11 @@ int fs_ext2_stat(vfs_handler_t *vfs, const char *path, struct stat *st,
         return 0;
     }
 
-    mutex_lock(&ext2_mutex);
+    mutex_lock(&fs->lock);
 
     /* Find the object in question */
     if((irv = ext2_inode_by_path(fs->fs, path, &inode, &inode_num, rl, NULL))) {
-        mutex_unlock(&ext2_mutex);
+        mutex_unlock(&fs->lock);
         errno = -irv;
         return -1;
     }
@@ -1778,7 +1901,7 @@ int fs_ext2_stat(vfs_handler_t *vfs, const char *path, struct stat *st,
     }
 
     ext2_inode_put(inode);
-    mutex_unlock(&ext2_mutex);
+    mutex_unlock(&fs->lock);
 
     return irv;
 }
@@ -1786,11 +1909,16 @@ int fs_ext2_stat(vfs_handler_t *vfs, const char *path, struct stat *st,
 static int fs_ext2_rewinddir(void *h) {
     file_t fd = ((file_t)h) - 1;
 
-    mutex_lock(&ext2_mutex);
-
     /* Check that the fd is valid */
-    if(fd >= MAX_EXT2_FILES || !fh[fd].inode_num || !(fh[fd].mode & O_DIR)) {
-        mutex_unlock(&ext2_mutex);
+    if(fd >= MAX_EXT2_FILES) {
+        errno = EBADF;
+        return -1;
+    }
+
+    mutex_lock(&fh[fd].lock);
+
+    if(!fh[fd].inode_num || !(fh[fd].mode & O_DIR)) {
+        mutex_unlock(&fh[fd].lock);
         errno = EBADF;
         return -1;
     }
@@ -1798,7 +1926,7 @@ static int fs_ext2_rewinddir(void *h) {
     /* Rewind to the beginning of the directory. */
     fh[fd].ptr = 0;
 
-    mutex_unlock(&ext2_mutex);
+    mutex_unlock(&fh[fd].lock);
     return 0;
 }
 
@@ -1809,10 +1937,15 @@ static int fs_ext2_fstat(void *h, struct stat *st) {
     file_t fd = ((file_t)h) - 1;
     int irv = 0;
 
-    mutex_lock(&ext2_mutex);
+    if(fd >= MAX_EXT2_FILES) {
+        errno = EBADF;
+        return -1;
+    }
 
-    if(fd >= MAX_EXT2_FILES || !fh[fd].inode_num) {
-        mutex_unlock(&ext2_mutex);
+    mutex_lock(&fh[fd].lock);
+
+    if(!fh[fd].inode_num) {
+        mutex_unlock(&fh[fd].lock);
         errno = EBADF;
         return -1;
     }
@@ -1821,6 +1954,8 @@ static int fs_ext2_fstat(void *h, struct stat *st) {
     inode = fh[fd].inode;
     fs = fh[fd].fs;
 
+    mutex_lock(&fs->lock);
+
     /* Fill in the structure */
     memset(st, 0, sizeof(struct stat));
     st->st_dev = (dev_t)((ptr_t)fs->vfsh);
@@ -1877,7 +2012,8 @@ static int fs_ext2_fstat(void *h, struct stat *st) {
             break;
     }
 
-    mutex_unlock(&ext2_mutex);
+    mutex_unlock(&fs->lock);
+    mutex_unlock(&fh[fd].lock);
 
     return irv;
 }
@@ -1926,6 +2062,61 @@ static vfs_handler_t vh = {
 
 static int initted = 0;
 
+/* The block device the filesystem sees, which passes everything on to the
+   real one with the mount's device lock held. */
+static int ext2_dev_init(kos_blockdev_t *d) {
+    fs_ext2_fs_t *mnt = (fs_ext2_fs_t *)d->dev_data;
+
+    return mnt->real_dev->init(mnt->real_dev);
+}
+
+static int ext2_dev_shutdown(kos_blockdev_t *d) {
+    fs_ext2_fs_t *mnt = (fs_ext2_fs_t *)d->dev_data;
+
+    return mnt->real_dev->shutdown(mnt->real_dev);
+}
+
+static int ext2_dev_read(kos_blockdev_t *d, uint64_t block, size_t count,
+                         void *buf) {
+    fs_ext2_fs_t *mnt = (fs_ext2_fs_t *)d->dev_data;
+    int rv;
+
+    mutex_lock(&mnt->dev_lock);
+    rv = mnt->real_dev->read_blocks(mnt->real_dev, block, count, buf);
+    mutex_unlock(&mnt->dev_lock);
+
+    return rv;
+}
+
+static int ext2_dev_write(kos_blockdev_t *d, uint64_t block, size_t count,
+                          const void *buf) {
+    fs_ext2_fs_t *mnt = (fs_ext2_fs_t *)d->dev_data;
+    int rv;
+
+    mutex_lock(&mnt->dev_lock);
+    rv = mnt->real_dev->write_blocks(mnt->real_dev, block, count, buf);
+    mutex_unlock(&mnt->dev_lock);
+
+    return rv;
+}
+
+static uint64_t ext2_dev_count(kos_blockdev_t *d) {
+    fs_ext2_fs_t *mnt = (fs_ext2_fs_t *)d->dev_data;
+
+    return mnt->real_dev->count_blocks(mnt->real_dev);
+}
+
+static int ext2_dev_flush(kos_blockdev_t *d) {
+    fs_ext2_fs_t *mnt = (fs_ext2_fs_t *)d->dev_data;
+    int rv;
+
+    mutex_lock(&mnt->dev_lock);
+    rv = mnt->real_dev->flush(mnt->real_dev);
+    mutex_unlock(&mnt->dev_lock);
+
+    return rv;
+}
+
 /* These two functions borrow heavily from the same functions in fs_romdisk */
 int fs_ext2_mount(const char *mp, kos_blockdev_t *dev, uint32_t flags) {
     ext2_fs_t *fs;
@@ -1941,31 +2132,45 @@ int fs_ext2_mount(const char *mp, kos_blockdev_t *dev, uint32_t flags) {
         return -1;
     }
 
+    /* Create a mount structure */
+    if(!(mnt = (fs_ext2_fs_t *)malloc(sizeof(fs_ext2_fs_t)))) {
+        dbglog(DBG_DEBUG, "fs_ext2: out of memory creating fs structure\n");
+        return -1;
+    }
+
+    mnt->real_dev = dev;
+    mnt->dev = *dev;
+    mnt->dev.dev_data = mnt;
+    mnt->dev.init = ext2_dev_init;
+    mnt->dev.shutdown = ext2_dev_shutdown;
+    mnt->dev.read_blocks = ext2_dev_read;
+    mnt->dev.write_blocks = dev->write_blocks ? ext2_dev_write : NULL;
+    mnt->dev.count_blocks = ext2_dev_count;
+    mnt->dev.flush = dev->flush ? ext2_dev_flush : NULL;
+    mutex_init(&mnt->dev_lock, MUTEX_TYPE_NORMAL);
+
     mutex_lock(&ext2_mutex);
 
     /* Try to initialize the filesystem */
-    if(!(fs = ext2_fs_init(dev, flags))) {
+    if(!(fs = ext2_fs_init(&mnt->dev, flags))) {
         mutex_unlock(&ext2_mutex);
+        mutex_destroy(&mnt->dev_lock);
+        free(mnt);
         dbglog(DBG_DEBUG, "fs_ext2: device does not contain a valid ext2fs.\n");
         return -1;
     }
 
-    /* Create a mount structure */
-    if(!(mnt = (fs_ext2_fs_t *)malloc(sizeof(fs_ext2_fs_t)))) {
-        dbglog(DBG_DEBUG, "fs_ext2: out of memory creating fs structure\n");
-        ext2_fs_shutdown(fs);
-        mutex_unlock(&ext2_mutex);
-        return -1;
-    }
-
     mnt->fs = fs;
     mnt->mount_flags = flags;
+    mutex_init(&mnt->lock, MUTEX_TYPE_NORMAL);
 
     /* Create a VFS structure */
     if(!(vfsh = (vfs_handler_t *)malloc(sizeof(vfs_handler_t)))) {
         dbglog(DBG_DEBUG, "fs_ext2: out of memory creating vfs handler\n");
-        free(mnt);
         ext2_fs_shutdown(fs);
+        mutex_destroy(&mnt->lock);
+        mutex_destroy(&mnt->dev_lock);
+        free(mnt);
         mutex_unlock(&ext2_mutex);
         return -1;
     }
@@ -1975,15 +2180,22 @@ int fs_ext2_mount(const char *mp, kos_blockdev_t *dev, uint32_t flags) {
     vfsh->privdata = mnt;
     mnt->vfsh = vfsh;
 
+    /* Show the filesystem's lock by its mount point in the lock statistics. */
+    lockstat_set_name(&mnt->lock, vfsh->nmmgr.pathname);
+
     /* Add it to our list */
     LIST_INSERT_HEAD(&ext2_fses, mnt, entry);
 
     /* Register with the VFS */
     if(nmmgr_handler_add(&vfsh->nmmgr)) {
         dbglog(DBG_DEBUG, "fs_ext2: couldn't add fs to nmmgr\n");
+        LIST_REMOVE(mnt, entry);
+        lockstat_set_name(&mnt->lock, NULL);
         free(vfsh);
-        free(mnt);
         ext2_fs_shutdown(fs);
+        mutex_destroy(&mnt->lock);
+        mutex_destroy(&mnt->dev_lock);
+        free(mnt);
         mutex_unlock(&ext2_mutex);
         return -1;
     }
@@ -2010,7 +2222,14 @@ int fs_ext2_unmount(const char *mp) {
 
         /* XXXX: We should probably do something with open files... */
         nmmgr_handler_remove(&i->vfsh->nmmgr);
+
+        mutex_lock(&i->lock);
         ext2_fs_shutdown(i->fs);
+        mutex_unlock(&i->lock);
+
+        mutex_destroy(&i->lock);
+        mutex_destroy(&i->dev_lock);
+        lockstat_set_name(&i->lock, NULL);
         free(i->vfsh);
         free(i);
     }
@@ -2038,7 +2257,9 @@ int fs_ext2_sync(const char *mp) {
 
     if(found) {
         /* ext2_fs_sync() will set errno if there's a problem. */
+        mutex_lock(&i->lock);
         rv = ext2_fs_sync(i->fs);
+        mutex_unlock(&i->lock);
     }
     else {
         errno = ENOENT;
@@ -2050,20 +2271,27 @@ int fs_ext2_sync(const char *mp) {
 }
 
 int fs_ext2_init(void) {
+    int i;
+
     if(initted)
         return 0;
 
     LIST_INIT(&ext2_fses);
     mutex_init(&ext2_mutex, MUTEX_TYPE_NORMAL);
+    lockstat_set_name(&ext2_mutex, "fs_ext2");
     initted = 1;
 
     memset(fh, 0, sizeof(fh));
 
+    for(i = 0; i < MAX_EXT2_FILES; ++i)
+        mutex_init(&fh[i].lock, MUTEX_TYPE_NORMAL);
+
     return 0;
 }
 
 int fs_ext2_shutdown(void) {
     fs_ext2_fs_t *i, *next;
+    int j;
 
     if(!initted)
         return 0;
@@ -2076,12 +2304,18 @@ int fs_ext2_shutdown(void) {
         /* XXXX: We should probably do something with open files... */
         nmmgr_handler_remove(&i->vfsh->nmmgr);
         ext2_fs_shutdown(i->fs);
+        mutex_destroy(&i->lock);
+        mutex_destroy(&i->dev_lock);
+        lockstat_set_name(&i->lock, NULL);
         free(i->vfsh);
         free(i);
 
         i = next;
     }
 
+    for(j = 0; j < MAX_EXT2_FILES; ++j)
+        mutex_destroy(&fh[j].lock);
+
     mutex_destroy(&ext2_mutex);
     initted = 0;
 
@@ -415,6 +415,7 @@ static inline int mark_block_free(ext2_fs_t *fs, uint32_t blk) {
     ext2_block_mark_dirty(fs, fs->bg[bg].bg_block_bitmap);
     ++fs->bg[bg].bg_free_blocks_count;
     ++fs->sb.s_free_blocks_count;
+    ++fs->blocks_freed;
 
     return 0;
 }
@@ -1275,9 +1276,8 @@ next_token:
     return 0;
 }
 
-uint8_t *ext2_inode_read_block(ext2_fs_t *fs, const ext2_inode_t *inode,
-                               uint32_t block_num, uint32_t *r_block,
-                               int *err) {
+int ext2_inode_map_block(ext2_fs_t *fs, const ext2_inode_t *inode,
+                         uint32_t block_num, uint32_t *r_block, int *err) {
     uint32_t blks_per_ind, ibn;
     uint32_t *iblock;
     int shift = 1 + fs->sb.s_log_block_size;
@@ -1292,15 +1292,13 @@ uint8_t *ext2_inode_read_block(ext2_fs_t *fs, const ext2_inode_t *inode,
     /* Check to be sure we're not being asked to do something stupid... */
     if((block_num << (shift + 9)) >= sz) {
         *err = EINVAL;
-        return NULL;
+        return -1;
     }
 
     /* If we're reading a direct block, this is easy. */
     if(block_num < 12) {
-        if(r_block)
-            *r_block = inode->i_block[block_num];
-
-        return ext2_block_read(fs, inode->i_block[block_num], err);
+        *r_block = inode->i_block[block_num];
+        return 0;
     }
 
     blks_per_ind = fs->block_size >> 2;
@@ -1309,63 +1307,137 @@ uint8_t *ext2_inode_read_block(ext2_fs_t *fs, const ext2_inode_t *inode,
     /* Are we looking at the singly-indirect block? */
     if(block_num < blks_per_ind) {
         if(!(iblock = (uint32_t *)ext2_block_read(fs, inode->i_block[12], err)))
-            return NULL;
+            return -1;
 
-        if(r_block)
-            *r_block = iblock[block_num];
-
-        return ext2_block_read(fs, iblock[block_num], err);
+        *r_block = iblock[block_num];
+        return 0;
     }
 
     /* Ok, we're looking at at least a doubly-indirect block... */
     block_num -= blks_per_ind;
     if(block_num < (blks_per_ind * blks_per_ind)) {
         if(!(iblock = (uint32_t *)ext2_block_read(fs, inode->i_block[13], err)))
-            return NULL;
+            return -1;
 
         /* Figure out what entry we want in here... */
         ibn = block_num / blks_per_ind;
         block_num %= blks_per_ind;
 
         if(!(iblock = (uint32_t *)ext2_block_read(fs, iblock[ibn], err)))
-            return NULL;
+            return -1;
 
         /* Ok... Now we should be good to go. */
-        if(r_block)
-            *r_block = iblock[block_num];
-
-        return ext2_block_read(fs, iblock[block_num], err);
+        *r_block = iblock[block_num];
+        return 0;
     }
 
     /* Ugh... You're going to make me look at a triply-indirect block now? */
     block_num -= blks_per_ind * blks_per_ind;
     if(!(iblock = (uint32_t *)ext2_block_read(fs, inode->i_block[14], err)))
-        return NULL;
+        return -1;
 
     /* Figure out what entry we want in here... */
     ibn = block_num / blks_per_ind;
     block_num %= blks_per_ind;
 
     if(!(iblock = (uint32_t *)ext2_block_read(fs, iblock[ibn], err)))
-        return NULL;
+        return -1;
 
     /* And in this one too... */
     ibn = block_num / blks_per_ind;
     block_num %= blks_per_ind;
 
     if(!(iblock = (uint32_t *)ext2_block_read(fs, iblock[ibn], err)))
-        return NULL;
+        return -1;
 
     /* Ok... Now we should be good to go. Finally. */
     if(block_num < blks_per_ind) {
-        if(r_block)
-            *r_block = iblock[block_num];
-
-        return ext2_block_read(fs, iblock[block_num], err);
+        *r_block = iblock[block_num];
+        return 0;
     }
     else {
         /* This really shouldn't happen... */
         *err = EIO;
+        return -1;
+    }
+}
+
+uint8_t *ext2_inode_read_block(ext2_fs_t *fs, const ext2_inode_t *inode,
+                               uint32_t block_num, uint32_t *r_block,
+                               int *err) {
+    uint32_t bn;
+
+    if(ext2_inode_map_block(fs, inode, block_num, &bn, err))
+        return NULL;
+
+    if(r_block)
+        *r_block = bn;
+
+    return ext2_block_read(fs, bn, err);
+}
+
+uint8_t *ext2_inode_pin_block(ext2_fs_t *fs, const ext2_inode_t *inode,
+                              uint32_t block_num, int *err) {
+    uint32_t bn;
+
+    if(ext2_inode_map_block(fs, inode, block_num, &bn, err))
         return NULL;
+
+    return ext2_block_pin(fs, bn, err);
+}
+
+int ext2_inode_map_run(ext2_fs_t *fs, const ext2_inode_t *inode,
+                       uint32_t block_num, uint32_t count, uint32_t *r_first,
+                       int *err) {
+    uint32_t first, bn, n;
+    int fs_per_block = fs->sb.s_log_block_size - fs->dev->l_block_size + 10;
+
+    if(!count)
+        return 0;
+
+    if(ext2_inode_map_block(fs, inode, block_num, &first, err))
+        return -1;
+
+    /* Holes and blocks that are in the cache (and thus possibly dirty) have to
+       go through the normal path. */
+    if(!first || blockcache_lookup(fs->bcache, first))
+        return 0;
+
+    /* Don't build up a request that the device can't handle in one go. */
+    if(count > ((uint32_t)EXT2_MAX_RUN_SECTORS >> fs_per_block))
+        count = (uint32_t)EXT2_MAX_RUN_SECTORS >> fs_per_block;
+
+    /* Figure out how many blocks are physically contiguous on the device. */
+    for(n = 1; n < count; ++n) {
+        if(ext2_inode_map_block(fs, inode, block_num + n, &bn, err))
+            return -1;
+
+        if(bn != first + n || blockcache_lookup(fs->bcache, bn))
+            break;
     }
+
+    if(first + n > fs->sb.s_blocks_count) {
+        *err = EIO;
+        return -1;
+    }
+
+    *r_first = first;
+    return (int)n;
+}
+
+int ext2_inode_read_blocks(ext2_fs_t *fs, const ext2_inode_t *inode,
+                           uint32_t block_num, uint32_t count, uint8_t *buf,
+                           int *err) {
+    uint32_t first;
+    int n, rv;
+
+    if((n = ext2_inode_map_run(fs, inode, block_num, count, &first, err)) <= 0)
+        return n;
+
+    if((rv = ext2_block_read_run_nc(fs, first, (uint32_t)n, buf))) {
+        *err = -rv;
+        return -1;
+    }
+
+    return n;
 }
@@ -154,10 +154,40 @@ int ext2_inode_deref(ext2_fs_t *fs, uint32_t inode_num, int isdir);
 uint8_t *ext2_inode_alloc_block(ext2_fs_t *fs, ext2_inode_t *inode,
                                 uint32_t blocks,int *err);
 
+/* Find the block number on the device of a block of an inode. Returns 0 on
+   success, or -1 on error (with err set). Holes in the file map to block 0. */
+int ext2_inode_map_block(ext2_fs_t *fs, const ext2_inode_t *inode,
+                         uint32_t block_num, uint32_t *r_block, int *err);
+
 uint8_t *ext2_inode_read_block(ext2_fs_t *fs, const ext2_inode_t *inode,
                                uint32_t block_num, uint32_t *r_block,
                                int *err);
 
+/* Like ext2_inode_read_block(), but the block is pinned in the cache until
+   ext2_block_unpin() is called on it. */
+uint8_t *ext2_inode_pin_block(ext2_fs_t *fs, const ext2_inode_t *inode,
+                              uint32_t block_num, int *err);
+
+/* Work out which blocks ext2_inode_read_blocks() would read, without reading
+   them. Returns the number of blocks, 0 if the first block must be read
+   through the cache instead, or -1 on error (with err set). The blocks are
+   r_first onwards on the device, and can be read with ext2_block_read_run_nc()
+   once the filesystem's lock has been let go of. */
+int ext2_inode_map_run(ext2_fs_t *fs, const ext2_inode_t *inode,
+                       uint32_t block_num, uint32_t count, uint32_t *r_first,
+                       int *err);
+
+/* Read up to count blocks of an inode, starting at block_num, straight from
+   the device into buf (bypassing the block cache). Only the blocks that are
+   physically contiguous on the device with the first one are read, and reading
+   stops at any block that is in the block cache. Returns the number of blocks
+   read, 0 if the first block must be read through the cache instead (it is
+   cached or is a hole), or -1 on error (with err set). The buffer must be
+   suitably aligned for the block device (32 bytes for DMA). */
+int ext2_inode_read_blocks(ext2_fs_t *fs, const ext2_inode_t *inode,
+                           uint32_t block_num, uint32_t count, uint8_t *buf,
+                           int *err);
+
 /* In symlink.c */
 int ext2_resolve_symlink(ext2_fs_t *fs, ext2_inode_t *inode, char *rv,
                          size_t *rv_len);
@@ -9,30 +9,14 @@
 #include <stdint.h>
 #include <string.h>
 #include <stdlib.h>
+#include <malloc.h>
 #include <inttypes.h>
 
 #include "fatfs.h"
 #include "fatinternal.h"
 
-/* This is basically the same as bgrad_cache from fs_iso9660 */
-static void make_mru(fat_fs_t *fs, fat_cache_t **cache, int block) {
-    int i;
-    fat_cache_t *tmp;
-
-    /* Don't try it with the end block */
-    if(block < 0 || block >= fs->cache_size - 1)
-        return;
-
-    /* Make a copy and scoot everything down */
-    tmp = cache[block];
-
-    for(i = block; i < fs->cache_size - 1; ++i) {
-        cache[i] = cache[i + 1];
-    }
-
-    cache[fs->cache_size - 1] = tmp;
-}
-
+/* Number of FAT sectors to read at a time while building the free map. */
+#define FREE_MAP_READ_SECTORS   32
 
 static int fat_fatblock_read_nc(fat_fs_t *fs, uint32_t bn, uint8_t *rv) {
     if(fs->sb.fat_size <= bn)
@@ -56,85 +40,39 @@ static int fat_fatblock_write_nc(fat_fs_t *fs, uint32_t bn,
 }
 
 static uint8_t *fat_read_fatblock(fat_fs_t *fs, uint32_t block, int *err) {
-    int i;
-    uint8_t *rv;
-    fat_cache_t **cache = fs->fcache;
-
-    /* Look through the cache from the most recently used to the least recently
-       used entry. */
-    for(i = fs->fcache_size - 1; i >= 0; --i) {
-        if(cache[i]->block == block && cache[i]->flags) {
-            rv = cache[i]->data;
-            make_mru(fs, cache, i);
-            goto out;
-        }
-    }
-
-    /* If we didn't get anything, did we end up with an invalid entry or do we
-       need to boot someone out? */
-    if(i < 0) {
-        i = 0;
-
-        /* Make sure that if the block is dirty, we write it back out. */
-        if(cache[0]->flags & FAT_CACHE_FLAG_DIRTY) {
-            if(fat_fatblock_write_nc(fs, cache[0]->block, cache[0]->data)) {
-                /* XXXX: Uh oh... */
-                *err = EIO;
-                return NULL;
-            }
-        }
-    }
-
-    /* Try to read the block in question. */
-    if(fat_fatblock_read_nc(fs, block, cache[i]->data)) {
-        *err = EIO;
-        cache[i]->flags = 0;            /* Mark it as invalid... */
-        return NULL;
-    }
-
-    cache[i]->block = block;
-    cache[i]->flags = FAT_CACHE_FLAG_VALID;
-    rv = cache[i]->data;
-    make_mru(fs, cache, i);
-
-out:
-    return rv;
+    return blockcache_read(fs->fcache, block, err);
 }
 
 static int fat_fatblock_mark_dirty(fat_fs_t *fs, uint32_t bn) {
-    int i;
-    fat_cache_t **cache = fs->fcache;
-
-    /* Look through the cache from the most recently used to the least recently
-       used entry. */
-    for(i = fs->fcache_size - 1; i >= 0; --i) {
-        if(cache[i]->block == bn && cache[i]->flags) {
-            cache[i]->flags |= FAT_CACHE_FLAG_DIRTY;
-            make_mru(fs, cache, i);
-            return 0;
-        }
-    }
-
-    return -EINVAL;
+    return blockcache_mark_dirty(fs->fcache, bn);
 }
 
 int fat_fatblock_cache_wb(fat_fs_t *fs) {
-    int i, err;
-    fat_cache_t **cache = fs->fcache;
-
     /* Don't even bother if we're mounted read-only. */
     if(!(fs->mnt_flags & FAT_MNT_FLAG_RW))
         return 0;
 
-    for(i = fs->fcache_size - 1; i >= 0; --i) {
-        if(cache[i]->flags & FAT_CACHE_FLAG_DIRTY) {
-            if((err = fat_fatblock_write_nc(fs, cache[i]->block,
-                                            cache[i]->data)))
-                return err;
+    return blockcache_writeback(fs->fcache);
+}
 
-            cache[i]->flags &= ~FAT_CACHE_FLAG_DIRTY;
-        }
-    }
+static int fat_fcache_read(void *ctx, uint32_t bn, uint8_t *rv) {
+    return fat_fatblock_read_nc((fat_fs_t *)ctx, bn, rv) ? -EIO : 0;
+}
+
+static int fat_fcache_write(void *ctx, uint32_t bn, const uint8_t *blk) {
+    return fat_fatblock_write_nc((fat_fs_t *)ctx, bn, blk) ? -EIO : 0;
+}
+
+int fat_fatblock_cache_init(fat_fs_t *fs, int fcache_sz) {
+    /* FAT12 entries can span two blocks, and both have to be in the cache at
+       the same time to read them. */
+    if(fcache_sz < 2)
+        fcache_sz = 2;
+
+    if(!(fs->fcache = blockcache_create(fcache_sz, fs->sb.bytes_per_sector,
+                                        &fat_fcache_read, &fat_fcache_write,
+                                        fs)))
+        return -ENOMEM;
 
     return 0;
 }
@@ -213,10 +151,12 @@ uint32_t fat_read_fat(fat_fs_t *fs, uint32_t cl, int *err) {
     return val;
 }
 
+static void fat_free_map_update(fat_fs_t *fs, uint32_t cl, int is_free);
+
 int fat_write_fat(fat_fs_t *fs, uint32_t cl, uint32_t val) {
-    uint32_t sn, off;
+    uint32_t sn, off, ocl = cl;
     uint8_t *blk, *blk2;
-    int err;
+    int err, is_free = !(val & 0x0FFFFFFF);
 
     /* Don't let us write to the FAT if we're on a read-only FS. */
     if(!(fs->mnt_flags & FAT_MNT_FLAG_RW))
@@ -232,7 +172,7 @@ int fat_write_fat(fat_fs_t *fs, uint32_t cl, uint32_t val) {
             /* Read the FAT block. */
             blk = fat_read_fatblock(fs, sn, &err);
             if(!blk)
-                return err;
+                return -err;
 
             blk[off] = (uint8_t)val;
             blk[off + 1] = (uint8_t)(val >> 8);
@@ -253,7 +193,7 @@ int fat_write_fat(fat_fs_t *fs, uint32_t cl, uint32_t val) {
             /* Read the FAT block. */
             blk = fat_read_fatblock(fs, sn, &err);
             if(!blk)
-                return err;
+                return -err;
 
             blk[off] = (uint8_t)val;
             blk[off + 1] = (uint8_t)(val >> 8);
@@ -270,7 +210,7 @@ int fat_write_fat(fat_fs_t *fs, uint32_t cl, uint32_t val) {
             /* Read the FAT block. */
             blk = fat_read_fatblock(fs, sn, &err);
             if(!blk)
-                return err;
+                return -err;
 
             /* See if we have the very special case of the entry spanning two
                blocks... This is why we can't have nice things... */
@@ -278,7 +218,7 @@ int fat_write_fat(fat_fs_t *fs, uint32_t cl, uint32_t val) {
                 blk2 = fat_read_fatblock(fs, sn + 1, &err);
 
                 if(!blk2)
-                    return err;
+                    return -err;
 
                 /* The bright side here is that we at least know that the
                    cluster number is odd... */
@@ -308,6 +248,10 @@ int fat_write_fat(fat_fs_t *fs, uint32_t cl, uint32_t val) {
             break;
     }
 
+    /* Keep the free map (and thus the free cluster count) in sync. */
+    if(fs->free_map)
+        fat_free_map_update(fs, ocl, is_free);
+
     return 0;
 }
 
@@ -326,18 +270,14 @@ int fat_is_eof(fat_fs_t *fs, uint32_t cl) {
     return -1;
 }
 
-uint32_t fat_allocate_cluster(fat_fs_t *fs, int *err) {
+/* Allocate a single cluster by searching through the FAT itself. This is only
+   used if there isn't enough memory for the free map. */
+static uint32_t fat_allocate_cluster_scan(fat_fs_t *fs, int *err) {
     uint32_t sn, off, val;
     uint8_t *blk;
     uint32_t cl, i, cps, last;
     int tries = 1;
 
-    /* Don't let us write to the FAT if we're on a read-only FS. */
-    if(!(fs->mnt_flags & FAT_MNT_FLAG_RW)) {
-        *err = EROFS;
-        return FAT_INVALID_CLUSTER;
-    }
-
     i = fs->sb.last_alloc_cluster + 1;
     last = fs->sb.num_clusters + 2;
 
@@ -424,6 +364,7 @@ retry_fat16:
                     fat_fatblock_mark_dirty(fs, sn);
 
                     fs->sb.last_alloc_cluster = i;
+                    --fs->sb.free_clusters;
                     return i;
                 }
 
@@ -457,10 +398,12 @@ retry_fat16:
                 ++i) {
                 if(!(cl = fat_read_fat(fs, i, err))) {
                     /* Allocate it by adding in an end of chain marker. */
-                    if((*err = fat_write_fat(fs, i, 0x0FFF)) < 0)
+                    if((*err = -fat_write_fat(fs, i, 0x0FFF)))
                         return FAT_INVALID_CLUSTER;
 
                     fs->sb.last_alloc_cluster = i;
+                    --fs->sb.free_clusters;
+                    return i;
                 }
                 else if(cl == FAT_INVALID_CLUSTER) {
                     return cl;
@@ -470,10 +413,12 @@ retry_fat16:
             for(i = 2; i < fs->sb.last_alloc_cluster + 1; ++i) {
                 if(!(cl = fat_read_fat(fs, i, err))) {
                     /* Allocate it by adding in an end of chain marker. */
-                    if((*err = fat_write_fat(fs, i, 0x0FFF)) < 0)
+                    if((*err = -fat_write_fat(fs, i, 0x0FFF)))
                         return FAT_INVALID_CLUSTER;
 
                     fs->sb.last_alloc_cluster = i;
+                    --fs->sb.free_clusters;
+                    return i;
                 }
                 else if(cl == FAT_INVALID_CLUSTER) {
                     return cl;
@@ -492,6 +437,285 @@ retry_fat16:
     return val;
 }
 
+/* The free map is a bitmap with one bit per cluster (including the two
+   reserved entries at the start of the FAT), where a set bit means the cluster
+   is in use. It is built when a filesystem is mounted read/write (or the first
+   time we need to allocate a cluster, if that failed), and from then on kept
+   up to date by
+   fat_write_fat(). This lets us find free clusters (and runs of them) without
+   reading through the FAT, which can be several megabytes on a large card. */
+static inline int fat_free_map_test(const fat_fs_t *fs, uint32_t cl) {
+    return fs->free_map[cl >> 5] & (1U << (cl & 31));
+}
+
+static void fat_free_map_update(fat_fs_t *fs, uint32_t cl, int is_free) {
+    uint32_t *w, bit = 1U << (cl & 31);
+
+    if(cl < 2 || cl >= fs->sb.num_clusters + 2)
+        return;
+
+    w = &fs->free_map[cl >> 5];
+
+    if(is_free && (*w & bit)) {
+        *w &= ~bit;
+        ++fs->sb.free_clusters;
+    }
+    else if(!is_free && !(*w & bit)) {
+        *w |= bit;
+        --fs->sb.free_clusters;
+    }
+}
+
+int fat_free_map_init(fat_fs_t *fs) {
+    uint32_t total = fs->sb.num_clusters + 2, words = (total + 31) >> 5;
+    uint32_t bps = fs->sb.bytes_per_sector, eps, cl, sn, n, j, k, val;
+    uint32_t nfree = 0, *map;
+    uint8_t *buf;
+    const uint8_t *blk;
+    int err = 0;
+
+    if(!(map = (uint32_t *)calloc(words, sizeof(uint32_t))))
+        return -ENOMEM;
+
+    /* The first two entries are reserved, and anything past the end of the
+       filesystem should never be allocated. */
+    map[0] = 3;
+
+    for(cl = total; cl < (words << 5); ++cl) {
+        map[cl >> 5] |= 1U << (cl & 31);
+    }
+
+    if(fs->sb.fs_type == FAT_FS_FAT12) {
+        /* FAT12 is small enough (and annoying enough to decode) that we might
+           as well just go through the cache for each entry. */
+        for(cl = 2; cl < total; ++cl) {
+            if((val = fat_read_fat(fs, cl, &err)) == FAT_INVALID_CLUSTER) {
+                free(map);
+                return -err;
+            }
+            else if(val == FAT_FREE_CLUSTER) {
+                ++nfree;
+            }
+            else {
+                map[cl >> 5] |= 1U << (cl & 31);
+            }
+        }
+    }
+    else {
+        /* Read the FAT in big chunks straight from the device, rather than
+           thrashing the FAT block cache. Anything already in the cache may
+           be newer than what's on the device, so use that instead. */
+        if(!(buf = (uint8_t *)memalign(32, FREE_MAP_READ_SECTORS * bps))) {
+            free(map);
+            return -ENOMEM;
+        }
+
+        eps = fs->sb.fs_type == FAT_FS_FAT32 ? bps >> 2 : bps >> 1;
+        sn = fs->sb.reserved_sectors;
+        cl = 0;
+
+        while(cl < total) {
+            n = (total - cl + eps - 1) / eps;
+
+            if(n > FREE_MAP_READ_SECTORS)
+                n = FREE_MAP_READ_SECTORS;
+
+            if(fs->dev->read_blocks(fs->dev, sn, n, buf)) {
+                free(buf);
+                free(map);
+                return -EIO;
+            }
+
+            for(j = 0; j < n; ++j) {
+                if(!(blk = blockcache_lookup(fs->fcache, sn + j)))
+                    blk = buf + j * bps;
+
+                for(k = 0; k < eps && cl < total; ++k, ++cl) {
+                    if(fs->sb.fs_type == FAT_FS_FAT32)
+                        val = (blk[k << 2] | (blk[(k << 2) + 1] << 8) |
+                               (blk[(k << 2) + 2] << 16) |
+                               (blk[(k << 2) + 3] << 24)) & 0x0FFFFFFF;
+                    else
+                        val = blk[k << 1] | (blk[(k << 1) + 1] << 8);
+
+                    if(cl < 2)
+                        continue;
+                    else if(val == FAT_FREE_CLUSTER)
+                        ++nfree;
+                    else
+                        map[cl >> 5] |= 1U << (cl & 31);
+                }
+            }
+
+            sn += n;
+        }
+
+        free(buf);
+    }
+
+    /* The count in the FSinfo sector is only a hint (and may well be wrong or
+       not there at all), so replace it with the real thing. It'll be written
+       back on the next sync. */
+    fs->sb.free_clusters = nfree;
+    fs->free_map = map;
+
+    return 0;
+}
+
+void fat_free_map_destroy(fat_fs_t *fs) {
+    free(fs->free_map);
+    fs->free_map = NULL;
+}
+
+/* Find the first free cluster in [i, end), or FAT_INVALID_CLUSTER if there
+   isn't one. */
+static uint32_t fat_free_map_find(const fat_fs_t *fs, uint32_t i,
+                                  uint32_t end) {
+    uint32_t w;
+
+    while(i < end) {
+        w = ~fs->free_map[i >> 5] & (0xFFFFFFFF << (i & 31));
+
+        if(w) {
+            i = (i & ~31) + __builtin_ctz(w);
+            return i < end ? i : FAT_INVALID_CLUSTER;
+        }
+
+        i = (i & ~31) + 32;
+    }
+
+    return FAT_INVALID_CLUSTER;
+}
+
+/* How many free clusters are there in a row starting at i (up to max)? */
+static uint32_t fat_free_map_run(const fat_fs_t *fs, uint32_t i,
+                                 uint32_t max) {
+    uint32_t n = 0, end = fs->sb.num_clusters + 2;
+
+    while(n < max && i + n < end && !fat_free_map_test(fs, i + n))
+        ++n;
+
+    return n;
+}
+
+static uint32_t fat_eoc_marker(const fat_fs_t *fs) {
+    switch(fs->sb.fs_type) {
+        case FAT_FS_FAT32:
+            return 0x0FFFFFFF;
+
+        case FAT_FS_FAT16:
+            return 0xFFFF;
+
+        default:
+            return 0x0FFF;
+    }
+}
+
+uint32_t fat_allocate_run(fat_fs_t *fs, uint32_t hint, uint32_t want,
+                          uint32_t *count, int *err) {
+    uint32_t end = fs->sb.num_clusters + 2, first, cl, n, i, len;
+    int rv;
+
+    /* Don't let us write to the FAT if we're on a read-only FS. */
+    if(!(fs->mnt_flags & FAT_MNT_FLAG_RW)) {
+        *err = EROFS;
+        return FAT_INVALID_CLUSTER;
+    }
+
+    if(!want)
+        want = 1;
+
+    /* Build the free map if we haven't already. If there isn't enough memory
+       for it, fall back to searching the FAT one cluster at a time. */
+    if(!fs->free_map && (rv = fat_free_map_init(fs))) {
+        if(rv != -ENOMEM) {
+            *err = -rv;
+            return FAT_INVALID_CLUSTER;
+        }
+
+        if((first = fat_allocate_cluster_scan(fs, err)) != FAT_INVALID_CLUSTER)
+            *count = 1;
+
+        return first;
+    }
+
+    if(!fs->sb.free_clusters) {
+        *err = ENOSPC;
+        return FAT_INVALID_CLUSTER;
+    }
+
+    /* Without a useful hint, carry on from where we last allocated. */
+    if(hint < 2 || hint >= end)
+        hint = fs->sb.last_alloc_cluster + 1;
+
+    if(hint < 2 || hint >= end)
+        hint = 2;
+
+    /* Find the first free cluster at or after the hint, wrapping around to the
+       start of the filesystem if need be. */
+    if((first = fat_free_map_find(fs, hint, end)) == FAT_INVALID_CLUSTER &&
+       (first = fat_free_map_find(fs, 2, hint)) == FAT_INVALID_CLUSTER) {
+        *err = ENOSPC;
+        return FAT_INVALID_CLUSTER;
+    }
+
+    n = fat_free_map_run(fs, first, want);
+
+    /* If that run isn't long enough for everything that was asked for, look
+       for one somewhere else that is, so the file doesn't end up fragmented.
+       If there isn't one anywhere, just take what we found first. */
+    if(n < want) {
+        i = first + n;
+
+        while(i < end &&
+              (cl = fat_free_map_find(fs, i, end)) != FAT_INVALID_CLUSTER) {
+            if((len = fat_free_map_run(fs, cl, want)) == want) {
+                first = cl;
+                n = len;
+                break;
+            }
+
+            i = cl + len;
+        }
+
+        for(i = 2; n < want && i < first; i = cl + len) {
+            if((cl = fat_free_map_find(fs, i, first)) == FAT_INVALID_CLUSTER)
+                break;
+
+            if((len = fat_free_map_run(fs, cl, want)) == want) {
+                first = cl;
+                n = len;
+            }
+        }
+    }
+
+    /* Link the run together, marking the end of the chain at the end. Write
+       the FAT backwards so that a failure part of the way through leaves us
+       with a valid (if shorter) chain to clean up. */
+    for(i = n; i > 0; --i) {
+        cl = first + i - 1;
+
+        if((rv = fat_write_fat(fs, cl, i == n ? fat_eoc_marker(fs) : cl + 1))) {
+            if(i != n)
+                fat_erase_chain(fs, cl + 1);
+
+            *err = -rv;
+            return FAT_INVALID_CLUSTER;
+        }
+    }
+
+    fs->sb.last_alloc_cluster = first + n - 1;
+    *count = n;
+
+    return first;
+}
+
+uint32_t fat_allocate_cluster(fat_fs_t *fs, int *err) {
+    uint32_t n;
+
+    return fat_allocate_run(fs, 0, 1, &n, err);
+}
+
 /* This function could be made better/more optimized... However, it takes the
    simplest/most clear approach to this for now. */
 int fat_erase_chain(fat_fs_t *fs, uint32_t cluster) {
@@ -517,7 +741,10 @@ int fat_erase_chain(fat_fs_t *fs, uint32_t cluster) {
         }
 
         cluster = next;
-        ++fs->sb.free_clusters;
+
+        /* The free map takes care of the count if we have it. */
+        if(!fs->free_map)
+            ++fs->sb.free_clusters;
     }
 
     return 0;
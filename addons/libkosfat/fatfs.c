@@ -4,7 +4,6 @@
    Copyright (C) 2012, 2013, 2019 Lawrence Sebald
 */
 
-#include <malloc.h>
 #include <stdio.h>
 #include <errno.h>
 #include <stdint.h>
@@ -16,112 +15,63 @@
 #include "bpb.h"
 #include "fatinternal.h"
 
-/* This is basically the same as bgrad_cache from fs_iso9660 */
-static void make_mru(fat_fs_t *fs, fat_cache_t **cache, int block) {
-    int i;
-    fat_cache_t *tmp;
-
-    /* Don't try it with the end block */
-    if(block < 0 || block >= fs->cache_size - 1)
-        return;
+uint8_t *fat_cluster_read(fat_fs_t *fs, uint32_t cl, int *err) {
+    return blockcache_read(fs->bcache, cl, err);
+}
 
-    /* Make a copy and scoot everything down */
-    tmp = cache[block];
+uint8_t *fat_cluster_clear(fat_fs_t *fs, uint32_t cl, int *err) {
+    uint8_t *rv;
 
-    for(i = block; i < fs->cache_size - 1; ++i) {
-        cache[i] = cache[i + 1];
-    }
+    /* Don't bother reading the cluster from disk, since we're erasing it
+       anyway... */
+    if(!(rv = blockcache_claim(fs->bcache, cl, err)))
+        return NULL;
 
-    cache[fs->cache_size - 1] = tmp;
+    memset(rv, 0, fs->sb.bytes_per_sector * fs->sb.sectors_per_cluster);
+    return rv;
 }
 
-/* XXXX: This needs locking! */
-uint8_t *fat_cluster_read(fat_fs_t *fs, uint32_t cl, int *err) {
-    int i;
-    uint8_t *rv;
-    fat_cache_t **cache = fs->bcache;
-
-    /* Look through the cache from the most recently used to the least recently
-       used entry. */
-    for(i = fs->cache_size - 1; i >= 0; --i) {
-        if(cache[i]->block == cl && cache[i]->flags) {
-            rv = cache[i]->data;
-            make_mru(fs, cache, i);
-            goto out;
-        }
-    }
+int fat_cluster_read_run(fat_fs_t *fs, uint32_t cl, uint32_t count,
+                         uint8_t *buf, uint32_t *last, int *err) {
+    uint32_t n, cur, next, spc = fs->sb.sectors_per_cluster;
 
-    /* If we didn't get anything, did we end up with an invalid entry or do we
-       need to boot someone out? */
-    if(i < 0) {
-        i = 0;
-
-        /* Make sure that if the block is dirty, we write it back out. */
-        if(cache[0]->flags & FAT_CACHE_FLAG_DIRTY) {
-            if(fat_cluster_write_nc(fs, cache[0]->block, cache[0]->data)) {
-                /* XXXX: Uh oh... */
-                *err = EIO;
-                return NULL;
-            }
-        }
-    }
+    /* Raw blocks (the FAT12/FAT16 root directory) and anything in the cache
+       have to go through the normal path. */
+    if(!count || (cl & 0x80000000 && fs->sb.fs_type != FAT_FS_FAT32) ||
+       blockcache_lookup(fs->bcache, cl))
+        return 0;
 
-    /* Try to read the block in question. */
-    if(fat_cluster_read_nc(fs, cl, cache[i]->data)) {
+    if(fs->sb.num_clusters + 2 <= cl || cl < 2) {
         *err = EIO;
-        cache[i]->flags = 0;            /* Mark it as invalid... */
-        return NULL;
+        return -1;
     }
 
-    cache[i]->block = cl;
-    cache[i]->flags = FAT_CACHE_FLAG_VALID;
-    rv = cache[i]->data;
-    make_mru(fs, cache, i);
+    /* Don't build up a request that the device can't handle in one go. */
+    if(count > FAT_MAX_RUN_SECTORS / spc)
+        count = FAT_MAX_RUN_SECTORS / spc;
 
-out:
-    return rv;
-}
+    /* Figure out how many clusters in the chain are contiguous on the
+       device. */
+    for(n = 1, cur = cl; n < count; ++n, cur = next) {
+        next = fat_read_fat(fs, cur, err);
 
-uint8_t *fat_cluster_clear(fat_fs_t *fs, uint32_t cl, int *err) {
-    int i;
-    uint8_t *rv;
-    fat_cache_t **cache = fs->bcache;
-
-    /* Look through the cache from the most recently used to the least recently
-       used entry. */
-    for(i = fs->cache_size - 1; i >= 0; --i) {
-        if(cache[i]->block == cl && cache[i]->flags) {
-            rv = cache[i]->data;
-            make_mru(fs, cache, i);
-            goto out;
-        }
-    }
+        if(next == FAT_INVALID_CLUSTER)
+            return -1;
 
-    /* If we didn't get anything, did we end up with an invalid entry or do we
-       need to boot someone out? */
-    if(i < 0) {
-        i = 0;
-
-        /* Make sure that if the block is dirty, we write it back out. */
-        if(cache[0]->flags & FAT_CACHE_FLAG_DIRTY) {
-            if(fat_cluster_write_nc(fs, cache[0]->block, cache[0]->data)) {
-                /* XXXX: Uh oh... */
-                *err = EIO;
-                return NULL;
-            }
-        }
+        if(next != cur + 1 || fat_is_eof(fs, next) ||
+           fs->sb.num_clusters + 2 <= next ||
+           blockcache_lookup(fs->bcache, next))
+            break;
     }
 
-    /* Don't bother reading the cluster from disk, since we're erasing it
-       anyway... */
-    cache[i]->block = cl;
-    cache[i]->flags = FAT_CACHE_FLAG_VALID | FAT_CACHE_FLAG_DIRTY;
-    rv = cache[i]->data;
-    make_mru(fs, cache, i);
+    if(fs->dev->read_blocks(fs->dev, (cl - 2) * spc + fs->sb.first_data_block,
+                            n * spc, buf)) {
+        *err = EIO;
+        return -1;
+    }
 
-out:
-    memset(rv, 0, fs->sb.bytes_per_sector * fs->sb.sectors_per_cluster);
-    return rv;
+    *last = cl + n - 1;
+    return (int)n;
 }
 
 int fat_cluster_read_nc(fat_fs_t *fs, uint32_t cluster, uint8_t *rv) {
@@ -181,41 +131,25 @@ int fat_cluster_write_nc(fat_fs_t *fs, uint32_t cluster, const uint8_t *blk) {
 }
 
 int fat_cluster_mark_dirty(fat_fs_t *fs, uint32_t cluster) {
-    int i;
-    fat_cache_t **cache = fs->bcache;
-
-    /* Look through the cache from the most recently used to the least recently
-       used entry. */
-    for(i = fs->cache_size - 1; i >= 0; --i) {
-        if(cache[i]->block == cluster && cache[i]->flags) {
-            cache[i]->flags |= FAT_CACHE_FLAG_DIRTY;
-            make_mru(fs, cache, i);
-            return 0;
-        }
-    }
-
-    return -EINVAL;
+    return blockcache_mark_dirty(fs->bcache, cluster);
 }
 
 int fat_cluster_cache_wb(fat_fs_t *fs) {
-    int i, err;
-    fat_cache_t **cache = fs->bcache;
-
     /* Don't even bother if we're mounted read-only. */
     if(!(fs->mnt_flags & FAT_MNT_FLAG_RW))
         return 0;
 
-    for(i = fs->cache_size - 1; i >= 0; --i) {
-        if(cache[i]->flags & FAT_CACHE_FLAG_DIRTY) {
-            if((err = fat_cluster_write_nc(fs, cache[i]->block,
-                                           cache[i]->data)))
-                return err;
+    return blockcache_writeback(fs->bcache);
+}
 
-            cache[i]->flags &= ~FAT_CACHE_FLAG_DIRTY;
-        }
-    }
+/* Glue between the block cache and the uncached cluster functions above. Any
+   failure at this level is reported as an I/O error to the upper layers. */
+static int fat_bcache_read(void *ctx, uint32_t cluster, uint8_t *rv) {
+    return fat_cluster_read_nc((fat_fs_t *)ctx, cluster, rv) ? -EIO : 0;
+}
 
-    return 0;
+static int fat_bcache_write(void *ctx, uint32_t cluster, const uint8_t *blk) {
+    return fat_cluster_write_nc((fat_fs_t *)ctx, cluster, blk) ? -EIO : 0;
 }
 
 static inline uint32_t ilog2(uint32_t i) {
@@ -265,8 +199,7 @@ fat_fs_t *fat_fs_init(kos_blockdev_t *bd, uint32_t flags) {
 fat_fs_t *fat_fs_init_ex(kos_blockdev_t *bd, uint32_t flags, int cache_sz,
                          int fcache_sz) {
     fat_fs_t *rv;
-    int j;
-    int block_size, cluster_size;
+    int cluster_size, err;
 
     if(bd->init(bd)) {
         return NULL;
@@ -278,6 +211,7 @@ fat_fs_t *fat_fs_init_ex(kos_blockdev_t *bd, uint32_t flags, int cache_sz,
     }
 
     rv->dev = bd;
+    rv->free_map = NULL;
     rv->mnt_flags = flags & FAT_MNT_VALID_FLAGS_MASK;
 
     if(rv->mnt_flags != flags) {
@@ -298,85 +232,33 @@ fat_fs_t *fat_fs_init_ex(kos_blockdev_t *bd, uint32_t flags, int cache_sz,
     fat_print_superblock(&rv->sb);
 #endif
 
-    block_size = rv->sb.bytes_per_sector;
     cluster_size = rv->sb.bytes_per_sector * rv->sb.sectors_per_cluster;
 
     /* Make space for the block cache. */
-    if(!(rv->bcache = (fat_cache_t **)malloc(sizeof(fat_cache_t *) *
-                                             cache_sz))) {
+    if(!(rv->bcache = blockcache_create(cache_sz, cluster_size,
+                                        &fat_bcache_read, &fat_bcache_write,
+                                        rv))) {
         free(rv);
         bd->shutdown(bd);
         return NULL;
     }
 
-    for(j = 0; j < cache_sz; ++j) {
-        if(!(rv->bcache[j] = (fat_cache_t *)malloc(sizeof(fat_cache_t)))) {
-            goto out_cache;
-        }
-    }
-
-    for(j = 0; j < cache_sz; ++j) {
-        if(!(rv->bcache[j]->data = (uint8_t *)memalign(32, cluster_size))) {
-            goto out_bcache;
-        }
-
-        rv->bcache[j]->flags = 0;
-    }
-
-    rv->cache_size = cache_sz;
-
     /* Make space for the FAT block cache. */
-    if(!(rv->fcache = (fat_cache_t **)malloc(sizeof(fat_cache_t *) *
-                                             fcache_sz))) {
-        goto out_bcache;
-    }
-
-    for(j = 0; j < fcache_sz; ++j) {
-        if(!(rv->fcache[j] = (fat_cache_t *)malloc(sizeof(fat_cache_t)))) {
-            goto out_fcache;
-        }
+    if(fat_fatblock_cache_init(rv, fcache_sz)) {
+        blockcache_destroy(rv->bcache);
+        free(rv);
+        bd->shutdown(bd);
+        return NULL;
     }
 
-    for(j = 0; j < fcache_sz; ++j) {
-        if(!(rv->fcache[j]->data = (uint8_t *)memalign(32, block_size))) {
-            goto out_fcache2;
-        }
-
-        rv->fcache[j]->flags = 0;
-    }
+    /* Find all the free clusters now, rather than holding up the first write
+       to the filesystem while reading the whole FAT. If this doesn't work out,
+       it'll be tried again when something needs to be allocated. */
+    if((rv->mnt_flags & FAT_MNT_FLAG_RW) && (err = fat_free_map_init(rv)))
+        dbglog(DBG_WARNING, "fat_fs_init: cannot build free cluster map: "
+               "%s\n", strerror(-err));
 
-    rv->fcache_size = fcache_sz;
     return rv;
-
-out_fcache2:
-    for(; j >= 0; --j) {
-        free(rv->fcache[j]->data);
-    }
-
-    j = fcache_sz - 1;
-
-out_fcache:
-    for(; j >= 0; --j) {
-        free(rv->fcache[j]);
-    }
-
-    free(rv->fcache);
-
-out_bcache:
-    for(; j >= 0; --j) {
-        free(rv->bcache[j]->data);
-    }
-
-    j = cache_sz - 1;
-out_cache:
-    for(; j >= 0; --j) {
-        free(rv->bcache[j]);
-    }
-
-    free(rv->bcache);
-    free(rv);
-    bd->shutdown(bd);
-    return NULL;
 }
 
 int fat_fs_sync(fat_fs_t *fs) {
@@ -415,22 +297,12 @@ int fat_fs_sync(fat_fs_t *fs) {
 }
 
 void fat_fs_shutdown(fat_fs_t *fs) {
-    int i;
-
     /* Sync the filesystem back to the block device, if needed. */
     fat_fs_sync(fs);
 
-    for(i = 0; i < fs->cache_size; ++i) {
-        free(fs->bcache[i]->data);
-        free(fs->bcache[i]);
-    }
-
-    free(fs->bcache);
-
-    for(i = 0; i < fs->fcache_size; ++i) {
-        free(fs->fcache[i]->data);
-        free(fs->fcache[i]);
-    }
+    blockcache_destroy(fs->bcache);
+    blockcache_destroy(fs->fcache);
+    fat_free_map_destroy(fs);
 
     fs->dev->shutdown(fs->dev);
     free(fs);
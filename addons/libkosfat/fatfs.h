@@ -48,6 +48,13 @@ __BEGIN_DECLS
 */
 #define FAT_FCACHE_BLOCKS       8
 
+/* Maximum size of a single read that bypasses the cluster cache, in device
+   sectors. Large reads of whole clusters that are contiguous on the device are
+   done straight into the caller's buffer with as few requests to the block
+   device as possible. This caps the size of each of those requests. This must
+   not be larger than 65535 (the most the G1 ATA DMA code can do in one go). */
+#define FAT_MAX_RUN_SECTORS     1024
+
 /* End tunable filesystem parameters. */
 
 /* Convenience stuff, for in case you want to use this outside of KOS. */
@@ -91,6 +98,16 @@ int fat_cluster_write_nc(fat_fs_t *fs, uint32_t cluster, const uint8_t *blk);
 
 int fat_cluster_mark_dirty(fat_fs_t *fs, uint32_t cluster);
 
+/* Read up to count clusters of a chain, starting at cl, straight from the
+   device into buf (bypassing the cluster cache). Only the clusters that are
+   physically contiguous on the device with the first one are read, and reading
+   stops at any cluster that is in the cache. On success, last is set to the
+   last cluster read. Returns the number of clusters read, 0 if the first one
+   must be read through the cache instead, or -1 on error (with err set). The
+   buffer must be suitably aligned for the block device (32 bytes for DMA). */
+int fat_cluster_read_run(fat_fs_t *fs, uint32_t cl, uint32_t count,
+                         uint8_t *buf, uint32_t *last, int *err);
+
 uint32_t fat_block_size(const fat_fs_t *fs);
 uint32_t fat_log_block_size(const fat_fs_t *fs);
 uint32_t fat_cluster_size(const fat_fs_t *fs);
@@ -121,6 +138,14 @@ uint32_t fat_read_fat(fat_fs_t *fs, uint32_t cl, int *err);
 int fat_write_fat(fat_fs_t *fs, uint32_t cl, uint32_t val);
 int fat_is_eof(fat_fs_t *fs, uint32_t cl);
 uint32_t fat_allocate_cluster(fat_fs_t *fs, int *err);
+
+/* Allocate a run of up to want clusters that are contiguous on the device,
+   linked together into a chain that ends with an end of chain marker. The
+   search starts at hint (pass 0 to let the allocator pick) and prefers a run
+   long enough for all of the clusters asked for. Returns the first cluster of
+   the run (with count set to its length), or FAT_INVALID_CLUSTER on error. */
+uint32_t fat_allocate_run(fat_fs_t *fs, uint32_t hint, uint32_t want,
+                          uint32_t *count, int *err);
 int fat_erase_chain(fat_fs_t *fs, uint32_t cluster);
 
 __END_DECLS
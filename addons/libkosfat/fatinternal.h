@@ -10,26 +10,21 @@
 #include <stddef.h>
 #include <stdint.h>
 
-#include "bpb.h"
-
-#define FAT_CACHE_FLAG_VALID    1
-#define FAT_CACHE_FLAG_DIRTY    2
+#include <kos/blockcache.h>
 
-typedef struct fat_cache {
-    uint32_t flags;
-    uint32_t block;
-    uint8_t *data;
-} fat_cache_t;
+#include "bpb.h"
 
 struct fatfs_struct {
     kos_blockdev_t *dev;
     fat_superblock_t sb;
 
-    fat_cache_t **bcache;
-    int cache_size;
+    kos_blockcache_t *bcache;
+    kos_blockcache_t *fcache;
 
-    fat_cache_t **fcache;
-    int fcache_size;
+    /* Bitmap of clusters in use, built when mounting read/write (NULL if the
+       filesystem is read-only, or building it failed). See fat.c for
+       details. */
+    uint32_t *free_map;
 
     uint32_t flags;
     uint32_t mnt_flags;
@@ -38,6 +33,16 @@ struct fatfs_struct {
 /* The BPB/FSinfo blocks need to be written back to the block device... */
 #define FAT_FS_FLAG_SB_DIRTY   1
 
+/* Set up the cache of FAT blocks for the filesystem (in fat.c). */
+int fat_fatblock_cache_init(fat_fs_t *fs, int fcache_sz);
+
+/* Build the free cluster map of the filesystem (in fat.c). Returns 0 on
+   success or a negative error code. */
+int fat_free_map_init(fat_fs_t *fs);
+
+/* Free the free cluster map of the filesystem, if it has one (in fat.c). */
+void fat_free_map_destroy(fat_fs_t *fs);
+
 #ifdef FAT_NOT_IN_KOS
 #include <stdio.h>
 #define DBG_DEBUG 0
@@ -35,6 +35,15 @@ char *strdup(const char *);
 
 #define MAX_FAT_FILES 16
 
+/* One run of contiguous clusters in a file's cluster chain: the clusters at
+   positions [order, order + count) in the file are the clusters starting at
+   cluster on the disk. */
+typedef struct fat_extent {
+    uint32_t order;
+    uint32_t cluster;
+    uint32_t count;
+} fat_extent_t;
+
 typedef struct fs_fat_fs {
     LIST_ENTRY(fs_fat_fs) entry;
 
@@ -60,6 +69,21 @@ static struct {
     uint32_t ptr;
     dirent_t dent;
     fs_fat_fs_t *fs;
+
+    /* Extent map of the cluster chain of the file, filled in lazily as the
+       chain is walked. This always covers the first "mapped" clusters of the
+       file, so that seeking within that range is just a binary search rather
+       than walking the FAT from the start of the file. */
+    fat_extent_t *extents;
+    uint32_t ext_count;
+    uint32_t ext_size;
+    uint32_t mapped;
+
+    /* Clusters allocated to the end of the file by a write that haven't been
+       reached (and cleared) yet, and the last cluster before them. */
+    uint32_t fresh_order;
+    uint32_t fresh_count;
+    uint32_t fresh_prev;
 } fh[MAX_FAT_FILES];
 
 static uint16_t longname_buf[256];
@@ -137,23 +161,119 @@ static int fat_create_entry(fat_fs_t *fs, const char *fn, uint8_t attr,
     return 0;
 }
 
-static int advance_cluster(fat_fs_t *fs, int fd, uint32_t order, int write) {
-    uint32_t clo, cl, cl2;
+static void extmap_clear(int fd) {
+    free(fh[fd].extents);
+    fh[fd].extents = NULL;
+    fh[fd].ext_count = fh[fd].ext_size = fh[fd].mapped = 0;
+}
+
+/* Record that the count clusters at position order in the file start at the
+   given cluster on the disk (and are contiguous). Anything that would leave a
+   hole in the map is ignored, as is anything that's already mapped. */
+static int extmap_add(int fd, uint32_t order, uint32_t cl, uint32_t count) {
+    fat_extent_t *ext;
+    uint32_t sz;
+
+    if(order > fh[fd].mapped || order + count <= fh[fd].mapped)
+        return 0;
+
+    /* Skip over anything we already have. */
+    cl += fh[fd].mapped - order;
+    count -= fh[fd].mapped - order;
+    order = fh[fd].mapped;
+
+    /* Can we just extend the last extent? */
+    if(fh[fd].ext_count) {
+        ext = &fh[fd].extents[fh[fd].ext_count - 1];
+
+        if(ext->cluster + ext->count == cl) {
+            ext->count += count;
+            fh[fd].mapped += count;
+            return 0;
+        }
+    }
+
+    /* Nope. Make room for another one, if need be. */
+    if(fh[fd].ext_count == fh[fd].ext_size) {
+        sz = fh[fd].ext_size ? fh[fd].ext_size << 1 : 8;
+
+        if(!(ext = (fat_extent_t *)realloc(fh[fd].extents,
+                                           sz * sizeof(fat_extent_t))))
+            return -ENOMEM;
+
+        fh[fd].extents = ext;
+        fh[fd].ext_size = sz;
+    }
+
+    ext = &fh[fd].extents[fh[fd].ext_count++];
+    ext->order = order;
+    ext->cluster = cl;
+    ext->count = count;
+    fh[fd].mapped += count;
+
+    return 0;
+}
+
+/* Look up the cluster at the given position in the file. It must be within the
+   mapped range. */
+static uint32_t extmap_find(int fd, uint32_t order) {
+    uint32_t lo = 0, hi = fh[fd].ext_count - 1, mid;
+    fat_extent_t *ext = fh[fd].extents;
+
+    while(lo < hi) {
+        mid = (lo + hi + 1) >> 1;
+
+        if(ext[mid].order <= order)
+            lo = mid;
+        else
+            hi = mid - 1;
+    }
+
+    return ext[lo].cluster + (order - ext[lo].order);
+}
+
+/* Move the file's current cluster to the given position in its chain. For a
+   read, want should be 0. For a write, want is the number of clusters (starting
+   at the given position) that the write is going to touch, so that if the file
+   has to be extended, all of the new clusters can be allocated in one go. */
+static int advance_cluster(fat_fs_t *fs, int fd, uint32_t order,
+                           uint32_t want) {
+    uint32_t clo, cl, cl2, n;
     int err;
 
+    /* If we already know where the cluster is, this is easy. */
+    if(order < fh[fd].mapped) {
+        fh[fd].cluster = extmap_find(fd, order);
+        fh[fd].cluster_order = order;
+        fh[fd].mode &= ~0x80000000;
+        return 0;
+    }
+
+    /* Otherwise, start at the last cluster we know about (or the beginning of
+       the file, if we don't know about any yet) and walk forward. The current
+       cluster might be a bit further along than the map, so use it if so. */
     cl = fh[fd].cluster;
     clo = fh[fd].cluster_order;
 
-    /* Are we moving forward or backward? */
-    if(clo > order) {
-        /* If moving backward, we have to start from the beginning of the file
-           and advance forward. */
+    if(clo >= fh[fd].mapped && clo <= order && cl >= 2 && !fat_is_eof(fs, cl)) {
+        if((err = extmap_add(fd, clo, cl, 1)))
+            return err;
+    }
+    else if(fh[fd].mapped) {
+        clo = fh[fd].mapped - 1;
+        cl = extmap_find(fd, clo);
+    }
+    else {
         clo = 0;
         cl = fh[fd].dentry.cluster_low | (fh[fd].dentry.cluster_high << 16);
-        fh[fd].cluster = cl;
-        fh[fd].cluster_order = clo;
+
+        if(cl >= 2 && !fat_is_eof(fs, cl) && (err = extmap_add(fd, 0, cl, 1)))
+            return err;
     }
 
+    fh[fd].cluster = cl;
+    fh[fd].cluster_order = clo;
+
     /* At this point, we're definitely moving forward, if at all... */
     while(clo < order) {
         /* Read the FAT for the current cluster to see where we're going
@@ -166,36 +286,49 @@ static int advance_cluster(fat_fs_t *fs, int fd, uint32_t order, int write) {
         else if(fat_is_eof(fs, cl2)) {
             /* If we've hit the EOF and we're writing, we need to allocate a new
                cluster to the file. If we're reading, then return error. */
-            if(!write) {
+            if(!want) {
                 fh[fd].cluster = cl2;
                 fh[fd].cluster_order = clo;
                 fh[fd].mode &= ~0x80000000;
                 return -EDOM;
             }
             else {
-                /* Allocate a new cluster */
-                cl2 = fat_allocate_cluster(fs, &err);
+                /* Allocate everything we need for the rest of the write,
+                   right after the end of the file if there's room. */
+                cl2 = fat_allocate_run(fs, cl + 1, order - clo + want - 1, &n,
+                                       &err);
 
                 if(cl2 == FAT_INVALID_CLUSTER) {
                     return -err;
                 }
 
-                /* Clear it. */
-                if(!fat_cluster_clear(fs, cl2, &err)) {
-                    fat_write_fat(fs, cl2, 0);
-                    return -err;
-                }
-
                 /* Write it to the file's FAT chain. */
                 if((err = fat_write_fat(fs, cl, cl2)) < 0) {
-                    fat_write_fat(fs, cl2, 0);
+                    fat_erase_chain(fs, cl2);
                     return err;
                 }
+
+                fh[fd].fresh_order = clo + 1;
+                fh[fd].fresh_count = n;
+                fh[fd].fresh_prev = cl;
             }
         }
 
         cl = cl2;
         ++clo;
+
+        /* Clear out newly allocated clusters as we get to them. */
+        if(fh[fd].fresh_count && clo == fh[fd].fresh_order) {
+            if(!fat_cluster_clear(fs, cl, &err))
+                return -err;
+
+            ++fh[fd].fresh_order;
+            --fh[fd].fresh_count;
+            fh[fd].fresh_prev = cl;
+        }
+
+        if((err = extmap_add(fd, clo, cl, 1)))
+            return err;
     }
 
     fh[fd].cluster = cl;
@@ -204,6 +337,25 @@ static int advance_cluster(fat_fs_t *fs, int fd, uint32_t order, int write) {
     return 0;
 }
 
+/* Give back the clusters a write allocated to the end of the file that it
+   never got to. This is for when the write fails part of the way through, as
+   they would otherwise stay allocated past the end of the file. */
+static void release_fresh(fat_fs_t *fs, int fd) {
+    uint32_t next;
+    int err;
+
+    if(!fh[fd].fresh_count)
+        return;
+
+    next = fat_read_fat(fs, fh[fd].fresh_prev, &err);
+
+    if(next != FAT_INVALID_CLUSTER && !fat_is_eof(fs, next) &&
+       !fat_write_fat(fs, fh[fd].fresh_prev, 0x0FFFFFFF))
+        fat_erase_chain(fs, next);
+
+    fh[fd].fresh_count = 0;
+}
+
 static void *fs_fat_open(vfs_handler_t *vfs, const char *fn, int mode) {
     file_t fd;
     fs_fat_fs_t *mnt = (fs_fat_fs_t *)vfs->privdata;
@@ -341,6 +493,8 @@ created:
     fh[fd].cluster = fh[fd].dentry.cluster_low |
         (fh[fd].dentry.cluster_high << 16);
     fh[fd].cluster_order = 0;
+    fh[fd].ext_count = fh[fd].mapped = 0;
+    fh[fd].fresh_order = fh[fd].fresh_count = 0;
     fh[fd].opened = 1;
 
     mutex_unlock(&fat_mutex);
@@ -357,6 +511,7 @@ static int fs_fat_close(void *h) {
         fh[fd].opened = 0;
         fh[fd].dentry_offset = fh[fd].dentry_cluster = 0;
         fh[fd].dentry_lcl = fh[fd].dentry_loff = 0;
+        extmap_clear(fd);
     }
     else {
         rv = -1;
@@ -375,7 +530,8 @@ static ssize_t fs_fat_read(void *h, void *buf, size_t cnt) {
     uint8_t *bbuf = (uint8_t *)buf;
     ssize_t rv;
     uint64_t sz, cl;
-    int mode;
+    uint32_t len, last;
+    int mode, n;
 
     mutex_lock(&fat_mutex);
 
@@ -485,24 +641,52 @@ static ssize_t fs_fat_read(void *h, void *buf, size_t cnt) {
 
     /* While we still have more to read, do it. */
     while(cnt) {
-        if(!(block = fat_cluster_read(fs, fh[fd].cluster, &errno))) {
-            mutex_unlock(&fat_mutex);
-            return -1;
+        n = 0;
+
+        /* Remember where this cluster is, in case we seek back to it later. If
+           this fails, we'll just end up walking the chain again. */
+        (void)extmap_add(fd, fh[fd].cluster_order, fh[fd].cluster, 1);
+
+        /* If we're reading whole clusters into a suitably aligned buffer, read
+           as many as we can that are contiguous on the device directly into
+           the user's buffer, bypassing the cache. */
+        if(cnt >= bs && !((uintptr_t)bbuf & 31)) {
+            if((n = fat_cluster_read_run(fs, fh[fd].cluster, cnt / bs, bbuf,
+                                         &last, &errno)) < 0) {
+                mutex_unlock(&fat_mutex);
+                return -1;
+            }
         }
 
-        /* Is there still more to read? */
-        if(cnt > bs) {
-            memcpy(bbuf, block, bs);
-            fh[fd].ptr += bs;
-            cnt -= bs;
-            bbuf += bs;
+        if(n > 0) {
+            len = n * bs;
+            (void)extmap_add(fd, fh[fd].cluster_order, fh[fd].cluster, n);
+            fh[fd].cluster = last;
+            fh[fd].cluster_order += n - 1;
+        }
+        else {
+            if(!(block = fat_cluster_read(fs, fh[fd].cluster, &errno))) {
+                mutex_unlock(&fat_mutex);
+                return -1;
+            }
+
+            len = cnt > bs ? bs : cnt;
+            memcpy(bbuf, block, len);
+        }
+
+        fh[fd].ptr += len;
+        cnt -= len;
+        bbuf += len;
+
+        /* Did we hit the end of the cluster? */
+        if(!(fh[fd].ptr & (bs - 1))) {
             cl = fat_read_fat(fs, fh[fd].cluster, &errno);
 
             if(cl == FAT_INVALID_CLUSTER) {
                 mutex_unlock(&fat_mutex);
                 return -1;
             }
-            else if(fat_is_eof(fs, cl)) {
+            else if(cnt && fat_is_eof(fs, cl)) {
                 mutex_unlock(&fat_mutex);
                 errno = EIO;
                 return -1;
@@ -511,25 +695,6 @@ static ssize_t fs_fat_read(void *h, void *buf, size_t cnt) {
             fh[fd].cluster = cl;
             ++fh[fd].cluster_order;
         }
-        else {
-            memcpy(bbuf, block, cnt);
-            fh[fd].ptr += cnt;
-
-            /* Did we hit the end of the cluster? */
-            if(cnt == bs) {
-                cl = fat_read_fat(fs, fh[fd].cluster, &errno);
-
-                if(cl == FAT_INVALID_CLUSTER) {
-                    mutex_unlock(&fat_mutex);
-                    return -1;
-                }
-
-                fh[fd].cluster = cl;
-                ++fh[fd].cluster_order;
-            }
-
-            cnt = 0;
-        }
     }
 
     /* We're done, clean up and return. */
@@ -576,7 +741,9 @@ static ssize_t fs_fat_write(void *h, const void *buf, size_t cnt) {
     /* Have we had an intervening seek call (or a write that ended exactly on
        a cluster boundary)? */
     if((fh[fd].mode & 0x80000000)) {
-        if((err = advance_cluster(fs, fd, fh[fd].ptr / bs, 1)) < 0) {
+        if((err = advance_cluster(fs, fd, fh[fd].ptr / bs,
+                                  (bo + cnt - 1) / bs + 1)) < 0) {
+            release_fresh(fs, fd);
             mutex_unlock(&fat_mutex);
             errno = -err;
             return -1;
@@ -586,6 +753,7 @@ static ssize_t fs_fat_write(void *h, const void *buf, size_t cnt) {
     /* Are we starting our write in the middle of a block? */
     if(bo) {
         if(!(block = fat_cluster_read(fs, fh[fd].cluster, &err))) {
+            release_fresh(fs, fd);
             mutex_unlock(&fat_mutex);
             errno = err;
             return -1;
@@ -601,7 +769,8 @@ static ssize_t fs_fat_write(void *h, const void *buf, size_t cnt) {
             cnt -= bs - bo;
 
             if((err = advance_cluster(fs, fd, fh[fd].cluster_order + 1,
-                                      1)) < 0) {
+                                      (cnt - 1) / bs + 1)) < 0) {
+                release_fresh(fs, fd);
                 mutex_unlock(&fat_mutex);
                 errno = -err;
                 return -1;
@@ -624,6 +793,7 @@ static ssize_t fs_fat_write(void *h, const void *buf, size_t cnt) {
     /* While we still have more to write, do it. */
     while(cnt) {
         if(!(block = fat_cluster_read(fs, fh[fd].cluster, &err))) {
+            release_fresh(fs, fd);
             mutex_unlock(&fat_mutex);
             errno = err;
             return -1;
@@ -638,7 +808,8 @@ static ssize_t fs_fat_write(void *h, const void *buf, size_t cnt) {
             bbuf += bs;
 
             if((err = advance_cluster(fs, fd, fh[fd].cluster_order + 1,
-                                      1)) < 0) {
+                                      (cnt - 1) / bs + 1)) < 0) {
+                release_fresh(fs, fd);
                 mutex_unlock(&fat_mutex);
                 errno = -err;
                 return -1;
@@ -1492,10 +1663,15 @@ int fs_fat_init(void) {
 
 int fs_fat_shutdown(void) {
     fs_fat_fs_t *i, *next;
+    int j;
 
     if(!initted)
         return 0;
 
+    for(j = 0; j < MAX_FAT_FILES; ++j) {
+        extmap_clear(j);
+    }
+
     /* Clean up the mounted filesystems */
     i = LIST_FIRST(&fat_fses);
     while(i) {
@@ -0,0 +1,199 @@
+/* KallistiOS ##version##
+
+   mallocbench.c
+   Copyright (C) 2024 The KallistiOS Team
+
+*/
+
+/* This program measures how fast malloc() and free() are with a few different
+   patterns of small allocations (16 to 512 bytes), from one thread and from
+   several at once, then reports how fragmented they left the heap. Build KOS
+   with and without MALLOC_TCACHE in kos/opts.h to compare the two. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <malloc.h>
+
+#include <kos/opts.h>
+#include <kos/thread.h>
+#include <kos/sem.h>
+
+#include <arch/arch.h>
+#include <arch/timer.h>
+#include <dc/maple.h>
+#include <dc/maple/controller.h>
+
+#define OPERATIONS      200000
+#define SLOTS           64
+#define MIN_SIZE        16
+#define MAX_SIZE        512
+#define MAX_THREADS     4
+
+typedef struct bench {
+    const char *name;
+    void (*run)(uint32_t *seed, int ops);
+} bench_t;
+
+static inline uint32_t rnd(uint32_t *seed) {
+    /* xorshift32 */
+    *seed ^= *seed << 13;
+    *seed ^= *seed >> 17;
+    *seed ^= *seed << 5;
+    return *seed;
+}
+
+static inline size_t rnd_size(uint32_t *seed) {
+    return MIN_SIZE + rnd(seed) % (MAX_SIZE - MIN_SIZE + 1);
+}
+
+/* Free each block right after allocating it. */
+static void run_pairs(uint32_t *seed, int ops) {
+    void *p;
+    int i;
+
+    for(i = 0; i < ops; i += 2) {
+        p = malloc(rnd_size(seed));
+        *(volatile uint8_t *)p = 0;
+        free(p);
+    }
+}
+
+/* Allocate a batch of blocks, then free them all, newest first. */
+static void run_batches(uint32_t *seed, int ops) {
+    void *p[SLOTS];
+    int i, j;
+
+    for(i = 0; i < ops; i += SLOTS * 2) {
+        for(j = 0; j < SLOTS; ++j)
+            p[j] = malloc(rnd_size(seed));
+
+        for(j = SLOTS - 1; j >= 0; --j)
+            free(p[j]);
+    }
+}
+
+/* Keep a set of blocks alive, replacing a random one each time. */
+static void run_random(uint32_t *seed, int ops) {
+    void *p[SLOTS] = { NULL };
+    int i, j;
+
+    for(i = 0; i < ops; i += 2) {
+        j = rnd(seed) % SLOTS;
+        free(p[j]);
+        p[j] = malloc(rnd_size(seed));
+    }
+
+    for(j = 0; j < SLOTS; ++j)
+        free(p[j]);
+}
+
+static const bench_t benches[] = {
+    { "pairs", run_pairs },
+    { "batches", run_batches },
+    { "random", run_random }
+};
+
+static const bench_t *cur_bench;
+static int cur_threads;
+
+/* The workers wait on this until they have all been created, then each one
+   times its own run, so creating and joining them isn't counted. */
+static semaphore_t start_sem = SEM_INITIALIZER(0);
+static uint64_t thd_start[MAX_THREADS], thd_end[MAX_THREADS];
+
+static void *bench_thd(void *param) {
+    int n = (int)param;
+    uint32_t seed = 0x1234567 + n;
+
+    sem_wait(&start_sem);
+
+    thd_start[n] = timer_ns_gettime64();
+    cur_bench->run(&seed, OPERATIONS / cur_threads);
+    thd_end[n] = timer_ns_gettime64();
+
+    return NULL;
+}
+
+static void run_bench(const bench_t *b, int threads) {
+    kthread_t *thds[MAX_THREADS];
+    uint64_t start, end, ns;
+    int i;
+
+    cur_bench = b;
+    cur_threads = threads;
+
+    for(i = 0; i < threads; ++i)
+        thds[i] = thd_create(false, bench_thd, (void *)i);
+
+    for(i = 0; i < threads; ++i)
+        sem_signal(&start_sem);
+
+    for(i = 0; i < threads; ++i)
+        thd_join(thds[i], NULL);
+
+    /* From the first worker starting to the last one finishing. */
+    start = thd_start[0];
+    end = thd_end[0];
+
+    for(i = 1; i < threads; ++i) {
+        if(thd_start[i] < start)
+            start = thd_start[i];
+
+        if(thd_end[i] > end)
+            end = thd_end[i];
+    }
+
+    ns = end - start;
+
+    printf("%-8s %d thread%s %8llu us: %5llu ns/op\n", b->name, threads,
+           threads == 1 ? " " : "s", ns / 1000, ns / OPERATIONS);
+}
+
+/* Free memory that isn't at the top of the heap can't be given back, and is
+   only of use to allocations that fit in the holes. */
+static void report_heap(const char *when) {
+    struct mallinfo mi = mallinfo();
+    int holes = mi.fordblks - mi.keepcost;
+
+    printf("\nHeap %s:\n", when);
+    printf("  arena %d, in use %d, free %d in %d chunks\n", mi.arena,
+           mi.uordblks, mi.fordblks, mi.ordblks);
+    printf("  small cached blocks %d (%d bytes), top %d\n", mi.smblks,
+           mi.fsmblks, mi.keepcost);
+    printf("  fragmentation: %d bytes free below the top (%d%% of arena)\n",
+           holes, mi.arena ? holes * 100 / mi.arena : 0);
+}
+
+KOS_INIT_FLAGS(INIT_DEFAULT);
+
+int main(int argc, char *argv[]) {
+    size_t i;
+    int threads;
+
+    /* Exit if the user presses all buttons at once. */
+    cont_btn_callback(0, CONT_START | CONT_A | CONT_B | CONT_X | CONT_Y,
+                      (cont_btn_callback_t)arch_exit);
+
+    printf("KallistiOS malloc benchmark\n");
+
+#ifdef MALLOC_TCACHE
+    printf("Per-thread caches: on (up to %d bytes, %d of each size)\n",
+           MALLOC_TCACHE_MAX_SIZE, MALLOC_TCACHE_COUNT);
+#else
+    printf("Per-thread caches: off\n");
+#endif
+
+    report_heap("before");
+    printf("\n");
+
+    for(i = 0; i < sizeof(benches) / sizeof(benches[0]); ++i) {
+        for(threads = 1; threads <= MAX_THREADS; threads *= 2)
+            run_bench(&benches[i], threads);
+    }
+
+    report_heap("after");
+
+    printf("\nDone!\n");
+    return 0;
+}
@@ -0,0 +1,254 @@
+/* KallistiOS ##version##
+
+   jobs_test.c
+   Copyright (C) 2024 The KallistiOS Team
+
+*/
+
+/* This program is a test of the job system. It checks that:
+
+     - every job submitted gets run exactly once,
+     - a job submitted after a counter only runs once that counter's jobs have
+       all finished,
+     - jobs can spawn (and wait on) more jobs without the pool deadlocking,
+     - higher priority lanes are emptied before lower priority ones.
+
+   Then it times how long the pool takes to get through a batch of small jobs.
+*/
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdatomic.h>
+
+#include <kos/jobs.h>
+#include <kos/thread.h>
+#include <kos/sem.h>
+
+#include <arch/arch.h>
+#include <arch/timer.h>
+#include <dc/maple.h>
+#include <dc/maple/controller.h>
+
+#define WORKERS     4
+#define FAN_JOBS    1000
+#define SUB_JOBS    16
+#define BENCH_JOBS  20000
+
+static kos_job_pool_t *pool;
+static atomic_int runs;
+
+static int failed;
+
+#define check(cond, ...) do { \
+        if(!(cond)) { \
+            printf("FAILED: " __VA_ARGS__); \
+            failed = 1; \
+        } \
+    } while(0)
+
+static void count_job(void *data) {
+    (void)data;
+    atomic_fetch_add(&runs, 1);
+}
+
+/* Every job runs once. */
+static void test_fan_out(void) {
+    static kos_job_t jobs[FAN_JOBS];
+    kos_job_counter_t done = KOS_JOB_COUNTER_INITIALIZER;
+    int i;
+
+    atomic_store(&runs, 0);
+
+    for(i = 0; i < FAN_JOBS; ++i) {
+        kos_job_init(&jobs[i], count_job, NULL, i % KOS_JOB_LANE_COUNT);
+        kos_job_submit(pool, &jobs[i], &done, NULL);
+    }
+
+    kos_job_wait(pool, &done);
+
+    check(atomic_load(&runs) == FAN_JOBS, "fan out: %d runs, expected %d\n",
+          atomic_load(&runs), FAN_JOBS);
+}
+
+static void check_after_job(void *data) {
+    int *seen = (int *)data;
+
+    *seen = atomic_load(&runs);
+}
+
+/* A job submitted after a counter sees the work of all of that counter's
+   jobs, and a chain of continuations runs in order. */
+static void test_dependencies(void) {
+    static kos_job_t jobs[FAN_JOBS];
+    kos_job_t after, chain[3];
+    kos_job_counter_t first = KOS_JOB_COUNTER_INITIALIZER;
+    kos_job_counter_t second = KOS_JOB_COUNTER_INITIALIZER;
+    kos_job_counter_t links[3];
+    int seen = -1, i;
+
+    atomic_store(&runs, 0);
+
+    for(i = 0; i < FAN_JOBS; ++i) {
+        kos_job_init(&jobs[i], count_job, NULL, KOS_JOB_LANE_NORMAL);
+        kos_job_submit(pool, &jobs[i], &first, NULL);
+    }
+
+    kos_job_init(&after, check_after_job, &seen, KOS_JOB_LANE_HIGH);
+    kos_job_submit(pool, &after, &second, &first);
+    kos_job_wait(pool, &second);
+
+    check(seen == FAN_JOBS, "dependency: ran after %d of %d jobs\n",
+          seen, FAN_JOBS);
+
+    atomic_store(&runs, 0);
+
+    for(i = 0; i < 3; ++i) {
+        kos_job_counter_init(&links[i]);
+        kos_job_init(&chain[i], count_job, NULL, KOS_JOB_LANE_LOW);
+        kos_job_submit(pool, &chain[i], &links[i], i ? &links[i - 1] : NULL);
+    }
+
+    kos_job_wait(pool, &links[2]);
+
+    check(atomic_load(&runs) == 3, "continuation: %d of 3 links ran\n",
+          atomic_load(&runs));
+}
+
+static void parent_job(void *data) {
+    kos_job_t subs[SUB_JOBS];
+    kos_job_counter_t done = KOS_JOB_COUNTER_INITIALIZER;
+    int i;
+
+    (void)data;
+
+    for(i = 0; i < SUB_JOBS; ++i) {
+        kos_job_init(&subs[i], count_job, NULL, KOS_JOB_LANE_NORMAL);
+        kos_job_submit(pool, &subs[i], &done, NULL);
+    }
+
+    /* This runs other jobs while waiting, instead of tying up the worker. */
+    kos_job_wait(pool, &done);
+}
+
+/* More jobs waiting on subjobs than there are workers doesn't deadlock. */
+static void test_nested(void) {
+    kos_job_t parents[WORKERS * 2];
+    kos_job_counter_t done = KOS_JOB_COUNTER_INITIALIZER;
+    int i;
+
+    atomic_store(&runs, 0);
+
+    for(i = 0; i < WORKERS * 2; ++i) {
+        kos_job_init(&parents[i], parent_job, NULL, KOS_JOB_LANE_NORMAL);
+        kos_job_submit(pool, &parents[i], &done, NULL);
+    }
+
+    kos_job_wait(pool, &done);
+
+    check(atomic_load(&runs) == WORKERS * 2 * SUB_JOBS,
+          "nested: %d runs, expected %d\n", atomic_load(&runs),
+          WORKERS * 2 * SUB_JOBS);
+}
+
+static semaphore_t gate = SEM_INITIALIZER(0);
+static int order[KOS_JOB_LANE_COUNT * 2];
+static int order_pos;
+
+static void gate_job(void *data) {
+    (void)data;
+    sem_wait(&gate);
+}
+
+static void lane_job(void *data) {
+    order[order_pos++] = (int)(intptr_t)data;
+}
+
+/* With the only worker blocked, queue up jobs in reverse priority order, then
+   let it go and see what order they run in. */
+static void test_lanes(void) {
+    kos_job_pool_t *single;
+    kos_job_t block, jobs[KOS_JOB_LANE_COUNT * 2];
+    kos_job_counter_t done = KOS_JOB_COUNTER_INITIALIZER;
+    int i, lane;
+
+    if(!(single = kos_job_pool_create(1, NULL))) {
+        check(0, "lanes: couldn't create a pool\n");
+        return;
+    }
+
+    kos_job_init(&block, gate_job, NULL, KOS_JOB_LANE_HIGH);
+    kos_job_submit(single, &block, &done, NULL);
+
+    /* Make sure the worker is stuck in the gate. */
+    thd_sleep(10);
+
+    for(i = 0; i < KOS_JOB_LANE_COUNT * 2; ++i) {
+        lane = KOS_JOB_LANE_COUNT - 1 - i / 2;
+        kos_job_init(&jobs[i], lane_job, (void *)(intptr_t)lane, lane);
+        kos_job_submit(single, &jobs[i], &done, NULL);
+    }
+
+    sem_signal(&gate);
+    kos_job_wait(single, &done);
+    kos_job_pool_destroy(single);
+
+    for(i = 1; i < KOS_JOB_LANE_COUNT * 2; ++i) {
+        check(order[i - 1] <= order[i], "lanes: lane %d ran before lane %d\n",
+              order[i - 1], order[i]);
+    }
+}
+
+static void bench(void) {
+    static kos_job_t jobs[BENCH_JOBS];
+    kos_job_counter_t done = KOS_JOB_COUNTER_INITIALIZER;
+    uint64_t start, elapsed;
+    int i;
+
+    start = timer_us_gettime64();
+
+    for(i = 0; i < BENCH_JOBS; ++i) {
+        kos_job_init(&jobs[i], count_job, NULL, KOS_JOB_LANE_NORMAL);
+        kos_job_submit(pool, &jobs[i], &done, NULL);
+    }
+
+    kos_job_wait(pool, &done);
+    elapsed = timer_us_gettime64() - start;
+
+    printf("%d jobs in %llu us (%llu jobs/s)\n", BENCH_JOBS, elapsed,
+           elapsed ? BENCH_JOBS * 1000000ULL / elapsed : 0);
+}
+
+KOS_INIT_FLAGS(INIT_DEFAULT);
+
+int main(int argc, char *argv[]) {
+    kthread_attr_t attr = { 0 };
+
+    /* Exit if the user presses all buttons at once. */
+    cont_btn_callback(0, CONT_START | CONT_A | CONT_B | CONT_X | CONT_Y,
+                      (cont_btn_callback_t)arch_exit);
+
+    printf("KallistiOS Job System test program\n");
+
+    attr.label = "[job]";
+
+    if(!(pool = kos_job_pool_create(WORKERS, &attr))) {
+        printf("Couldn't create the job pool\n");
+        return 1;
+    }
+
+    test_fan_out();
+    test_dependencies();
+    test_nested();
+    test_lanes();
+    bench();
+
+    kos_job_pool_destroy(pool);
+
+    if(failed) {
+        printf("Job system tests failed!\n");
+        return 1;
+    }
+
+    printf("Job system tests completed successfully!\n");
+    return 0;
+}
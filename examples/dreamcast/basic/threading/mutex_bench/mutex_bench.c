@@ -0,0 +1,185 @@
+/* KallistiOS ##version##
+
+   mutex_bench.c
+   Copyright (C) 2024 The KallistiOS Team
+
+*/
+
+/* This program measures the throughput of mutex lock/unlock pairs, first with
+   no contention at all, then with a few threads of the same priority fighting
+   over a single mutex, and finally with a thread of lower priority holding it
+   for a short while every so often. Run it before and after changing the
+   mutex code to see what difference it makes. Last of all, it checks how long
+   mutex_lock_timed() really takes to give up on a mutex that a thread of the
+   same priority holds for much longer than the timeout. */
+
+#include <stdio.h>
+
+#include <kos/thread.h>
+#include <kos/mutex.h>
+
+#include <arch/arch.h>
+#include <arch/timer.h>
+#include <dc/maple.h>
+#include <dc/maple/controller.h>
+
+#define UNUSED __attribute__((unused))
+
+#define ITERATIONS      1000000
+#define THREADS         4
+#define WORK            16
+
+static mutex_t lock = MUTEX_INITIALIZER;
+static volatile uint32_t counter;
+
+static void report(const char *test, uint32_t pairs, uint64_t ns) {
+    printf("%-14s %8lu pairs in %8llu us: %6llu ns/pair\n", test, pairs,
+           ns / 1000, ns / pairs);
+}
+
+static void bench_uncontended(void) {
+    uint64_t start;
+    int i;
+
+    start = timer_ns_gettime64();
+
+    for(i = 0; i < ITERATIONS; ++i) {
+        mutex_lock(&lock);
+        mutex_unlock(&lock);
+    }
+
+    report("uncontended", ITERATIONS, timer_ns_gettime64() - start);
+}
+
+static void *contend_thd(void *param UNUSED) {
+    int i, j;
+
+    for(i = 0; i < ITERATIONS / THREADS; ++i) {
+        mutex_lock(&lock);
+
+        /* Hold on to it for a little while, so that we get preempted with it
+           held every now and then. */
+        for(j = 0; j < WORK; ++j)
+            ++counter;
+
+        mutex_unlock(&lock);
+    }
+
+    return NULL;
+}
+
+static void bench_contended(void) {
+    kthread_t *thds[THREADS];
+    uint64_t start;
+    int i;
+
+    counter = 0;
+    start = timer_ns_gettime64();
+
+    for(i = 0; i < THREADS; ++i)
+        thds[i] = thd_create(0, contend_thd, NULL);
+
+    for(i = 0; i < THREADS; ++i)
+        thd_join(thds[i], NULL);
+
+    report("contended", ITERATIONS / THREADS * THREADS,
+           timer_ns_gettime64() - start);
+
+    if(counter != ITERATIONS / THREADS * THREADS * WORK)
+        printf("Counter is %lu, the mutex doesn't work!\n", counter);
+}
+
+static volatile int holding = 1;
+
+static void *holder_thd(void *param UNUSED) {
+    while(holding) {
+        mutex_lock(&lock);
+        timer_spin_delay_us(50);
+        mutex_unlock(&lock);
+        thd_sleep(1);
+    }
+
+    return NULL;
+}
+
+static void bench_blocking(void) {
+    kthread_attr_t attr = { 0 };
+    kthread_t *holder;
+    uint64_t start;
+    int i;
+
+    attr.prio = PRIO_DEFAULT + 1;
+    attr.label = "holder";
+    holder = thd_create_ex(&attr, holder_thd, NULL);
+
+    start = timer_ns_gettime64();
+
+    for(i = 0; i < ITERATIONS / 10; ++i) {
+        mutex_lock(&lock);
+        mutex_unlock(&lock);
+    }
+
+    report("lower holder", ITERATIONS / 10, timer_ns_gettime64() - start);
+
+    holding = 0;
+    thd_join(holder, NULL);
+}
+
+#define TIMED_HOLD      100
+#define TIMED_TIMEOUT   5
+
+static void *long_holder_thd(void *param UNUSED) {
+    uint64_t end;
+
+    mutex_lock(&lock);
+
+    /* Keep running with it held, rather than sleeping. */
+    end = timer_ms_gettime64() + TIMED_HOLD;
+    while(timer_ms_gettime64() < end)
+        ;
+
+    mutex_unlock(&lock);
+
+    return NULL;
+}
+
+static void bench_timed(void) {
+    kthread_t *holder;
+    uint64_t start;
+    int rv;
+
+    holder = thd_create(0, long_holder_thd, NULL);
+
+    while(!mutex_is_locked(&lock))
+        thd_pass();
+
+    start = timer_ns_gettime64();
+    rv = mutex_lock_timed(&lock, TIMED_TIMEOUT);
+
+    printf("timed          %d ms timeout %s after %llu us\n", TIMED_TIMEOUT,
+           rv ? "ran out" : "got the lock",
+           (timer_ns_gettime64() - start) / 1000);
+
+    if(!rv)
+        mutex_unlock(&lock);
+
+    thd_join(holder, NULL);
+}
+
+KOS_INIT_FLAGS(INIT_DEFAULT);
+
+int main(int argc, char *argv[]) {
+    /* Exit if the user presses all buttons at once. */
+    cont_btn_callback(0, CONT_START | CONT_A | CONT_B | CONT_X | CONT_Y,
+                      (cont_btn_callback_t)arch_exit);
+
+    printf("KallistiOS mutex benchmark\n");
+
+    bench_uncontended();
+    bench_contended();
+    bench_blocking();
+    bench_timed();
+
+    printf("Done!\n");
+    return 0;
+}
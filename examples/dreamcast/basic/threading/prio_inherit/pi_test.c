@@ -0,0 +1,149 @@
+/* KallistiOS ##version##
+
+   pi_test.c
+   Copyright (C) 2024 The KallistiOS Team
+
+*/
+
+/* This program is a test of priority inheritance through a chain of mutexes.
+   It sets up the classic unbounded priority inversion:
+
+     - A low priority thread takes lock B and goes off to do some work.
+     - A middle priority thread takes lock A, then blocks on lock B.
+     - A high priority thread blocks on lock A.
+     - Meanwhile, a few threads with a priority between the low and the high
+       one hog the CPU for a good while.
+
+   There is more than one CPU hog, all at the same priority, so that there is
+   always another one ready to run when one's time slice is up. If only the
+   direct holder of a lock inherits the priority of its waiters, the low
+   priority thread never gets to run until the hogs are done, so the high
+   priority thread is stuck waiting for all that time. With priority
+   inheritance carried down the whole chain, the low priority thread runs at
+   the high priority thread's priority, and the high priority thread gets its
+   lock almost right away.
+
+   The timing is all done with thd_sleep(), so the order of events is the
+   same on every run. */
+
+#include <stdio.h>
+
+#include <kos/thread.h>
+#include <kos/mutex.h>
+
+#include <arch/arch.h>
+#include <arch/timer.h>
+#include <dc/maple.h>
+#include <dc/maple/controller.h>
+
+#define UNUSED __attribute__((unused))
+
+/* How many CPU hogs there are, how long they run for, and how long the high
+   priority thread can wait before we call it a failure. */
+#define HOGS        3
+#define HOG_MS      1000
+#define LIMIT_MS    100
+
+static mutex_t lock_a = MUTEX_INITIALIZER;
+static mutex_t lock_b = MUTEX_INITIALIZER;
+static uint64_t high_wait;
+
+static void busy_wait(uint64_t ms) {
+    uint64_t end = timer_ms_gettime64() + ms;
+
+    while(timer_ms_gettime64() < end)
+        ;
+}
+
+static void *low_thd(void *param UNUSED) {
+    mutex_lock(&lock_b);
+
+    /* Give everyone else time to line up behind us. */
+    thd_sleep(40);
+    busy_wait(5);
+
+    mutex_unlock(&lock_b);
+    return NULL;
+}
+
+static void *mid_thd(void *param UNUSED) {
+    thd_sleep(10);
+    mutex_lock(&lock_a);
+    mutex_lock(&lock_b);
+
+    busy_wait(5);
+
+    mutex_unlock(&lock_b);
+    mutex_unlock(&lock_a);
+    return NULL;
+}
+
+static void *high_thd(void *param UNUSED) {
+    uint64_t start;
+
+    thd_sleep(20);
+
+    start = timer_ms_gettime64();
+    mutex_lock(&lock_a);
+    high_wait = timer_ms_gettime64() - start;
+    mutex_unlock(&lock_a);
+
+    return NULL;
+}
+
+static void *hog_thd(void *param UNUSED) {
+    thd_sleep(30);
+    busy_wait(HOG_MS);
+
+    return NULL;
+}
+
+static kthread_t *start(void *(*routine)(void *), prio_t prio,
+                        const char *label) {
+    kthread_attr_t attr = { 0 };
+
+    attr.prio = prio;
+    attr.label = label;
+    return thd_create_ex(&attr, routine, NULL);
+}
+
+KOS_INIT_FLAGS(INIT_DEFAULT);
+
+int main(int argc, char *argv[]) {
+    kthread_t *low, *mid, *high, *hog[HOGS];
+    int i;
+
+    /* Exit if the user presses all buttons at once. */
+    cont_btn_callback(0, CONT_START | CONT_A | CONT_B | CONT_X | CONT_Y,
+                      (cont_btn_callback_t)arch_exit);
+
+    printf("KallistiOS Priority Inheritance test program\n");
+
+    /* Stay above everyone else, so we can set things up undisturbed. */
+    thd_set_prio(thd_current, 1);
+
+    low = start(low_thd, 40, "low");
+    mid = start(mid_thd, 30, "mid");
+    high = start(high_thd, 10, "high");
+
+    for(i = 0; i < HOGS; ++i)
+        hog[i] = start(hog_thd, 20, "hog");
+
+    thd_join(high, NULL);
+    thd_join(mid, NULL);
+    thd_join(low, NULL);
+
+    for(i = 0; i < HOGS; ++i)
+        thd_join(hog[i], NULL);
+
+    printf("High priority thread waited %llu ms for its lock\n", high_wait);
+
+    if(high_wait >= LIMIT_MS) {
+        printf("Priority inversion: the lock holders were starved by lower "
+               "priority threads!\n");
+        return 1;
+    }
+
+    printf("Priority inheritance tests completed successfully!\n");
+    return 0;
+}
@@ -0,0 +1,284 @@
+/* KallistiOS ##version##
+
+   aio.c
+   Copyright (C) 2024 The KallistiOS Team
+
+*/
+
+/* This program streams the largest file in the root of the CD with the
+   asynchronous I/O API (kos/fs_aio.h), while the main thread goes on with
+   its own frames. A few requests are kept in flight, and the completion
+   callback of each one checks the data it got and resubmits the request for
+   the next part of the file, until the end.
+
+   While that goes on, it also:
+     - cancels a request that is still queued behind the stream, which is
+       then finished with ECANCELED without ever being read,
+     - reads from the CD into a buffer that isn't 32-byte aligned, which the
+       ISO9660 filesystem can't DMA into, so it refuses it with ENOTSUP and
+       the VFS falls back to a normal read,
+     - writes and reads back a file on /ram, which has no asynchronous
+       support of its own and has its own worker thread, so it doesn't have
+       to wait for the CD.
+
+   At the end, the whole file is read again normally to check that the
+   stream got the same data. */
+
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+
+#include <kos/fs.h>
+#include <kos/fs_aio.h>
+#include <kos/thread.h>
+
+#include <arch/arch.h>
+#include <arch/timer.h>
+#include <dc/maple.h>
+#include <dc/maple/controller.h>
+
+#define CHUNK_SIZE      (64 * 1024)
+#define REQUESTS        4
+#define SMALL_SIZE      4096
+#define FRAME_MS        16
+
+static fs_aio_t stream_reqs[REQUESTS];
+static uint8_t stream_bufs[REQUESTS][CHUNK_SIZE] __attribute__((aligned(32)));
+static file_t stream_fd;
+
+/* Only ever changed by the CD's worker thread, from the callback. */
+static volatile uint32_t stream_sum;
+static volatile uint32_t stream_bytes;
+static volatile int stream_active;
+static volatile int stream_error;
+
+static uint8_t small_buf[SMALL_SIZE + 1] __attribute__((aligned(32)));
+static uint8_t check_buf[SMALL_SIZE] __attribute__((aligned(32)));
+
+static uint32_t checksum(const uint8_t *buf, size_t cnt) {
+    uint32_t sum = 0;
+
+    while(cnt--)
+        sum += *buf++;
+
+    return sum;
+}
+
+/* Runs on the CD's worker thread whenever one of the stream's requests is
+   done. */
+static void stream_done(fs_aio_t *req, void *data) {
+    (void)data;
+
+    if(req->result < 0) {
+        stream_error = req->error;
+    }
+    else {
+        stream_sum += checksum(req->buf, req->result);
+        stream_bytes += req->result;
+    }
+
+    /* A full chunk means there may be more to come, so put the request
+       straight back in line for the next one. */
+    if(req->result == CHUNK_SIZE && !stream_error &&
+       !fs_aio_read(req, stream_fd, req->buf, CHUNK_SIZE, stream_done, NULL))
+        return;
+
+    --stream_active;
+}
+
+static int find_largest(char *path, size_t len) {
+    dirent_t *ent;
+    file_t d;
+    int size = -1;
+
+    if((d = fs_open("/cd", O_RDONLY | O_DIR)) < 0)
+        return -1;
+
+    while((ent = fs_readdir(d))) {
+        if(!(ent->attr & O_DIR) && ent->size > size) {
+            size = ent->size;
+            snprintf(path, len, "/cd/%s", ent->name);
+        }
+    }
+
+    fs_close(d);
+    return size;
+}
+
+static void test_cancel(const char *path) {
+    fs_aio_t req = { 0 };
+    file_t fd;
+
+    if((fd = fs_open(path, O_RDONLY)) < 0)
+        return;
+
+    /* This goes to the back of the CD's queue, behind the stream. */
+    fs_aio_read(&req, fd, check_buf, SMALL_SIZE, NULL, NULL);
+
+    if(fs_aio_cancel(&req)) {
+        printf("cancel: couldn't cancel: %s\n", strerror(errno));
+    }
+    else if(fs_aio_wait(&req) < 0 && errno == ECANCELED) {
+        printf("cancel: finished with ECANCELED, file position %ld\n",
+               (long)fs_tell(fd));
+    }
+    else {
+        printf("cancel: wasn't canceled!\n");
+    }
+
+    fs_close(fd);
+}
+
+static void test_fallback(const char *path) {
+    fs_aio_t req = { 0 };
+    ssize_t rv;
+    file_t fd;
+
+    if((fd = fs_open(path, O_RDONLY)) < 0)
+        return;
+
+    /* Misaligned, so the ISO9660 code turns it down with ENOTSUP and the VFS
+       does a normal read instead. */
+    fs_aio_read(&req, fd, small_buf + 1, SMALL_SIZE, NULL, NULL);
+    rv = fs_aio_wait(&req);
+
+    fs_seek(fd, 0, SEEK_SET);
+    fs_read(fd, check_buf, SMALL_SIZE);
+    fs_close(fd);
+
+    if(rv < 0)
+        printf("fallback: failed: %s\n", strerror(errno));
+    else
+        printf("fallback: read %d bytes from an unaligned buffer, %s\n",
+               (int)rv, memcmp(small_buf + 1, check_buf, rv) ? "MISMATCH" :
+               "matches");
+}
+
+static void test_ram(void) {
+    fs_aio_t req = { 0 };
+    uint64_t start, end;
+    ssize_t rv;
+    file_t fd;
+    int i;
+
+    for(i = 0; i < SMALL_SIZE; ++i)
+        small_buf[i] = i * 7;
+
+    if((fd = fs_open("/ram/aio.bin", O_RDWR | O_CREAT | O_TRUNC)) < 0) {
+        printf("ram: can't create the file\n");
+        return;
+    }
+
+    start = timer_us_gettime64();
+
+    fs_aio_write(&req, fd, small_buf, SMALL_SIZE, NULL, NULL);
+    rv = fs_aio_wait(&req);
+
+    if(rv == SMALL_SIZE) {
+        fs_seek(fd, 0, SEEK_SET);
+        fs_aio_read(&req, fd, check_buf, SMALL_SIZE, NULL, NULL);
+        rv = fs_aio_wait(&req);
+    }
+
+    end = timer_us_gettime64();
+
+    printf("ram: write and read back %s in %lu us, %d CD requests still "
+           "going\n", rv == SMALL_SIZE &&
+           !memcmp(small_buf, check_buf, SMALL_SIZE) ? "matches" : "FAILED",
+           (unsigned long)(end - start), stream_active);
+
+    fs_close(fd);
+    fs_unlink("/ram/aio.bin");
+}
+
+static void verify_stream(const char *path) {
+    uint32_t sum = 0, bytes = 0;
+    ssize_t rv;
+    file_t fd;
+
+    if((fd = fs_open(path, O_RDONLY)) < 0)
+        return;
+
+    while((rv = fs_read(fd, stream_bufs[0], CHUNK_SIZE)) > 0) {
+        sum += checksum(stream_bufs[0], rv);
+        bytes += rv;
+    }
+
+    fs_close(fd);
+
+    printf("verify: %lu bytes normally, %lu streamed, %s\n",
+           (unsigned long)bytes, (unsigned long)stream_bytes,
+           bytes == stream_bytes && sum == stream_sum ? "same data" :
+           "MISMATCH");
+}
+
+KOS_INIT_FLAGS(INIT_DEFAULT);
+
+int main(int argc, char *argv[]) {
+    char path[NAME_MAX + 8];
+    uint64_t start, end;
+    uint32_t frames = 0;
+    int size, i;
+
+    (void)argc;
+    (void)argv;
+
+    /* Exit if the user presses all buttons at once. */
+    cont_btn_callback(0, CONT_START | CONT_A | CONT_B | CONT_X | CONT_Y,
+                      (cont_btn_callback_t)arch_exit);
+
+    printf("KallistiOS asynchronous I/O example\n");
+
+    if((size = find_largest(path, sizeof(path))) <= 0) {
+        printf("No files found in /cd\n");
+        return 1;
+    }
+
+    if((stream_fd = fs_open(path, O_RDONLY)) < 0) {
+        printf("Can't open %s\n", path);
+        return 1;
+    }
+
+    printf("Streaming %s (%d bytes)\n", path, size);
+
+    start = timer_ms_gettime64();
+    stream_active = REQUESTS;
+
+    for(i = 0; i < REQUESTS; ++i) {
+        if(fs_aio_read(&stream_reqs[i], stream_fd, stream_bufs[i], CHUNK_SIZE,
+                       stream_done, NULL)) {
+            printf("Can't start the stream: %s\n", strerror(errno));
+            return 1;
+        }
+    }
+
+    test_cancel(path);
+    test_fallback(path);
+    test_ram();
+
+    /* Stand-in for a game's main loop: the stream keeps going in the
+       background between frames. */
+    while(stream_active) {
+        thd_sleep(FRAME_MS);
+
+        if(!(++frames % 60))
+            printf("frame %lu: %lu bytes streamed\n", (unsigned long)frames,
+                   (unsigned long)stream_bytes);
+    }
+
+    end = timer_ms_gettime64();
+
+    if(stream_error)
+        printf("Stream failed: %s\n", strerror(stream_error));
+
+    printf("Streamed %lu bytes in %lu ms (%lu KB/s), %lu frames meanwhile\n",
+           (unsigned long)stream_bytes, (unsigned long)(end - start),
+           (unsigned long)(end > start ? stream_bytes / (end - start) : 0),
+           (unsigned long)frames);
+
+    fs_close(stream_fd);
+    verify_stream(path);
+
+    printf("Done!\n");
+    return 0;
+}
@@ -0,0 +1,193 @@
+/* KallistiOS ##version##
+
+   sd-fatseek.c
+   Copyright (C) 2024 The KallistiOS Team
+
+   This example measures how long seeking around in a large file takes on a
+   FAT filesystem on an SD card, which mostly comes down to how fast fs_fat
+   can find the cluster a given offset is in.
+
+   It mounts the first partition of the SD card on /sd, creates a test file of
+   FILE_MB megabytes on it (if one isn't already there from an earlier run),
+   then times reading 4 bytes at a time from random offsets. The first pass
+   over the file is where each file handle builds its map of the cluster
+   chain, so it is timed separately from the ones after it. The last test
+   jumps back and forth between the start and end of the file, which used to
+   mean walking the whole cluster chain from the start on every backwards
+   seek.
+
+   The card must be formatted FAT16 or FAT32 with an MBR partition table, and
+   the test file is left on it afterwards.
+*/
+
+#include <stdio.h>
+#include <errno.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include <dc/sd.h>
+#include <dc/maple.h>
+#include <dc/maple/controller.h>
+
+#include <arch/arch.h>
+#include <arch/timer.h>
+
+#include <kos/init.h>
+#include <kos/dbgio.h>
+#include <kos/blockdev.h>
+
+#include <fat/fs_fat.h>
+
+KOS_INIT_FLAGS(INIT_DEFAULT);
+
+#define FILE_MB     64
+#define FILE_SIZE   (FILE_MB * 1024 * 1024)
+#define TEST_FILE   "/sd/fatseek.bin"
+#define SEEKS       2000
+
+static uint32_t buf[16384] __attribute__((aligned(32)));
+
+static void __attribute__((__noreturn__)) wait_exit(void) {
+    maple_device_t *dev;
+    cont_state_t *state;
+
+    printf("Press any button to exit.\n");
+
+    for(;;) {
+        dev = maple_enum_type(0, MAPLE_FUNC_CONTROLLER);
+
+        if(dev) {
+            state = (cont_state_t *)maple_dev_status(dev);
+
+            if(state)   {
+                if(state->buttons)
+                    arch_exit();
+            }
+        }
+    }
+}
+
+/* Each word of the file holds its own index, so reads can be checked. */
+static int make_file(void) {
+    struct stat st;
+    uint32_t i, j;
+    int fd;
+
+    if(!stat(TEST_FILE, &st) && st.st_size == FILE_SIZE)
+        return 0;
+
+    printf("Writing a %d MB test file, this will take a while...\n", FILE_MB);
+
+    if((fd = open(TEST_FILE, O_WRONLY | O_CREAT | O_TRUNC)) < 0)
+        return -1;
+
+    for(i = 0; i < FILE_SIZE / 4; i += 16384) {
+        for(j = 0; j < 16384; ++j)
+            buf[j] = i + j;
+
+        if(write(fd, buf, sizeof(buf)) != (ssize_t)sizeof(buf)) {
+            close(fd);
+            return -1;
+        }
+    }
+
+    close(fd);
+    return 0;
+}
+
+static uint32_t rnd_state = 12345;
+
+static uint32_t rnd(void) {
+    rnd_state ^= rnd_state << 13;
+    rnd_state ^= rnd_state >> 17;
+    rnd_state ^= rnd_state << 5;
+    return rnd_state;
+}
+
+/* Time SEEKS seeks and reads. If pingpong is set, alternate between the
+   first and last sixteenth of the file, rather than going anywhere. */
+static int run_seeks(int fd, const char *name, int pingpong) {
+    uint64_t start, us;
+    uint32_t word, val;
+    int i, bad = 0;
+
+    start = timer_us_gettime64();
+
+    for(i = 0; i < SEEKS; ++i) {
+        word = rnd() % (FILE_SIZE / 4);
+
+        if(pingpong)
+            word = (i & 1) ? FILE_SIZE / 4 - 1 - word / 16 : word / 16;
+
+        if(lseek(fd, word * 4, SEEK_SET) < 0 ||
+           read(fd, &val, 4) != 4) {
+            printf("Seek to %lu failed: %s\n", (unsigned long)word * 4,
+                   strerror(errno));
+            return -1;
+        }
+
+        if(val != word)
+            ++bad;
+    }
+
+    us = timer_us_gettime64() - start;
+
+    printf("%-12s %5d seeks in %6lu ms, %5lu us per seek%s\n", name, SEEKS,
+           (unsigned long)(us / 1000), (unsigned long)(us / SEEKS),
+           bad ? ", DATA MISMATCH" : "");
+    return 0;
+}
+
+int main(int argc, char *argv[]) {
+    kos_blockdev_t sd_dev;
+    uint8_t pt;
+    int fd;
+
+    dbgio_dev_select("fb");
+
+    if(sd_init()) {
+        printf("Could not initialize the SD card. Please make sure that you "
+               "have an SD card adapter plugged in and an SD card inserted.\n");
+        wait_exit();
+    }
+
+    /* Grab the block device for the first partition on the SD card. Note that
+       you must have the SD card formatted with an MBR partitioning scheme. */
+    if(sd_blockdev_for_partition(0, &sd_dev, &pt)) {
+        printf("Could not find the first partition on the SD card!\n");
+        wait_exit();
+    }
+
+    if(fs_fat_init() ||
+       fs_fat_mount("/sd", &sd_dev, FS_FAT_MOUNT_READWRITE)) {
+        printf("Could not mount the SD card as FAT!\n");
+        wait_exit();
+    }
+
+    if(make_file()) {
+        printf("Could not write %s: %s\n", TEST_FILE, strerror(errno));
+        goto out;
+    }
+
+    /* Start with a fresh handle, so that it has no map of its clusters. */
+    if((fd = open(TEST_FILE, O_RDONLY)) < 0) {
+        printf("Could not open %s: %s\n", TEST_FILE, strerror(errno));
+        goto out;
+    }
+
+    if(!run_seeks(fd, "first pass", 0) && !run_seeks(fd, "random", 0))
+        run_seeks(fd, "start/end", 1);
+
+    close(fd);
+
+out:
+    fs_fat_unmount("/sd");
+    fs_fat_shutdown();
+    sd_shutdown();
+    wait_exit();
+    return 0;
+}
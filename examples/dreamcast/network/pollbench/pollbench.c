@@ -0,0 +1,243 @@
+/* KallistiOS ##version##
+
+   pollbench.c
+   Copyright (C) 2024 The KallistiOS Team
+
+*/
+
+/* This program measures how the cost of waiting for network events grows
+   with the number of sockets being watched. It opens a number of UDP sockets
+   on the loopback address, then repeatedly has a datagram sent to a random one
+   and waits for it to show up, first with poll() and then with epoll_wait().
+   poll() has to look at every socket on every call, while epoll only has to
+   look at the ones that have something to report.
+
+   The datagrams are sent by a thread of lower priority than the main one, so
+   it only gets to run once the main thread has gone to sleep waiting. That
+   way each round goes through the whole of going to sleep and being woken
+   up, rather than finding the datagram already there. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <poll.h>
+
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include <kos/thread.h>
+#include <kos/sem.h>
+
+#include <arch/arch.h>
+#include <arch/timer.h>
+#include <dc/maple.h>
+#include <dc/maple/controller.h>
+
+#define ROUNDS          2000
+#define BASE_PORT       6000
+#define MAX_SOCKS       512
+
+static const int counts[] = { 1, 16, 64, 256, MAX_SOCKS };
+
+static int socks[MAX_SOCKS];
+static struct pollfd pfds[MAX_SOCKS];
+static int sender;
+
+/* Socket for the sender thread to send to next, or -1 to make it exit. */
+static volatile int target;
+static semaphore_t go = SEM_INITIALIZER(0);
+
+static inline uint32_t rnd(uint32_t *seed) {
+    /* xorshift32 */
+    *seed ^= *seed << 13;
+    *seed ^= *seed >> 17;
+    *seed ^= *seed << 5;
+    return *seed;
+}
+
+static int send_to(int idx) {
+    struct sockaddr_in addr;
+    char c = 'x';
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(BASE_PORT + idx);
+    addr.sin_addr.s_addr = inet_addr("127.0.0.1");
+
+    return sendto(sender, &c, 1, 0, (struct sockaddr *)&addr, sizeof(addr));
+}
+
+static void *sender_thd(void *param) {
+    (void)param;
+
+    for(;;) {
+        sem_wait(&go);
+
+        if(target < 0)
+            break;
+
+        send_to(target);
+    }
+
+    return NULL;
+}
+
+/* Have the sender thread send a datagram once we're waiting for it. */
+static void queue_send(int idx) {
+    target = idx;
+    sem_signal(&go);
+}
+
+/* Wait with poll(), and read whatever came in. */
+static int wait_poll(int n) {
+    char c;
+    int i, got = 0;
+
+    if(poll(pfds, n, -1) <= 0)
+        return 0;
+
+    for(i = 0; i < n; ++i) {
+        if(pfds[i].revents & POLLIN) {
+            recv(socks[i], &c, 1, 0);
+            ++got;
+        }
+    }
+
+    return got;
+}
+
+/* Wait with epoll_wait(), and read whatever came in. */
+static int wait_epoll(int epfd) {
+    struct epoll_event ev[8];
+    char c;
+    int i, rv;
+
+    if((rv = epoll_wait(epfd, ev, 8, -1)) <= 0)
+        return 0;
+
+    for(i = 0; i < rv; ++i)
+        recv(ev[i].data.fd, &c, 1, 0);
+
+    return rv;
+}
+
+static void run_bench(int n) {
+    struct epoll_event ev;
+    uint64_t start, poll_ns, epoll_ns;
+    uint32_t seed = 0x1234567;
+    int i, epfd, got;
+
+    for(i = 0; i < n; ++i) {
+        pfds[i].fd = socks[i];
+        pfds[i].events = POLLIN;
+    }
+
+    got = 0;
+    start = timer_ns_gettime64();
+
+    for(i = 0; i < ROUNDS; ++i) {
+        queue_send(rnd(&seed) % n);
+        got += wait_poll(n);
+    }
+
+    poll_ns = timer_ns_gettime64() - start;
+
+    if(got != ROUNDS)
+        printf("poll() missed %d events!\n", ROUNDS - got);
+
+    if((epfd = epoll_create1(0)) < 0) {
+        perror("epoll_create1");
+        return;
+    }
+
+    for(i = 0; i < n; ++i) {
+        ev.events = EPOLLIN;
+        ev.data.fd = socks[i];
+        epoll_ctl(epfd, EPOLL_CTL_ADD, socks[i], &ev);
+    }
+
+    got = 0;
+    start = timer_ns_gettime64();
+
+    for(i = 0; i < ROUNDS; ++i) {
+        queue_send(rnd(&seed) % n);
+        got += wait_epoll(epfd);
+    }
+
+    epoll_ns = timer_ns_gettime64() - start;
+
+    if(got != ROUNDS)
+        printf("epoll_wait() missed %d events!\n", ROUNDS - got);
+
+    close(epfd);
+
+    printf("%4d sockets: poll %6llu ns/event, epoll %6llu ns/event\n", n,
+           poll_ns / ROUNDS, epoll_ns / ROUNDS);
+}
+
+KOS_INIT_FLAGS(INIT_DEFAULT | INIT_NET);
+
+int main(int argc, char *argv[]) {
+    kthread_attr_t attr = { 0 };
+    kthread_t *thd;
+    struct sockaddr_in addr;
+    size_t i;
+    int n = 0;
+
+    /* Exit if the user presses all buttons at once. */
+    cont_btn_callback(0, CONT_START | CONT_A | CONT_B | CONT_X | CONT_Y,
+                      (cont_btn_callback_t)arch_exit);
+
+    printf("KallistiOS poll/epoll scaling benchmark\n\n");
+
+    if((sender = socket(AF_INET, SOCK_DGRAM, 0)) < 0) {
+        perror("socket");
+        return EXIT_FAILURE;
+    }
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = inet_addr("127.0.0.1");
+
+    for(n = 0; n < MAX_SOCKS; ++n) {
+        if((socks[n] = socket(AF_INET, SOCK_DGRAM, 0)) < 0)
+            break;
+
+        addr.sin_port = htons(BASE_PORT + n);
+
+        if(bind(socks[n], (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+            close(socks[n]);
+            break;
+        }
+    }
+
+    if(n < MAX_SOCKS)
+        printf("Could only open %d sockets\n\n", n);
+
+    attr.prio = PRIO_DEFAULT + 1;
+    attr.label = "sender";
+
+    if(!(thd = thd_create_ex(&attr, sender_thd, NULL))) {
+        printf("Couldn't start the sender thread\n");
+        return EXIT_FAILURE;
+    }
+
+    for(i = 0; i < sizeof(counts) / sizeof(counts[0]); ++i) {
+        if(counts[i] <= n)
+            run_bench(counts[i]);
+    }
+
+    queue_send(-1);
+    thd_join(thd, NULL);
+
+    while(n--)
+        close(socks[n]);
+
+    close(sender);
+
+    printf("\nDone!\n");
+    return 0;
+}
@@ -0,0 +1,187 @@
+/* KallistiOS ##version##
+
+   udpbench.c
+   Copyright (C) 2024 The KallistiOS Team
+
+*/
+
+/* This program measures how fast UDP datagrams of a few different sizes make
+   it through the network stack, by sending them to itself over the loopback
+   address. Datagrams bigger than the MTU are fragmented and reassembled along
+   the way. Along with the rate, it reports how many times (and how many bytes)
+   the stack had to copy packet data per datagram, from the packet buffer
+   statistics. Each size is run once a datagram at a time, with sendto() and
+   recv(), and once in batches, with sendmmsg() and recvmmsg(). */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include <kos/net.h>
+
+#include <arch/arch.h>
+#include <arch/timer.h>
+#include <dc/maple.h>
+#include <dc/maple/controller.h>
+
+#define PACKETS         5120    /* A multiple of BATCH */
+#define BENCH_PORT      5150
+#define MAX_SIZE        8192
+#define BATCH           16
+
+static const size_t sizes[] = { 16, 512, 1472, 4096, MAX_SIZE };
+
+static uint8_t sbuf[MAX_SIZE], rbuf[BATCH][MAX_SIZE];
+
+static void report(const char *how, size_t size, int ok, uint64_t ns,
+                   const net_pbuf_stats_t *before,
+                   const net_pbuf_stats_t *after) {
+    unsigned long copies, bytes;
+
+    copies = after->copies - before->copies;
+    bytes = after->bytes_copied - before->bytes_copied;
+
+    printf("%5u bytes, %s: %5d ok, %7llu pkt/s, %6llu KB/s, "
+           "%lu.%02lu copies (%lu bytes) per packet\n", (unsigned)size, how,
+           ok, ns ? ok * 1000000000ULL / ns : 0,
+           ns ? ok * size * 1000000ULL / ns : 0,
+           copies / PACKETS, copies * 100 / PACKETS % 100, bytes / PACKETS);
+}
+
+static void run_bench(int sock, const struct sockaddr_in *addr, size_t size) {
+    net_pbuf_stats_t before, after;
+    uint64_t start, ns;
+    int i, ok = 0;
+
+    before = net_pbuf_get_stats();
+    start = timer_ns_gettime64();
+
+    /* Loopback traffic is delivered before sendto() returns, so there's
+       always a datagram waiting once it has. */
+    for(i = 0; i < PACKETS; ++i) {
+        if(sendto(sock, sbuf, size, 0, (const struct sockaddr *)addr,
+                  sizeof(*addr)) != (ssize_t)size)
+            break;
+
+        if(recv(sock, rbuf[0], sizeof(rbuf[0]), 0) == (ssize_t)size)
+            ++ok;
+    }
+
+    ns = timer_ns_gettime64() - start;
+    after = net_pbuf_get_stats();
+
+    report("single", size, ok, ns, &before, &after);
+
+    if(memcmp(sbuf, rbuf[0], size))
+        printf("       data mismatch!\n");
+}
+
+static void run_batch(int sock, const struct sockaddr_in *addr, size_t size) {
+    struct mmsghdr smsg[BATCH], rmsg[BATCH];
+    struct iovec siov[BATCH], riov[BATCH];
+    net_pbuf_stats_t before, after;
+    uint64_t start, ns;
+    int i, j, n, ok = 0;
+
+    memset(smsg, 0, sizeof(smsg));
+    memset(rmsg, 0, sizeof(rmsg));
+
+    for(i = 0; i < BATCH; ++i) {
+        siov[i].iov_base = sbuf;
+        siov[i].iov_len = size;
+        smsg[i].msg_hdr.msg_iov = &siov[i];
+        smsg[i].msg_hdr.msg_iovlen = 1;
+        smsg[i].msg_hdr.msg_name = (void *)addr;
+        smsg[i].msg_hdr.msg_namelen = sizeof(*addr);
+
+        riov[i].iov_base = rbuf[i];
+        riov[i].iov_len = sizeof(rbuf[i]);
+        rmsg[i].msg_hdr.msg_iov = &riov[i];
+        rmsg[i].msg_hdr.msg_iovlen = 1;
+    }
+
+    before = net_pbuf_get_stats();
+    start = timer_ns_gettime64();
+
+    for(i = 0; i < PACKETS; i += BATCH) {
+        if(sendmmsg(sock, smsg, BATCH, 0) != BATCH)
+            break;
+
+        /* Everything sent is already queued, so this only comes up short if
+           some of it got lost along the way. */
+        for(j = 0; j < BATCH; j += n) {
+            if((n = recvmmsg(sock, rmsg, BATCH - j, MSG_DONTWAIT, NULL)) <= 0)
+                break;
+
+            while(n--) {
+                if(rmsg[n].msg_len == size)
+                    ++ok;
+            }
+        }
+    }
+
+    ns = timer_ns_gettime64() - start;
+    after = net_pbuf_get_stats();
+
+    report("batch ", size, ok, ns, &before, &after);
+
+    for(i = 0; i < BATCH; ++i) {
+        if(memcmp(sbuf, rbuf[i], size)) {
+            printf("       data mismatch!\n");
+            break;
+        }
+    }
+}
+
+KOS_INIT_FLAGS(INIT_DEFAULT | INIT_NET);
+
+int main(int argc, char *argv[]) {
+    struct sockaddr_in addr;
+    net_pbuf_stats_t st;
+    size_t i;
+    int sock;
+
+    /* Exit if the user presses all buttons at once. */
+    cont_btn_callback(0, CONT_START | CONT_A | CONT_B | CONT_X | CONT_Y,
+                      (cont_btn_callback_t)arch_exit);
+
+    printf("KallistiOS UDP loopback benchmark\n\n");
+
+    for(i = 0; i < sizeof(sbuf); ++i)
+        sbuf[i] = (uint8_t)(i * 7);
+
+    if((sock = socket(AF_INET, SOCK_DGRAM, 0)) < 0) {
+        perror("socket");
+        return EXIT_FAILURE;
+    }
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(BENCH_PORT);
+    addr.sin_addr.s_addr = inet_addr("127.0.0.1");
+
+    if(bind(sock, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+        perror("bind");
+        close(sock);
+        return EXIT_FAILURE;
+    }
+
+    for(i = 0; i < sizeof(sizes) / sizeof(sizes[0]); ++i) {
+        run_bench(sock, &addr, sizes[i]);
+        run_batch(sock, &addr, sizes[i]);
+    }
+
+    close(sock);
+
+    st = net_pbuf_get_stats();
+    printf("\nPacket buffers: %lu allocated (%lu failed), %lu in use, "
+           "%lu clones\n", st.allocs, st.alloc_failed, st.in_use, st.clones);
+
+    printf("\nDone!\n");
+    return 0;
+}
@@ -0,0 +1,232 @@
+/* KallistiOS ##version##
+
+   kos/blockcache.h
+   Copyright (C) 2024 The KallistiOS Team
+*/
+
+/** \file    kos/blockcache.h
+    \brief   Write-back block cache for block device based filesystems.
+    \ingroup vfs_blockcache
+
+    This file contains the interface to a simple write-back cache of fixed-size
+    blocks that is shared by the various filesystems that sit on top of a
+    kos_blockdev_t (such as ext2 and FAT). Blocks are found by way of a hash
+    table keyed on the block number and are evicted in least recently used
+    order, so both lookups and replacement are constant time regardless of how
+    large the cache is made.
+
+    The cache does not do any I/O on its own. Instead, the filesystem provides
+    a pair of callbacks that read and write a single block, which lets each
+    filesystem keep its own idea of what a "block" is (a FAT cluster, an ext2
+    block, a single sector of the FAT, etc).
+
+    The cache does not do any locking internally. The filesystem using it is
+    responsible for serializing access to it. A block can be pinned, though, so
+    that its data can be used without holding the filesystem's lock.
+*/
+
+#ifndef __KOS_BLOCKCACHE_H
+#define __KOS_BLOCKCACHE_H
+
+#include <sys/cdefs.h>
+__BEGIN_DECLS
+
+#include <stdint.h>
+#include <stddef.h>
+
+/** \defgroup vfs_blockcache    Block Cache
+    \brief                      Write-back block cache for filesystems
+    \ingroup                    vfs_blockdev
+
+    @{
+*/
+
+/** \brief  Block cache read callback type.
+
+    Read a single block from the backing store into the buffer provided.
+
+    \param  ctx         The context pointer given at cache creation.
+    \param  block       The block number to read.
+    \param  buf         The buffer to read into (one block in size).
+    \retval 0           On success.
+    \retval -errno      On failure.
+*/
+typedef int (*blockcache_read_t)(void *ctx, uint32_t block, uint8_t *buf);
+
+/** \brief  Block cache write callback type.
+
+    Write a single block from the buffer provided to the backing store.
+
+    \param  ctx         The context pointer given at cache creation.
+    \param  block       The block number to write.
+    \param  buf         The buffer to write from (one block in size).
+    \retval 0           On success.
+    \retval -errno      On failure.
+*/
+typedef int (*blockcache_write_t)(void *ctx, uint32_t block,
+                                  const uint8_t *buf);
+
+/** \brief  Opaque block cache type. */
+typedef struct kos_blockcache kos_blockcache_t;
+
+/** \brief  Block cache statistics.
+
+    These counters are cumulative from the creation of the cache (or the last
+    call to blockcache_reset_stats()).
+
+    \headerfile kos/blockcache.h
+*/
+typedef struct blockcache_stats {
+    uint32_t hits;          /**< \brief Lookups satisfied from the cache */
+    uint32_t misses;        /**< \brief Lookups that required a read */
+    uint32_t evictions;     /**< \brief Valid blocks pushed out of the cache */
+    uint32_t writebacks;    /**< \brief Dirty blocks written to the device */
+    uint32_t entries;       /**< \brief Number of blocks the cache holds */
+    uint32_t dirty;         /**< \brief Number of blocks currently dirty */
+} blockcache_stats_t;
+
+/** \brief  Create a block cache.
+
+    \param  entries     The number of blocks to cache.
+    \param  block_size  The size of each block, in bytes.
+    \param  rd          The callback used to read a block.
+    \param  wr          The callback used to write a block (may be NULL for a
+                        read-only cache).
+    \param  ctx         Context pointer passed to the callbacks.
+    \return             The new cache, or NULL if out of memory.
+*/
+kos_blockcache_t *blockcache_create(int entries, size_t block_size,
+                                    blockcache_read_t rd,
+                                    blockcache_write_t wr, void *ctx);
+
+/** \brief  Destroy a block cache.
+
+    This does NOT write back any dirty blocks. Call blockcache_writeback() first
+    if that is needed.
+
+    \param  c           The cache to destroy.
+*/
+void blockcache_destroy(kos_blockcache_t *c);
+
+/** \brief  Look up a block, reading it in if it is not already cached.
+
+    The returned pointer remains valid until the block is evicted from the
+    cache, which will not happen before at least (entries - 1) other blocks,
+    less however many are pinned, are looked up.
+
+    \param  c           The cache to look in.
+    \param  block       The block number to look up.
+    \param  err         Set to a positive errno value on error.
+    \return             The block's data, or NULL on error.
+*/
+uint8_t *blockcache_read(kos_blockcache_t *c, uint32_t block, int *err);
+
+/** \brief  Look up a block and keep it in the cache until it is unpinned.
+
+    This works like blockcache_read(), except that the block will not be
+    evicted until blockcache_unpin() is called on it, however many other blocks
+    are looked up in the meantime. This lets a filesystem copy the data out of
+    the block without holding its lock for the duration of the copy. Pins
+    nest, and each one must be undone by a call to blockcache_unpin(). Other
+    lookups fail with EBUSY if every block in the cache is pinned.
+
+    \param  c           The cache to look in.
+    \param  block       The block number to look up.
+    \param  err         Set to a positive errno value on error.
+    \return             The block's data, or NULL on error.
+*/
+uint8_t *blockcache_pin(kos_blockcache_t *c, uint32_t block, int *err);
+
+/** \brief  Unpin a block pinned by blockcache_pin().
+
+    \param  c           The cache the block is in.
+    \param  data        The pointer that blockcache_pin() returned.
+*/
+void blockcache_unpin(kos_blockcache_t *c, const uint8_t *data);
+
+/** \brief  Check if a block is in the cache, without doing any I/O.
+
+    This does not count as a use of the block for the purposes of replacement,
+    nor does it count as a hit or a miss. It is intended for filesystems that
+    read data directly from the device into a user buffer, bypassing the cache,
+    to make sure they do not miss out on any newer data in the cache.
+
+    \param  c           The cache to look in.
+    \param  block       The block number to look up.
+    \return             The block's data, or NULL if it is not cached.
+*/
+uint8_t *blockcache_lookup(kos_blockcache_t *c, uint32_t block);
+
+/** \brief  Get a cache entry for a block without reading it from the device.
+
+    This is useful when the caller is about to overwrite the whole block. The
+    block is marked dirty. If it was already cached, its contents are returned
+    untouched, otherwise the contents of the buffer are undefined.
+
+    \param  c           The cache to look in.
+    \param  block       The block number to look up.
+    \param  err         Set to a positive errno value on error.
+    \return             The block's data, or NULL on error.
+*/
+uint8_t *blockcache_claim(kos_blockcache_t *c, uint32_t block, int *err);
+
+/** \brief  Add a block to the cache from data the caller already has.
+
+    This is intended for filesystems that read several blocks from the device
+    in one go (for read-ahead, for instance). The block is added as clean. If
+    the block is already in the cache, the cached copy is left alone, as it is
+    at least as new as the data given.
+
+    \param  c           The cache to add to.
+    \param  block       The block number of the data.
+    \param  data        The block's data (one block in size).
+    \retval 0           On success.
+    \retval -errno      On failure (from writing back an evicted block).
+*/
+int blockcache_insert(kos_blockcache_t *c, uint32_t block,
+                      const uint8_t *data);
+
+/** \brief  Mark a cached block as dirty.
+
+    \param  c           The cache to look in.
+    \param  block       The block number to mark.
+    \retval 0           On success.
+    \retval -EINVAL     If the block is not in the cache.
+*/
+int blockcache_mark_dirty(kos_blockcache_t *c, uint32_t block);
+
+/** \brief  Write all dirty blocks in the cache back to the device.
+
+    \param  c           The cache to write back.
+    \retval 0           On success.
+    \retval -errno      On failure (from the write callback).
+*/
+int blockcache_writeback(kos_blockcache_t *c);
+
+/** \brief  Throw away everything in the cache.
+
+    This does NOT write back any dirty blocks. It is intended for removable
+    media that have been changed.
+
+    \param  c           The cache to empty.
+*/
+void blockcache_invalidate(kos_blockcache_t *c);
+
+/** \brief  Retrieve the statistics for a block cache.
+
+    \param  c           The cache to query.
+    \param  st          Storage for the statistics.
+*/
+void blockcache_get_stats(const kos_blockcache_t *c, blockcache_stats_t *st);
+
+/** \brief  Reset the hit/miss/eviction/writeback counters of a block cache.
+
+    \param  c           The cache to reset.
+*/
+void blockcache_reset_stats(kos_blockcache_t *c);
+
+/** @} */
+
+__END_DECLS
+
+#endif /* !__KOS_BLOCKCACHE_H */
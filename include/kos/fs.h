@@ -56,8 +56,9 @@ typedef struct kos_dirent {
     uint32 attr;            /**< \brief Attributes of the file. */
 } dirent_t;
 
-/* Forward declaration */
+/* Forward declarations */
 struct vfs_handler;
+struct fs_aio;
 
 /* stat_t.unique */
 /** \brief stat_t.unique: Constant to use denoting file has no unique ID */
@@ -204,6 +205,17 @@ typedef struct vfs_handler {
 
     /** \brief Get status information on an already opened file. */
     int (*fstat)(void *hnd, struct stat *st);
+
+    /** \brief Start an asynchronous read or write (see kos/fs_aio.h)
+
+        This is called on the filesystem's own asynchronous I/O worker thread,
+        so a transfer that blocks here only holds up other requests on the
+        same filesystem. Return 0 if the request was accepted, and call
+        fs_aio_complete() when it is done (which may be before this returns).
+        Return -1 with errno set to ENOTSUP to have the request done through
+        the normal read or write function, or to anything else to fail the
+        request. */
+    int (*aio_submit)(void *hnd, struct fs_aio *req);
 } vfs_handler_t;
 
 /** \cond */
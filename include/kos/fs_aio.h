@@ -0,0 +1,211 @@
+/* KallistiOS ##version##
+
+   kos/fs_aio.h
+   Copyright (C) 2024 The KallistiOS Team
+*/
+
+/** \file    kos/fs_aio.h
+    \brief   Asynchronous file I/O.
+    \ingroup vfs_aio
+
+    This file contains the interface to the asynchronous I/O layer of the VFS.
+    Asynchronous requests let a program start a read or a write on a file and
+    go on with other work (rendering the next frame, for instance) while the
+    transfer happens, then either poll the request, wait for it, or be called
+    back when it finishes.
+
+    Each filesystem gets a worker thread of its own, started the first time a
+    request is made on one of its files, which processes the requests on that
+    filesystem in the order they were submitted. Requests on different
+    filesystems (the CD and an SD card, say) don't wait on each other.
+    Filesystems that can do better than a plain read or write (by using DMA
+    directly into the caller's buffer, for instance) may provide an aio_submit
+    function in their vfs_handler_t. For everything else, the worker simply
+    calls the normal read or write function of the filesystem, so every file
+    can be used with this interface.
+
+    Each request reads or writes at the current position of the file, and
+    moves it forward just like fs_read() and fs_write() would. Don't mix
+    asynchronous requests on a file with other operations on the same file
+    that depend on its position (reads, writes or seeks) while any requests on
+    it are still outstanding.
+*/
+
+#ifndef __KOS_FS_AIO_H
+#define __KOS_FS_AIO_H
+
+#include <sys/cdefs.h>
+__BEGIN_DECLS
+
+#include <sys/types.h>
+#include <kos/fs.h>
+#include <kos/worker_thread.h>
+
+/** \defgroup vfs_aio   Asynchronous I/O
+    \brief              Asynchronous reads and writes of files
+    \ingroup            vfs
+
+    @{
+*/
+
+/** \name   Request operations
+    @{
+*/
+#define FS_AIO_READ     0       /**< \brief Read from the file */
+#define FS_AIO_WRITE    1       /**< \brief Write to the file */
+/** @} */
+
+/** \name   Request states
+    @{
+*/
+#define FS_AIO_IDLE     0       /**< \brief Never submitted */
+#define FS_AIO_PENDING  1       /**< \brief Waiting to be started */
+#define FS_AIO_RUNNING  2       /**< \brief Transfer in progress */
+#define FS_AIO_DONE     3       /**< \brief Finished (or canceled) */
+/** @} */
+
+struct fs_aio;
+
+/** \brief  Asynchronous I/O completion callback type.
+
+    The callback is run on the asynchronous I/O worker thread once the request
+    has finished and has been marked as done. The callback is free to resubmit
+    or free the request. It should not block for long, as no other requests
+    on the same filesystem are processed while it runs.
+
+    \param  req         The request that finished.
+    \param  data        The data pointer given when the request was submitted.
+*/
+typedef void (*fs_aio_callback_t)(struct fs_aio *req, void *data);
+
+/** \brief  Asynchronous I/O request.
+
+    The storage for each request is provided by the caller, and must remain
+    valid until the request is done. Set all of it to zero before first use,
+    and use fs_aio_read() or fs_aio_write() to fill it in and submit it.
+
+    \headerfile kos/fs_aio.h
+*/
+typedef struct fs_aio {
+    int op;                     /**< \brief FS_AIO_READ or FS_AIO_WRITE */
+    void *buf;                  /**< \brief Buffer to transfer to/from */
+    size_t cnt;                 /**< \brief Number of bytes to transfer */
+    fs_aio_callback_t callback; /**< \brief Completion callback (or NULL) */
+    void *data;                 /**< \brief Data passed to the callback */
+
+    /** \brief  State of the request (see the request states above). */
+    volatile int state;
+
+    /** \brief  Result of the transfer, as fs_read() or fs_write() would have
+                returned it. Only valid once the request is done. */
+    ssize_t result;
+
+    /** \brief  Error code of the transfer, if result is -1. ECANCELED if the
+                request was canceled before it started. */
+    int error;
+
+    /** \cond */
+    /* Private to the VFS. */
+    file_t fd;
+    kthread_job_t job;
+    kthread_worker_t *worker;
+    /** \endcond */
+} fs_aio_t;
+
+/** \brief  Start an asynchronous read.
+
+    \param  req         The request to submit. It must not be pending or
+                        running already.
+    \param  fd          The file to read from.
+    \param  buf         The buffer to read into.
+    \param  cnt         The number of bytes to read.
+    \param  cb          The function to call on completion (may be NULL).
+    \param  data        Data pointer to pass to the callback.
+    \retval 0           On success.
+    \retval -1          On error, errno will be set as appropriate.
+
+    \par    Error Conditions:
+    \em     EBADF - fd is not a valid file descriptor \n
+    \em     EBUSY - the request is already pending or running \n
+    \em     ENOMEM - the worker thread could not be started \n
+    \em     EMFILE - no file descriptors left
+*/
+int fs_aio_read(fs_aio_t *req, file_t fd, void *buf, size_t cnt,
+                fs_aio_callback_t cb, void *data);
+
+/** \brief  Start an asynchronous write.
+
+    \param  req         The request to submit. It must not be pending or
+                        running already.
+    \param  fd          The file to write to.
+    \param  buf         The buffer to write from.
+    \param  cnt         The number of bytes to write.
+    \param  cb          The function to call on completion (may be NULL).
+    \param  data        Data pointer to pass to the callback.
+    \retval 0           On success.
+    \retval -1          On error, errno will be set as appropriate.
+
+    \par    Error Conditions:
+    \em     EBADF - fd is not a valid file descriptor \n
+    \em     EBUSY - the request is already pending or running \n
+    \em     ENOMEM - the worker thread could not be started \n
+    \em     EMFILE - no file descriptors left
+*/
+int fs_aio_write(fs_aio_t *req, file_t fd, const void *buf, size_t cnt,
+                 fs_aio_callback_t cb, void *data);
+
+/** \brief  Check on the progress of a request without blocking.
+
+    \param  req         The request to check.
+    \return             The state of the request (FS_AIO_PENDING,
+                        FS_AIO_RUNNING or FS_AIO_DONE).
+*/
+int fs_aio_status(const fs_aio_t *req);
+
+/** \brief  Wait for a request to finish.
+
+    Don't wait on a request that is freed from its completion callback.
+
+    \param  req         The request to wait on.
+    \return             The result of the request. If it is -1, errno is set
+                        to the error code of the request.
+*/
+ssize_t fs_aio_wait(fs_aio_t *req);
+
+/** \brief  Cancel a request.
+
+    Only requests that haven't been started yet can be canceled. A canceled
+    request is finished as usual (including running its callback), with a
+    result of -1 and an error of ECANCELED.
+
+    \param  req         The request to cancel.
+    \retval 0           On success.
+    \retval -1          On error, errno will be set as appropriate.
+
+    \par    Error Conditions:
+    \em     EBUSY - the transfer has already been started \n
+    \em     EINVAL - the request is not pending
+*/
+int fs_aio_cancel(fs_aio_t *req);
+
+/** \brief  Finish a request started by a filesystem's aio_submit function.
+
+    This is for use by filesystems only. It may be called from an interrupt
+    handler, and may be called before aio_submit returns.
+
+    \param  req         The request that finished.
+    \param  rv          The result of the transfer.
+    \param  err         The errno value for the transfer, if rv is -1.
+*/
+void fs_aio_complete(fs_aio_t *req, ssize_t rv, int err);
+
+/** \cond */
+/* Stop the worker thread. Called by fs_shutdown(). */
+void fs_aio_shutdown(void);
+/** \endcond */
+
+/** @} */
+
+__END_DECLS
+
+#endif /* !__KOS_FS_AIO_H */
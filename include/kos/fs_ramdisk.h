@@ -46,7 +46,10 @@ int fs_ramdisk_shutdown(void);
     This function takes a block of memory and associates it with a file on the
     ramdisk. This memory should be allocated with malloc(), as an unlink() of
     the file will call free on the block of memory. The ramdisk then effectively
-    takes control of the block, and is responsible for it at that point.
+    takes control of the block, and is responsible for it at that point. The
+    block is not copied. If the file is written past its end later on, the
+    new data goes into separate chunks of memory, so the block itself is never
+    reallocated.
 
     \param  fn              The name to give the new file
     \param  obj             The block of memory to associate
@@ -60,7 +63,9 @@ int fs_ramdisk_attach(const char * fn, void * obj, size_t size);
 
     This function retrieves the block of memory associated with the file,
     removing it from the ramdisk. You are responsible for freeing obj when you
-    are done with it.
+    are done with it. If the file is still the block it was attached with, that
+    block is handed back as-is. Otherwise, the data is copied into a new block
+    allocated with malloc().
 
     \param  fn              The name of the file to look for.
     \param  obj             A pointer to return the address of the object in.
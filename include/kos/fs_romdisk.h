@@ -33,6 +33,14 @@
     ROMFS image must be kept below 16MB, with 14MB being the maximum recommended size, 
     as your binary will also reside in RAM and you need to leave some memory available
     for it. Generating files larger than the available RAM will lead to system crashes.
+
+    To save memory, files can be stored compressed in the image by passing -z to
+    genromfs (add it to KOS_GENROMFS_FLAGS in your Makefile to do that for the
+    embedded romdisk). Compressed files are split into blocks (8KB by default,
+    see -Z) that are decompressed as they are read, through a small cache of
+    FS_ROMDISK_ZCACHE_BLOCKS blocks per image. They can be read and seeked in
+    like any other file, but cannot be mmapped. Use -U to leave files that you
+    want to mmap uncompressed.
     
     A romdisk filesystem image can be created by adding "KOS_ROMDISK_DIR=" to your Makefile
     and pointing it to the directory contaning all the resources you wish to have embeded in
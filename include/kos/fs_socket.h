@@ -378,6 +378,60 @@ typedef struct fs_socket_proto {
                             currently true in the socket. 0 if none are true.
     */
     short (*poll)(net_socket_t *s, short events);
+
+    /** \brief  Input a packet held in packet buffers into a protocol.
+
+        This is optional, and works just like the input function, except that
+        the packet is passed as a chain of packet buffers, so that the protocol
+        can hold on to it with net_pbuf_clone() rather than copying it. If this
+        is NULL, the input function is used instead.
+
+        \param  src         The interface the packet was input on
+        \param  domain      The low-level protocol used (AF_INET or AF_INET6)
+        \param  hdr         The low-level protocol header
+        \param  p           The packet itself, including any protocol headers,
+                            but not any from lower-level protocols. The chain
+                            still belongs to the caller.
+        \param  size        The size of the packet, not including any lower-
+                            level protocol headers
+        \retval -1          On error (the packet is discarded)
+        \retval 0           On success
+    */
+    int (*input_pbuf)(netif_t *src, int domain, const void *hdr, net_pbuf_t *p,
+                      size_t size);
+
+    /** \brief  Receive a batch of messages on a socket.
+
+        This is optional, and backs the ::recvmmsg() function. If this is NULL,
+        ::recvmmsg() fails with EOPNOTSUPP.
+
+        \param  s           The socket to receive on.
+        \param  msgvec      The messages to fill in.
+        \param  vlen        The number of entries in msgvec.
+        \param  flags       Flags for the receive, as for recvfrom().
+        \param  timeout     How long to wait for the first message, in
+                            milliseconds. 0 means forever, unless the socket
+                            or flags say not to block at all.
+        \return             The number of messages received, or -1 on error
+                            (sets errno).
+    */
+    int (*recvmmsg)(net_socket_t *s, struct mmsghdr *msgvec, unsigned int vlen,
+                    int flags, int timeout);
+
+    /** \brief  Send a batch of messages on a socket.
+
+        This is optional, and backs the ::sendmmsg() function. If this is NULL,
+        ::sendmmsg() fails with EOPNOTSUPP.
+
+        \param  s           The socket to send on.
+        \param  msgvec      The messages to send.
+        \param  vlen        The number of entries in msgvec.
+        \param  flags       Flags for the send, as for sendto().
+        \return             The number of messages sent, or -1 on error (sets
+                            errno) if none could be sent.
+    */
+    int (*sendmmsg)(net_socket_t *s, struct mmsghdr *msgvec, unsigned int vlen,
+                    int flags);
 } fs_socket_proto_t;
 
 /** \brief   Initializer for the entry field in the fs_socket_proto_t struct. 
@@ -450,6 +504,29 @@ net_socket_t *fs_socket_open_sock(fs_socket_proto_t *proto);
 int fs_socket_input(netif_t *src, int domain, int protocol, const void *hdr,
                     const uint8 *data, size_t size);
 
+/** \brief   Input a packet held in packet buffers into some socket family
+             handler.
+    \ingroup vfs_sockets
+
+    This works just like fs_socket_input(), but passes the packet along as a
+    chain of packet buffers. If the protocol handler doesn't take those, the
+    chain is put into one piece for it.
+
+    \param  src         The network interface the packet came in on
+    \param  domain      The low-level protocol used (AF_INET or AF_INET6)
+    \param  protocol    The upper-level protocol that we're looking for
+    \param  hdr         The low-level protocol header
+    \param  p           The upper-level packet, without any lower-level protocol
+                        headers, but with the upper-level ones intact
+    \param  size        The size of the packet (the data in p)
+
+    \retval -2          The protocol is not known
+    \retval -1          Protocol-level error processing packet
+    \retval 0           On success
+*/
+int fs_socket_input_pbuf(netif_t *src, int domain, int protocol,
+                         const void *hdr, net_pbuf_t *p, size_t size);
+
 /** \brief   Add a new protocol for use with fs_socket.
     \ingroup vfs_sockets
 
@@ -0,0 +1,181 @@
+/* KallistiOS ##version##
+
+   include/kos/jobs.h
+   Copyright (C) 2024 The KallistiOS Team
+*/
+
+/** \file    kos/jobs.h
+    \brief   Job system on top of threaded workers.
+    \ingroup kthreads
+
+    This file contains the interface to a simple job system. A job pool is a
+    fixed set of threaded workers (see kos/worker_thread.h) that run small
+    pieces of work (jobs) as they are submitted. This makes it easy to push
+    things like texture twiddling, audio decoding or file parsing off the main
+    thread without having to manage threads by hand.
+
+    Each worker has its own queue of jobs for each priority lane. Jobs
+    submitted from inside a job go on the queue of the worker running it, and
+    jobs submitted from anywhere else are spread around the workers. A worker
+    that runs out of jobs of its own takes (steals) them from the others.
+    Higher priority lanes are always emptied first, across all of the workers.
+
+    Jobs can be made to wait for others to finish through counters. A counter
+    counts the jobs submitted with it as their "done" counter that haven't
+    finished yet. A job submitted with a counter as its "after" counter is held
+    back until that counter drops to zero. This covers continuations (one job
+    after another), fan-in (one job after many) and fan-out (many jobs after
+    one) without any memory being allocated by the job system.
+
+    \author The KallistiOS Team
+    \see    kos/worker_thread.h
+*/
+
+#ifndef __KOS_JOBS_H
+#define __KOS_JOBS_H
+
+#include <sys/cdefs.h>
+__BEGIN_DECLS
+
+#include <kos/thread.h>
+#include <sys/queue.h>
+
+/** \defgroup jobs  Job System
+    \brief          Job pools with priority lanes and dependencies
+    \ingroup        kthreads
+
+    @{
+*/
+
+/** \name   Priority lanes
+    @{
+*/
+#define KOS_JOB_LANE_HIGH       0   /**< \brief Urgent work (audio decoding) */
+#define KOS_JOB_LANE_NORMAL     1   /**< \brief Normal work (asset loading) */
+#define KOS_JOB_LANE_LOW        2   /**< \brief Background work */
+#define KOS_JOB_LANE_COUNT      3   /**< \brief Number of lanes */
+/** @} */
+
+struct kos_job_pool;
+
+/** \brief   Opaque structure describing a job pool. */
+typedef struct kos_job_pool kos_job_pool_t;
+
+struct kos_job;
+
+/** \brief   Counter of unfinished jobs.
+
+    Initialize with kos_job_counter_init() or KOS_JOB_COUNTER_INITIALIZER
+    before use. A counter must not be reinitialized while it has jobs counted
+    on it, or jobs waiting on it.
+
+    \headerfile kos/jobs.h
+*/
+typedef struct kos_job_counter {
+    /** \brief  Number of unfinished jobs counted. */
+    volatile int count;
+
+    /** \cond */
+    /* Jobs submitted to run once this reaches zero. */
+    SLIST_HEAD(kos_job_waiters, kos_job) waiting;
+    /** \endcond */
+} kos_job_counter_t;
+
+/** \brief  Initializer for a job counter. */
+#define KOS_JOB_COUNTER_INITIALIZER     { 0, { NULL } }
+
+/** \brief   Structure describing one job.
+
+    The storage for each job is provided by the caller, and must remain valid
+    until the job has finished running. Set it up with kos_job_init(). A job
+    may be submitted again once it has finished (including from its own
+    routine).
+
+    \headerfile kos/jobs.h
+*/
+typedef struct kos_job {
+    /** \brief  The function to run. */
+    void (*routine)(void *data);
+
+    /** \brief  User pointer passed to the function. */
+    void *data;
+
+    /** \brief  Priority lane to run the job in. */
+    int lane;
+
+    /** \cond */
+    /* Private to the job system. */
+    kos_job_pool_t *pool;
+    kos_job_counter_t *done;
+    STAILQ_ENTRY(kos_job) entry;
+    SLIST_ENTRY(kos_job) wait_entry;
+    /** \endcond */
+} kos_job_t;
+
+/** \brief   Create a job pool.
+
+    \param  workers         The number of worker threads to start.
+    \param  attr            Attributes for the worker threads (may be NULL).
+                            The label is used as a prefix for each thread's.
+    \return                 The new job pool, or NULL on failure.
+*/
+kos_job_pool_t *kos_job_pool_create(int workers, const kthread_attr_t *attr);
+
+/** \brief   Stop and destroy a job pool.
+
+    This waits for the jobs that are running to finish. Jobs that haven't
+    started yet are dropped, without their counters being updated.
+
+    \param  pool            The job pool to destroy.
+*/
+void kos_job_pool_destroy(kos_job_pool_t *pool);
+
+/** \brief   Initialize a job counter.
+
+    \param  counter         The counter to initialize.
+*/
+void kos_job_counter_init(kos_job_counter_t *counter);
+
+/** \brief   Set up a job.
+
+    \param  job             The job to set up.
+    \param  routine         The function to run.
+    \param  data            The parameter to pass to the function.
+    \param  lane            The priority lane to run the job in.
+*/
+void kos_job_init(kos_job_t *job, void (*routine)(void *), void *data,
+                  int lane);
+
+/** \brief   Submit a job to a pool.
+
+    \param  pool            The job pool to run the job in.
+    \param  job             The job to run.
+    \param  done            Counter to count the job on until it finishes (may
+                            be NULL).
+    \param  after           Counter that has to drop to zero before the job can
+                            start (may be NULL).
+    \retval 0               On success.
+    \retval -1              On error, errno will be set as appropriate.
+
+    \par    Error Conditions:
+    \em     EINVAL - the lane of the job is invalid
+*/
+int kos_job_submit(kos_job_pool_t *pool, kos_job_t *job,
+                   kos_job_counter_t *done, kos_job_counter_t *after);
+
+/** \brief   Wait for a counter to drop to zero.
+
+    If this is called from one of the pool's own workers (from inside a job),
+    the worker runs other jobs of the pool while it waits, so the pool can't
+    run out of workers this way. From any other thread, this simply blocks.
+
+    \param  pool            The job pool the counted jobs run in.
+    \param  counter         The counter to wait on.
+*/
+void kos_job_wait(kos_job_pool_t *pool, kos_job_counter_t *counter);
+
+/** @} */
+
+__END_DECLS
+
+#endif /* __KOS_JOBS_H */
@@ -0,0 +1,174 @@
+/* KallistiOS ##version##
+
+   include/kos/lockstat.h
+   Copyright (C) 2024 The KallistiOS Team
+*/
+
+/** \file    kos/lockstat.h
+    \brief   Lock contention statistics.
+    \ingroup lockstat
+
+    This file contains an interface for finding out which locks in a program
+    are hot. When enabled (with lockstat_enable(), or INIT_LOCK_STATS in
+    KOS_INIT_FLAGS()), mutexes, semaphores, condition variables and
+    reader/writer semaphores keep count of how many times they are acquired,
+    how many of those times the caller had to wait, and how long it waited for.
+    Mutexes and the write side of reader/writer semaphores also keep track of
+    how long they were held.
+
+    \author The KallistiOS Team
+*/
+
+#ifndef __KOS_LOCKSTAT_H
+#define __KOS_LOCKSTAT_H
+
+#include <sys/cdefs.h>
+__BEGIN_DECLS
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include <arch/timer.h>
+
+/** \defgroup lockstat  Lock Statistics
+    \brief              Contention statistics for the locking primitives
+    \ingroup            kthreads
+
+    Statistics are kept in a fixed size table (see LOCKSTAT_MAX_LOCKS), keyed
+    by the address of the lock. An entry is made for a lock the first time it
+    is acquired with statistics enabled, and stays until lockstat_reset() is
+    called, so a lock that is destroyed and another one later created at the
+    same address share their statistics.
+
+    When statistics are disabled, which is the default, all of this costs the
+    locking primitives a single test of a flag.
+
+    @{
+*/
+
+/** \name   Lock types
+    @{
+*/
+#define LOCKSTAT_MUTEX  0   /**< \brief Mutex (including recursive locks) */
+#define LOCKSTAT_SEM    1   /**< \brief Semaphore */
+#define LOCKSTAT_COND   2   /**< \brief Condition variable */
+#define LOCKSTAT_RWSEM  3   /**< \brief Reader/writer semaphore */
+/** @} */
+
+/** \brief   Statistics for one lock.
+
+    For condition variables, each wait counts as a contended acquisition. For
+    the other locks, a timed wait that gives up is counted in timeouts rather
+    than as an acquisition, but the time it spent waiting is still counted.
+
+    \headerfile kos/lockstat.h
+*/
+typedef struct lockstat {
+    const void *lock;       /**< \brief The lock these are for */
+    const char *name;       /**< \brief Name given with lockstat_set_name() */
+    int type;               /**< \brief The type of lock (see above) */
+    uint32_t acquired;      /**< \brief Number of acquisitions */
+    uint32_t contended;     /**< \brief Acquisitions that had to wait */
+    uint32_t timeouts;      /**< \brief Waits that timed out instead */
+    uint64_t wait_ns;       /**< \brief Total time spent waiting */
+    uint64_t max_wait_ns;   /**< \brief Longest single wait */
+    uint64_t hold_ns;       /**< \brief Total time held (mutex and writer) */
+    uint64_t max_hold_ns;   /**< \brief Longest time held in one go */
+
+    /** \cond */
+    uint64_t hold_start;
+    /** \endcond */
+} lockstat_t;
+
+/** \brief   Enable or disable lock statistics.
+
+    The first time statistics are enabled, the table for them is allocated.
+
+    \param  enable          Whether to keep lock statistics.
+    \retval 0               On success.
+    \retval -1              On error, errno will be set as appropriate.
+
+    \par    Error Conditions:
+    \em     ENOMEM - out of memory for the table
+*/
+int lockstat_enable(bool enable);
+
+/** \brief   Give a lock a name to show in the statistics.
+
+    This can be called whether statistics are enabled or not.
+
+    \param  lock            The lock to name.
+    \param  name            The name to give it (the string is not copied), or
+                            NULL to forget the lock's name.
+    \retval 0               On success.
+    \retval -1              On error, errno will be set as appropriate.
+
+    \par    Error Conditions:
+    \em     ENOMEM - out of memory
+*/
+int lockstat_set_name(const void *lock, const char *name);
+
+/** \brief   Retrieve the statistics for a lock.
+
+    \param  lock            The lock to look up.
+    \param  st              Storage for the statistics.
+    \retval 0               On success.
+    \retval -1              If there are no statistics for the lock.
+*/
+int lockstat_get(const void *lock, lockstat_t *st);
+
+/** \brief   Throw away all of the statistics gathered so far. */
+void lockstat_reset(void);
+
+/** \brief   Print the statistics of all locks.
+
+    Locks are listed in order of the total time spent waiting for them, so the
+    most contended ones come first.
+
+    \param  pf              The printf-like function to print with.
+    \retval 0               On success.
+    \retval -1              On error, errno will be set as appropriate.
+
+    \par    Error Conditions:
+    \em     ENOMEM - out of memory
+*/
+int lockstat_print(int (*pf)(const char *fmt, ...));
+
+/** @} */
+
+/** \cond */
+/* Hooks for the locking primitives. These must be called with interrupts
+   disabled. Start timing a wait with lockstat_wait_start(), then pass the
+   result to lockstat_acquire() once the lock is taken (or 0 if there was no
+   wait), or to lockstat_timeout() if the wait timed out. */
+extern bool __lockstat_enabled;
+
+void __lockstat_acquire(const void *lock, int type, uint64_t wait_start);
+void __lockstat_timeout(const void *lock, int type, uint64_t wait_start);
+void __lockstat_release(const void *lock);
+
+static inline uint64_t lockstat_wait_start(void) {
+    return __lockstat_enabled ? timer_ns_gettime64() : 0;
+}
+
+static inline void lockstat_acquire(const void *lock, int type,
+                                    uint64_t wait_start) {
+    if(__lockstat_enabled)
+        __lockstat_acquire(lock, type, wait_start);
+}
+
+static inline void lockstat_timeout(const void *lock, int type,
+                                    uint64_t wait_start) {
+    if(__lockstat_enabled)
+        __lockstat_timeout(lock, type, wait_start);
+}
+
+static inline void lockstat_release(const void *lock) {
+    if(__lockstat_enabled)
+        __lockstat_release(lock);
+}
+/** \endcond */
+
+__END_DECLS
+
+#endif /* __KOS_LOCKSTAT_H */
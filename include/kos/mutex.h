@@ -45,6 +45,13 @@
     There is a fourth type of mutex defined (MUTEX_TYPE_DEFAULT), which maps to
     the MUTEX_TYPE_NORMAL type. This is simply for alignment with POSIX.
 
+    All types of mutexes use priority inheritance. While a thread is blocked on
+    a mutex, the thread holding it runs at the blocked thread's priority (if
+    that is higher than its own). If the holder is itself blocked on another
+    mutex, the holder of that one is boosted too, and so on down the chain. A
+    thread's priority only drops back once it has released every mutex that
+    higher priority threads are waiting on.
+
     \author Lawrence Sebald
     \see    kos/sem.h
 */
@@ -70,6 +77,7 @@ typedef struct kos_mutex {
     int dynamic;
     kthread_t *holder;
     int count;
+    kthread_pi_t pi;
 } mutex_t;
 
 /** \name  Mutex types
@@ -90,13 +98,16 @@ typedef struct kos_mutex {
 /** @} */
 
 /** \brief  Initializer for a transient mutex. */
-#define MUTEX_INITIALIZER               { MUTEX_TYPE_NORMAL, 0, NULL, 0 }
+#define MUTEX_INITIALIZER \
+    { MUTEX_TYPE_NORMAL, 0, NULL, 0, KTHREAD_PI_INITIALIZER }
 
 /** \brief  Initializer for a transient error-checking mutex. */
-#define ERRORCHECK_MUTEX_INITIALIZER    { MUTEX_TYPE_ERRORCHECK, 0, NULL, 0 }
+#define ERRORCHECK_MUTEX_INITIALIZER \
+    { MUTEX_TYPE_ERRORCHECK, 0, NULL, 0, KTHREAD_PI_INITIALIZER }
 
 /** \brief  Initializer for a transient recursive mutex. */
-#define RECURSIVE_MUTEX_INITIALIZER     { MUTEX_TYPE_RECURSIVE, 0, NULL, 0 }
+#define RECURSIVE_MUTEX_INITIALIZER \
+    { MUTEX_TYPE_RECURSIVE, 0, NULL, 0, KTHREAD_PI_INITIALIZER }
 
 /** \brief  Allocate a new mutex.
 
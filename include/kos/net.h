@@ -42,6 +42,9 @@ __BEGIN_DECLS
     \ingroup                        networking
 */
 
+/* Defined below, with the rest of the packet buffer functions. */
+struct net_pbuf;
+
 /** \brief   Structure describing one usable network device.
     \ingroup networking_drivers
 
@@ -181,6 +184,24 @@ typedef struct knetif {
         \param  count       The number of addresses in list.
     */
     int (*if_set_mc)(struct knetif *self, const uint8 *list, int count);
+
+    /** \brief  Queue a chain of packet buffers for transmission.
+
+        This is optional. If a driver provides it, outgoing packets are handed
+        to it as a chain of buffers (headers first, then the data from the
+        socket layer) and the driver is expected to gather them into its
+        transmit buffer itself. Otherwise, the chain is copied into one buffer
+        and sent with if_tx().
+
+        \param  self        The network device in question.
+        \param  chain       The packet to transmit.
+        \param  blocking    1 if we should block if needed, 0 otherwise.
+        \retval NETIF_TX_OK     On success.
+        \retval NETIF_TX_ERROR  On general failure.
+        \retval NETIF_TX_AGAIN  If non-blocking and we must block to send.
+    */
+    int (*if_tx_pbuf)(struct knetif *self, const struct net_pbuf *chain,
+                      int blocking);
 } netif_t;
 
 /** \defgroup net_drivers_flags netif_t Flags
@@ -375,6 +396,163 @@ int net_arp_input(netif_t *nif, const uint8 *pkt, int len);
 int net_arp_query(netif_t *nif, const uint8 ip[4]);
 
 
+/***** net_pbuf.c *********************************************************/
+
+/** \defgroup networking_pbuf   Packet Buffers
+    \brief                      Reference counted buffers for packet data
+    \ingroup                    networking
+
+    Packets are passed through the stack as chains of packet buffers, so that
+    headers can be added and stripped and fragments put back together without
+    copying the data around. Each buffer in a chain either has its own storage,
+    shares the storage of another buffer (in which case that buffer stays
+    around until everything using it is freed), or points at memory that
+    belongs to someone else and is only valid until the function it was passed
+    to returns.
+
+    Anything that wants to hold on to a packet it was given (a socket queueing
+    it for a later recv(), say) takes a clone of it with net_pbuf_clone(), which
+    only copies the data that it has no other way of keeping.
+
+    Device drivers that receive packets into buffers from net_pbuf_alloc() can
+    pass them up with net_input_pbuf(), and drivers that can gather a chain
+    into their transmit buffer should set the if_tx_pbuf() member of their
+    netif_t.
+
+    @{
+*/
+
+/** \brief   A packet buffer.
+
+    Only the first four members should be touched outside of net_pbuf.c, and
+    only by the owner of the chain.
+
+    \headerfile kos/net.h
+*/
+typedef struct net_pbuf {
+    struct net_pbuf *next;      /**< \brief Next buffer in the chain */
+    uint8 *data;                /**< \brief Data in this buffer */
+    size_t len;                 /**< \brief Length of data in this buffer */
+    size_t tot_len;             /**< \brief Length of this and later buffers */
+    uint16 ref;                 /**< \brief Reference count */
+    uint16 flags;               /**< \brief Type of buffer */
+    struct net_pbuf *owner;     /**< \brief Buffer whose storage we share */
+} net_pbuf_t;
+
+/** \brief   Packet buffer statistics structure.
+
+    \headerfile kos/net.h
+*/
+typedef struct net_pbuf_stats {
+    uint32  allocs;             /**< \brief Buffers allocated with storage */
+    uint32  alloc_failed;       /**< \brief Allocations that failed */
+    uint32  in_use;             /**< \brief Buffers with storage in use */
+    uint32  clones;             /**< \brief Buffers shared instead of copied */
+    uint32  copies;             /**< \brief Buffers copied within the stack */
+    uint32  bytes_copied;       /**< \brief Bytes copied within the stack */
+} net_pbuf_stats_t;
+
+/** \brief   Allocate a packet buffer.
+
+    The buffer is allocated from a pool if it fits in an Ethernet frame, and
+    from the heap otherwise.
+
+    \param  len             The amount of data the buffer should hold.
+    \return                 The new buffer, or NULL if out of memory.
+*/
+net_pbuf_t *net_pbuf_alloc(size_t len);
+
+/** \brief   Make a packet buffer that points at existing memory.
+
+    The memory is not copied, so it must stay valid for as long as the buffer
+    is in use. The stack will copy it if it needs to keep it any longer than
+    the call it was passed to.
+
+    \param  data            The data for the buffer.
+    \param  len             The length of the data.
+    \return                 The new buffer, or NULL if out of memory.
+*/
+net_pbuf_t *net_pbuf_wrap(const void *data, size_t len);
+
+/** \brief   Free a chain of packet buffers.
+
+    This drops a reference to each buffer in the chain. The storage of each
+    one is released once nothing else refers to it.
+
+    \param  p               The chain to free. NULL is ignored.
+*/
+void net_pbuf_free(net_pbuf_t *p);
+
+/** \brief   Append one chain of packet buffers to another.
+
+    \param  head            The chain to append to.
+    \param  tail            The chain to append. This now belongs to head.
+*/
+void net_pbuf_cat(net_pbuf_t *head, net_pbuf_t *tail);
+
+/** \brief   Strip data from the front of a chain of packet buffers.
+
+    Buffers that end up empty are skipped over, but stay in the chain, so the
+    original head must still be used to free it.
+
+    \param  p               The chain to strip data from.
+    \param  len             The number of bytes to strip.
+    \return                 The first buffer that still has data in it (or
+                            the last one, if none do), or NULL if the chain
+                            holds less than len bytes.
+*/
+net_pbuf_t *net_pbuf_pull(net_pbuf_t *p, size_t len);
+
+/** \brief   Take a copy of part of a chain of packet buffers that can be kept.
+
+    Buffers with their own storage are shared with the new chain instead of
+    being copied. Only data that belongs to someone else is copied.
+
+    \param  p               The chain to copy.
+    \param  off             Where to start in the chain.
+    \param  len             How many bytes to take.
+    \return                 The new chain, or NULL on error (out of memory,
+                            or p holds less than off + len bytes).
+*/
+net_pbuf_t *net_pbuf_clone(const net_pbuf_t *p, size_t off, size_t len);
+
+/** \brief   Copy data out of a chain of packet buffers.
+
+    \param  p               The chain to copy from.
+    \param  off             Where to start in the chain.
+    \param  buf             The buffer to copy into.
+    \param  len             The maximum number of bytes to copy.
+    \return                 The number of bytes copied.
+*/
+size_t net_pbuf_copy_out(const net_pbuf_t *p, size_t off, void *buf,
+                         size_t len);
+
+/** \brief   Get all of the data in a chain of packet buffers in one piece.
+
+    If there's only one buffer in the chain, this just returns its data.
+    Otherwise the data is copied into a new buffer, which is stored in copy
+    and has to be freed with net_pbuf_free() once the data isn't needed any
+    more. Freeing it is harmless when no copy was made, as copy is set to NULL
+    then.
+
+    \param  p               The chain to look at.
+    \param  copy            Where to store the buffer holding the copy.
+    \return                 A pointer to the data, or NULL if a copy was
+                            needed and there was no memory for it.
+
+    \par   Error Conditions:
+    \em    ENOMEM - out of memory
+*/
+const uint8 *net_pbuf_flatten(const net_pbuf_t *p, net_pbuf_t **copy);
+
+/** \brief   Retrieve statistics about packet buffers.
+
+    \return                 The net_pbuf_stats_t structure.
+*/
+net_pbuf_stats_t net_pbuf_get_stats(void);
+
+/** @} */
+
 /***** net_input.c *********************************************************/
 
 /** \brief   Network input callback type.
@@ -408,6 +586,21 @@ extern net_input_func net_input_target;
 */
 int net_input(netif_t *device, const uint8 *data, int len);
 
+/** \brief   Submit a received packet held in packet buffers.
+    \ingroup networking_drivers
+
+    This works just like net_input(), but lets the stack hold on to the packet
+    without copying it. The Ethernet header must be in the first buffer of the
+    chain. The chain still belongs to the caller, who should free it once this
+    returns.
+
+    \param  device          The network device submitting packets.
+    \param  p               The packet to submit.
+
+    \return                 0 on success, <0 on failure.
+*/
+int net_input_pbuf(netif_t *device, net_pbuf_t *p);
+
 /** \brief   Setup a network input target.
     \ingroup networking_drivers
 
@@ -60,6 +60,13 @@ __BEGIN_DECLS
    serious issues. */
 /* #define KM_DBG_VERBOSE 1 */
 
+/* Enable this define to give each thread a small cache of freed blocks, which
+   malloc(), calloc() and free() can use without taking the global malloc lock.
+   This helps programs that allocate and free lots of small objects from
+   several threads (C++ programs, in particular). See the MALLOC_TCACHE_*
+   limits below. It has no effect when KM_DBG is enabled. */
+/* #define MALLOC_TCACHE 1 */
+
 
 /* The following three macros are similar to the ones above, but for the PVR
    memory pool malloc. */
@@ -119,11 +126,47 @@ __BEGIN_DECLS
 #define FS_CD_MAX_FILES 8
 #endif
 
+/** \brief  The default number of sectors in the cd data cache.
+
+    This can be changed at runtime with fs_iso9660_set_cache().
+*/
+#ifndef FS_CD_CACHE_BLOCKS
+#define FS_CD_CACHE_BLOCKS 32
+#endif
+
+/** \brief  The default maximum number of sectors to read ahead on the cd.
+
+    This can be changed at runtime with fs_iso9660_set_cache().
+*/
+#ifndef FS_CD_READAHEAD
+#define FS_CD_READAHEAD 8
+#endif
+
 /** \brief  The maximum number of romdisk files that can be open at a time. */
 #ifndef FS_ROMDISK_MAX_FILES
 #define FS_ROMDISK_MAX_FILES 16
 #endif
 
+/** \brief  The minimum number of objects for a romdisk to be indexed.
+
+    When a romdisk image is mounted without an index made by genromfs -I, an
+    index of its paths is built if it has at least this many files and
+    directories. Set to 0 to never build one.
+*/
+#ifndef FS_ROMDISK_INDEX_MIN
+#define FS_ROMDISK_INDEX_MIN 64
+#endif
+
+/** \brief  The number of decompressed blocks cached per compressed romdisk.
+
+    Each mounted romdisk image that has compressed files in it (see genromfs
+    -z) gets a cache of this many decompressed blocks, allocated the first time
+    one of its compressed files is opened.
+*/
+#ifndef FS_ROMDISK_ZCACHE_BLOCKS
+#define FS_ROMDISK_ZCACHE_BLOCKS 4
+#endif
+
 /** \brief  The maximum number of ramdisk files that can be open at a time. */
 #ifndef FS_RAMDISK_MAX_FILES
 #define FS_RAMDISK_MAX_FILES 8
@@ -136,6 +179,49 @@ __BEGIN_DECLS
 #define FD_SETSIZE 1024
 #endif
 
+/** \brief  The maximum number of locks lock statistics are kept for.
+
+    Statistics for any locks beyond this are dropped. This must be a power of
+    two. See kos/lockstat.h.
+*/
+#ifndef LOCKSTAT_MAX_LOCKS
+#define LOCKSTAT_MAX_LOCKS 256
+#endif
+
+/** \brief  The smallest slab size used by object caches.
+
+    Caches of larger objects use bigger slabs, so that each slab holds at least
+    a few objects. This must be a power of two. See kos/slab.h.
+*/
+#ifndef KMEM_SLAB_SIZE
+#define KMEM_SLAB_SIZE 4096
+#endif
+
+/** \brief  The largest request served from the per-thread malloc caches.
+
+    Only used when MALLOC_TCACHE is defined.
+*/
+#ifndef MALLOC_TCACHE_MAX_SIZE
+#define MALLOC_TCACHE_MAX_SIZE 512
+#endif
+
+/** \brief  The number of freed blocks of each size a thread's malloc cache
+            holds on to.
+
+    Only used when MALLOC_TCACHE is defined.
+*/
+#ifndef MALLOC_TCACHE_COUNT
+#define MALLOC_TCACHE_COUNT 8
+#endif
+
+/** \brief  The most memory, in bytes, a thread's malloc cache holds on to.
+
+    Only used when MALLOC_TCACHE is defined.
+*/
+#ifndef MALLOC_TCACHE_MAX_BYTES
+#define MALLOC_TCACHE_MAX_BYTES 16384
+#endif
+
 /** @} */
 
 __END_DECLS
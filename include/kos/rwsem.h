@@ -20,6 +20,11 @@
     a reader either (since the reader might attempt to read while the writer is
     changing data).
 
+    The thread holding the write lock inherits the priority of any higher
+    priority thread blocked on the semaphore, just like with a mutex (see
+    kos/mutex.h). Readers are not tracked individually, so they do not inherit
+    priority from a blocked writer.
+
     \author Lawrence Sebald
 */
 
@@ -52,10 +57,13 @@ typedef struct rw_semaphore {
 
     /** \brief  Space for one reader who's trying to upgrade to a writer. */
     kthread_t *reader_waiting;
+
+    /** \brief  Priority inheritance state for the write lock. */
+    kthread_pi_t pi;
 } rw_semaphore_t;
 
 /** \brief  Initializer for a transient reader/writer semaphore */
-#define RWSEM_INITIALIZER   { 0, 0, NULL, NULL }
+#define RWSEM_INITIALIZER   { 0, 0, NULL, NULL, KTHREAD_PI_INITIALIZER }
 
 /** \brief  Allocate a reader/writer semaphore.
 
@@ -0,0 +1,161 @@
+/* KallistiOS ##version##
+
+   include/kos/slab.h
+   Copyright (C) 2024 The KallistiOS Team
+*/
+
+/** \file    kos/slab.h
+    \brief   Slab allocator for fixed size objects.
+    \ingroup slab
+
+    This file contains the interface to the slab allocator. An object cache
+    hands out objects of one size, carved out of larger blocks of memory
+    (slabs) that it gets from malloc(). Objects are allocated and freed by
+    popping them off and pushing them back on a free list, which is a lot
+    quicker than going through malloc() and free(), needs no locks beyond
+    disabling interrupts for a moment, and keeps long lived objects of the same
+    kind together instead of scattered around the heap.
+
+    The kernel uses object caches for its own fixed size objects, like thread
+    control blocks, file handles and TCP sockets. Programs are free to create
+    their own for anything they allocate a lot of.
+
+    \author The KallistiOS Team
+*/
+
+#ifndef __KOS_SLAB_H
+#define __KOS_SLAB_H
+
+#include <sys/cdefs.h>
+__BEGIN_DECLS
+
+#include <stddef.h>
+#include <stdint.h>
+
+/** \defgroup slab  Slab Allocator
+    \brief          Caches of fixed size objects
+    \ingroup        system_allocator
+
+    @{
+*/
+
+/** \brief   Object constructor.
+
+    A constructor is called on each object once, when the slab it is in is
+    allocated, not on each kmem_cache_alloc(). Objects are expected to be in
+    their constructed state when they are given back with kmem_cache_free(),
+    so that expensive setup (initializing locks, say) only happens once.
+
+    \param  obj             The object to construct.
+*/
+typedef void (*kmem_ctor_t)(void *obj);
+
+/** \brief   Object cache.
+
+    This is an opaque type. Create one with kmem_cache_create().
+*/
+typedef struct kmem_cache kmem_cache_t;
+
+/** \brief   Object cache statistics.
+
+    \headerfile kos/slab.h
+*/
+typedef struct kmem_cache_stats {
+    const char *name;       /**< \brief Name of the cache */
+    size_t obj_size;        /**< \brief Size of each object (with padding) */
+    size_t slab_size;       /**< \brief Size of each slab */
+    size_t objs_per_slab;   /**< \brief Number of objects in each slab */
+    size_t slabs;           /**< \brief Number of slabs allocated */
+    size_t empty_slabs;     /**< \brief Slabs with no objects in use */
+    size_t active;          /**< \brief Objects in use */
+    size_t max_active;      /**< \brief Most objects in use at once */
+    uint32_t allocs;        /**< \brief Calls to kmem_cache_alloc() */
+    uint32_t frees;         /**< \brief Calls to kmem_cache_free() */
+    uint32_t grows;         /**< \brief Slabs allocated over time */
+    uint32_t shrinks;       /**< \brief Slabs released over time */
+    uint32_t failures;      /**< \brief Allocations that ran out of memory */
+} kmem_cache_stats_t;
+
+/** \brief   Create an object cache.
+
+    \param  name            A name for the cache, for the statistics. The
+                            string is not copied.
+    \param  size            The size of each object.
+    \param  align           The alignment of each object, or 0 for the
+                            default (8 bytes). Must be a power of two.
+    \param  ctor            Constructor for the objects, or NULL for none.
+    \return                 The new cache, or NULL on error (errno will be
+                            set as appropriate).
+
+    \par    Error Conditions:
+    \em     EINVAL - size is 0, or align is not a power of two \n
+    \em     ENOMEM - out of memory
+*/
+kmem_cache_t *kmem_cache_create(const char *name, size_t size, size_t align,
+                                kmem_ctor_t ctor);
+
+/** \brief   Destroy an object cache.
+
+    All of the memory the cache has is given back, so any objects still in
+    use are lost.
+
+    \param  cache           The cache to destroy.
+*/
+void kmem_cache_destroy(kmem_cache_t *cache);
+
+/** \brief   Allocate an object from a cache.
+
+    A new slab is allocated if the cache has no free objects left. If that
+    fails, all caches are shrunk and the allocation tried again.
+
+    \param  cache           The cache to allocate from.
+    \return                 The object, or NULL if out of memory (errno will be
+                            set to ENOMEM).
+*/
+void *kmem_cache_alloc(kmem_cache_t *cache);
+
+/** \brief   Give an object back to its cache.
+
+    This never calls free(), so it is safe to use in an interrupt handler.
+    Slabs that end up empty are kept around for later allocations until the
+    cache is shrunk.
+
+    \param  cache           The cache the object came from.
+    \param  obj             The object to free. NULL is ignored.
+*/
+void kmem_cache_free(kmem_cache_t *cache, void *obj);
+
+/** \brief   Release the empty slabs of a cache.
+
+    \param  cache           The cache to shrink.
+    \return                 The number of bytes given back to malloc().
+*/
+size_t kmem_cache_shrink(kmem_cache_t *cache);
+
+/** \brief   Release the empty slabs of all caches.
+
+    This is called automatically when a cache can't grow, but programs might
+    also want to call it before a big allocation, or when changing levels.
+
+    \return                 The number of bytes given back to malloc().
+*/
+size_t kmem_cache_reap(void);
+
+/** \brief   Retrieve the statistics of a cache.
+
+    \param  cache           The cache to look at.
+    \param  st              Storage for the statistics.
+*/
+void kmem_cache_get_stats(kmem_cache_t *cache, kmem_cache_stats_t *st);
+
+/** \brief   Print the statistics of all caches.
+
+    \param  pf              The printf-like function to print with.
+*/
+void kmem_cache_print_stats(int (*pf)(const char *fmt, ...));
+
+/** @} */
+
+__END_DECLS
+
+#endif /* __KOS_SLAB_H */
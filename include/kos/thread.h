@@ -177,7 +177,11 @@ typedef __attribute__((aligned(32))) struct kthread {
     TAILQ_ENTRY(kthread) thdq;
 
     /** \brief  Timer queue handle (if applicable). Also not a function. */
-    TAILQ_ENTRY(kthread) timerq;
+    struct {
+        struct kthread *child;  /**< \brief First child in the heap */
+        struct kthread *next;   /**< \brief Next sibling in the heap */
+        struct kthread *prev;   /**< \brief Previous sibling, or parent */
+    } timerq;
 
     /** \brief  Kernel thread id. */
     tid_t tid;
@@ -188,6 +192,22 @@ typedef __attribute__((aligned(32))) struct kthread {
     /** \brief  Static priority: 0..PRIO_MAX (higher means lower priority). */
     prio_t real_prio;
 
+    /** \brief  Run queue bucket the thread is on, if queued. */
+    int queue_bucket;
+
+    /** \brief  Priority inheriting locks held by the thread.
+
+        The thread's dynamic priority is the best of its static priority and
+        the priorities of all threads blocked on these locks.
+    */
+    LIST_HEAD(kthread_pi_list, kthread_pi) pi_held;
+
+    /** \brief  Priority inheriting lock the thread is blocked on, if any. */
+    struct kthread_pi *pi_blocked;
+
+    /** \brief  Entry in the list of threads blocked on pi_blocked. */
+    LIST_ENTRY(kthread) pi_waitq;
+
     /** \brief  Thread flags. */
     kthread_flags_t flags;
 
@@ -229,6 +249,12 @@ typedef __attribute__((aligned(32))) struct kthread {
         uint64_t total;     /**< \brief total running CPU time for thread */
     } cpu_time;
 
+    /** \brief Per-Thread context switch counts. */
+    struct {
+        uint32_t voluntary;   /**< \brief times the thread blocked or yielded */
+        uint32_t involuntary; /**< \brief times the thread was preempted */
+    } switches;
+
     /** \brief  Thread label.
 
         This value is used when printing out a user-readable process listing.
@@ -269,6 +295,34 @@ typedef __attribute__((aligned(32))) struct kthread {
     void *rv;
 } kthread_t;
 
+/** \brief   Priority inheritance state of a lock.
+
+    This is embedded in the locks that support priority inheritance (mutex_t,
+    and thereby recursive_lock_t, and rw_semaphore_t for its writer). While a
+    thread holds one of these locks, it runs at the priority of the highest
+    priority thread blocked on it, if that is better than its own. This
+    carries on down the chain: if the holder is itself blocked on another such
+    lock, the holder of that one gets the boost too.
+
+    All zeroes is a valid, unowned state, so static initializers of the locks
+    don't need to mention it.
+
+    \headerfile kos/thread.h
+*/
+typedef struct kthread_pi {
+    /** \brief  The thread that inherits priority from the waiters. */
+    kthread_t *owner;
+
+    /** \brief  Entry in the owner's list of held locks. */
+    LIST_ENTRY(kthread_pi) held;
+
+    /** \brief  Threads blocked on the lock. */
+    LIST_HEAD(kthread_pi_waiters, kthread) waiters;
+} kthread_pi_t;
+
+/** \brief  Initializer for the priority inheritance state of a lock. */
+#define KTHREAD_PI_INITIALIZER  { NULL, { NULL, NULL }, { NULL } }
+
 /** \brief   Thread creation attributes.
 
     This structure allows you to specify the various attributes for a thread to
@@ -387,6 +441,23 @@ void thd_add_to_runnable(kthread_t *t, bool front_of_line);
 */
 int thd_remove_from_runnable(kthread_t *thd);
 
+/** \cond */
+/* Priority inheritance hooks for the lock implementations. All of these must
+   be called with interrupts disabled. */
+
+/* Make thd the owner of a lock. */
+void thd_pi_acquire(kthread_pi_t *pi, kthread_t *thd);
+
+/* The owner (if any) lets go of a lock. */
+void thd_pi_release(kthread_pi_t *pi);
+
+/* The current thread is about to block on a lock. */
+void thd_pi_block(kthread_pi_t *pi);
+
+/* A thread is done being blocked on a lock (it got it, timed out, etc). */
+void thd_pi_unblock(kthread_t *thd);
+/** \endcond */
+
 /** \brief       Create a new thread.
     \relatesalso kthread_t
 
@@ -680,6 +751,25 @@ int thd_set_hz(unsigned int hertz);
 */
 unsigned thd_get_hz(void);
 
+/** \brief   Enable or disable tickless scheduling.
+
+    Normally, the scheduler interrupt happens at the frequency set with
+    thd_set_hz(), no matter what. In tickless mode, the scheduler interrupt
+    only happens when it is needed: at the end of the current thread's time
+    slice if another thread of the same (or higher) priority is waiting to
+    run, and when a timed wait (such as thd_sleep()) is due. This cuts down on
+    interrupts when one thread has the CPU to itself, such as in a typical
+    render loop.
+
+    Timed waits are woken up on time in either mode.
+
+    \param  enable          True to enable tickless mode, false to disable.
+    \return                 The previous setting.
+
+    \sa thd_set_hz()
+*/
+int thd_set_tickless(bool enable);
+
 /** \brief       Wait for a thread to exit.
     \relatesalso kthread_t
 
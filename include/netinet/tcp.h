@@ -25,6 +25,8 @@
 
 __BEGIN_DECLS
 
+#include <stdint.h>
+
 /** \defgroup tcp_opts                  Options
     \brief                              TCP protocol level options
     \ingroup                            networking_tcp
@@ -33,8 +35,9 @@ __BEGIN_DECLS
     setsockopt() and getsockopt() functions for the IPPROTO_TCP level value.
 
     All options listed here are at least guaranteed to be accepted by
-    setsockopt() and getsockopt() for IPPROTO_TCP, however they are not
-    guaranteed to be implemented in any meaningful way.
+    setsockopt() and getsockopt() for IPPROTO_TCP (except for TCP_INFO, which
+    can only be read), however they are not guaranteed to be implemented in any
+    meaningful way.
 
     \see                so_opts
     \see                ipv4_opts
@@ -46,9 +49,68 @@ __BEGIN_DECLS
 */
 
 #define TCP_NODELAY             1 /**< \brief Don't delay to coalesce. */
+#define TCP_INFO                11 /**< \brief Connection info (get). */
+
+/** @} */
 
+/** \defgroup tcp_info_opts             Info Options
+    \brief                              Values for tcpi_options in tcp_info
+    \ingroup                            networking_tcp
+
+    These tell which TCP extensions were agreed on with the other side.
+
+    @{
+*/
+#define TCPI_OPT_TIMESTAMPS     0x01 /**< \brief Timestamps (RFC 7323) */
+#define TCPI_OPT_SACK           0x02 /**< \brief Selective ACKs (RFC 2018) */
+#define TCPI_OPT_WSCALE         0x04 /**< \brief Window scaling (RFC 7323) */
 /** @} */
 
+/** \brief   TCP connection information.
+    \ingroup networking_tcp
+
+    This structure is filled in by getsockopt() with the TCP_INFO option, to
+    see how a connection is doing. The names follow the structure of the same
+    name on other systems, but only a subset of the fields is here, and the
+    congestion window and slow start threshold are in bytes rather than
+    segments.
+
+    The state is numbered in the order RFC 793 lists the states in, so 0 is
+    CLOSED, 1 is LISTEN, 4 is ESTABLISHED and 10 is TIME-WAIT. Times are in
+    microseconds. Counters start at zero when the connection is made. For a
+    socket that isn't connected, everything other than tcpi_state is zero.
+
+    \headerfile netinet/tcp.h
+*/
+struct tcp_info {
+    uint8_t tcpi_state;           /**< \brief State (0 = closed) */
+    uint8_t tcpi_options;         /**< \brief TCPI_OPT_* in use */
+    uint8_t tcpi_snd_wscale;      /**< \brief Their window scale factor */
+    uint8_t tcpi_rcv_wscale;      /**< \brief Our window scale factor */
+    uint8_t tcpi_backoff;         /**< \brief Timeouts in a row */
+    uint8_t tcpi_ca_state;        /**< \brief 1 when in fast recovery */
+    uint16_t tcpi_snd_mss;        /**< \brief Their maximum segment size */
+
+    uint32_t tcpi_rto;            /**< \brief Retransmission timeout */
+    uint32_t tcpi_rtt;            /**< \brief Smoothed round trip time */
+    uint32_t tcpi_rttvar;         /**< \brief Round trip time variation */
+
+    uint32_t tcpi_snd_cwnd;       /**< \brief Congestion window */
+    uint32_t tcpi_snd_ssthresh;   /**< \brief Slow start threshold */
+    uint32_t tcpi_snd_wnd;        /**< \brief Window they're offering */
+    uint32_t tcpi_rcv_wnd;        /**< \brief Window we're offering */
+    uint32_t tcpi_unacked;        /**< \brief Bytes sent, but not acked */
+    uint32_t tcpi_sacked;         /**< \brief Ranges they've SACKed */
+
+    uint32_t tcpi_segs_out;       /**< \brief Segments sent */
+    uint32_t tcpi_segs_in;        /**< \brief Segments received */
+    uint32_t tcpi_total_retrans;  /**< \brief Segments retransmitted */
+    uint32_t tcpi_fast_retrans;   /**< \brief Times fast retransmit kicked in */
+    uint32_t tcpi_timeouts;       /**< \brief Retransmission timeouts */
+    uint64_t tcpi_bytes_acked;    /**< \brief Bytes sent and acked */
+    uint64_t tcpi_bytes_received; /**< \brief Bytes received in order */
+};
+
 __END_DECLS
 
 #endif /* !__NETINET_TCP_H */
@@ -0,0 +1,182 @@
+/* KallistiOS ##version##
+
+   sys/epoll.h
+   Copyright (C) 2024 The KallistiOS Team
+*/
+
+/** \file    sys/epoll.h
+    \brief   Scalable I/O event notification.
+    \ingroup threading_epoll
+
+    This file contains an interface for waiting on events from many file
+    descriptors at once, modelled after the epoll interface from Linux. Unlike
+    with poll(), the set of file descriptors to watch is set up once, and the
+    cost of waiting on it depends on how many of them have events to report,
+    rather than on how many there are.
+
+    The events that can be waited for are the same as those for poll(), and
+    just like poll(), only sockets really report events at the moment. Other
+    files that don't know how to be polled are always considered ready for
+    reading and writing.
+
+    \author The KallistiOS Team
+*/
+
+#ifndef __SYS_EPOLL_H
+#define __SYS_EPOLL_H
+
+#include <sys/cdefs.h>
+#include <sys/types.h>
+#include <stdint.h>
+#include <poll.h>
+
+__BEGIN_DECLS
+
+/** \defgroup threading_epoll   Event Polling
+    \brief                      Waiting for events on large sets of files.
+    \ingroup                    threading_polling
+    @{
+*/
+
+/** \defgroup epoll_events              Events for epoll
+    \brief                              Masks for the events field of an
+                                        epoll_event
+    \ingroup                            threading_epoll
+
+    The event types are the same as the ones that poll() uses, with a couple of
+    flags that change how they're reported. By default, a file descriptor is
+    reported every time epoll_wait() is called for as long as it is ready
+    (level-triggered). With EPOLLET, it is only reported when something new
+    happens on it (edge-triggered).
+
+    @{
+*/
+#define EPOLLIN         POLLIN      /**< \brief Data may be read */
+#define EPOLLRDNORM     POLLRDNORM  /**< \brief Normal data may be read */
+#define EPOLLRDBAND     POLLRDBAND  /**< \brief Priority data may be read */
+#define EPOLLPRI        POLLPRI     /**< \brief High-priority data may be read */
+#define EPOLLOUT        POLLOUT     /**< \brief Normal data may be written */
+#define EPOLLWRNORM     POLLWRNORM  /**< \brief Normal data may be written */
+#define EPOLLWRBAND     POLLWRBAND  /**< \brief Priority data may be written */
+#define EPOLLERR        POLLERR     /**< \brief Error (always reported) */
+#define EPOLLHUP        POLLHUP     /**< \brief Hung up (always reported) */
+
+/** \brief  Disable the file descriptor after it has been reported once.
+
+    It can be enabled again with EPOLL_CTL_MOD.
+*/
+#define EPOLLONESHOT    (1U << 30)
+
+/** \brief  Report only new events, rather than the current state. */
+#define EPOLLET         (1U << 31)
+/** @} */
+
+/** \name   Operations for epoll_ctl()
+    @{
+*/
+#define EPOLL_CTL_ADD   1   /**< \brief Start watching a file descriptor */
+#define EPOLL_CTL_DEL   2   /**< \brief Stop watching a file descriptor */
+#define EPOLL_CTL_MOD   3   /**< \brief Change what to watch for */
+/** @} */
+
+/** \brief  Flag for epoll_create1(), accepted for compatibility.
+
+    There is no exec() for it to have an effect on.
+*/
+#define EPOLL_CLOEXEC   1
+
+/** \brief   User data attached to a watched file descriptor.
+
+    This is handed back unchanged with each event, so that the caller can tell
+    where the event came from.
+*/
+typedef union epoll_data {
+    void *ptr;                  /**< \brief A pointer */
+    int fd;                     /**< \brief A file descriptor */
+    uint32_t u32;               /**< \brief A 32-bit integer */
+    uint64_t u64;               /**< \brief A 64-bit integer */
+} epoll_data_t;
+
+/** \brief   An event to watch for, or one that happened.
+    \headerfile sys/epoll.h
+*/
+struct epoll_event {
+    uint32_t events;            /**< \brief Event mask, see \ref epoll_events */
+    epoll_data_t data;          /**< \brief User data */
+};
+
+/** \brief   Create an epoll instance.
+
+    \param  size            Ignored, but must be greater than zero.
+    \return                 A file descriptor for the new instance, or -1 on
+                            error (sets errno). Close it with close() when
+                            done with it.
+
+    \par    Error Conditions:
+    \em     EINVAL - size was not greater than zero \n
+    \em     ENOMEM - out of memory \n
+    \em     EMFILE - too many open files
+*/
+int epoll_create(int size);
+
+/** \brief   Create an epoll instance.
+
+    \param  flags           0 or EPOLL_CLOEXEC.
+    \return                 A file descriptor for the new instance, or -1 on
+                            error (sets errno).
+
+    \par    Error Conditions:
+    \em     EINVAL - invalid flags \n
+    \em     ENOMEM - out of memory \n
+    \em     EMFILE - too many open files
+*/
+int epoll_create1(int flags);
+
+/** \brief   Change the set of file descriptors an instance watches.
+
+    A file descriptor is removed from every instance watching it when it is
+    closed.
+
+    \param  epfd            The epoll instance.
+    \param  op              One of the EPOLL_CTL_* operations.
+    \param  fd              The file descriptor to add, modify or remove.
+    \param  event           What to watch for and the data to report with it.
+                            Ignored for EPOLL_CTL_DEL.
+    \return                 0 on success, or -1 on error (sets errno).
+
+    \par    Error Conditions:
+    \em     EBADF - epfd or fd is not a valid file descriptor \n
+    \em     EINVAL - epfd is not an epoll instance, fd is one, or op is
+                     invalid \n
+    \em     EEXIST - fd is already being watched (EPOLL_CTL_ADD) \n
+    \em     ENOENT - fd is not being watched (EPOLL_CTL_MOD, EPOLL_CTL_DEL) \n
+    \em     EFAULT - event is NULL \n
+    \em     ENOMEM - out of memory
+*/
+int epoll_ctl(int epfd, int op, int fd, struct epoll_event *event);
+
+/** \brief   Wait for events on an epoll instance.
+
+    \param  epfd            The epoll instance.
+    \param  events          Where to store the events.
+    \param  maxevents       How many events fit in events.
+    \param  timeout         Maximum time to block, in milliseconds. Pass 0 to
+                            not block at all, or -1 to block until an event
+                            occurs.
+    \return                 The number of events stored, 0 on timeout, or -1
+                            on error (sets errno).
+
+    \par    Error Conditions:
+    \em     EBADF - epfd is not a valid file descriptor \n
+    \em     EINVAL - epfd is not an epoll instance, or maxevents is not
+                     greater than zero \n
+    \em     EPERM - called inside an interrupt with a nonzero timeout
+*/
+int epoll_wait(int epfd, struct epoll_event *events, int maxevents,
+               int timeout);
+
+/** @} */
+
+__END_DECLS
+
+#endif /* !__SYS_EPOLL_H */
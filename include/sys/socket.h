@@ -87,6 +87,28 @@ struct sockaddr_storage {
     char _ss_pad2[_SS_PAD2SIZE];
 };
 
+/** \brief  Message header, used to send or receive one message from a set of
+            buffers.
+    \headerfile sys/socket.h
+*/
+struct msghdr {
+    void *msg_name;             /**< \brief Peer address (optional) */
+    socklen_t msg_namelen;      /**< \brief Size of the peer address */
+    struct iovec *msg_iov;      /**< \brief Buffers for the message */
+    int msg_iovlen;             /**< \brief Number of buffers in msg_iov */
+    void *msg_control;          /**< \brief Ancillary data (unsupported) */
+    socklen_t msg_controllen;   /**< \brief Size of the ancillary data */
+    int msg_flags;              /**< \brief Flags on the received message */
+};
+
+/** \brief  One message of a batch, for recvmmsg() and sendmmsg().
+    \headerfile sys/socket.h
+*/
+struct mmsghdr {
+    struct msghdr msg_hdr;      /**< \brief The message */
+    unsigned int msg_len;       /**< \brief Bytes received or sent */
+};
+
 /** \brief  Datagram socket type.
 
     This socket type specifies that the socket in question transmits datagrams
@@ -171,6 +193,7 @@ struct sockaddr_storage {
 #define MSG_TRUNC       0x20    /**< \brief Normal data truncated (U) */
 #define MSG_WAITALL     0x40    /**< \brief Attempt to fill read buffer */
 #define MSG_DONTWAIT    0x80    /**< \brief Make this call non-blocking (non-standard) */
+#define MSG_WAITFORONE  0x100   /**< \brief Only block for the first message (non-standard) */
 /** @} */
 
 /** \addtogroup networking_sockets
@@ -467,6 +490,53 @@ int getsockopt(int socket, int level, int option_name, void *option_value,
 int setsockopt(int socket, int level, int option_name, const void *option_value,
                socklen_t option_len);
 
+struct timespec;
+
+/** \brief  Receive a batch of messages on a socket.
+
+    This function receives up to vlen datagrams with one call, which saves the
+    overhead of a call per datagram when many small ones are coming in. Only
+    datagram sockets support this.
+
+    The call blocks (unless the socket is non-blocking or MSG_DONTWAIT is set)
+    until at least one message is available, then returns every message that
+    is waiting, up to vlen. That is, MSG_WAITFORONE is always in effect.
+
+    \param  socket      The socket to receive on.
+    \param  msgvec      The messages to fill in. For each, msg_len is set to
+                        the number of bytes stored, and MSG_TRUNC is set in
+                        msg_flags if the datagram didn't fit.
+    \param  vlen        The number of entries in msgvec.
+    \param  flags       The type of message reception, as for recvfrom().
+    \param  timeout     The longest to wait for the first message, or NULL to
+                        wait as long as it takes. A zero timeout doesn't wait
+                        at all.
+
+    \return             The number of messages received. On error, -1, and
+                        sets errno as appropriate.
+*/
+int recvmmsg(int socket, struct mmsghdr *msgvec, unsigned int vlen, int flags,
+             struct timespec *timeout);
+
+/** \brief  Send a batch of messages on a socket.
+
+    This function sends up to vlen datagrams with one call, which saves the
+    overhead of a call per datagram when many small ones are going out. Only
+    datagram sockets support this. The data of each message is gathered
+    straight from its buffers, without being copied together first.
+
+    \param  socket      The socket to send on.
+    \param  msgvec      The messages to send. For each message sent, msg_len
+                        is set to the number of bytes sent.
+    \param  vlen        The number of entries in msgvec.
+    \param  flags       The type of message transmission. Set to 0 for now.
+
+    \return             The number of messages sent, which is less than vlen
+                        if one of them failed. If the first one fails, -1, and
+                        sets errno as appropriate.
+*/
+int sendmmsg(int socket, struct mmsghdr *msgvec, unsigned int vlen, int flags);
+
 /** @} */
 
 __END_DECLS
@@ -36,11 +36,12 @@ ISO9660 systems, as these were used as references as well.
 #include <kos/thread.h>
 #include <kos/mutex.h>
 #include <kos/fs.h>
+#include <kos/fs_aio.h>
+#include <kos/blockcache.h>
 #include <kos/opts.h>
 
 #include <stdlib.h>
 #include <stdio.h>
-#include <stdalign.h>
 #include <ctype.h>
 #include <string.h>
 #include <strings.h>
@@ -190,132 +191,102 @@ static uint32 iso_733(const uint8 *from) {
 
 
 /********************************************************************************/
-/* Low-level block caching routines. This implements a simple queue-based
-   LRU/MRU caching system. Whenever a block is requested, it will be placed
-   on the MRU end of the queue. As more blocks are loaded than can fit in
-   the cache, blocks are deleted from the LRU end. */
-
-/* Holds the data for one cache block, and a pointer to the next one.
-   As sectors are read from the disc, they are added to the front of
-   this cache. As the cache fills up, sectors are removed from the end
-   of it. */
-typedef struct {
-    uint8   *data;          /* Sector data */
-    uint32  sector;         /* CD sector */
-} cache_block_t;
+/* Low-level block caching routines. Both the inode (directory) and data
+   caches are kos_blockcache_t caches of whole sectors. The data cache can be
+   resized at runtime, and is filled by read-ahead when files are read
+   sequentially in small pieces (see bdread_ra() below).
+
+   All reads from the drive are done with cache_mutex held, which also protects
+   the stream state. When taking both this and fh_mutex, take fh_mutex first. */
 
-/* List of cache blocks (ordered least recently used to most recently) */
 #define NUM_CACHE_BLOCKS 16
-static cache_block_t *icache[NUM_CACHE_BLOCKS];     /* inode cache */
-static cache_block_t *dcache[NUM_CACHE_BLOCKS];     /* data cache */
+static kos_blockcache_t *icache;    /* inode cache */
+static kos_blockcache_t *dcache;    /* data cache */
 
-static unsigned char *cache_data;
-static cache_block_t *caches;
+/* Read-ahead buffer and size limit */
+static uint8_t *ra_buf;
+static size_t ra_max;
 
-/* Cache modification mutex */
-static mutex_t cache_mutex;
+/* Streamed read state. When a file has been read sequentially for long
+   enough, the rest of it is read through a stream, which saves sending a new
+   command to the drive for each read-ahead. */
+static file_t stream_fd = -1;
+static uint32_t stream_sector, stream_end;
 
-/* Clears all cache blocks */
-static void bclear_cache(cache_block_t **cache) {
-    int i;
+static fs_iso9660_stats_t stats;
 
-    mutex_lock(&cache_mutex);
+/* Result of the last read, for disc change detection */
+static int last_cd_err;
 
-    for(i = 0; i < NUM_CACHE_BLOCKS; i++)
-        cache[i]->sector = (uint32)-1;
+/* Cache modification mutex */
+static mutex_t cache_mutex;
 
-    mutex_unlock(&cache_mutex);
+/* Stop any streamed read that's in progress. */
+static void iso_abort_stream(void) {
+    if(stream_fd >= 0) {
+        cdrom_stream_stop(false);
+        stream_fd = -1;
+    }
 }
 
-/* Graduate a block from its current position to the MRU end of the cache */
-static void bgrad_cache(cache_block_t **cache, int block) {
-    int     i;
-    cache_block_t   *tmp;
+/* Read sectors from the drive. The buffer must be 32-byte aligned. */
+static int iso_read_sectors(void *buf, uint32_t sector, int cnt) {
+    iso_abort_stream();
 
-    /* Don't try it with the end block */
-    if(block < 0 || block >= (NUM_CACHE_BLOCKS - 1)) return;
+    ++stats.commands;
+    stats.sectors += cnt;
 
-    /* Make a copy and scoot everything down */
-    tmp = cache[block];
+    last_cd_err = cdrom_read_sectors_ex(buf, sector + 150, cnt,
+                                        CDROM_READ_DMA_IRQ);
+    return last_cd_err;
+}
 
-    for(i = block; i < (NUM_CACHE_BLOCKS - 1); i++)
-        cache[i] = cache[i + 1];
+static int iso_bcache_read(void *ctx, uint32_t sector, uint8_t *buf) {
+    (void)ctx;
 
-    cache[NUM_CACHE_BLOCKS - 1] = tmp;
+    return iso_read_sectors(buf, sector, 1) ? -EIO : 0;
 }
 
-/* Pulls the requested sector into a cache block and returns the cache
-   block index. Note that the sector in question may already be in the
-   cache, in which case it just returns the containing block. */
-static void iso_break_all(void);
-static void iso_abort_stream(int lock);
-static int bread_cache(cache_block_t **cache, uint32 sector) {
-    int i, j, rv;
+/* Pulls the requested sector into the cache and returns its data. Note that
+   the sector in question may already be in the cache, in which case no read
+   is needed. */
+static uint8_t *bread_cache(kos_blockcache_t *cache, uint32 sector) {
+    uint8_t *rv;
+    int err;
 
-    rv = -1;
     mutex_lock(&cache_mutex);
 
-    /* Look for a pre-existing cache block */
-    for(i = NUM_CACHE_BLOCKS - 1; i >= 0; i--) {
-        if(cache[i]->sector == sector) {
-            bgrad_cache(cache, i);
-            rv = NUM_CACHE_BLOCKS - 1;
-            goto bread_exit;
-        }
-    }
-
-    /* If not, look for an open cache slot; if we find one, use it */
-    for(i = 0; i < NUM_CACHE_BLOCKS; i++) {
-        if(cache[i]->sector == (uint32)-1) break;
-    }
-
-    /* If we didn't find one, kick an LRU block out of cache */
-    if(i >= NUM_CACHE_BLOCKS) {
-        i = 0;
-    }
-
-    iso_abort_stream(cache == icache);
-
-    /* Load the requested block */
-    j = cdrom_read_sectors_ex(cache[i]->data, sector + 150, 1, CDROM_READ_DMA_IRQ);
-
-    if(j < 0) {
+    /* If the disc has been changed, the next open will take care of it. This
+       can't be done here, as we may be holding the locks that it needs. */
+    if(!(rv = blockcache_read(cache, sector, &err))) {
         //dbglog(DBG_ERROR, "fs_iso9660: can't read_sectors for %d: %d\n",
-        //  sector+150, j);
-        if(j == ERR_DISC_CHG || j == ERR_NO_DISC) {
-            init_percd();
+        //  sector+150, last_cd_err);
+        if(last_cd_err == ERR_DISC_CHG || last_cd_err == ERR_NO_DISC) {
+            percd_done = 0;
         }
-
-        rv = -1;
-        goto bread_exit;
     }
 
-    cache[i]->sector = sector;
-
-    /* Move it to the most-recently-used position */
-    bgrad_cache(cache, i);
-    rv = NUM_CACHE_BLOCKS - 1;
-
-    /* Return the new cache block index */
-bread_exit:
     mutex_unlock(&cache_mutex);
     return rv;
 }
 
 /* read data block */
-static inline int bdread(uint32_t sector) {
+static inline uint8_t *bdread(uint32_t sector) {
     return bread_cache(dcache, sector);
 }
 
 /* read inode block */
-static inline int biread(uint32_t sector) {
+static inline uint8_t *biread(uint32_t sector) {
     return bread_cache(icache, sector);
 }
 
 /* Clear both caches */
-static inline void bclear(void) {
-    bclear_cache(dcache);
-    bclear_cache(icache);
+static void bclear(void) {
+    mutex_lock(&cache_mutex);
+    iso_abort_stream();
+    blockcache_invalidate(dcache);
+    blockcache_invalidate(icache);
+    mutex_unlock(&cache_mutex);
 }
 
 /********************************************************************************/
@@ -334,7 +305,8 @@ static iso_dirent_t root_dirent;
 /* Per-disc initialization; this is done every time it's discovered that
    a new CD has been inserted. */
 static int init_percd(void) {
-    int     i, blk;
+    int     i;
+    uint8_t     *blk;
     CDROM_TOC   toc;
 
     dbglog(DBG_NOTICE, "fs_iso9660: disc change detected\n");
@@ -360,10 +332,10 @@ static int init_percd(void) {
     for(i = 1; i <= 3; i++) {
         blk = biread(session_base + i + 16 - 150);
 
-        if(blk < 0) return blk;
+        if(!blk) return -1;
 
-        if(memcmp((char *)icache[blk]->data, "\02CD001", 6) == 0) {
-            joliet = isjoliet((char *)icache[blk]->data + 88);
+        if(memcmp((char *)blk, "\02CD001", 6) == 0) {
+            joliet = isjoliet((char *)blk + 88);
             dbglog(DBG_NOTICE, "  (joliet level %d extensions detected)\n", joliet);
 
             if(joliet) break;
@@ -375,16 +347,16 @@ static int init_percd(void) {
         /* Grab and check the volume descriptor */
         blk = biread(session_base + 16 - 150);
 
-        if(blk < 0) return i;
+        if(!blk) return i;
 
-        if(memcmp((char*)icache[blk]->data, "\01CD001", 6)) {
+        if(memcmp((char*)blk, "\01CD001", 6)) {
             dbglog(DBG_ERROR, "fs_iso9660: disc is not iso9660\r\n");
             return -1;
         }
     }
 
     /* Locate the root directory */
-    memcpy(&root_dirent, icache[blk]->data + 156, sizeof(iso_dirent_t));
+    memcpy(&root_dirent, blk + 156, sizeof(iso_dirent_t));
     root_extent = iso_733(root_dirent.extent);
     root_size = iso_733(root_dirent.size);
 
@@ -433,7 +405,8 @@ static int fncompare(const char *isofn, int isosize, const char *normalfn) {
  */
 static iso_dirent_t *find_object(const char *fn, int dir,
                                  uint32 dir_extent, uint32 dir_size) {
-    int     i, c;
+    int     i;
+    uint8_t     *c;
     iso_dirent_t    *de;
 
     /* RockRidge */
@@ -456,11 +429,11 @@ static iso_dirent_t *find_object(const char *fn, int dir,
     while(size_left > 0) {
         c = biread(dir_extent);
 
-        if(c < 0) return NULL;
+        if(!c) return NULL;
 
         for(i = 0; i < 2048 && i < size_left;) {
             /* Locate the current dirent */
-            de = (iso_dirent_t *)(icache[c]->data + i);
+            de = (iso_dirent_t *)(c + i);
 
             if(!de->length) break;
 
@@ -584,13 +557,12 @@ static struct {
     uint32_t size;           /* Length of file in bytes */
     dirent_t dirent;         /* A static dirent to pass back to clients */
     bool broken;             /* True if the CD has been swapped out since open */
-    size_t stream_part;      /* Stream DMA part of 32 bytes */
-    uint8_t alignas(32) stream_data[32];
+    uint32_t last_sector;    /* Last data sector read through the cache */
+    uint32_t ra;             /* Current read-ahead, in sectors */
 } fh[FS_CD_MAX_FILES];
 
 /* Mutex for file handles */
 static mutex_t fh_mutex;
-static file_t stream_fd = -1;
 
 /* Break all of our open file descriptor. This is necessary when the disc
    is changed so that we don't accidentally try to keep on doing stuff
@@ -607,19 +579,115 @@ static void iso_break_all(void) {
     mutex_unlock(&fh_mutex);
 }
 
-static void iso_abort_stream(int lock) {
-    if(stream_fd >= 0) {
-        if(lock) {
-            mutex_lock(&fh_mutex);
+/* Read a data sector of a file, reading ahead of it if the file is being read
+   sequentially. The amount read ahead starts at one sector and doubles on each
+   sequential miss, up to ra_max. Once it gets there, the rest of the file is
+   streamed rather than sending the drive a new command for every read-ahead.
+   Called with fh_mutex held. */
+static uint8_t *bdread_ra(file_t fd, uint32_t sector) {
+    uint32_t end, cnt, i;
+    uint8_t *rv;
+    size_t remain;
+    int seq, err, c;
+
+    seq = sector == fh[fd].last_sector + 1;
+
+    if(sector != fh[fd].last_sector) {
+        fh[fd].last_sector = sector;
+
+        if(!seq)
+            fh[fd].ra = 1;
+    }
+
+    mutex_lock(&cache_mutex);
+
+    if(blockcache_lookup(dcache, sector)) {
+        ++stats.cache_hits;
+        rv = blockcache_read(dcache, sector, &err);
+        mutex_unlock(&cache_mutex);
+        return rv;
+    }
+
+    ++stats.cache_misses;
+
+    if(seq && fh[fd].ra < ra_max) {
+        fh[fd].ra <<= 1;
+
+        if(fh[fd].ra > ra_max)
+            fh[fd].ra = ra_max;
+    }
+
+    /* Don't read past the end of the file, or over anything we already have. */
+    end = fh[fd].first_extent + (fh[fd].size + 2047) / 2048;
+    cnt = fh[fd].ra;
+
+    if(cnt > end - sector)
+        cnt = end - sector;
+
+    for(i = 1; i < cnt; ++i) {
+        if(blockcache_lookup(dcache, sector + i))
+            break;
+    }
+
+    cnt = i;
+
+    if(cnt > 1) {
+        c = -1;
+
+        if(stream_fd != fd || stream_sector != sector) {
+            iso_abort_stream();
+
+            if(fh[fd].ra == ra_max && end - sector > cnt &&
+               !cdrom_stream_start(sector + 150, end - sector,
+                                   CDROM_READ_DMA_IRQ)) {
+                ++stats.streams;
+                stream_fd = fd;
+                stream_sector = sector;
+                stream_end = end;
+            }
         }
-        cdrom_stream_stop(false);
-        stream_fd = -1;
 
-        if(lock) {
-            mutex_unlock(&fh_mutex);
+        if(stream_fd == fd) {
+            if(cnt > stream_end - sector)
+                cnt = stream_end - sector;
+
+            c = cdrom_stream_request(ra_buf, cnt * 2048, 1);
+
+            if(!c) {
+                ++stats.stream_reqs;
+                stats.sectors += cnt;
+                stream_sector += cnt;
+                cdrom_stream_progress(&remain);
+
+                if(!remain || stream_sector >= stream_end)
+                    iso_abort_stream();
+            }
+            else {
+                iso_abort_stream();
+            }
+        }
+
+        /* If there's no stream (or it broke), just ask for the sectors. */
+        if(c)
+            c = iso_read_sectors(ra_buf, sector, cnt);
+
+        if(!c) {
+            ++stats.readaheads;
+
+            for(i = 0; i < cnt; ++i) {
+                if(blockcache_insert(dcache, sector + i, ra_buf + i * 2048))
+                    break;
+            }
         }
-        // dbglog(DBG_DEBUG, "Stream stop for %s read\n", lock ? "cached" : "inode");
     }
+
+    rv = blockcache_read(dcache, sector, &err);
+
+    if(!rv && (last_cd_err == ERR_DISC_CHG || last_cd_err == ERR_NO_DISC))
+        percd_done = 0;
+
+    mutex_unlock(&cache_mutex);
+    return rv;
 }
 
 /* Open a file or directory */
@@ -671,6 +739,8 @@ static void * iso_open(vfs_handler_t * vfs, const char *fn, int mode) {
     fh[fd].ptr = 0;
     fh[fd].size = iso_733(de->size);
     fh[fd].broken = false;
+    fh[fd].last_sector = 0;
+    fh[fd].ra = 1;
 
     return (void *)fd;
 }
@@ -687,13 +757,12 @@ static int iso_close(void * h) {
 
     fh[fd].first_extent = 0;
 
-    if(fd == stream_fd) {
-        mutex_lock(&fh_mutex);
-        cdrom_stream_stop(false);
-        stream_fd = -1;
-        mutex_unlock(&fh_mutex);
-        // dbglog(DBG_DEBUG, "Stream stop on close, fd=%d\n", fd);
-    }
+    mutex_lock(&cache_mutex);
+
+    if(fd == stream_fd)
+        iso_abort_stream();
+
+    mutex_unlock(&cache_mutex);
     return 0;
 }
 
@@ -701,8 +770,8 @@ static int iso_close(void * h) {
 static ssize_t iso_read(void * h, void *buf, size_t bytes) {
     int rv, toread, thissect, c;
     uint8 * outbuf;
+    uint8_t *data;
     file_t fd = (file_t)h;
-    // size_t remain_size = 0, req_size;
     uint32_t sector;
 
     /* Check that the fd is valid */
@@ -726,99 +795,14 @@ static ssize_t iso_read(void * h, void *buf, size_t bytes) {
         /* How much more can we read in the current sector? */
         thissect = 2048 - (fh[fd].ptr % 2048);
         sector = fh[fd].first_extent + (fh[fd].ptr / 2048);
-#if 0
-        if((thissect & 31) == 0 && toread >= 32 && (((uintptr_t)outbuf) & 31) == 0) {
-
-            if(stream_fd == fd) {
-                toread &= ~31;
-                c = cdrom_stream_request(outbuf, toread, 1);
-
-                if(c) {
-                    goto read_error;
-                }
-                cdrom_stream_progress(&remain_size);
-                // dbglog(DBG_DEBUG, "Stream request: read=%d remain=%d out=%p fd=%d\n",
-                //         toread, remain_size, outbuf, fd);
-            }
-            else if(thissect == 2048) {
-                req_size = (fh[fd].size - fh[fd].ptr);
-
-                if(req_size & 2047) {
-                    req_size = (req_size + 2048) & ~2047;
-                }
-                if(stream_fd >= 0) {
-                    cdrom_stream_stop(false);
-                    // dbglog(DBG_DEBUG, "Stream stop for file fd: %d -> %d\n", stream_fd, fd);
-                    stream_fd = -1;
-                }
-                c = cdrom_stream_start(sector + 150, req_size / 2048, CDROM_READ_DMA_IRQ);
-
-                if(c) {
-                    goto read_loop;
-                }
-                fh[fd].stream_part = 0;
-                stream_fd = fd;
-                // dbglog(DBG_DEBUG, "Stream start: lba=%ld cnt=%d fd=%d\n",
-                //     sector + 150, req_size / 2048, fd);
-
-                toread &= ~31;
-                c = cdrom_stream_request(outbuf, toread, 1);
-
-                if(c) {
-                    goto read_error;
-                }
-                cdrom_stream_progress(&remain_size);
-                // dbglog(DBG_DEBUG, "Stream request: read=%d remain=%d out=%p fd=%d\n",
-                //         toread, remain_size, outbuf, fd);
-            }
-            else {
-                goto read_loop;
-            }
-
-            if(remain_size == 0) {
-                cdrom_stream_stop(false);
-                stream_fd = -1;
-                // dbglog(DBG_DEBUG, "Stream stop on end, fd=%d\n", fd);
-            }
-            goto end_loop;
-        }
-        else if(stream_fd == fd && toread < 32) {
-
-            toread = (toread > thissect) ? thissect : toread;
-
-            if(fh[fd].stream_part > 0) {
-                memcpy(outbuf, &fh[fd].stream_data[fh[fd].stream_part - 1], toread);
-                fh[fd].stream_part = 0;
-            }
-            else {
-                c = cdrom_stream_request(fh[fd].stream_data, 32, 0);
-                if(c) {
-                    goto read_error;
-                }
-                fh[fd].stream_part = toread;
-                while(cdrom_stream_progress(&remain_size) == 1) {
-                    thd_pass();
-                }
-                memcpy(outbuf, fh[fd].stream_data, toread);
-            }
-            // dbglog(DBG_DEBUG, "Stream request: read=%d remain=%d part=%d out=%p fd=%d\n",
-            //         toread, remain_size, fh[fd].stream_part, outbuf, fd);
-
-            if(remain_size == 0) {
-                cdrom_stream_stop(false);
-                stream_fd = -1;
-                // dbglog(DBG_DEBUG, "Stream stop on end, fd=%d\n", fd);
-            }
-            goto end_loop;
-        }
-
-read_loop:
-#endif
         if(thissect == 2048 && toread >= 2048 && (((uintptr_t)outbuf) & 31) == 0) {
             // Round it off to an even sector count
             thissect = toread / 2048;
             toread = thissect * 2048;
-            c = cdrom_read_sectors_ex(outbuf, sector + 150, thissect, CDROM_READ_DMA_IRQ);
+
+            mutex_lock(&cache_mutex);
+            c = iso_read_sectors(outbuf, sector, thissect);
+            mutex_unlock(&cache_mutex);
 
             if(c) {
                 goto read_error;
@@ -826,15 +810,14 @@ read_loop:
         }
         else {
             toread = (toread > thissect) ? thissect : toread;
-            c = bdread(sector);
+            data = ra_max > 1 ? bdread_ra(fd, sector) : bdread(sector);
 
-            if(c < 0) {
+            if(!data) {
                 goto read_error;
             }
-            memcpy(outbuf, dcache[c]->data + (fh[fd].ptr % 2048), toread);
+            memcpy(outbuf, data + (fh[fd].ptr % 2048), toread);
         }
 
-// end_loop:
         /* Adjust pointers */
         outbuf += toread;
         fh[fd].ptr += toread;
@@ -842,6 +825,7 @@ read_loop:
         rv += toread;
     }
 
+    stats.bytes += rv;
     mutex_unlock(&fh_mutex);
     return rv;
 
@@ -851,17 +835,85 @@ read_error:
     return -1;
 }
 
+/* Asynchronous read. This is called on the CD's asynchronous I/O thread. The
+   whole sectors of the request are DMAed straight into the caller's buffer
+   without holding the file handle mutex, so reads of other files through the
+   cache aren't held up behind a long transfer. Any partial sector at the end
+   is then read as normal. Anything that doesn't start on a sector boundary
+   with a suitably aligned buffer just gets passed along to iso_read(). */
+static int iso_aio_submit(void *h, fs_aio_t *req) {
+    file_t fd = (file_t)h;
+    uint32_t sector, ptr;
+    size_t total, cnt;
+    ssize_t rv;
+
+    if(req->op != FS_AIO_READ) {
+        errno = ENOTSUP;
+        return -1;
+    }
+
+    mutex_lock(&fh_mutex);
+
+    /* Check that the fd is valid */
+    if(fd >= FS_CD_MAX_FILES || fh[fd].first_extent == 0 || fh[fd].broken) {
+        mutex_unlock(&fh_mutex);
+        errno = EBADF;
+        return -1;
+    }
+
+    ptr = fh[fd].ptr;
+    total = req->cnt > fh[fd].size - ptr ? fh[fd].size - ptr : req->cnt;
+    cnt = total & ~2047;
+
+    if((ptr & 2047) || ((uintptr_t)req->buf & 31) || !cnt) {
+        mutex_unlock(&fh_mutex);
+        errno = ENOTSUP;
+        return -1;
+    }
+
+    /* Claim the part of the file we're about to read. */
+    sector = fh[fd].first_extent + (ptr / 2048);
+    fh[fd].ptr += cnt;
+    mutex_unlock(&fh_mutex);
+
+    mutex_lock(&cache_mutex);
+    rv = iso_read_sectors(req->buf, sector, cnt / 2048);
+    mutex_unlock(&cache_mutex);
+
+    if(rv) {
+        mutex_lock(&fh_mutex);
+        fh[fd].ptr = ptr;
+        mutex_unlock(&fh_mutex);
+
+        fs_aio_complete(req, -1, EIO);
+        return 0;
+    }
+
+    rv = cnt;
+    stats.bytes += cnt;
+
+    if(total > cnt) {
+        if(iso_read(h, (uint8_t *)req->buf + cnt, total - cnt) < 0) {
+            fs_aio_complete(req, -1, errno);
+            return 0;
+        }
+
+        rv = total;
+    }
+
+    fs_aio_complete(req, rv, 0);
+    return 0;
+}
+
 /* Seek elsewhere in a file */
 static off_t iso_seek(void * h, off_t offset, int whence) {
     file_t fd = (file_t)h;
-    uint32_t old_ptr;
 
     /* Check that the fd is valid */
     if(fd >= FS_CD_MAX_FILES || fh[fd].first_extent == 0 || fh[fd].broken) {
         errno = EBADF;
         return -1;
     }
-    old_ptr = fh[fd].ptr;
 
     /* Update current position according to arguments */
     switch(whence) {
@@ -901,13 +953,6 @@ static off_t iso_seek(void * h, off_t offset, int whence) {
     if(fh[fd].ptr > fh[fd].size)
         fh[fd].ptr = fh[fd].size;
 
-    if(fd == stream_fd && old_ptr != fh[fd].ptr) {
-        mutex_lock(&fh_mutex);
-        cdrom_stream_stop(false);
-        stream_fd = -1;
-        mutex_unlock(&fh_mutex);
-        // dbglog(DBG_DEBUG, "Stream stop on seek: %ld != %ld\n", old_ptr, fh[fd].ptr);
-    }
     return fh[fd].ptr;
 }
 
@@ -955,7 +1000,7 @@ static void fn_postprocess(char *fnin) {
 
 /* Read a directory entry */
 static dirent_t *iso_readdir(void * h) {
-    int     c;
+    uint8_t     *c;
     iso_dirent_t    *de;
 
     /* RockRidge */
@@ -972,16 +1017,16 @@ static dirent_t *iso_readdir(void * h) {
 
     /* Scan forwards until we find the next valid entry, an
        end-of-entry mark, or run out of dir size. */
-    c = -1;
+    c = NULL;
     de = NULL;
 
     while(fh[fd].ptr < fh[fd].size) {
         /* Get the current dirent block */
         c = biread(fh[fd].first_extent + fh[fd].ptr / 2048);
 
-        if(c < 0) return NULL;
+        if(!c) return NULL;
 
-        de = (iso_dirent_t *)(icache[c]->data + (fh[fd].ptr % 2048));
+        de = (iso_dirent_t *)(c + (fh[fd].ptr % 2048));
 
         if(de->length) break;
 
@@ -994,9 +1039,9 @@ static dirent_t *iso_readdir(void * h) {
     /* If we're at the first, skip the two blank entries */
     if(!de->name[0] && de->name_len == 1) {
         fh[fd].ptr += de->length;
-        de = (iso_dirent_t *)(icache[c]->data + (fh[fd].ptr % 2048));
+        de = (iso_dirent_t *)(c + (fh[fd].ptr % 2048));
         fh[fd].ptr += de->length;
-        de = (iso_dirent_t *)(icache[c]->data + (fh[fd].ptr % 2048));
+        de = (iso_dirent_t *)(c + (fh[fd].ptr % 2048));
 
         if(!de->length) return NULL;
     }
@@ -1058,9 +1103,6 @@ static int iso_ioctl(void *h, int cmd, va_list ap) {
             if(arg != NULL) {
                 *(uint32_t *)arg = 32;
             }
-            if(stream_fd == fd) {
-                return (fh[fd].ptr & 31) ? -1 : 0;
-            }
             return (fh[fd].ptr & 2047) ? -1 : 0;
         default:
             errno = EINVAL;
@@ -1085,7 +1127,6 @@ static int iso_rewinddir(void * h) {
 int iso_reset(void) {
     iso_break_all();
     bclear();
-    iso_abort_stream(0);
     percd_done = 0;
     return 0;
 }
@@ -1253,13 +1294,68 @@ static vfs_handler_t vh = {
     NULL,               /* total64 */
     NULL,               /* readlink */
     iso_rewinddir,
-    iso_fstat
+    iso_fstat,
+    iso_aio_submit      /* aio_submit */
 };
 
 /* Initialize the file system */
-void fs_iso9660_init(void) {
+int fs_iso9660_set_cache(size_t blocks, size_t readahead) {
+    kos_blockcache_t *nc;
+    uint8_t *nb = NULL;
     int i;
 
+    if(blocks < 2) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    if(readahead > blocks / 2)
+        readahead = blocks / 2;
+
+    if(!(nc = blockcache_create(blocks, 2048, iso_bcache_read, NULL, NULL))) {
+        errno = ENOMEM;
+        return -1;
+    }
+
+    if(readahead > 1 && !(nb = memalign(32, readahead * 2048))) {
+        blockcache_destroy(nc);
+        errno = ENOMEM;
+        return -1;
+    }
+
+    mutex_lock(&fh_mutex);
+    mutex_lock(&cache_mutex);
+
+    iso_abort_stream();
+    blockcache_destroy(dcache);
+    free(ra_buf);
+
+    dcache = nc;
+    ra_buf = nb;
+    ra_max = readahead;
+
+    for(i = 0; i < FS_CD_MAX_FILES; i++)
+        fh[i].ra = 1;
+
+    mutex_unlock(&cache_mutex);
+    mutex_unlock(&fh_mutex);
+
+    return 0;
+}
+
+void fs_iso9660_get_stats(fs_iso9660_stats_t *st) {
+    mutex_lock(&cache_mutex);
+    memcpy(st, &stats, sizeof(fs_iso9660_stats_t));
+    mutex_unlock(&cache_mutex);
+}
+
+void fs_iso9660_reset_stats(void) {
+    mutex_lock(&cache_mutex);
+    memset(&stats, 0, sizeof(fs_iso9660_stats_t));
+    mutex_unlock(&cache_mutex);
+}
+
+void fs_iso9660_init(void) {
     /* Reset fd's */
     memset(fh, 0, sizeof(fh));
 
@@ -1270,18 +1366,18 @@ void fs_iso9660_init(void) {
     mutex_init(&cache_mutex, MUTEX_TYPE_NORMAL);
     mutex_init(&fh_mutex, MUTEX_TYPE_NORMAL);
 
-    /* Allocate cache block space, properly aligned for DMA access */
-    cache_data = memalign(32, 2 * NUM_CACHE_BLOCKS * 2048);
-    caches = malloc(2 * NUM_CACHE_BLOCKS * sizeof(cache_block_t));
-
-    for(i = 0; i < NUM_CACHE_BLOCKS; i++) {
-        icache[i] = &caches[i * 2];
-        icache[i]->data = &cache_data[i * 2 * 2048];
-        icache[i]->sector = -1;
-        dcache[i] = &caches[i * 2 + 1];
-        dcache[i]->data = &cache_data[i * 2 * 2048 + 2048];
-        dcache[i]->sector = -1;
-    }
+    /* Allocate the caches (which are properly aligned for DMA access) and the
+       read-ahead buffer */
+    icache = blockcache_create(NUM_CACHE_BLOCKS, 2048, iso_bcache_read, NULL,
+                               NULL);
+    dcache = blockcache_create(FS_CD_CACHE_BLOCKS, 2048, iso_bcache_read, NULL,
+                               NULL);
+    ra_max = FS_CD_READAHEAD > FS_CD_CACHE_BLOCKS / 2 ?
+             FS_CD_CACHE_BLOCKS / 2 : FS_CD_READAHEAD;
+    ra_buf = ra_max > 1 ? memalign(32, ra_max * 2048) : NULL;
+
+    if(ra_max > 1 && !ra_buf)
+        ra_max = 0;
 
     percd_done = 0;
     iso_last_status = -1;
@@ -1299,8 +1395,12 @@ void fs_iso9660_shutdown(void) {
     vblank_handler_remove(iso_vblank_hnd);
 
     /* Dealloc cache block space */
-    free(cache_data);
-    free(caches);
+    iso_abort_stream();
+    blockcache_destroy(icache);
+    blockcache_destroy(dcache);
+    free(ra_buf);
+    icache = dcache = NULL;
+    ra_buf = NULL;
 
     /* Free muteces */
     mutex_destroy(&cache_mutex);
@@ -618,13 +618,36 @@ static int rx_enq(int ring_offset, size_t pkt_size) {
         return 1;
 }
 
-/* Transmit a single packet */
+/* Copy part of a packet out to RTL memory. Use the widest writes that the
+   alignment of both ends allows, and single bytes for whatever is left. */
+static void bba_tx_copy(const uint8 *src, uint32 dst, int len) {
+    int done = 0;
+
+    if(!(((uint32)src | dst) & 0x03)) {
+        done = len & ~3;
+        g2_write_block_32((const uint32_t *)src, dst, done >> 2);
+    }
+    else if(!(((uint32)src | dst) & 0x01)) {
+        done = len & ~1;
+        g2_write_block_16((const uint16_t *)src, dst, done >> 1);
+    }
+
+    if(len > done)
+        g2_write_block_8(src + done, dst + done, len - done);
+}
+
+/* Transmit a single packet, gathered up from a chain of buffers */
 #ifdef TX_SEMA
-static int bba_rtx(const uint8 * pkt, int len, int wait)
+static int bba_rtx(const net_pbuf_t *p, int wait)
 #else
-static int bba_tx(const uint8 * pkt, int len, int wait)
+static int bba_tx_pbuf(const net_pbuf_t *p, int wait)
 #endif
 {
+    int len = 0;
+
+    if(p->tot_len > TX_BUFFER_LEN)
+        return BBA_TX_ERROR;
+
     if(!link_stable) {
         if(wait == BBA_TX_WAIT) {
             while(!link_stable)
@@ -648,22 +671,11 @@ static int bba_tx(const uint8 * pkt, int len, int wait)
         }
     }
 
-    /* Copy the packet out to RTL memory */
+    /* Copy the packet out to RTL memory, one piece at a time */
     /* XXX could use store queues or memcpy8 here */
-
-    //g2_write_block_8(pkt, txdesc[rtl.cur_tx], len);
-
-    /* Check alignment of the packet, if its 32-bit aligned, use
-       g2_write_block_32, if its 16-bit aligned, use g2_write_block_16,
-       otherwise, use g2_write_block_8. */
-    if(!((uint32)pkt & 0x03)) {
-        g2_write_block_32((uint32 *) pkt, txdesc[rtl.cur_tx], (len + 3) >> 2);
-    }
-    else if(!((uint32)pkt & 0x01)) {
-        g2_write_block_16((uint16 *) pkt, txdesc[rtl.cur_tx], (len + 1) >> 1);
-    }
-    else {
-        g2_write_block_8(pkt, txdesc[rtl.cur_tx], len);
+    for(; p; p = p->next) {
+        bba_tx_copy(p->data, txdesc[rtl.cur_tx] + len, p->len);
+        len += p->len;
     }
 
     /* All packets must be at least 60 bytes, pad them with null bytes if
@@ -683,7 +695,7 @@ static int bba_tx(const uint8 * pkt, int len, int wait)
 }
 
 #ifdef TX_SEMA
-int bba_tx(const uint8 * pkt, int len, int wait) {
+static int bba_tx_pbuf(const net_pbuf_t *p, int wait) {
     int res;
 
     if(irq_inside_int()) {
@@ -695,13 +707,22 @@ int bba_tx(const uint8 * pkt, int len, int wait) {
     else
         sem_wait(&tx_sema);
 
-    res = bba_rtx(pkt, len, wait);
+    res = bba_rtx(p, wait);
     sem_signal(&tx_sema);
 
     return res;
 }
 #endif
 
+int bba_tx(const uint8 * pkt, int len, int wait) {
+    net_pbuf_t p = { 0 };
+
+    p.data = (uint8 *)pkt;
+    p.len = p.tot_len = len;
+
+    return bba_tx_pbuf(&p, wait);
+}
+
 void bba_lock(void) {
     //sem_wait(&bba_rx_sema2);
     //asic_evt_disable(ASIC_EVT_EXP_PCI, BBA_ASIC_IRQ);
@@ -989,6 +1010,19 @@ static int bba_if_tx(netif_t *self, const uint8 *data, int len, int blocking) {
     return 0;
 }
 
+static int bba_if_tx_pbuf(netif_t *self, const net_pbuf_t *chain,
+                          int blocking) {
+    (void)self;
+
+    if(!(bba_if.flags & NETIF_RUNNING))
+        return -1;
+
+    if(bba_tx_pbuf(chain, blocking) != BBA_TX_OK)
+        return -1;
+
+    return 0;
+}
+
 /* We'll auto-commit for now */
 static int bba_if_tx_commit(netif_t *self) {
     (void)self;
@@ -1155,6 +1189,7 @@ int bba_init(void) {
     bba_if.if_rx_poll = bba_if_rx_poll;
     bba_if.if_set_flags = bba_if_set_flags;
     bba_if.if_set_mc = bba_if_set_mc;
+    bba_if.if_tx_pbuf = bba_if_tx_pbuf;
 
     /* Attempt to set up our IP address et al from the flashrom */
     bba_set_ispcfg();
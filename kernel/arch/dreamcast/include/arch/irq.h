@@ -297,6 +297,47 @@ int irq_inside_int(void);
 
 /** @} */
 
+/** \defgroup irq_accounting    Accounting
+    \brief                      Measuring the time spent handling interrupts.
+
+    When enabled, the time spent in the kernel handling each kind of interrupt
+    or exception is measured and accumulated, along with how many of them
+    there were. This costs two reads of the nanosecond timer per interrupt,
+    so it is disabled by default.
+
+    @{
+*/
+
+/** Accumulated statistics for one kind of interrupt. */
+typedef struct irq_stats {
+    uint32_t count;     /**< Number of times it was handled */
+    uint64_t time_ns;   /**< Total time spent handling it */
+} irq_stats_t;
+
+/** Enable or disable interrupt time accounting.
+
+    \param  enable          Whether to measure interrupt handling time.
+*/
+void irq_set_accounting(bool enable);
+
+/** Retrieve the accounting statistics for an interrupt.
+
+    \param  code            The interrupt or exception to query.
+    \param  stats           Storage for the statistics.
+
+    \retval 0               On success.
+    \retval -1              On error, errno will be set as appropriate.
+
+    \par    Error Conditions:
+    \em     EINVAL - the code is out of range
+*/
+int irq_get_stats(irq_t code, irq_stats_t *stats);
+
+/** Reset the accounting statistics of all interrupts. */
+void irq_reset_stats(void);
+
+/** @} */
+
 /** \defgroup irq_mask      Mask
     \brief                  Accessors and modifiers of the IMASK state.
 
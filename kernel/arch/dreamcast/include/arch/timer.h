@@ -83,7 +83,9 @@ __BEGIN_DECLS
 
     \warning
     This timer channel is used for the timer_spin_sleep() function, which also
-    backs the kthread, C, C++, and POSIX sleep functions.
+    backs the kthread, C, C++, and POSIX sleep functions. While the sampling
+    profiler (dc/profiler.h) is running, it drives this channel instead and
+    timer_spin_sleep() spins on \ref TMU2.
 */
 #define TMU1    1
 
@@ -29,6 +29,7 @@
 #include <sys/cdefs.h>
 __BEGIN_DECLS
 
+#include <stdint.h>
 #include <arch/types.h>
 #include <kos/limits.h>
 #include <kos/fs.h>
@@ -47,6 +48,55 @@ __BEGIN_DECLS
 */
 int iso_reset(void);
 
+/** \brief  ISO9660 driver statistics.
+
+    Comparing the number of commands sent to the drive with the number of bytes
+    delivered to readers gives an idea of how well the cache and read-ahead are
+    working for a given access pattern.
+
+    \headerfile dc/fs_iso9660.h
+*/
+typedef struct fs_iso9660_stats {
+    uint32_t commands;      /**< \brief Read commands sent to the drive */
+    uint32_t streams;       /**< \brief Streamed reads started */
+    uint32_t stream_reqs;   /**< \brief Transfers from a streamed read */
+    uint32_t sectors;       /**< \brief Sectors transferred from the drive */
+    uint32_t readaheads;    /**< \brief Read-ahead transfers done */
+    uint32_t cache_hits;    /**< \brief Data cache hits */
+    uint32_t cache_misses;  /**< \brief Data cache misses */
+    uint64_t bytes;         /**< \brief Bytes delivered to readers */
+} fs_iso9660_stats_t;
+
+/** \brief  Change the size of the data cache and the read-ahead.
+
+    When a file is read sequentially in pieces that can't be transferred
+    straight into the caller's buffer (small or unaligned reads), the driver
+    reads ahead, doubling the amount each time up to the maximum given here. Once
+    a file has been read sequentially for long enough to reach the maximum,
+    the rest of it is streamed from the drive, rather than issuing a command
+    for each read-ahead.
+
+    Changing the cache throws away everything in it.
+
+    \param  blocks          The number of 2048 byte sectors to cache. The
+                            default is FS_CD_CACHE_BLOCKS.
+    \param  readahead       The maximum number of sectors to read ahead, or 0
+                            to disable read-ahead. This is limited to half of
+                            the cache. The default is FS_CD_READAHEAD.
+    \retval 0               On success.
+    \retval -1              On error (errno will be set to ENOMEM or EINVAL).
+*/
+int fs_iso9660_set_cache(size_t blocks, size_t readahead);
+
+/** \brief  Retrieve the ISO9660 driver statistics.
+
+    \param  st              Storage for the statistics.
+*/
+void fs_iso9660_get_stats(fs_iso9660_stats_t *st);
+
+/** \brief  Reset the ISO9660 driver statistics. */
+void fs_iso9660_reset_stats(void);
+
 /* \cond */
 void fs_iso9660_init(void);
 void fs_iso9660_shutdown(void);
@@ -0,0 +1,112 @@
+/* KallistiOS ##version##
+
+   arch/dreamcast/include/dc/profiler.h
+   Copyright (C) 2024 The KallistiOS Team
+
+*/
+
+/** \file    dc/profiler.h
+    \brief   Sampling profiler
+    \ingroup profiler
+
+    This file contains a simple sampling profiler. While it runs, it looks at
+    what the CPU was doing at regular intervals and records where it was and
+    which thread it was running. The samples can then be written out in the
+    "collapsed stack" format understood by flamegraph.pl, speedscope and pprof
+    (through its collapsed importer), either to the host over dcload (with a
+    /pc/ path) or to any other writable filesystem.
+
+    \author The KallistiOS Team
+    \see    dc/perf_monitor.h
+*/
+
+#ifndef __DC_PROFILER_H
+#define __DC_PROFILER_H
+
+#include <sys/cdefs.h>
+__BEGIN_DECLS
+
+#include <stddef.h>
+#include <stdio.h>
+
+/** \defgroup   profiler Sampling profiler
+    \brief      Statistical profiling of the whole program
+    \ingroup    debugging
+
+    The profiler drives \ref TMU1 to interrupt the program at the requested
+    rate. Each interrupt records the program counter of the interrupted code
+    and the thread running it. If KOS and the program are built with frame
+    pointers (FRAME_POINTERS), the callers are recorded too, up to
+    PROFILER_MAX_DEPTH frames. The samples go in a ring buffer, so if it fills
+    up, only the most recent samples are kept.
+
+    On top of that, each sample also counts what every blocked thread is waiting
+    on (the genwait wait message), which adds up to a histogram of the reasons
+    threads spend their time blocked. Interrupt time accounting (see
+    irq_set_accounting()) is enabled for as long as the profiler runs.
+
+    The addresses in the output are raw. They can be turned into function names
+    with the profsym.py script from utils/profsym, given the program's ELF file.
+
+    @{
+*/
+
+/** \brief  Maximum number of stack frames recorded per sample. */
+#define PROFILER_MAX_DEPTH      8
+
+/** \brief  Start the profiler.
+
+    \param  rate            The number of samples to take per second.
+    \param  samples         The number of samples the ring buffer can hold.
+    \retval 0               On success.
+    \retval -1              On error, errno will be set as appropriate.
+
+    \par    Error Conditions:
+    \em     EBUSY - the profiler is already running \n
+    \em     EINVAL - the rate or the number of samples is zero \n
+    \em     ENOMEM - out of memory for the ring buffer
+*/
+int profiler_start(unsigned int rate, size_t samples);
+
+/** \brief  Stop the profiler.
+
+    The samples taken are kept until the profiler is started again.
+*/
+void profiler_stop(void);
+
+/** \brief  Write the samples out as collapsed stacks.
+
+    Each line holds a thread label, the frames outermost first, and the number
+    of identical samples, like this:
+
+    \code
+    [user];0x8c010bc4;0x8c012a40 120
+    \endcode
+
+    \param  fn              The file to write to (for instance "/pc/prof.txt").
+    \retval 0               On success.
+    \retval -1              On error, errno will be set as appropriate.
+
+    \par    Error Conditions:
+    \em     EBUSY - the profiler is still running \n
+    \em     ENOENT - no samples have been taken \n
+    Any error from fopen() or from writing the file
+*/
+int profiler_write(const char *fn);
+
+/** \brief  Print a summary of the profile.
+
+    This prints, for each thread, the number of samples taken in it, its CPU
+    time and its numbers of voluntary and involuntary context switches. Then
+    comes the histogram of wait reasons, and the time spent handling each kind
+    of interrupt while the profiler ran.
+
+    \param  f               The file to print to (such as stdout).
+*/
+void profiler_print_stats(FILE *f);
+
+/** @} */
+
+__END_DECLS
+
+#endif /* __DC_PROFILER_H */
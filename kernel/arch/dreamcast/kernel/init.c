@@ -12,6 +12,7 @@
 #include <stdlib.h>
 #include <kos/dbgio.h>
 #include <kos/init.h>
+#include <kos/lockstat.h>
 #include <kos/platform.h>
 #include <arch/arch.h>
 #include <arch/irq.h>
@@ -181,6 +182,9 @@ int  __weak arch_auto_init(void) {
 
     thd_init();
 
+    if(__kos_init_flags & INIT_LOCK_STATS)
+        lockstat_enable(true);
+
     nmmgr_init();
 
     fs_init();          /* VFS */
@@ -341,6 +345,9 @@ void arch_shutdown(void) {
         malloc_stats();
     }
 
+    if(__kos_init_flags & INIT_LOCK_STATS)
+        lockstat_print(dbgio_printf);
+
     /* Shut down IRQs */
     irq_shutdown();
 }
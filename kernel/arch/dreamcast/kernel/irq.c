@@ -10,6 +10,7 @@
 /* This module contains low-level handling for IRQs and related exceptions. */
 
 #include <string.h>
+#include <errno.h>
 #include <assert.h>
 #include <stdio.h>
 #include <arch/arch.h>
@@ -50,6 +51,10 @@ static struct irq_cb   global_irq_handler;
 /* Default IRQ context location */
 static irq_context_t    irq_context_default;
 
+/* Time spent handling each kind of exception, if accounting is enabled */
+static bool irq_acct_enabled;
+static irq_stats_t irq_stats[0x100];
+
 /* Are we inside an interrupt? */
 static int inside_int;
 int irq_inside_int(void) {
@@ -206,6 +211,7 @@ void irq_handle_exception(int code) {
     const struct irq_cb *hnd;
     uint32_t evt = 0;
     int handled = 0;
+    uint64_t start = 0;
 
     switch(code) {
         /* If it's a code 0, well, we shouldn't be here. */
@@ -241,6 +247,9 @@ void irq_handle_exception(int code) {
        diagnostics returns if we try to do something in the int. */
     inside_int = ((code&0xf)<<16) | (evt&0xffff);
 
+    if(irq_acct_enabled)
+        start = timer_ns_gettime64();
+
     /* If there's a global handler, call it */
     if(global_irq_handler.hdl) {
         global_irq_handler.hdl(evt, irq_srt_addr, global_irq_handler.data);
@@ -283,10 +292,35 @@ void irq_handle_exception(int code) {
         arch_panic("unhandled IRQ/Exception");
     }
 
+    if(irq_acct_enabled) {
+        ++irq_stats[evt >> 4].count;
+        irq_stats[evt >> 4].time_ns += timer_ns_gettime64() - start;
+    }
+
     irq_disable();
     inside_int = 0;
 }
 
+void irq_set_accounting(bool enable) {
+    irq_acct_enabled = enable;
+}
+
+int irq_get_stats(irq_t code, irq_stats_t *stats) {
+    if((code >> 4) >= 0x100) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    irq_disable_scoped();
+    *stats = irq_stats[code >> 4];
+    return 0;
+}
+
+void irq_reset_stats(void) {
+    irq_disable_scoped();
+    memset(irq_stats, 0, sizeof(irq_stats));
+}
+
 void irq_handle_trapa(irq_t code, irq_context_t *context, void *data) {
     const struct irq_cb *hnd, *handlers = data;
     uint32_t vec;
@@ -0,0 +1,312 @@
+/* KallistiOS ##version##
+
+   arch/dreamcast/kernel/profiler.c
+   Copyright (C) 2024 The KallistiOS Team
+*/
+
+/* A sampling profiler. TMU1 interrupts the program at a fixed rate, and each
+   interrupt records the interrupted PC (plus its callers, if we have frame
+   pointers) and thread in a ring buffer. Nothing gets aggregated in the
+   interrupt handler; the samples are sorted and counted when they are written
+   out, which keeps the handler short and allocation free. */
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <arch/arch.h>
+#include <arch/irq.h>
+#include <arch/timer.h>
+#include <kos/thread.h>
+#include <dc/profiler.h>
+
+/* Number of different wait messages we keep track of. Anything beyond that
+   goes in the last slot. */
+#define PROF_WAIT_REASONS   32
+
+typedef struct prof_sample {
+    tid_t tid;
+    uint32_t depth;
+    uint32_t frames[PROFILER_MAX_DEPTH];   /* Innermost first */
+} prof_sample_t;
+
+typedef struct prof_wait {
+    const char *msg;
+    uint32_t samples;
+} prof_wait_t;
+
+static prof_sample_t *prof_ring;
+static size_t prof_size, prof_head, prof_count;
+static uint32_t prof_dropped;
+static bool prof_running;
+
+static prof_wait_t prof_waits[PROF_WAIT_REASONS];
+static int prof_wait_count;
+
+static void prof_backtrace(prof_sample_t *s, const irq_context_t *cxt) {
+#ifdef FRAME_POINTERS
+    uint32_t fp = CONTEXT_FP(*cxt), ra;
+
+    while(s->depth < PROFILER_MAX_DEPTH && fp != 0xffffffff) {
+        if((fp & 3) || fp < 0x8c000000 || fp > _arch_mem_top)
+            break;
+
+        ra = arch_fptr_ret_addr(fp);
+
+        if(!arch_valid_address(ra))
+            break;
+
+        s->frames[s->depth++] = ra;
+        fp = arch_fptr_next(fp);
+    }
+#else
+    (void)s;
+    (void)cxt;
+#endif
+}
+
+static int prof_count_wait(kthread_t *thd, void *data) {
+    const char *msg = thd->wait_msg ? thd->wait_msg : "(none)";
+    int i;
+
+    (void)data;
+
+    if(thd->state != STATE_WAIT)
+        return 0;
+
+    /* Wait messages are nearly always string literals, so compare pointers
+       here and leave merging any duplicates for later. */
+    for(i = 0; i < prof_wait_count; ++i) {
+        if(prof_waits[i].msg == msg)
+            break;
+    }
+
+    if(i == prof_wait_count) {
+        if(prof_wait_count < PROF_WAIT_REASONS - 1)
+            prof_waits[prof_wait_count++].msg = msg;
+        else
+            prof_waits[i].msg = "(other)";
+    }
+
+    ++prof_waits[i].samples;
+    return 0;
+}
+
+static void prof_sample(irq_t src, irq_context_t *cxt, void *data) {
+    prof_sample_t *s = &prof_ring[prof_head];
+
+    (void)src;
+    (void)data;
+
+    if(++prof_head == prof_size)
+        prof_head = 0;
+
+    if(prof_count < prof_size)
+        ++prof_count;
+    else
+        ++prof_dropped;
+
+    memset(s, 0, sizeof(*s));
+    s->tid = thd_current ? thd_current->tid : 0;
+    s->frames[s->depth++] = CONTEXT_PC(*cxt);
+    prof_backtrace(s, cxt);
+
+    thd_each(prof_count_wait, NULL);
+}
+
+int profiler_start(unsigned int rate, size_t samples) {
+    prof_sample_t *ring;
+
+    if(prof_running) {
+        errno = EBUSY;
+        return -1;
+    }
+
+    if(!rate || !samples) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    /* Someone is in timer_spin_sleep(). */
+    if(timer_running(TMU1)) {
+        errno = EBUSY;
+        return -1;
+    }
+
+    if(!(ring = (prof_sample_t *)malloc(samples * sizeof(prof_sample_t)))) {
+        errno = ENOMEM;
+        return -1;
+    }
+
+    free(prof_ring);
+    prof_ring = ring;
+    prof_size = samples;
+    prof_head = prof_count = 0;
+    prof_dropped = 0;
+
+    memset(prof_waits, 0, sizeof(prof_waits));
+    prof_wait_count = 0;
+
+    irq_reset_stats();
+    irq_set_accounting(true);
+
+    irq_disable_scoped();
+    irq_set_handler(EXC_TMU1_TUNI1, prof_sample, NULL);
+    timer_prime(TMU1, rate, 1);
+    timer_clear(TMU1);
+    timer_start(TMU1);
+    prof_running = true;
+
+    return 0;
+}
+
+void profiler_stop(void) {
+    irq_disable_scoped();
+
+    if(!prof_running)
+        return;
+
+    timer_stop(TMU1);
+    timer_clear(TMU1);
+    irq_set_handler(EXC_TMU1_TUNI1, NULL, NULL);
+    irq_set_accounting(false);
+    prof_running = false;
+}
+
+static int prof_sample_cmp(const void *a, const void *b) {
+    return memcmp(a, b, sizeof(prof_sample_t));
+}
+
+/* Sort the samples so that identical ones are next to each other. The ring
+   buffer order doesn't matter once sampling has stopped. */
+static void prof_sort(void) {
+    qsort(prof_ring, prof_count, sizeof(prof_sample_t), prof_sample_cmp);
+    prof_head = prof_count % prof_size;
+}
+
+static void prof_write_label(FILE *f, tid_t tid) {
+    kthread_t *thd = thd_by_tid(tid);
+    const char *c;
+
+    if(!thd) {
+        fprintf(f, "tid %d", tid);
+        return;
+    }
+
+    /* Semicolons separate frames, so keep them out of the label. */
+    for(c = thd_get_label(thd); *c; ++c)
+        fputc(*c == ';' ? ':' : *c, f);
+}
+
+int profiler_write(const char *fn) {
+    const prof_sample_t *s, *end;
+    uint32_t n;
+    int i, err;
+    FILE *f;
+
+    if(prof_running) {
+        errno = EBUSY;
+        return -1;
+    }
+
+    if(!prof_count) {
+        errno = ENOENT;
+        return -1;
+    }
+
+    if(!(f = fopen(fn, "w")))
+        return -1;
+
+    prof_sort();
+    end = prof_ring + prof_count;
+
+    for(s = prof_ring; s < end; s += n) {
+        for(n = 1; s + n < end && !prof_sample_cmp(s, s + n); ++n)
+            ;
+
+        prof_write_label(f, s->tid);
+
+        for(i = s->depth - 1; i >= 0; --i)
+            fprintf(f, ";0x%08lx", s->frames[i]);
+
+        fprintf(f, " %lu\n", n);
+    }
+
+    err = ferror(f);
+
+    if(fclose(f) || err)
+        return -1;
+
+    return 0;
+}
+
+static int prof_print_thread(kthread_t *thd, void *data) {
+    FILE *f = (FILE *)data;
+    uint32_t samples = 0;
+    size_t i;
+
+    for(i = 0; i < prof_count; ++i) {
+        if(prof_ring[i].tid == thd->tid)
+            ++samples;
+    }
+
+    fprintf(f, "%5d  %8lu  %12llu  %9lu  %11lu  %s\n", thd->tid, samples,
+            thd_get_cpu_time(thd) / 1000, thd->switches.voluntary,
+            thd->switches.involuntary, thd_get_label(thd));
+
+    return 0;
+}
+
+void profiler_print_stats(FILE *f) {
+    irq_stats_t st;
+    uint32_t samples;
+    int i, j;
+
+    fprintf(f, "Profiler: %lu samples kept, %lu dropped\n",
+            (uint32_t)prof_count, prof_dropped);
+
+    fprintf(f, "\n  tid   samples   cpu time us  voluntary  involuntary"
+            "  name\n");
+    thd_each(prof_print_thread, f);
+
+    if(prof_wait_count)
+        fprintf(f, "\nWait reasons (samples of blocked threads):\n");
+
+    /* Merge duplicate messages that came from different string literals as we
+       go, by only printing the first of each. The last slot only gets used for
+       the overflow, if there was one. */
+    for(i = 0; i < PROF_WAIT_REASONS; ++i) {
+        if(!prof_waits[i].msg)
+            continue;
+
+        for(j = 0; j < i; ++j) {
+            if(prof_waits[j].msg &&
+               !strcmp(prof_waits[i].msg, prof_waits[j].msg))
+                break;
+        }
+
+        if(j < i)
+            continue;
+
+        samples = prof_waits[i].samples;
+
+        for(j = i + 1; j < PROF_WAIT_REASONS; ++j) {
+            if(prof_waits[j].msg &&
+               !strcmp(prof_waits[i].msg, prof_waits[j].msg))
+                samples += prof_waits[j].samples;
+        }
+
+        fprintf(f, "  %8lu  %s\n", samples, prof_waits[i].msg);
+    }
+
+    fprintf(f, "\nInterrupts:\n   code     count       time us\n");
+
+    for(i = 0; i < 0x100; ++i) {
+        irq_get_stats((irq_t)(i << 4), &st);
+
+        if(st.count)
+            fprintf(f, "  0x%03x  %8lu  %12llu\n", i << 4, st.count,
+                    st.time_ns / 1000);
+    }
+}
@@ -12,6 +12,7 @@
 #include <string.h>
 #include <errno.h>
 #include <sys/queue.h>
+#include <kos/slab.h>
 #include <dc/sound/sound.h>
 #include <arch/spinlock.h>
 
@@ -64,6 +65,10 @@ static int initted = 0;
 static TAILQ_HEAD(snd_block_q, snd_block_str) pool = {0};
 static spinlock_t snd_mem_mutex = SPINLOCK_INITIALIZER;
 
+/* Where the block descriptors are allocated from. This is kept around across
+   shutdowns. */
+static kmem_cache_t *snd_blk_cache;
+
 
 /* Reinitialize the pool with the given RAM base offset */
 int snd_mem_init(uint32 reserve) {
@@ -72,6 +77,11 @@ int snd_mem_init(uint32 reserve) {
     if(initted)
         snd_mem_shutdown();
 
+    if(!snd_blk_cache &&
+       !(snd_blk_cache = kmem_cache_create("snd_block", sizeof(snd_block_t), 0,
+                                           NULL)))
+        return -1;
+
     if(irq_inside_int()) {
         if(!spinlock_trylock(&snd_mem_mutex)) {
             errno = EAGAIN;
@@ -88,7 +98,7 @@ int snd_mem_init(uint32 reserve) {
     /* Make sure our tailq is initted */
     TAILQ_INIT(&pool);
 
-    blk = (snd_block_t *)malloc(sizeof(snd_block_t));
+    blk = (snd_block_t *)kmem_cache_alloc(snd_blk_cache);
 
     if(!blk) {
         spinlock_unlock(&snd_mem_mutex);
@@ -140,7 +150,7 @@ void snd_mem_shutdown(void) {
             dbglog(DBG_DEBUG, "snd_mem_shutdown: unused block at %08lx (size %d)\n", e->addr, e->size);
 
 #endif
-        free(e);
+        kmem_cache_free(snd_blk_cache, e);
         e = n;
     }
 
@@ -196,7 +206,7 @@ uint32 snd_mem_malloc(size_t size) {
     }
 
     /* Nope: break it up into two chunks */
-    e = (snd_block_t*)malloc(sizeof(snd_block_t));
+    e = (snd_block_t*)kmem_cache_alloc(snd_blk_cache);
 
     if(e == NULL) {
         dbglog(DBG_ERROR, "snd_mem_malloc: not enough main memory to alloc(%d)\n", size);
@@ -271,7 +281,7 @@ void snd_mem_free(uint32 addr) {
 
         o->size += e->size;
         TAILQ_REMOVE(&pool, e, qent);
-        free(e);
+        kmem_cache_free(snd_blk_cache, e);
         e = o;
     }
 
@@ -285,7 +295,7 @@ void snd_mem_free(uint32 addr) {
 
         e->size += o->size;
         TAILQ_REMOVE(&pool, o, qent);
-        free(o);
+        kmem_cache_free(snd_blk_cache, o);
     }
     spinlock_unlock(&snd_mem_mutex);
 }
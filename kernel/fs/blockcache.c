@@ -0,0 +1,352 @@
+/* KallistiOS ##version##
+
+   blockcache.c
+   Copyright (C) 2024 The KallistiOS Team
+*/
+
+/* This is a replacement for the array-based MRU caches that used to live in
+   each of the block device based filesystems. Those had to scan the whole array
+   on every lookup and then shift everything down to move the block to the MRU
+   position, which made large caches pretty much useless. Here each block lives
+   in a hash bucket (for lookup) and on an LRU list (for replacement), so both
+   of those operations are constant time. */
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <malloc.h>
+#include <sys/queue.h>
+
+#include <kos/blockcache.h>
+
+#define BC_FLAG_VALID   1
+#define BC_FLAG_DIRTY   2
+
+typedef struct bc_entry {
+    LIST_ENTRY(bc_entry) hash;
+    TAILQ_ENTRY(bc_entry) lru;
+    uint32_t flags;
+    uint32_t block;
+    int pins;
+    uint8_t *data;
+} bc_entry_t;
+
+LIST_HEAD(bc_bucket, bc_entry);
+TAILQ_HEAD(bc_lru, bc_entry);
+
+struct kos_blockcache {
+    /* Least recently used at the head, most recently used at the tail. */
+    struct bc_lru lru;
+    struct bc_bucket *buckets;
+    uint32_t hash_shift;
+
+    bc_entry_t *entries;
+    uint8_t *data;
+    int entry_count;
+    size_t block_size;
+
+    blockcache_read_t read;
+    blockcache_write_t write;
+    void *ctx;
+
+    blockcache_stats_t stats;
+};
+
+static inline uint32_t bc_hash(const kos_blockcache_t *c, uint32_t block) {
+    /* Fibonacci hashing. Sequential block numbers spread out nicely. */
+    return (block * 2654435761U) >> c->hash_shift;
+}
+
+static bc_entry_t *bc_find(kos_blockcache_t *c, uint32_t block) {
+    bc_entry_t *i;
+
+    LIST_FOREACH(i, &c->buckets[bc_hash(c, block)], hash) {
+        if(i->block == block)
+            return i;
+    }
+
+    return NULL;
+}
+
+static inline void bc_make_mru(kos_blockcache_t *c, bc_entry_t *e) {
+    if(e != TAILQ_LAST(&c->lru, bc_lru)) {
+        TAILQ_REMOVE(&c->lru, e, lru);
+        TAILQ_INSERT_TAIL(&c->lru, e, lru);
+    }
+}
+
+/* Grab the least recently used entry that isn't pinned so that it can be
+   reused for another block, writing it back first if need be. On success, the
+   entry is no longer in the hash table and is marked invalid. */
+static bc_entry_t *bc_evict(kos_blockcache_t *c, int *err) {
+    bc_entry_t *e;
+    int rv;
+
+    /* Only a handful of blocks are ever pinned at once (one for each thread
+       copying out of the cache), so this won't go far. */
+    TAILQ_FOREACH(e, &c->lru, lru) {
+        if(!e->pins)
+            break;
+    }
+
+    if(!e) {
+        *err = EBUSY;
+        return NULL;
+    }
+
+    if(e->flags & BC_FLAG_DIRTY) {
+        if(!c->write) {
+            *err = EROFS;
+            return NULL;
+        }
+
+        if((rv = c->write(c->ctx, e->block, e->data))) {
+            *err = -rv;
+            return NULL;
+        }
+
+        ++c->stats.writebacks;
+        --c->stats.dirty;
+    }
+
+    if(e->flags & BC_FLAG_VALID) {
+        LIST_REMOVE(e, hash);
+        ++c->stats.evictions;
+    }
+
+    e->flags = 0;
+    return e;
+}
+
+static void bc_insert(kos_blockcache_t *c, bc_entry_t *e, uint32_t block,
+                      uint32_t flags) {
+    e->block = block;
+    e->flags = flags;
+    LIST_INSERT_HEAD(&c->buckets[bc_hash(c, block)], e, hash);
+    bc_make_mru(c, e);
+}
+
+kos_blockcache_t *blockcache_create(int entries, size_t block_size,
+                                    blockcache_read_t rd,
+                                    blockcache_write_t wr, void *ctx) {
+    kos_blockcache_t *rv;
+    uint32_t buckets = 2, shift = 31;
+    int i;
+
+    if(entries <= 0 || !block_size || !rd) {
+        errno = EINVAL;
+        return NULL;
+    }
+
+    /* Aim for a load factor of at most one entry per bucket. */
+    while(buckets < (uint32_t)entries) {
+        buckets <<= 1;
+        --shift;
+    }
+
+    if(!(rv = (kos_blockcache_t *)malloc(sizeof(kos_blockcache_t))))
+        return NULL;
+
+    memset(rv, 0, sizeof(kos_blockcache_t));
+
+    if(!(rv->buckets = (struct bc_bucket *)malloc(sizeof(struct bc_bucket) *
+                                                  buckets)))
+        goto out_rv;
+
+    if(!(rv->entries = (bc_entry_t *)malloc(sizeof(bc_entry_t) * entries)))
+        goto out_buckets;
+
+    /* Allocate all of the data in one go. Keep it aligned for DMA. */
+    if(!(rv->data = (uint8_t *)memalign(32, block_size * entries)))
+        goto out_entries;
+
+    for(i = 0; i < (int)buckets; ++i) {
+        LIST_INIT(&rv->buckets[i]);
+    }
+
+    TAILQ_INIT(&rv->lru);
+
+    for(i = 0; i < entries; ++i) {
+        rv->entries[i].flags = 0;
+        rv->entries[i].block = 0;
+        rv->entries[i].pins = 0;
+        rv->entries[i].data = rv->data + block_size * i;
+        TAILQ_INSERT_TAIL(&rv->lru, &rv->entries[i], lru);
+    }
+
+    rv->hash_shift = shift;
+    rv->entry_count = entries;
+    rv->block_size = block_size;
+    rv->read = rd;
+    rv->write = wr;
+    rv->ctx = ctx;
+    rv->stats.entries = entries;
+
+    return rv;
+
+out_entries:
+    free(rv->entries);
+out_buckets:
+    free(rv->buckets);
+out_rv:
+    free(rv);
+    return NULL;
+}
+
+void blockcache_destroy(kos_blockcache_t *c) {
+    if(!c)
+        return;
+
+    free(c->data);
+    free(c->entries);
+    free(c->buckets);
+    free(c);
+}
+
+uint8_t *blockcache_read(kos_blockcache_t *c, uint32_t block, int *err) {
+    bc_entry_t *e;
+    int rv;
+
+    if((e = bc_find(c, block))) {
+        ++c->stats.hits;
+        bc_make_mru(c, e);
+        return e->data;
+    }
+
+    ++c->stats.misses;
+
+    if(!(e = bc_evict(c, err)))
+        return NULL;
+
+    /* Try to read the block in question. If it fails, the entry stays invalid
+       at the LRU end of the list, so it'll be the first one reused. */
+    if((rv = c->read(c->ctx, block, e->data))) {
+        *err = -rv;
+        return NULL;
+    }
+
+    bc_insert(c, e, block, BC_FLAG_VALID);
+    return e->data;
+}
+
+uint8_t *blockcache_pin(kos_blockcache_t *c, uint32_t block, int *err) {
+    uint8_t *rv;
+
+    if((rv = blockcache_read(c, block, err)))
+        ++c->entries[(rv - c->data) / c->block_size].pins;
+
+    return rv;
+}
+
+void blockcache_unpin(kos_blockcache_t *c, const uint8_t *data) {
+    --c->entries[(data - c->data) / c->block_size].pins;
+}
+
+uint8_t *blockcache_lookup(kos_blockcache_t *c, uint32_t block) {
+    bc_entry_t *e = bc_find(c, block);
+
+    return e ? e->data : NULL;
+}
+
+uint8_t *blockcache_claim(kos_blockcache_t *c, uint32_t block, int *err) {
+    bc_entry_t *e;
+
+    if((e = bc_find(c, block))) {
+        ++c->stats.hits;
+
+        if(!(e->flags & BC_FLAG_DIRTY)) {
+            e->flags |= BC_FLAG_DIRTY;
+            ++c->stats.dirty;
+        }
+
+        bc_make_mru(c, e);
+        return e->data;
+    }
+
+    ++c->stats.misses;
+
+    if(!(e = bc_evict(c, err)))
+        return NULL;
+
+    bc_insert(c, e, block, BC_FLAG_VALID | BC_FLAG_DIRTY);
+    ++c->stats.dirty;
+    return e->data;
+}
+
+int blockcache_insert(kos_blockcache_t *c, uint32_t block,
+                      const uint8_t *data) {
+    bc_entry_t *e;
+    int err;
+
+    /* Whatever is already there is at least as new as what we were given. */
+    if(bc_find(c, block))
+        return 0;
+
+    if(!(e = bc_evict(c, &err)))
+        return -err;
+
+    memcpy(e->data, data, c->block_size);
+    bc_insert(c, e, block, BC_FLAG_VALID);
+    return 0;
+}
+
+int blockcache_mark_dirty(kos_blockcache_t *c, uint32_t block) {
+    bc_entry_t *e;
+
+    if(!(e = bc_find(c, block)))
+        return -EINVAL;
+
+    if(!(e->flags & BC_FLAG_DIRTY)) {
+        e->flags |= BC_FLAG_DIRTY;
+        ++c->stats.dirty;
+    }
+
+    bc_make_mru(c, e);
+    return 0;
+}
+
+int blockcache_writeback(kos_blockcache_t *c) {
+    bc_entry_t *e;
+    int err;
+
+    if(!c->write)
+        return c->stats.dirty ? -EROFS : 0;
+
+    /* Write back in LRU order, which is as good an order as any. */
+    TAILQ_FOREACH(e, &c->lru, lru) {
+        if(e->flags & BC_FLAG_DIRTY) {
+            if((err = c->write(c->ctx, e->block, e->data)))
+                return err;
+
+            e->flags &= ~BC_FLAG_DIRTY;
+            ++c->stats.writebacks;
+            --c->stats.dirty;
+        }
+    }
+
+    return 0;
+}
+
+void blockcache_invalidate(kos_blockcache_t *c) {
+    bc_entry_t *e;
+
+    TAILQ_FOREACH(e, &c->lru, lru) {
+        if(e->flags & BC_FLAG_VALID)
+            LIST_REMOVE(e, hash);
+
+        e->flags = 0;
+    }
+
+    c->stats.dirty = 0;
+}
+
+void blockcache_get_stats(const kos_blockcache_t *c, blockcache_stats_t *st) {
+    memcpy(st, &c->stats, sizeof(blockcache_stats_t));
+}
+
+void blockcache_reset_stats(kos_blockcache_t *c) {
+    c->stats.hits = 0;
+    c->stats.misses = 0;
+    c->stats.evictions = 0;
+    c->stats.writebacks = 0;
+}
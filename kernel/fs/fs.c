@@ -35,10 +35,12 @@ something like this:
 #include <stdlib.h>
 #include <limits.h>
 #include <kos/fs.h>
+#include <kos/fs_aio.h>
 #include <kos/thread.h>
 #include <kos/mutex.h>
 #include <kos/nmmgr.h>
 #include <kos/dbgio.h>
+#include <kos/slab.h>
 
 /* File handle structure; this is an entirely internal structure so it does
    not go in a header file. */
@@ -52,9 +54,17 @@ typedef struct fs_hnd {
 /* The global file descriptor table */
 fs_hnd_t * fd_table[FD_SETSIZE] = { NULL };
 
+/* Where file handles are allocated from */
+static kmem_cache_t *fs_hnd_cache;
+
 /* Internal file commands for root dir reading */
 static fs_hnd_t * fs_root_opendir(void) {
-    return calloc(1, sizeof(fs_hnd_t));
+    fs_hnd_t *hnd = kmem_cache_alloc(fs_hnd_cache);
+
+    if(hnd)
+        memset(hnd, 0, sizeof(fs_hnd_t));
+
+    return hnd;
 }
 
 /* Not thread-safe right now */
@@ -143,7 +153,7 @@ static fs_hnd_t * fs_hnd_open(const char *fn, int mode) {
     if(h == NULL) return NULL;
 
     /* Wrap it up in a structure */
-    hnd = malloc(sizeof(fs_hnd_t));
+    hnd = kmem_cache_alloc(fs_hnd_cache);
 
     if(hnd == NULL) {
         cur->close(h);
@@ -181,7 +191,7 @@ static int fs_hnd_unref(fs_hnd_t *ref) {
     if(ref->handler && ref->handler->close)
         retval = ref->handler->close(ref->hnd);
 
-    free(ref);
+    kmem_cache_free(fs_hnd_cache, ref);
     return retval;
 }
 
@@ -245,7 +255,7 @@ file_t fs_open_handle(vfs_handler_t * vfs, void * vhnd) {
     fs_hnd_t * hnd;
 
     /* Wrap it up in a structure */
-    hnd = malloc(sizeof(fs_hnd_t));
+    hnd = kmem_cache_alloc(fs_hnd_cache);
 
     if(hnd == NULL) {
         errno = ENOMEM;
@@ -330,6 +340,9 @@ static fs_hnd_t * fs_map_hnd(file_t fd) {
     return fd_table[fd];
 }
 
+/* In poll.c */
+extern void __poll_fd_closed(int fd);
+
 /* Close a file and clean up the handle */
 int fs_close(file_t fd) {
     int retval;
@@ -337,6 +350,9 @@ int fs_close(file_t fd) {
 
     if(!h) return -1;
 
+    /* Nobody can be waiting on this descriptor for the next file to get it */
+    __poll_fd_closed(fd);
+
     /* Deref it and remove it from our table */
     retval = fs_hnd_unref(h);
 
@@ -946,9 +962,15 @@ int fs_fstat(file_t fd, struct stat *st) {
 
 /* Initialize FS structures */
 int fs_init(void) {
+    if(!fs_hnd_cache &&
+       !(fs_hnd_cache = kmem_cache_create("fs_hnd", sizeof(fs_hnd_t), 0,
+                                          NULL)))
+        return -1;
+
     return 0;
 }
 
 void fs_shutdown(void) {
+    fs_aio_shutdown();
     fs_fdtbl_destroy();
 }
@@ -0,0 +1,267 @@
+/* KallistiOS ##version##
+
+   fs_aio.c
+   Copyright (C) 2024 The KallistiOS Team
+*/
+
+/* This module implements asynchronous reads and writes on top of the VFS.
+   Each filesystem handler gets a worker thread of its own the first time a
+   request is made on one of its files, and its requests go through that, in
+   the order they were made. That way, a long transfer on the CD doesn't hold
+   up requests on an SD card, for instance. For each request, the worker gives
+   the filesystem a chance to handle it natively (through the aio_submit
+   member of its vfs_handler_t), and if it doesn't want to, just does a normal
+   read or write on the file.
+
+   Workers are found by the name their handler is mounted at, so that
+   unmounting and remounting something reuses the same one, and are only
+   stopped by fs_aio_shutdown().
+
+   Each request holds a duplicate of the file descriptor it was made on, so
+   that the file stays open until the request is done, even if the caller
+   closes its own descriptor. */
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/queue.h>
+#include <arch/irq.h>
+#include <kos/fs.h>
+#include <kos/fs_aio.h>
+#include <kos/genwait.h>
+#include <kos/mutex.h>
+#include <kos/worker_thread.h>
+
+typedef struct aio_queue {
+    LIST_ENTRY(aio_queue) entry;
+    kthread_worker_t *worker;
+    char name[NAME_MAX];
+} aio_queue_t;
+
+static LIST_HEAD(, aio_queue) aio_queues = LIST_HEAD_INITIALIZER(aio_queues);
+static mutex_t aio_mutex = MUTEX_INITIALIZER;
+
+/* Mark a request as done and let anyone who cares know about it. */
+static void fs_aio_finish(fs_aio_t *req) {
+    fs_aio_callback_t cb = req->callback;
+    void *data = req->data;
+    irq_mask_t flags;
+
+    fs_close(req->fd);
+    req->fd = FILEHND_INVALID;
+
+    flags = irq_disable();
+    req->state = FS_AIO_DONE;
+    genwait_wake_all(req);
+    irq_restore(flags);
+
+    /* The request may be freed or resubmitted by either a waiter or the
+       callback from here on out, so don't touch it again. */
+    if(cb)
+        cb(req, data);
+}
+
+static void fs_aio_process(fs_aio_t *req) {
+    vfs_handler_t *vfs = fs_get_handler(req->fd);
+    ssize_t rv;
+
+    /* Give the filesystem a chance to do it itself first. */
+    if(vfs && vfs->aio_submit) {
+        if(!vfs->aio_submit(fs_get_handle(req->fd), req))
+            return;
+
+        if(errno != ENOTSUP) {
+            req->result = -1;
+            req->error = errno;
+            fs_aio_finish(req);
+            return;
+        }
+    }
+
+    if(req->op == FS_AIO_READ)
+        rv = fs_read(req->fd, req->buf, req->cnt);
+    else
+        rv = fs_write(req->fd, req->buf, req->cnt);
+
+    req->result = rv;
+    req->error = rv < 0 ? errno : 0;
+    fs_aio_finish(req);
+}
+
+static void fs_aio_thread(void *d) {
+    aio_queue_t *q = (aio_queue_t *)d;
+    kthread_job_t *job;
+    fs_aio_t *req;
+    irq_mask_t flags;
+    int state;
+
+    while((job = thd_worker_dequeue_job(q->worker))) {
+        req = (fs_aio_t *)job->data;
+
+        /* Requests show up in the queue twice: once when they're submitted
+           (pending), and once when a filesystem (or fs_aio_cancel) finishes
+           them (running). */
+        flags = irq_disable();
+
+        if((state = req->state) == FS_AIO_PENDING)
+            req->state = FS_AIO_RUNNING;
+
+        irq_restore(flags);
+
+        if(state == FS_AIO_PENDING)
+            fs_aio_process(req);
+        else
+            fs_aio_finish(req);
+    }
+}
+
+/* Find the worker for the filesystem the file is on, starting it if this is
+   the first request made there. */
+static kthread_worker_t *fs_aio_get_worker(file_t fd) {
+    kthread_attr_t attr = { 0 };
+    char label[NAME_MAX + 8];
+    vfs_handler_t *vfs;
+    aio_queue_t *q;
+
+    if(!(vfs = fs_get_handler(fd)))
+        return NULL;
+
+    mutex_lock(&aio_mutex);
+
+    LIST_FOREACH(q, &aio_queues, entry) {
+        if(!strcmp(q->name, vfs->nmmgr.pathname))
+            break;
+    }
+
+    if(!q) {
+        if(!(q = (aio_queue_t *)malloc(sizeof(aio_queue_t)))) {
+            mutex_unlock(&aio_mutex);
+            errno = ENOMEM;
+            return NULL;
+        }
+
+        strncpy(q->name, vfs->nmmgr.pathname, NAME_MAX - 1);
+        q->name[NAME_MAX - 1] = 0;
+
+        snprintf(label, sizeof(label), "fs_aio %s", q->name);
+        attr.label = label;
+
+        if(!(q->worker = thd_worker_create_ex(&attr, &fs_aio_thread, q))) {
+            mutex_unlock(&aio_mutex);
+            free(q);
+            errno = ENOMEM;
+            return NULL;
+        }
+
+        LIST_INSERT_HEAD(&aio_queues, q, entry);
+    }
+
+    mutex_unlock(&aio_mutex);
+    return q->worker;
+}
+
+static int fs_aio_submit(fs_aio_t *req, int op, file_t fd, void *buf,
+                         size_t cnt, fs_aio_callback_t cb, void *data) {
+    kthread_worker_t *worker;
+
+    if(req->state == FS_AIO_PENDING || req->state == FS_AIO_RUNNING) {
+        errno = EBUSY;
+        return -1;
+    }
+
+    /* Hang on to the file until we're done with it. */
+    if((req->fd = fs_dup(fd)) < 0)
+        return -1;
+
+    if(!(worker = fs_aio_get_worker(req->fd))) {
+        fs_close(req->fd);
+        req->fd = FILEHND_INVALID;
+        return -1;
+    }
+
+    req->op = op;
+    req->buf = buf;
+    req->cnt = cnt;
+    req->callback = cb;
+    req->data = data;
+    req->result = 0;
+    req->error = 0;
+    req->job.data = req;
+    req->worker = worker;
+    req->state = FS_AIO_PENDING;
+
+    thd_worker_add_job(worker, &req->job);
+    thd_worker_wakeup(worker);
+
+    return 0;
+}
+
+int fs_aio_read(fs_aio_t *req, file_t fd, void *buf, size_t cnt,
+                fs_aio_callback_t cb, void *data) {
+    return fs_aio_submit(req, FS_AIO_READ, fd, buf, cnt, cb, data);
+}
+
+int fs_aio_write(fs_aio_t *req, file_t fd, const void *buf, size_t cnt,
+                 fs_aio_callback_t cb, void *data) {
+    return fs_aio_submit(req, FS_AIO_WRITE, fd, (void *)buf, cnt, cb, data);
+}
+
+int fs_aio_status(const fs_aio_t *req) {
+    return req->state;
+}
+
+ssize_t fs_aio_wait(fs_aio_t *req) {
+    irq_disable_scoped();
+
+    while(req->state == FS_AIO_PENDING || req->state == FS_AIO_RUNNING)
+        genwait_wait(req, "fs_aio_wait", 0, NULL);
+
+    if(req->result < 0)
+        errno = req->error;
+
+    return req->result;
+}
+
+int fs_aio_cancel(fs_aio_t *req) {
+    irq_disable_scoped();
+
+    if(req->state == FS_AIO_RUNNING) {
+        errno = EBUSY;
+        return -1;
+    }
+    else if(req->state != FS_AIO_PENDING) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    /* It's still in the queue, so just let the worker know that it's already
+       done when it gets to it. */
+    req->result = -1;
+    req->error = ECANCELED;
+    req->state = FS_AIO_RUNNING;
+
+    return 0;
+}
+
+void fs_aio_complete(fs_aio_t *req, ssize_t rv, int err) {
+    req->result = rv;
+    req->error = rv < 0 ? err : 0;
+
+    thd_worker_add_job(req->worker, &req->job);
+    thd_worker_wakeup(req->worker);
+}
+
+void fs_aio_shutdown(void) {
+    aio_queue_t *q;
+
+    mutex_lock(&aio_mutex);
+
+    while((q = LIST_FIRST(&aio_queues))) {
+        LIST_REMOVE(q, entry);
+        thd_worker_destroy(q->worker);
+        free(q);
+    }
+
+    mutex_unlock(&aio_mutex);
+}
@@ -14,13 +14,19 @@ many operating systems would do, this file system keeps the directory structure
 and file data in allocated chunks of RAM. This also means that the ramdisk can
 get as big as the memory available, there's no arbitrary limit.
 
-A note of warning about thread usage here as well. This FS is protected against
-thread contention at a file handle and data structure level. This means that the
-directory structures and the file handles will never become inconsistent. However,
-it is not protected at the individual file level. Because of this limitation, only
-one file handle may be open to an individual file for writing at any given time.
-If the file is already open for reading, it cannot be written to. Likewise, if
-the file is open for writing, you can't open it for reading or writing.
+File data is kept in fixed-size chunks (RD_CHUNK_SIZE bytes each), so growing a
+file never needs to copy what's already there. A file may also start with one
+contiguous block of data, which is how fs_ramdisk_attach() gets a buffer into
+the ramdisk without copying it. mmap() and fs_ramdisk_detach() gather the whole
+file into one such block if it isn't in one already.
+
+A note of warning about thread usage here as well. The directory structures and
+the file handle table are protected by a single mutex, and the data of each file
+by a mutex of its own, so reading or writing one file doesn't hold up others.
+However, only one file handle may be open to an individual file for writing at
+any given time. If the file is already open for reading, it cannot be written
+to. Likewise, if the file is open for writing, you can't open it for reading or
+writing.
 
 So for example, if you wanted to cache an MP3 in the ramdisk, you'd copy the data
 to the ramdisk in write mode, then close the file and let the library re-open it
@@ -33,6 +39,7 @@ cache data from disk rather than as a general purpose file system.
 
 #include <kos/thread.h>
 #include <kos/mutex.h>
+#include <kos/lockstat.h>
 #include <kos/fs_ramdisk.h>
 #include <kos/opts.h>
 #include <malloc.h>
@@ -50,6 +57,9 @@ cache data from disk rather than as a general purpose file system.
 char *strdup(const char *);
 #endif
 
+/* Size of each chunk of file data */
+#define RD_CHUNK_SIZE   4096
+
 /* File definition */
 typedef struct rd_file {
     char    * name;     /* File name -- allocated */
@@ -59,17 +69,23 @@ typedef struct rd_file {
     int usage;      /* Usage count (unopened is 0) */
 
     /* For the following two members:
-      - In files, this is a block of allocated memory containing the
-        actual file data. Each time we need to expand it beyond its
-        current capacity, we realloc() with enough to hold the new
-        data plus 4k (to avoid realloc thrashing). All files start
-        out with a 1K block of space.
+      - In files, this is an optional block of allocated memory containing
+        the first datasize bytes of the file data (from fs_ramdisk_attach()
+        or mmap()). The rest of the data is in the chunks below.
       - In directories, this is just a pointer to an rd_dir struct,
         which is defined below. datasize has no meaning for a
         directory. */
     void    * data;     /* Data block pointer */
     uint32  datasize;   /* Size of data block pointer */
 
+    /* Chunks of RD_CHUNK_SIZE bytes holding the data past the data block.
+       The array of pointers grows by doubling. */
+    uint8   ** chunks;
+    uint32  chunk_count;    /* Number of chunks allocated */
+    uint32  chunk_max;      /* Size of the chunks array */
+
+    mutex_t lock;       /* Protects the file's data and size */
+
     LIST_ENTRY(rd_file) dirlist;    /* Directory list entry */
 } rd_file_t;
 
@@ -101,6 +117,107 @@ static struct {
 /* Mutex for file system structs */
 static mutex_t rd_mutex;
 
+/* Free all of a file's data. Assumes we hold the file's lock (or that nobody
+   else can get to the file). */
+static void ramdisk_free_data(rd_file_t *f) {
+    uint32 i;
+
+    for(i = 0; i < f->chunk_count; i++)
+        free(f->chunks[i]);
+
+    free(f->chunks);
+    free(f->data);
+
+    f->chunks = NULL;
+    f->chunk_count = 0;
+    f->chunk_max = 0;
+    f->data = NULL;
+    f->datasize = 0;
+    f->size = 0;
+}
+
+/* Find where the byte at offset off of a file is stored, and how many bytes
+   are stored contiguously from there on. Returns NULL if no space has been
+   allocated for it. Assumes we hold the file's lock. */
+static uint8 *ramdisk_locate(rd_file_t *f, uint32 off, uint32 *avail) {
+    uint32 c;
+
+    if(off < f->datasize) {
+        *avail = f->datasize - off;
+        return (uint8 *)f->data + off;
+    }
+
+    off -= f->datasize;
+    c = off / RD_CHUNK_SIZE;
+
+    if(c >= f->chunk_count)
+        return NULL;
+
+    off %= RD_CHUNK_SIZE;
+    *avail = RD_CHUNK_SIZE - off;
+    return f->chunks[c] + off;
+}
+
+/* Make sure there's room for size bytes in the file. Assumes we hold the
+   file's lock. */
+static int ramdisk_grow(rd_file_t *f, uint32 size) {
+    uint32 need, max;
+    uint8 **nc;
+
+    if(size <= f->datasize)
+        return 0;
+
+    need = (size - f->datasize + RD_CHUNK_SIZE - 1) / RD_CHUNK_SIZE;
+
+    if(need > f->chunk_max) {
+        max = f->chunk_max ? f->chunk_max : 8;
+
+        while(max < need)
+            max <<= 1;
+
+        if(!(nc = (uint8 **)realloc(f->chunks, max * sizeof(uint8 *))))
+            return -1;
+
+        f->chunks = nc;
+        f->chunk_max = max;
+    }
+
+    while(f->chunk_count < need) {
+        if(!(f->chunks[f->chunk_count] = (uint8 *)malloc(RD_CHUNK_SIZE)))
+            return -1;
+
+        f->chunk_count++;
+    }
+
+    return 0;
+}
+
+/* Gather all of a file's data into one contiguous block. Assumes we hold the
+   file's lock. */
+static int ramdisk_flatten(rd_file_t *f) {
+    uint32 size = f->size, off, n, avail;
+    uint8 *nd, *p;
+
+    if(f->data && !f->chunk_count)
+        return 0;
+
+    if(!(nd = (uint8 *)malloc(size ? size : 1)))
+        return -1;
+
+    for(off = 0; off < size; off += n) {
+        p = ramdisk_locate(f, off, &avail);
+        n = (avail < size - off) ? avail : size - off;
+        memcpy(nd + off, p, n);
+    }
+
+    ramdisk_free_data(f);
+    f->data = nd;
+    f->datasize = size;
+    f->size = size;
+
+    return 0;
+}
+
 /* Search a directory for the named file; return the struct if
    we find it. Assumes we hold rd_mutex. */
 static rd_file_t *ramdisk_find(rd_dir_t *parent, const char *name, size_t namelen) {
@@ -216,22 +333,23 @@ static rd_file_t * ramdisk_create_file(rd_dir_t * parent, const char * fn, int d
     f->type = dir ? STAT_TYPE_DIR : STAT_TYPE_FILE;
     f->openfor = OPENFOR_NOTHING;
     f->usage = 0;
+    f->data = NULL;
+    f->datasize = 0;
+    f->chunks = NULL;
+    f->chunk_count = 0;
+    f->chunk_max = 0;
 
-    if(!dir) {
-        f->data = malloc(1024);
-        f->datasize = 1024;
-    }
-    else {
+    if(dir) {
         f->data = malloc(sizeof(rd_dir_t));
-        f->datasize = 0;
-    }
 
-    if(f->data == NULL) {
-        free(f->name);
-        free(f);
-        return NULL;
+        if(f->data == NULL) {
+            free(f->name);
+            free(f);
+            return NULL;
+        }
     }
 
+    mutex_init(&f->lock, MUTEX_TYPE_NORMAL);
     LIST_INSERT_HEAD(pdir, f, dirlist);
 
     return f;
@@ -316,10 +434,7 @@ static void * ramdisk_open(vfs_handler_t * vfs, const char *fn, int mode) {
             fh[fd].ptr = f->size;
         /* If we're opening with O_TRUNC, kill the existing contents */
         else if(mode & O_TRUNC) {
-            free(f->data);
-            f->data = malloc(1024);
-            f->datasize = 1024;
-            f->size = 0;
+            ramdisk_free_data(f);
             fh[fd].ptr = 0;
         }
         else
@@ -376,22 +491,31 @@ static int ramdisk_close(void * h) {
 
 /* Read from a file */
 static ssize_t ramdisk_read(void * h, void *buf, size_t bytes) {
-    ssize_t rv = -1;
     file_t  fd = (file_t)h;
-
-    mutex_lock_scoped(&rd_mutex);
+    rd_file_t *f;
+    uint8   *out = (uint8 *)buf, *p;
+    uint32  n, avail;
+    size_t  rv;
 
     /* Check that the fd is valid */
-    if(fd < FS_RAMDISK_MAX_FILES && fh[fd].file != NULL && !fh[fd].dir) {
-        /* Is there enough left? */
-        if((fh[fd].ptr + bytes) > fh[fd].file->size)
-            bytes = fh[fd].file->size - fh[fd].ptr;
+    if(fd >= FS_RAMDISK_MAX_FILES || !(f = fh[fd].file) || fh[fd].dir) {
+        errno = EBADF;
+        return -1;
+    }
+
+    mutex_lock_scoped(&f->lock);
 
-        /* Copy out the requested amount */
-        memcpy(buf, ((uint8 *)fh[fd].file->data) + fh[fd].ptr, bytes);
-        fh[fd].ptr += bytes;
+    /* Is there enough left? */
+    if((fh[fd].ptr + bytes) > f->size)
+        bytes = f->size - fh[fd].ptr;
 
-        rv = bytes;
+    /* Copy out the requested amount, a piece at a time */
+    for(rv = bytes; bytes; bytes -= n) {
+        p = ramdisk_locate(f, fh[fd].ptr, &avail);
+        n = (avail < bytes) ? avail : bytes;
+        memcpy(out, p, n);
+        out += n;
+        fh[fd].ptr += n;
     }
 
     return rv;
@@ -399,36 +523,40 @@ static ssize_t ramdisk_read(void * h, void *buf, size_t bytes) {
 
 /* Write to a file */
 static ssize_t ramdisk_write(void * h, const void *buf, size_t bytes) {
-    ssize_t rv = -1;
     file_t  fd = (file_t)h;
-
-    mutex_lock_scoped(&rd_mutex);
+    rd_file_t *f;
+    const uint8 *in = (const uint8 *)buf;
+    uint8   *p;
+    uint32  n, avail;
+    size_t  rv;
 
     /* Check that the fd is valid */
-    if(fd < FS_RAMDISK_MAX_FILES && fh[fd].file != NULL && !fh[fd].dir && fh[fd].file->openfor == OPENFOR_WRITE) {
-        /* Is there enough left? */
-        if((fh[fd].ptr + bytes) > fh[fd].file->datasize) {
-            /* We need to realloc the block */
-            void * np = realloc(fh[fd].file->data, (fh[fd].ptr + bytes) + 4096);
-
-            if(np == NULL)
-                return -1;
-
-            fh[fd].file->data = np;
-            fh[fd].file->datasize = (fh[fd].ptr + bytes) + 4096;
-        }
+    if(fd >= FS_RAMDISK_MAX_FILES || !(f = fh[fd].file) || fh[fd].dir ||
+       f->openfor != OPENFOR_WRITE) {
+        errno = EBADF;
+        return -1;
+    }
 
-        /* Copy out the requested amount */
-        memcpy(((uint8 *)fh[fd].file->data) + fh[fd].ptr, buf, bytes);
-        fh[fd].ptr += bytes;
+    mutex_lock_scoped(&f->lock);
 
-        if(fh[fd].file->size < fh[fd].ptr) {
-            fh[fd].file->size = fh[fd].ptr;
-        }
+    /* Make sure there's room, adding chunks as needed */
+    if(ramdisk_grow(f, fh[fd].ptr + bytes) < 0) {
+        errno = ENOSPC;
+        return -1;
+    }
 
-        rv = bytes;
+    /* Copy in the requested amount, a piece at a time */
+    for(rv = bytes; bytes; bytes -= n) {
+        p = ramdisk_locate(f, fh[fd].ptr, &avail);
+        n = (avail < bytes) ? avail : bytes;
+        memcpy(p, in, n);
+        in += n;
+        fh[fd].ptr += n;
     }
 
+    if(f->size < fh[fd].ptr)
+        f->size = fh[fd].ptr;
+
     return rv;
 }
 
@@ -436,14 +564,14 @@ static ssize_t ramdisk_write(void * h, const void *buf, size_t bytes) {
 static off_t ramdisk_seek(void * h, off_t offset, int whence) {
     file_t  fd = (file_t)h;
 
-    mutex_lock_scoped(&rd_mutex);
-
     /* Check that the fd is valid */
     if(fd >= FS_RAMDISK_MAX_FILES || !fh[fd].file || fh[fd].dir) {
         errno = EBADF;
         return -1;
     }
 
+    mutex_lock_scoped(&fh[fd].file->lock);
+
     /* Update current position according to arguments */
     switch(whence) {
         case SEEK_SET:
@@ -489,10 +617,10 @@ static off_t ramdisk_seek(void * h, off_t offset, int whence) {
 static off_t ramdisk_tell(void * h) {
     file_t  fd = (file_t)h;
 
-    mutex_lock_scoped(&rd_mutex);
-
-    if(fd < FS_RAMDISK_MAX_FILES && fh[fd].file != NULL && !fh[fd].dir)
+    if(fd < FS_RAMDISK_MAX_FILES && fh[fd].file != NULL && !fh[fd].dir) {
+        mutex_lock_scoped(&fh[fd].file->lock);
         return fh[fd].ptr;
+    }
 
     return -1;
 }
@@ -501,10 +629,10 @@ static off_t ramdisk_tell(void * h) {
 static size_t ramdisk_total(void * h) {
     file_t  fd = (file_t)h;
 
-    mutex_lock_scoped(&rd_mutex);
-
-    if(fd < FS_RAMDISK_MAX_FILES && fh[fd].file != NULL && !fh[fd].dir)
+    if(fd < FS_RAMDISK_MAX_FILES && fh[fd].file != NULL && !fh[fd].dir) {
+        mutex_lock_scoped(&fh[fd].file->lock);
         return fh[fd].file->size;
+    }
 
     return -1;
 }
@@ -558,7 +686,8 @@ static int ramdisk_unlink(vfs_handler_t * vfs, const char *fn) {
         if(f->usage == 0) {
             /* Free its data */
             free(f->name);
-            free(f->data);
+            ramdisk_free_data(f);
+            mutex_destroy(&f->lock);
 
             /* Remove it from the parent list */
             LIST_REMOVE(f, dirlist);
@@ -574,13 +703,22 @@ static int ramdisk_unlink(vfs_handler_t * vfs, const char *fn) {
 
 static void * ramdisk_mmap(void * h) {
     file_t  fd = (file_t)h;
+    rd_file_t *f;
 
-    mutex_lock_scoped(&rd_mutex);
+    if(fd >= FS_RAMDISK_MAX_FILES || !(f = fh[fd].file) || fh[fd].dir) {
+        errno = EBADF;
+        return NULL;
+    }
 
-    if(fd < FS_RAMDISK_MAX_FILES && fh[fd].file != NULL && !fh[fd].dir)
-        return fh[fd].file->data;
+    mutex_lock_scoped(&f->lock);
 
-    return NULL;
+    /* The caller needs to see the whole file in one piece. */
+    if(ramdisk_flatten(f) < 0) {
+        errno = ENOMEM;
+        return NULL;
+    }
+
+    return f->data;
 }
 
 static int ramdisk_stat(vfs_handler_t *vfs, const char *path, struct stat *st,
@@ -616,12 +754,12 @@ static int ramdisk_stat(vfs_handler_t *vfs, const char *path, struct stat *st,
     st->st_mode = S_IRUSR | S_IWUSR | S_IRGRP | S_IWGRP | S_IROTH | S_IWOTH;
     st->st_mode |= (f->type == STAT_TYPE_DIR) ? 
         (S_IFDIR | S_IXUSR | S_IXGRP | S_IXOTH) : S_IFREG;
-    st->st_size = (f->type == STAT_TYPE_DIR) ? -1 : (int)f->datasize;
+    st->st_size = (f->type == STAT_TYPE_DIR) ? -1 : (int)f->size;
     st->st_nlink = (f->type == STAT_TYPE_DIR) ? 2 : 1;
     st->st_blksize = 1024;
-    st->st_blocks = f->datasize >> 10;
+    st->st_blocks = f->size >> 10;
 
-    if(f->datasize & 0x3ff)
+    if(f->size & 0x3ff)
         ++st->st_blocks;
 
     return 0;
@@ -689,12 +827,12 @@ static int ramdisk_fstat(void *h, struct stat *st) {
     st->st_dev = (dev_t)('r' | ('a' << 8) | ('m' << 16));
     st->st_mode = S_IRUSR | S_IWUSR | S_IRGRP | S_IWGRP | S_IROTH | S_IWOTH;
     st->st_mode |= (f->type == STAT_TYPE_DIR) ? S_IFDIR : S_IFREG;
-    st->st_size = (f->type == STAT_TYPE_DIR) ? -1 : (int)f->datasize;
+    st->st_size = (f->type == STAT_TYPE_DIR) ? -1 : (int)f->size;
     st->st_nlink = (f->type == STAT_TYPE_DIR) ? 2 : 1;
     st->st_blksize = 1024;
-    st->st_blocks = f->datasize >> 10;
+    st->st_blocks = f->size >> 10;
 
-    if(f->datasize & 0x3ff)
+    if(f->size & 0x3ff)
         ++st->st_blocks;
 
     return 0;
@@ -756,12 +894,15 @@ int fs_ramdisk_attach(const char * fn, void * obj, size_t size) {
     if(fd == NULL)
         return -1;
 
-    /* Ditch the data block we had and replace it with the user one. */
+    /* Ditch the data we had and replace it with the user block. Opening the
+       file with O_TRUNC already freed it. */
     f = fh[(int)fd].file;
-    free(f->data);
+    mutex_lock(&f->lock);
+    ramdisk_free_data(f);
     f->data = obj;
     f->datasize = size;
     f->size = size;
+    mutex_unlock(&f->lock);
 
     /* Close the file */
     ramdisk_close(fd);
@@ -786,13 +927,25 @@ int fs_ramdisk_detach(const char * fn, void ** obj, size_t * size) {
     assert(size != NULL);
 
     f = fh[(int)fd].file;
+    mutex_lock(&f->lock);
+
+    /* If the file has grown since it was attached (or was never attached),
+       the data has to be gathered into one block first. */
+    if(ramdisk_flatten(f) < 0) {
+        mutex_unlock(&f->lock);
+        ramdisk_close(fd);
+        errno = ENOMEM;
+        return -1;
+    }
+
     *obj = f->data;
     *size = f->size;
 
-    /* Ditch the data block we had and replace it with a fake one. */
-    f->data = malloc(64);
-    f->datasize = 64;
-    f->size = 64;
+    /* The data belongs to the caller now. */
+    f->data = NULL;
+    f->datasize = 0;
+    f->size = 0;
+    mutex_unlock(&f->lock);
 
     /* Close the file */
     ramdisk_close(fd);
@@ -832,6 +985,9 @@ int fs_ramdisk_init(void) {
     root->usage = 0;
     root->data = rootdir;
     root->datasize = 0;
+    root->chunks = NULL;
+    root->chunk_count = 0;
+    root->chunk_max = 0;
 
     LIST_INIT(rootdir);
 
@@ -840,6 +996,7 @@ int fs_ramdisk_init(void) {
 
     /* Init thread mutexes */
     mutex_init(&rd_mutex, MUTEX_TYPE_NORMAL);
+    lockstat_set_name(&rd_mutex, "fs_ramdisk");
 
     /* Register with VFS */
     return nmmgr_handler_add(&vh.nmmgr);
@@ -860,7 +1017,8 @@ int fs_ramdisk_shutdown(void) {
     while(f1) {
         f2 = LIST_NEXT(f1, dirlist);
         free(f1->name);
-        free(f1->data);
+        ramdisk_free_data(f1);
+        mutex_destroy(&f1->lock);
         free(f1);
         f1 = f2;
     }
@@ -20,12 +20,15 @@ on sunsite.unc.edu in /pub/Linux/system/recovery/, or as a package under Debian
 #include <kos/thread.h>
 #include <kos/mutex.h>
 #include <kos/fs_romdisk.h>
+#include <kos/blockcache.h>
 #include <kos/opts.h>
 #include <malloc.h>
 #include <stdbool.h>
 #include <string.h>
 #include <strings.h>
 #include <stdio.h>
+#include <stdlib.h>
+#include <ctype.h>
 #include <assert.h>
 #include <errno.h>
 
@@ -64,6 +67,28 @@ typedef struct {
     char    filename[RD_FN_MAX];    /* File name (zero-terminated) */
 } romdisk_file_t;
 
+/* Path index definitions (see romdisk_index_find() below). */
+#define ROMDISK_INDEX_NAME  ".romdisk_index"
+#define ROMDISK_INDEX_MAGIC "-rdindex"
+#define ROMDISK_INDEX_HASH  1           /* 32-bit FNV-1a */
+
+/* The index starts with this header... */
+typedef struct {
+    char    magic[8];               /* Should be "-rdindex" */
+    uint32  count;                  /* Number of entries */
+    uint32  hash;                   /* Hash function (ROMDISK_INDEX_HASH) */
+} romdisk_index_hdr_t;
+
+/* ...followed by count of these, sorted by hash. Entries with equal hashes
+   are in the order that their objects appear in the image. */
+typedef struct {
+    uint32  hash;                   /* Hash of the path */
+    uint32  offset;                 /* Header offset | (type & ROMFH_MASK) */
+    uint32  parent;                 /* Index of the parent dir, or 0xffffffff */
+} romdisk_index_ent_t;
+
+#define ROMDISK_INDEX_ROOT  0xffffffff
+
 
 /* Util function to reverse the byte order of a uint32 */
 static uint32 ntohl_32(const void *data) {
@@ -87,6 +112,15 @@ typedef struct rd_image {
     const romdisk_hdr_t * hdr;      /* Pointer to the header */
     uint32          files;      /* Offset in the image to the files area */
     vfs_handler_t       * vfsh;     /* Our VFS mount struct */
+
+    const romdisk_index_ent_t * index;  /* Path index (or NULL) */
+    uint32          index_count;    /* Number of entries in the index */
+    uint32          index_hdr;  /* Header of the index file in the image */
+    int             own_index;  /* Do we own the index memory? */
+
+    mutex_t         zmutex;     /* Protects the compressed block cache */
+    kos_blockcache_t    * zcache;   /* Decompressed blocks (or NULL) */
+    uint32          zblock_size;    /* Size of the blocks in zcache */
 } rd_image_t;
 
 /* Global list of mounted romdisks */
@@ -104,6 +138,7 @@ static struct {
     uint32      size;       /* Length of file in bytes */
     dirent_t    dirent;     /* A static dirent to pass back to clients */
     rd_image_t  * mnt;      /* Which mount instance are we using? */
+    bool        z;          /* true if the file is compressed */
 } fh[FS_ROMDISK_MAX_FILES];
 
 #define FH_INDEX_FREE 0
@@ -169,6 +204,318 @@ static uint32_t romdisk_find_object(rd_image_t *mnt, const char *fn, size_t fnle
     return 0;
 }
 
+/* Path index. Looking up a path by walking the directory chains takes one
+   string comparison for every entry before it in each directory along the
+   way, which adds up quickly on images with lots of files. So each image gets
+   an index: an array of (hash, header, parent) entries sorted by a hash of the
+   full, lowercased path of each file and directory. A lookup is then a binary
+   search on the hash, followed by checking the path of the candidate(s) against
+   the names in their headers, following the parent links.
+
+   genromfs -I puts a prebuilt index in the image as a file named
+   ROMDISK_INDEX_NAME in the root directory. Otherwise, it is built when the
+   image is mounted, if the image has at least FS_ROMDISK_INDEX_MIN objects.
+   Either way, the index is in the same big-endian format, described below. */
+
+#define FNV_BASIS   2166136261U
+#define FNV_PRIME   16777619U
+
+static inline uint32_t romdisk_hash(uint32_t h, const char *s, size_t len) {
+    while(len--) {
+        h ^= (uint8_t)tolower((int)(uint8_t)*s++);
+        h *= FNV_PRIME;
+    }
+
+    return h;
+}
+
+static void htonl_32(void *data, uint32 v) {
+    uint8 *d = (uint8 *)data;
+
+    d[0] = v >> 24;
+    d[1] = v >> 16;
+    d[2] = v >> 8;
+    d[3] = v;
+}
+
+/* Check the path fn (with no leading or trailing slashes) against index entry
+   i and its parents. */
+static bool romdisk_index_check(rd_image_t *mnt, const char *fn, size_t len,
+                                uint32_t i) {
+    const romdisk_file_t *fhdr;
+    const char *cur;
+
+    for(;;) {
+        if(i >= mnt->index_count)
+            return false;
+
+        /* Find the last component */
+        for(cur = fn + len; cur > fn && cur[-1] != '/'; --cur);
+
+        fhdr = (const romdisk_file_t *)(mnt->image +
+            (ntohl_32(&mnt->index[i].offset) & 0xfffffff0));
+
+        if(strlen(fhdr->filename) != (size_t)(fn + len - cur) ||
+           strncasecmp(fhdr->filename, cur, fn + len - cur))
+            return false;
+
+        i = ntohl_32(&mnt->index[i].parent);
+
+        /* Skip the slash(es) before it */
+        while(cur > fn && cur[-1] == '/')
+            --cur;
+
+        if(cur == fn)
+            return i == ROMDISK_INDEX_ROOT;
+
+        len = cur - fn;
+    }
+}
+
+/* Look up a path in the index. Returns the header offset of the object, 0 if
+   it doesn't exist, or (uint32_t)-1 if the path is one the index can't deal
+   with, in which case the directories will have to be walked. */
+static uint32_t romdisk_index_find(rd_image_t *mnt, const char *fn, bool dir) {
+    const char *cur, *end;
+    uint32_t h = FNV_BASIS, lo, hi, mid, off;
+    size_t len;
+    int first = 1;
+
+    /* Skip leading slashes */
+    while(*fn == '/')
+        ++fn;
+
+    len = strlen(fn);
+
+    /* The root and paths ending in a slash are handled by the walk, as
+       are . and .. (which aren't in the index). */
+    if(!len || fn[len - 1] == '/')
+        return (uint32_t)-1;
+
+    for(cur = fn; *cur; cur = end) {
+        for(end = cur; *end && *end != '/'; ++end);
+
+        if((end - cur == 1 && cur[0] == '.') ||
+           (end - cur == 2 && cur[0] == '.' && cur[1] == '.'))
+            return (uint32_t)-1;
+
+        if(!first)
+            h = romdisk_hash(h, "/", 1);
+
+        h = romdisk_hash(h, cur, end - cur);
+        first = 0;
+
+        while(*end == '/')
+            ++end;
+    }
+
+    /* Find the first entry with this hash */
+    lo = 0;
+    hi = mnt->index_count;
+
+    while(lo < hi) {
+        mid = (lo + hi) / 2;
+
+        if(ntohl_32(&mnt->index[mid].hash) < h)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+
+    for(; lo < mnt->index_count && ntohl_32(&mnt->index[lo].hash) == h; ++lo) {
+        off = ntohl_32(&mnt->index[lo].offset);
+
+        if((off & ROMFH_MASK) != (dir ? ROMFH_DIR : ROMFH_REG))
+            continue;
+
+        if(romdisk_index_check(mnt, fn, len, lo))
+            return off & 0xfffffff0;
+    }
+
+    return 0;
+}
+
+typedef struct {
+    uint32  hash;
+    uint32  order;
+} rd_sort_t;
+
+static int romdisk_index_cmp(const void *a, const void *b) {
+    const rd_sort_t *x = (const rd_sort_t *)a, *y = (const rd_sort_t *)b;
+
+    if(x->hash != y->hash)
+        return x->hash < y->hash ? -1 : 1;
+
+    return x->order < y->order ? -1 : (x->order > y->order);
+}
+
+/* Build the index for an image by walking all of its directories, breadth
+   first. Returns 0 on success, or if the image is too small to bother
+   with. */
+static int romdisk_index_build(rd_image_t *mnt) {
+    romdisk_index_ent_t *ents = NULL, *tmp, *out;
+    const romdisk_file_t *fhdr;
+    rd_sort_t *srt;
+    uint32_t *pos;
+    uint32_t cnt = 0, size = 0, max, i, j, o, ni, type, h, par;
+    uint32_t total = ntohl_32(&mnt->hdr->full_size);
+    size_t len;
+
+    /* Every header takes at least 32 bytes, which keeps a broken image
+       from sending us around in circles forever. */
+    max = total / 32;
+    i = ROMDISK_INDEX_ROOT;
+    o = mnt->files;
+
+    for(;;) {
+        /* Add everything in the directory starting at o. */
+        while(o && o + 32 <= total) {
+            fhdr = (const romdisk_file_t *)(mnt->image + o);
+            ni = ntohl_32(&fhdr->next_header);
+            type = ni & 0x0f;
+
+            if(o != mnt->index_hdr && ((type & ROMFH_MASK) == ROMFH_DIR ||
+                                       (type & ROMFH_MASK) == ROMFH_REG) &&
+               strcmp(fhdr->filename, ".") && strcmp(fhdr->filename, "..")) {
+                if(cnt >= max)
+                    goto fail;
+
+                if(cnt == size) {
+                    size = size ? size * 2 : 64;
+
+                    if(size > max)
+                        size = max;
+
+                    if(!(tmp = (romdisk_index_ent_t *)realloc(ents,
+                            size * sizeof(romdisk_index_ent_t))))
+                        goto fail;
+
+                    ents = tmp;
+                }
+
+                len = strnlen(fhdr->filename, total - o - 16);
+                h = i == ROMDISK_INDEX_ROOT ? FNV_BASIS :
+                    romdisk_hash(ents[i].hash, "/", 1);
+                ents[cnt].hash = romdisk_hash(h, fhdr->filename, len);
+                ents[cnt].offset = o | (type & ROMFH_MASK);
+                ents[cnt].parent = i;
+                ++cnt;
+            }
+
+            o = ni & 0xfffffff0;
+        }
+
+        /* Move on to the next directory we've found. */
+        do {
+            if(++i >= cnt)
+                goto done;
+        } while((ents[i].offset & 0x0f) != ROMFH_DIR ||
+                (ntohl_32(mnt->image + (ents[i].offset & 0xfffffff0)) &
+                 0x07) != ROMFH_DIR);
+
+        fhdr = (const romdisk_file_t *)(mnt->image +
+                                        (ents[i].offset & 0xfffffff0));
+        o = ntohl_32(&fhdr->spec_info) & 0xfffffff0;
+
+        /* genromfs points empty directories at themselves. */
+        if(o == (ents[i].offset & 0xfffffff0))
+            o = 0;
+    }
+
+done:
+    if(cnt < FS_ROMDISK_INDEX_MIN) {
+        free(ents);
+        return 0;
+    }
+
+    srt = (rd_sort_t *)malloc(cnt * sizeof(rd_sort_t));
+    pos = (uint32_t *)malloc(cnt * sizeof(uint32_t));
+    out = (romdisk_index_ent_t *)malloc(cnt * sizeof(romdisk_index_ent_t));
+
+    if(!srt || !pos || !out) {
+        free(srt);
+        free(pos);
+        free(out);
+        goto fail;
+    }
+
+    for(j = 0; j < cnt; ++j) {
+        srt[j].hash = ents[j].hash;
+        srt[j].order = j;
+    }
+
+    qsort(srt, cnt, sizeof(rd_sort_t), romdisk_index_cmp);
+
+    for(j = 0; j < cnt; ++j)
+        pos[srt[j].order] = j;
+
+    for(j = 0; j < cnt; ++j) {
+        par = ents[srt[j].order].parent;
+        htonl_32(&out[j].hash, srt[j].hash);
+        htonl_32(&out[j].offset, ents[srt[j].order].offset);
+        htonl_32(&out[j].parent, par == ROMDISK_INDEX_ROOT ? par : pos[par]);
+    }
+
+    free(srt);
+    free(pos);
+    free(ents);
+
+    mnt->index = out;
+    mnt->index_count = cnt;
+    mnt->own_index = 1;
+
+    return 0;
+
+fail:
+    free(ents);
+    return -1;
+}
+
+/* Look for an index that genromfs put in the image, and check that it is
+   sane enough to use. */
+static void romdisk_index_load(rd_image_t *mnt) {
+    const romdisk_file_t *fhdr;
+    const romdisk_index_hdr_t *ihdr;
+    const romdisk_index_ent_t *ents;
+    uint32_t o, cnt, size, i, total = ntohl_32(&mnt->hdr->full_size);
+
+    if(!(o = romdisk_find_object(mnt, ROMDISK_INDEX_NAME,
+                                 strlen(ROMDISK_INDEX_NAME), false,
+                                 mnt->files)))
+        return;
+
+    fhdr = (const romdisk_file_t *)(mnt->image + o);
+    size = ntohl_32(&fhdr->size);
+    ihdr = (const romdisk_index_hdr_t *)(mnt->image + o +
+        sizeof(romdisk_file_t) + (strlen(fhdr->filename) / RD_FN_MAX) * RD_FN_MAX);
+    ents = (const romdisk_index_ent_t *)(ihdr + 1);
+    cnt = ntohl_32(&ihdr->count);
+
+    /* Hide it from everyone, whether we use it or not. */
+    mnt->index_hdr = o;
+
+    if(size < sizeof(romdisk_index_hdr_t) ||
+       memcmp(ihdr->magic, ROMDISK_INDEX_MAGIC, 8) ||
+       ntohl_32(&ihdr->hash) != ROMDISK_INDEX_HASH ||
+       cnt > (size - sizeof(romdisk_index_hdr_t)) / sizeof(romdisk_index_ent_t))
+        goto bad;
+
+    for(i = 0; i < cnt; ++i) {
+        if((ntohl_32(&ents[i].offset) & 0xfffffff0) >= total ||
+           (ntohl_32(&ents[i].parent) >= cnt &&
+            ntohl_32(&ents[i].parent) != ROMDISK_INDEX_ROOT))
+            goto bad;
+    }
+
+    mnt->index = ents;
+    mnt->index_count = cnt;
+    return;
+
+bad:
+    dbglog(DBG_WARNING, "fs_romdisk: ignoring invalid index in image at %p\n",
+           mnt->image);
+}
+
 /* Locate an object anywhere in the image, starting at the root, and
    expecting a fully qualified path name. This is analogous to the
    find_object_path in iso9660.
@@ -182,6 +529,10 @@ static uint32_t romdisk_find(rd_image_t *mnt, const char *fn, bool dir) {
     uint32          i;
     const romdisk_file_t    *fhdr;
 
+    /* Use the index, if there is one and it knows about this sort of path. */
+    if(mnt->index && (i = romdisk_index_find(mnt, fn, dir)) != (uint32_t)-1)
+        return i;
+
     /* If the object is in a sub-tree, traverse the trees looking
        for the right directory. */
     i = mnt->files;
@@ -212,11 +563,254 @@ static uint32_t romdisk_find(rd_image_t *mnt, const char *fn, bool dir) {
     }
 }
 
+/********************************************************************************/
+/* Compressed files. genromfs -z stores regular files (that shrink) as a series
+   of independently LZ4 compressed blocks, so that a file can be read from any
+   point without decompressing everything before it. Such files are marked by
+   a spec_info of ROMDISK_SPEC_LZ4 in their header (spec_info is otherwise
+   unused for regular files) and their data looks like this:
+
+       romdisk_zhdr_t              header
+       uint32 offsets[blocks]      offset of each block from the header
+       blocks, each one made of:
+           uint32 raw_size         size of the block once decompressed
+           uint32 stored_size      size of the data that follows; if this is
+                                   the same as raw_size, it isn't compressed
+           data
+
+   All integers are big-endian, like the rest of the image. Decompressed
+   blocks are kept in a small per-image block cache, keyed on the offset of the
+   block in the image. Reads of whole blocks that aren't cached decompress
+   straight into the caller's buffer. */
+
+#define ROMDISK_SPEC_LZ4    1
+#define ROMDISK_ZMAGIC      "-rdzlz4-"
+
+typedef struct {
+    char    magic[8];               /* Should be "-rdzlz4-" */
+    uint32  size;                   /* Decompressed size of the file */
+    uint32  block_size;             /* Decompressed size of each block */
+    uint32  blocks;                 /* Number of blocks */
+} romdisk_zhdr_t;
+
+/* Decompress an LZ4 block. Returns the number of bytes written to dst, or -1
+   if the data is corrupt. */
+static int romdisk_lz4_decode(const uint8 *src, size_t slen, uint8 *dst,
+                              size_t dlen) {
+    const uint8 *ip = src, *iend = src + slen, *m;
+    uint8 *op = dst, *oend = dst + dlen;
+    size_t len, off;
+    uint8 tok, b;
+
+    while(ip < iend) {
+        tok = *ip++;
+
+        /* Literals */
+        if((len = tok >> 4) == 15) {
+            do {
+                if(ip >= iend)
+                    return -1;
+
+                b = *ip++;
+                len += b;
+            } while(b == 255);
+        }
+
+        if(len > (size_t)(iend - ip) || len > (size_t)(oend - op))
+            return -1;
+
+        memcpy(op, ip, len);
+        op += len;
+        ip += len;
+
+        /* The last sequence has no match */
+        if(ip >= iend)
+            break;
+
+        /* Match */
+        if(iend - ip < 2)
+            return -1;
+
+        off = ip[0] | (ip[1] << 8);
+        ip += 2;
+
+        if(!off || off > (size_t)(op - dst))
+            return -1;
+
+        if((len = tok & 15) == 15) {
+            do {
+                if(ip >= iend)
+                    return -1;
+
+                b = *ip++;
+                len += b;
+            } while(b == 255);
+        }
+
+        len += 4;
+
+        if(len > (size_t)(oend - op))
+            return -1;
+
+        /* The match may overlap what it's copying, so go byte by byte */
+        for(m = op - off; len; --len)
+            *op++ = *m++;
+    }
+
+    return op - dst;
+}
+
+/* Decompress the block at offset blk in the image into buf. */
+static int romdisk_zblock(const rd_image_t *mnt, uint32 blk, uint8 *buf) {
+    const uint8 *p = mnt->image + blk;
+    uint32 raw, stored;
+
+    if(blk + 8 > ntohl_32(&mnt->hdr->full_size))
+        return -EIO;
+
+    raw = ntohl_32(p);
+    stored = ntohl_32(p + 4);
+
+    if(raw > mnt->zblock_size ||
+       blk + 8 + stored > ntohl_32(&mnt->hdr->full_size))
+        return -EIO;
+
+    if(stored == raw)
+        memcpy(buf, p + 8, raw);
+    else if(romdisk_lz4_decode(p + 8, stored, buf, raw) != (int)raw)
+        return -EIO;
+
+    return 0;
+}
+
+static int romdisk_zcache_read(void *ctx, uint32_t block, uint8_t *buf) {
+    return romdisk_zblock((const rd_image_t *)ctx, block, buf);
+}
+
+/* Return the compression header of the file with the header at offset
+   filehdr, or NULL if it isn't compressed. */
+static const romdisk_zhdr_t *romdisk_zhdr(const rd_image_t *mnt,
+                                          uint32 filehdr) {
+    const romdisk_file_t *fhdr = (const romdisk_file_t *)(mnt->image + filehdr);
+    const romdisk_zhdr_t *zhdr;
+
+    if((ntohl_32(&fhdr->next_header) & 7) != ROMFH_REG ||
+       ntohl_32(&fhdr->spec_info) != ROMDISK_SPEC_LZ4 ||
+       ntohl_32(&fhdr->size) < sizeof(romdisk_zhdr_t))
+        return NULL;
+
+    zhdr = (const romdisk_zhdr_t *)(mnt->image + filehdr +
+        sizeof(romdisk_file_t) + (strlen(fhdr->filename) / RD_FN_MAX) * RD_FN_MAX);
+
+    if(memcmp(zhdr->magic, ROMDISK_ZMAGIC, 8))
+        return NULL;
+
+    return zhdr;
+}
+
+/* The size of a file's contents, compressed or not. */
+static uint32 romdisk_size(const rd_image_t *mnt, uint32 filehdr) {
+    const romdisk_zhdr_t *zhdr = romdisk_zhdr(mnt, filehdr);
+
+    if(zhdr)
+        return ntohl_32(&zhdr->size);
+
+    return ntohl_32(&((const romdisk_file_t *)(mnt->image + filehdr))->size);
+}
+
+/* Get ready to read a compressed file, creating the image's block cache if it
+   doesn't have one yet. */
+static int romdisk_zopen(rd_image_t *mnt, const romdisk_zhdr_t *zhdr) {
+    uint32 bs = ntohl_32(&zhdr->block_size);
+    uint32 size = ntohl_32(&zhdr->size);
+    int rv = 0;
+
+    if(!bs || (bs & (bs - 1)) ||
+       ntohl_32(&zhdr->blocks) != (size + bs - 1) / bs) {
+        errno = EIO;
+        return -1;
+    }
+
+    mutex_lock(&mnt->zmutex);
+
+    if(!mnt->zcache) {
+        if(!(mnt->zcache = blockcache_create(FS_ROMDISK_ZCACHE_BLOCKS, bs,
+                                             romdisk_zcache_read, NULL,
+                                             mnt))) {
+            errno = ENOMEM;
+            rv = -1;
+        }
+        else {
+            mnt->zblock_size = bs;
+        }
+    }
+    else if(mnt->zblock_size != bs) {
+        /* genromfs uses the same block size for a whole image. */
+        errno = EIO;
+        rv = -1;
+    }
+
+    mutex_unlock(&mnt->zmutex);
+    return rv;
+}
+
+/* Read from a compressed file. */
+static ssize_t romdisk_zread(file_t fd, uint8 *buf, size_t bytes) {
+    rd_image_t *mnt = fh[fd].mnt;
+    const romdisk_zhdr_t *zhdr;
+    const uint8 *offs, *data;
+    uint32 bs = mnt->zblock_size, blk, bo, cnt, pos;
+    ssize_t rv = 0;
+    int err;
+
+    zhdr = (const romdisk_zhdr_t *)(mnt->image + fh[fd].index);
+    offs = (const uint8 *)(zhdr + 1);
+
+    mutex_lock(&mnt->zmutex);
+
+    while(bytes) {
+        blk = fh[fd].ptr / bs;
+        bo = fh[fd].ptr % bs;
+        cnt = bs - bo;
+
+        if(cnt > bytes)
+            cnt = bytes;
+
+        pos = fh[fd].index + ntohl_32(offs + blk * 4);
+
+        /* Whole blocks go straight to the caller, unless they're cached. */
+        if(!bo && cnt == bs && !blockcache_lookup(mnt->zcache, pos)) {
+            if((err = romdisk_zblock(mnt, pos, buf))) {
+                errno = -err;
+                break;
+            }
+        }
+        else {
+            if(!(data = blockcache_read(mnt->zcache, pos, &err))) {
+                errno = err;
+                break;
+            }
+
+            memcpy(buf, data + bo, cnt);
+        }
+
+        buf += cnt;
+        bytes -= cnt;
+        rv += cnt;
+        fh[fd].ptr += cnt;
+    }
+
+    mutex_unlock(&mnt->zmutex);
+
+    return (rv || !bytes) ? rv : -1;
+}
+
 /* Open a file or directory */
 static void * romdisk_open(vfs_handler_t * vfs, const char *fn, int mode) {
     file_t          fd;
     uint32          filehdr;
     const romdisk_file_t    *fhdr;
+    const romdisk_zhdr_t    *zhdr = NULL;
     rd_image_t      *mnt = (rd_image_t *)vfs->privdata;
 
     /* Make sure they don't want to open things as writeable */
@@ -237,6 +831,10 @@ static void * romdisk_open(vfs_handler_t * vfs, const char *fn, int mode) {
         return NULL;
     }
 
+    if(!(mode & O_DIR) && (zhdr = romdisk_zhdr(mnt, filehdr)) &&
+       romdisk_zopen(mnt, zhdr) < 0)
+        return NULL;
+
     /* Find a free file handle */
     mutex_lock(&fh_mutex);
 
@@ -258,8 +856,9 @@ static void * romdisk_open(vfs_handler_t * vfs, const char *fn, int mode) {
     fh[fd].index = filehdr + sizeof(romdisk_file_t) + (strlen(fhdr->filename) / RD_FN_MAX) * RD_FN_MAX;
     fh[fd].dir = ((mode & O_DIR) != 0);
     fh[fd].ptr = 0;
-    fh[fd].size = ntohl_32(&fhdr->size);
+    fh[fd].size = zhdr ? ntohl_32(&zhdr->size) : ntohl_32(&fhdr->size);
     fh[fd].mnt = mnt;
+    fh[fd].z = zhdr != NULL;
 
     return (void *)fd;
 }
@@ -290,6 +889,9 @@ static ssize_t romdisk_read(void * h, void *buf, size_t bytes) {
     if((fh[fd].ptr + bytes) > fh[fd].size)
         bytes = fh[fd].size - fh[fd].ptr;
 
+    if(fh[fd].z)
+        return romdisk_zread(fd, (uint8 *)buf, bytes);
+
     /* Copy out the requested amount */
     memcpy(buf, fh[fd].mnt->image + fh[fd].index + fh[fd].ptr, bytes);
     fh[fd].ptr += bytes;
@@ -384,6 +986,7 @@ static size_t romdisk_total(void * h) {
 /* Read a directory entry */
 static dirent_t *romdisk_readdir(void * h) {
     romdisk_file_t *fhdr;
+    uint32 hdr;
     int type;
     file_t fd = (file_t)h;
 
@@ -392,23 +995,28 @@ static dirent_t *romdisk_readdir(void * h) {
         return NULL;
     }
 
-    /* This happens if we hit the end of the directory on advancing the pointer
-       last time through. */
-    if(fh[fd].ptr == (uint32)-1)
-        return NULL;
-
-    /* Get the current file header */
-    fhdr = (romdisk_file_t *)(fh[fd].mnt->image + fh[fd].index + fh[fd].ptr);
-
-    /* Update the pointer */
-    fh[fd].ptr = ntohl_32(&fhdr->next_header);
-    type = fh[fd].ptr & 0x0f;
-    fh[fd].ptr = fh[fd].ptr & 0xfffffff0;
+    do {
+        /* This happens if we hit the end of the directory on advancing the
+           pointer last time through. */
+        if(fh[fd].ptr == (uint32)-1)
+            return NULL;
+
+        /* Get the current file header */
+        hdr = fh[fd].index + fh[fd].ptr;
+        fhdr = (romdisk_file_t *)(fh[fd].mnt->image + hdr);
+
+        /* Update the pointer */
+        fh[fd].ptr = ntohl_32(&fhdr->next_header);
+        type = fh[fd].ptr & 0x0f;
+        fh[fd].ptr = fh[fd].ptr & 0xfffffff0;
+
+        if(fh[fd].ptr != 0)
+            fh[fd].ptr = fh[fd].ptr - fh[fd].index;
+        else
+            fh[fd].ptr = (uint32)-1;
 
-    if(fh[fd].ptr != 0)
-        fh[fd].ptr = fh[fd].ptr - fh[fd].index;
-    else
-        fh[fd].ptr = (uint32)-1;
+        /* Don't show the path index, if the image has one */
+    } while(hdr == fh[fd].mnt->index_hdr);
 
     /* Copy out the requested data */
     strcpy(fh[fd].dirent.name, fhdr->filename);
@@ -422,7 +1030,7 @@ static dirent_t *romdisk_readdir(void * h) {
     }
     else {
         fh[fd].dirent.attr = 0;
-        fh[fd].dirent.size = ntohl_32(&fhdr->size);
+        fh[fd].dirent.size = romdisk_size(fh[fd].mnt, hdr);
     }
 
     return &fh[fd].dirent;
@@ -445,6 +1053,12 @@ static void *romdisk_mmap(void * h) {
         return NULL;
     }
 
+    /* Compressed files have nothing to map */
+    if(fh[fd].z) {
+        errno = ENOTSUP;
+        return NULL;
+    }
+
     /* Can't really help the loss of "const" here */
     return (void *)(fh[fd].mnt->image + fh[fd].index);
 }
@@ -453,7 +1067,6 @@ static int romdisk_stat(vfs_handler_t *vfs, const char *path, struct stat *st,
                         int flag) {
     mode_t md;
     uint32_t filehdr;
-    const romdisk_file_t *fhdr;
     rd_image_t *mnt = (rd_image_t *)vfs->privdata;
     size_t len = strlen(path);
 
@@ -495,8 +1108,7 @@ static int romdisk_stat(vfs_handler_t *vfs, const char *path, struct stat *st,
     st->st_blksize = 1024;
 
     if(md == S_IFREG) {
-        fhdr = (const romdisk_file_t *)(mnt->image + filehdr);
-        st->st_size = ntohl_32(&fhdr->size);
+        st->st_size = romdisk_size(mnt, filehdr);
         st->st_nlink = 1;
         st->st_blocks = st->st_size >> 10;
 
@@ -665,6 +1277,12 @@ void fs_romdisk_shutdown(void) {
         if(c->own_buffer)
             free((void *)c->image);
 
+        if(c->own_index)
+            free((void *)c->index);
+
+        blockcache_destroy(c->zcache);
+        mutex_destroy(&c->zmutex);
+
         nmmgr_handler_remove(&c->vfsh->nmmgr);
         free(c->vfsh);
         free(c);
@@ -715,11 +1333,30 @@ int fs_romdisk_mount(const char * mountpoint, const uint8 *img, int own_buffer)
     mnt->hdr = hdr;
     mnt->files = sizeof(romdisk_hdr_t)
                  + (strlen(hdr->volume_name) / RD_VN_MAX) * RD_VN_MAX;
+    mnt->index = NULL;
+    mnt->index_count = 0;
+    mnt->index_hdr = 0;
+    mnt->own_index = 0;
+    mnt->zcache = NULL;
+    mnt->zblock_size = 0;
+    mutex_init(&mnt->zmutex, MUTEX_TYPE_NORMAL);
+
+    /* Use the image's own path index if it has one, otherwise build one. A
+       failure here just means lookups will be slower. */
+    romdisk_index_load(mnt);
+
+    if(!mnt->index && FS_ROMDISK_INDEX_MIN && romdisk_index_build(mnt) < 0)
+        dbglog(DBG_WARNING, "fs_romdisk: can't build path index for %p\n",
+               img);
 
     /* Make a VFS struct */
     vfsh = (vfs_handler_t *)malloc(sizeof(vfs_handler_t));
 
     if(vfsh == NULL) {
+        if(mnt->own_index)
+            free((void *)mnt->index);
+
+        mutex_destroy(&mnt->zmutex);
         free(mnt);
         errno=ENOMEM;
         return -3;
@@ -772,6 +1409,12 @@ int fs_romdisk_unmount(const char * mountpoint) {
         if(n->own_buffer)
             free((void *)n->image);
 
+        if(n->own_index)
+            free((void *)n->index);
+
+        blockcache_destroy(n->zcache);
+        mutex_destroy(&n->zmutex);
+
         /* Free the structs */
         free(n->vfsh);
         free(n);
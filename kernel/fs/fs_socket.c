@@ -12,6 +12,7 @@
 
 #include <errno.h>
 #include <string.h>
+#include <time.h>
 #include <malloc.h>
 #include <sys/queue.h>
 #include <sys/socket.h>
@@ -208,6 +209,45 @@ int fs_socket_input(netif_t *src, int domain, int protocol, const void *hdr,
     return rv;
 }
 
+int fs_socket_input_pbuf(netif_t *src, int domain, int protocol,
+                         const void *hdr, net_pbuf_t *p, size_t size) {
+    fs_socket_proto_t *i;
+    int rv = -2;
+
+    if(!initted)
+        return -1;
+
+    /* Find the protocol handler and call its input function... */
+    if(mutex_lock_irqsafe(&proto_rlock))
+        return -1;
+
+    TAILQ_FOREACH(i, &protocols, entry) {
+        if(i->protocol == protocol) {
+            if(i->input_pbuf) {
+                rv = i->input_pbuf(src, domain, hdr, p, size);
+            }
+            else {
+                net_pbuf_t *copy;
+                const uint8 *data;
+
+                if((data = net_pbuf_flatten(p, &copy))) {
+                    rv = i->input(src, domain, hdr, data, size);
+                    net_pbuf_free(copy);
+                }
+                else {
+                    rv = -1;
+                }
+            }
+
+            break;
+        }
+    }
+
+    mutex_unlock(&proto_rlock);
+
+    return rv;
+}
+
 int fs_socket_proto_add(fs_socket_proto_t *proto) {
     if(!initted)
         return -1;
@@ -504,6 +544,71 @@ ssize_t sendto(int sock, const void *message, size_t length, int flags,
                                  dest_len);
 }
 
+int recvmmsg(int sock, struct mmsghdr *msgvec, unsigned int vlen, int flags,
+             struct timespec *timeout) {
+    net_socket_t *hnd;
+    int tmo = 0;
+
+    hnd = (net_socket_t *)fs_get_handle(sock);
+
+    if(hnd == NULL) {
+        errno = EBADF;
+        return -1;
+    }
+
+    /* Make sure this is actually a socket. */
+    if(fs_get_handler(sock) != &vh) {
+        errno = ENOTSOCK;
+        return -1;
+    }
+
+    if(!hnd->protocol->recvmmsg) {
+        errno = EOPNOTSUPP;
+        return -1;
+    }
+
+    /* Convert the timeout to milliseconds, rounding up so that a short one
+       doesn't turn into waiting forever. */
+    if(timeout) {
+        if(timeout->tv_sec < 0 || timeout->tv_nsec < 0 ||
+           timeout->tv_nsec >= 1000000000) {
+            errno = EINVAL;
+            return -1;
+        }
+
+        tmo = timeout->tv_sec * 1000 + (timeout->tv_nsec + 999999) / 1000000;
+
+        if(!tmo)
+            flags |= MSG_DONTWAIT;
+    }
+
+    return hnd->protocol->recvmmsg(hnd, msgvec, vlen, flags, tmo);
+}
+
+int sendmmsg(int sock, struct mmsghdr *msgvec, unsigned int vlen, int flags) {
+    net_socket_t *hnd;
+
+    hnd = (net_socket_t *)fs_get_handle(sock);
+
+    if(hnd == NULL) {
+        errno = EBADF;
+        return -1;
+    }
+
+    /* Make sure this is actually a socket. */
+    if(fs_get_handler(sock) != &vh) {
+        errno = ENOTSOCK;
+        return -1;
+    }
+
+    if(!hnd->protocol->sendmmsg) {
+        errno = EOPNOTSUPP;
+        return -1;
+    }
+
+    return hnd->protocol->sendmmsg(hnd, msgvec, vlen, flags);
+}
+
 int shutdown(int sock, int how) {
     net_socket_t *hnd;
 
@@ -25,6 +25,14 @@
 
 #include <kos/opts.h>
 
+#if defined(MALLOC_TCACHE) && !defined(KM_DBG)
+#define USE_TCACHE 1
+#include <sys/queue.h>
+#include <arch/irq.h>
+#include <kos/thread.h>
+#include <kos/tls.h>
+#endif
+
 #undef DEBUG
 
 #ifdef MALLOC_DEBUG
@@ -1643,6 +1651,13 @@ static pthread_mutex_t mALLOC_MUTEx = PTHREAD_MUTEX_INITIALIZER;
 /********************************************************************************************************/
 /*** Begin KOS Code ***/
 
+#ifdef USE_TCACHE
+/* Per-thread caches; see the end of the file. */
+static Void_t *tc_get(size_t bytes);
+static int tc_put(Void_t *m);
+static void tc_mallinfo(struct mallinfo *mi);
+#endif
+
 
 /************************** Debug Stuff **************************/
 
@@ -1783,6 +1798,11 @@ Void_t* public_mALLOc(size_t bytes) {
     memctl_t * ctl;
 #endif
 
+#ifdef USE_TCACHE
+    if((m = tc_get(bytes)))
+        return m;
+#endif
+
     if(MALLOC_PREACTION != 0) {
         return 0;
     }
@@ -1844,6 +1864,11 @@ void public_fREe(Void_t* m) {
     if(m == NULL)
         return;
 
+#ifdef USE_TCACHE
+    if(tc_put(m))
+        return;
+#endif
+
     if(MALLOC_PREACTION != 0) {
         return;
     }
@@ -2086,6 +2111,14 @@ Void_t* public_cALLOc(size_t n, size_t elem_size) {
     memctl_t * ctl;
 #endif
 
+#ifdef USE_TCACHE
+    if((!elem_size || n <= MALLOC_TCACHE_MAX_SIZE / elem_size) &&
+       (m = tc_get(n * elem_size))) {
+        memset(m, 0, n * elem_size);
+        return m;
+    }
+#endif
+
     if(MALLOC_PREACTION != 0) {
         return 0;
     }
@@ -2368,6 +2401,10 @@ struct mallinfo public_mALLINFo(void) {
     if(MALLOC_POSTACTION != 0) {
     }
 
+#ifdef USE_TCACHE
+    tc_mallinfo(&m);
+#endif
+
     return m;
 }
 
@@ -5612,3 +5649,197 @@ History:
 /* Enable this define if you want REALLY verbose debugging (print
    every time a block is allocated or freed) */
 /* #define KM_DBG_VERBOSE */
+
+/*** Begin KOS per-thread caches ***/
+
+#ifdef USE_TCACHE
+
+/* Each thread gets a bin of freed chunks for each chunk size up to the limit,
+   linked through their first word. As far as the rest of malloc is concerned
+   these chunks are still in use, so the thread can take them out and put them
+   back without the lock. Only the thread a cache belongs to ever touches it
+   (interrupt handlers go straight to the heap), apart from the TLS destructor
+   that gives everything back once the thread is gone, and mallinfo(), which
+   only reads the totals. */
+
+/* The number of chunks in each bin is kept in a byte. */
+#if MALLOC_TCACHE_COUNT > 255
+#error "MALLOC_TCACHE_COUNT must be no more than 255"
+#endif
+
+#define TC_MAX_CHUNK    request2size(MALLOC_TCACHE_MAX_SIZE)
+#define TC_BINS         ((TC_MAX_CHUNK - MINSIZE) / MALLOC_ALIGNMENT + 1)
+#define tc_index(sz)    (((sz) - MINSIZE) / MALLOC_ALIGNMENT)
+
+typedef struct tcache {
+    LIST_ENTRY(tcache) list;
+    size_t bytes;
+    size_t blocks;
+    Void_t *bins[TC_BINS];
+    uint8_t counts[TC_BINS];
+} tcache_t;
+
+static LIST_HEAD(tcache_list, tcache) tc_all = LIST_HEAD_INITIALIZER(tc_all);
+static __thread tcache_t *tc_self;
+static kthread_key_t tc_key;
+
+/* Threads don't have their TLS set up until the thread system is, and
+   interrupt handlers mustn't touch the cache of the thread they interrupted. */
+static inline int tc_usable(void) {
+    return thd_current && !irq_inside_int();
+}
+
+static void tc_destroy(void *data) {
+    tcache_t *tc = (tcache_t *)data;
+    Void_t *m;
+    int i;
+
+    /* The thread being destroyed might be the one we're running in. */
+    if(tc_self == tc)
+        tc_self = NULL;
+
+    {
+        irq_disable_scoped();
+        LIST_REMOVE(tc, list);
+    }
+
+    if(MALLOC_PREACTION != 0) {
+        return;
+    }
+
+    for(i = 0; i < (int)TC_BINS; ++i) {
+        while((m = tc->bins[i])) {
+            tc->bins[i] = *(Void_t **)m;
+            fREe(m);
+        }
+    }
+
+    fREe(tc);
+
+    if(MALLOC_POSTACTION != 0) {
+    }
+}
+
+static tcache_t *tc_create(void) {
+    kthread_key_t key = 0;
+    tcache_t *tc;
+
+    if(!tc_key) {
+        if(kthread_key_create(&key, tc_destroy))
+            return NULL;
+
+        {
+            irq_disable_scoped();
+
+            if(!tc_key) {
+                tc_key = key;
+                key = 0;
+            }
+        }
+
+        /* Someone else beat us to it. */
+        if(key)
+            kthread_key_delete(key);
+    }
+
+    if(MALLOC_PREACTION != 0) {
+        return NULL;
+    }
+
+    tc = (tcache_t *)cALLOc(1, sizeof(tcache_t));
+
+    if(MALLOC_POSTACTION != 0) {
+    }
+
+    if(!tc)
+        return NULL;
+
+    /* This allocates too, but that goes straight to the heap, as the thread
+       has no cache yet. */
+    if(kthread_setspecific(tc_key, tc)) {
+        if(MALLOC_PREACTION == 0) {
+            fREe(tc);
+
+            if(MALLOC_POSTACTION != 0) {
+            }
+        }
+
+        return NULL;
+    }
+
+    {
+        irq_disable_scoped();
+        LIST_INSERT_HEAD(&tc_all, tc, list);
+    }
+
+    tc_self = tc;
+    return tc;
+}
+
+static Void_t *tc_get(size_t bytes) {
+    tcache_t *tc;
+    Void_t *m;
+    size_t i;
+
+    if(bytes > MALLOC_TCACHE_MAX_SIZE || !tc_usable() || !(tc = tc_self))
+        return NULL;
+
+    i = tc_index(request2size(bytes));
+
+    if(!(m = tc->bins[i]))
+        return NULL;
+
+    tc->bins[i] = *(Void_t **)m;
+    --tc->counts[i];
+    --tc->blocks;
+    tc->bytes -= chunksize(mem2chunk(m));
+
+    return m;
+}
+
+static int tc_put(Void_t *m) {
+    size_t sz = chunksize(mem2chunk(m)), i;
+    tcache_t *tc;
+
+    if(sz > TC_MAX_CHUNK || !tc_usable())
+        return 0;
+
+    if(!(tc = tc_self) && !(tc = tc_create()))
+        return 0;
+
+    i = tc_index(sz);
+
+    if(tc->counts[i] >= MALLOC_TCACHE_COUNT ||
+       tc->bytes + sz > MALLOC_TCACHE_MAX_BYTES)
+        return 0;
+
+    *(Void_t **)m = tc->bins[i];
+    tc->bins[i] = m;
+    ++tc->counts[i];
+    ++tc->blocks;
+    tc->bytes += sz;
+
+    return 1;
+}
+
+/* Count the cached chunks as free, in with the fastbins they stand in for. */
+static void tc_mallinfo(struct mallinfo *mi) {
+    size_t bytes = 0, blocks = 0;
+    tcache_t *tc;
+
+    {
+        irq_disable_scoped();
+
+        LIST_FOREACH(tc, &tc_all, list) {
+            bytes += tc->bytes;
+            blocks += tc->blocks;
+        }
+    }
+
+    mi->smblks += blocks;
+    mi->fsmblks += bytes;
+    mi->fordblks += bytes;
+    mi->uordblks -= bytes;
+}
+
+#endif /* USE_TCACHE */
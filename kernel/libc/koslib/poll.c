@@ -2,136 +2,662 @@
 
    poll.c
    Copyright (C) 2012 Lawrence Sebald
+   Copyright (C) 2024 The KallistiOS Team
 
 */
 
+/* Event notification for poll() and epoll. Everyone waiting for events on a
+   file descriptor hangs an item off of that descriptor's watch list, so that
+   when something happens on it, only the items on that one list have to be
+   looked at. Items with events to report go on their instance's ready list,
+   and waiting is just a matter of sleeping until that list isn't empty.
+
+   poll() is a short-lived epoll instance on the stack, with one item for each
+   of the descriptors it was given. The watch and ready lists are touched with
+   interrupts disabled, as events are triggered from the network stack, which
+   might be running in an interrupt. Everything else about an instance is
+   protected by its mutex.
+
+   Closing an epoll instance marks it as closing and wakes anyone waiting on
+   it, then waits for all of them to leave before it is freed. */
+
 #include <poll.h>
 #include <errno.h>
+#include <stdlib.h>
+#include <sys/epoll.h>
 #include <sys/queue.h>
 
 #include <arch/irq.h>
+#include <arch/timer.h>
 #include <kos/fs.h>
 #include <kos/mutex.h>
-#include <kos/cond.h>
-
-struct poll_int {
-    LIST_ENTRY(poll_int) entry;
-    struct pollfd *fds;
-    nfds_t nfds;
-    int nmatched;
-    condvar_t cv;
+#include <kos/genwait.h>
+
+/* The bits of the events mask that are actually events, not flags. */
+#define EP_EVENTS       0xFFFF
+
+/* Set on a one-shot item once it has fired, until it is modified again. This
+   isn't one of the flags epoll_ctl() takes, so it's cleared on the way in. */
+#define EP_DISABLED     (1U << 29)
+
+/* Don't bother with malloc() for polling this many descriptors or less. */
+#define POLL_STACK_FDS  8
+
+/* One file descriptor that an instance is watching. */
+struct epoll_item {
+    LIST_ENTRY(epoll_item) fd_entry;    /* On the descriptor's watch list */
+    TAILQ_ENTRY(epoll_item) rdy_entry;  /* On the instance's ready list */
+    LIST_ENTRY(epoll_item) ep_entry;    /* On the instance's list of items */
+    struct epoll_inst *ep;
+    int fd;                             /* -1 once the fd has been closed */
+    int ready;                          /* On the ready list? */
+    uint32_t revents;                   /* Events since the last report */
+    struct epoll_event event;
 };
 
-LIST_HEAD(polllist, poll_int) poll_list;
+LIST_HEAD(ep_watch_list, epoll_item);
+TAILQ_HEAD(ep_ready_list, epoll_item);
+LIST_HEAD(ep_item_list, epoll_item);
 
-static mutex_t mutex = MUTEX_INITIALIZER;
+struct epoll_inst {
+    struct ep_ready_list ready;
+    struct ep_item_list items;          /* Only for epoll_create() ones */
+    int nready;
+    int ndead;                          /* Items whose fd has been closed */
+    int waiters;                        /* Threads in epoll_wait()/_ctl() */
+    int closing;
+    mutex_t lock;
+};
 
-void __poll_event_trigger(int fd, short event) {
-    struct poll_int *i;
-    nfds_t j;
-    int gotone = 0;
-    short mask;
+static struct ep_watch_list watches[FD_SETSIZE];
 
-    if(mutex_lock_irqsafe(&mutex))
-        /* XXXX: Uhh... this is bad... */
-        return;
+static int ep_close(void *hnd);
 
-    /* Look through the list of poll fds for any that match */
-    LIST_FOREACH(i, &poll_list, entry) {
-        for(j = 0; j < i->nfds; ++j) {
-            if(i->fds[j].fd == fd) {
-                mask = i->fds[j].events | POLLERR | POLLHUP | POLLNVAL;
-                if(event & mask) {
-                    i->fds[j].revents |= event & mask;
-                    ++i->nmatched;
-                    gotone = 1;
-                }
-            }
+static vfs_handler_t ep_vh = {
+    /* Name handler */
+    {
+        "/epoll",       /* Name */
+        0,              /* tbfi */
+        0x00010000,     /* Version 1.0 */
+        0,              /* Flags */
+        NMMGR_TYPE_VFS,
+        NMMGR_LIST_INIT,
+    },
+
+    0, NULL,        /* No cache, privdata */
+
+    NULL,           /* open */
+    ep_close,       /* close */
+};
+
+/* Which events an item wants to hear about. Errors and hangups are always
+   reported, even if no events were asked for, unless a one-shot item has
+   already fired. */
+static inline uint32_t ep_mask(uint32_t events) {
+    if(events & EP_DISABLED)
+        return 0;
+
+    return (events & EP_EVENTS) | POLLERR | POLLHUP;
+}
+
+/* Check the current state of a file descriptor. */
+static short ep_poll_fd(int fd, short events) {
+    vfs_handler_t *hndl;
+    void *hnd;
+
+    if(fd < 0 || fd >= FD_SETSIZE || !(hndl = fs_get_handler(fd)) ||
+       !(hnd = fs_get_handle(fd)))
+        return POLLNVAL;
+
+    /* Assume its a regular file if there's no poll method in the handler. */
+    if(!hndl->poll)
+        return (POLLRDNORM | POLLWRNORM) & events;
+
+    return hndl->poll(hnd, events);
+}
+
+/* Note events on an item, and put it on the ready list if it isn't there yet.
+   Interrupts must be disabled. */
+static void ep_queue(struct epoll_item *i, uint32_t events) {
+    struct epoll_inst *ep = i->ep;
+
+    i->revents |= events;
+
+    if(!i->ready) {
+        TAILQ_INSERT_TAIL(&ep->ready, i, rdy_entry);
+        i->ready = 1;
+        ++ep->nready;
+        genwait_wake_all(ep);
+    }
+}
+
+/* Take an item off of the lists that events can reach it from. Interrupts
+   must be disabled. */
+static void ep_unlink(struct epoll_item *i) {
+    if(i->fd >= 0)
+        LIST_REMOVE(i, fd_entry);
+
+    if(i->ready) {
+        TAILQ_REMOVE(&i->ep->ready, i, rdy_entry);
+        i->ready = 0;
+        --i->ep->nready;
+    }
+}
+
+static void ep_init(struct epoll_inst *ep) {
+    TAILQ_INIT(&ep->ready);
+    LIST_INIT(&ep->items);
+    ep->nready = 0;
+    ep->ndead = 0;
+    ep->waiters = 0;
+    ep->closing = 0;
+    mutex_init(&ep->lock, MUTEX_TYPE_NORMAL);
+}
+
+/* Start watching a file descriptor, and check whether it's ready already.
+   Checking after the item is on the watch list means nothing can happen in
+   between without us hearing about it. */
+static void ep_add(struct epoll_inst *ep, struct epoll_item *i, int fd,
+                   const struct epoll_event *event) {
+    short ev;
+
+    i->ep = ep;
+    i->fd = fd;
+    i->ready = 0;
+    i->revents = 0;
+    i->event = *event;
+    i->event.events &= ~EP_DISABLED;
+
+    {
+        irq_disable_scoped();
+        LIST_INSERT_HEAD(&watches[fd], i, fd_entry);
+    }
+
+    if((ev = ep_poll_fd(fd, ep_mask(i->event.events)) &
+             ep_mask(i->event.events))) {
+        irq_disable_scoped();
+        ep_queue(i, ev);
+    }
+}
+
+/* Move up to max events off of the ready list and into out. Level-triggered
+   items get their state checked again, and go back to the end of the list as
+   long as they're still ready, to be checked again next time. The instance's
+   lock must be held, which keeps items from being freed under us. */
+static int ep_harvest(struct epoll_inst *ep, struct epoll_event *out,
+                      int max) {
+    struct epoll_item *i;
+    uint32_t events, pending, rv;
+    int left, fd, n = 0;
+
+    {
+        irq_disable_scoped();
+        left = ep->nready;
+    }
+
+    while(left-- > 0 && n < max) {
+        {
+            irq_disable_scoped();
+
+            if(!(i = TAILQ_FIRST(&ep->ready)))
+                break;
+
+            TAILQ_REMOVE(&ep->ready, i, rdy_entry);
+            i->ready = 0;
+            --ep->nready;
+
+            pending = i->revents;
+            i->revents = 0;
+            events = i->event.events;
+            fd = i->fd;
+        }
+
+        if(events & EPOLLET) {
+            rv = pending & ep_mask(events);
+        }
+        else {
+            rv = ep_poll_fd(fd, ep_mask(events)) & ep_mask(events);
+            rv |= pending & (POLLERR | POLLHUP);
+        }
+
+        irq_disable_scoped();
+
+        /* It might have been closed while we were looking at it. */
+        if(!rv || i->fd < 0)
+            continue;
+
+        out[n].events = rv;
+        out[n].data = i->event.data;
+        ++n;
+
+        if(events & EPOLLONESHOT)
+            i->event.events |= EP_DISABLED;
+        else if(!(events & EPOLLET))
+            ep_queue(i, 0);
+    }
+
+    return n;
+}
+
+static int ep_wait(struct epoll_inst *ep, struct epoll_event *out, int max,
+                   int timeout) {
+    uint64 deadline = 0, now;
+    int n, wait = 0, err = errno;
+
+    if(timeout > 0)
+        deadline = timer_ms_gettime64() + timeout;
+
+    for(;;) {
+        if(mutex_lock_irqsafe(&ep->lock))
+            return -1;
+
+        n = ep_harvest(ep, out, max);
+        mutex_unlock(&ep->lock);
+
+        if(n || !timeout)
+            return n;
+
+        /* We can't actually wait while we're in an interrupt, so if we got
+           this far it is an error. */
+        if(irq_inside_int()) {
+            errno = EPERM;
+            return -1;
         }
 
-        /* If we got any events, signal the waiting thread to wake it up. */
-        if(gotone) {
-            cond_signal(&i->cv);
-            gotone = 0;
+        if(timeout > 0) {
+            if((now = timer_ms_gettime64()) >= deadline)
+                return 0;
+
+            wait = (int)(deadline - now);
+        }
+
+        irq_disable_scoped();
+
+        /* Anything that shows up from here on will wake us. */
+        if(!TAILQ_EMPTY(&ep->ready))
+            continue;
+
+        if(ep->closing) {
+            errno = EBADF;
+            return -1;
+        }
+
+        if(genwait_wait(ep, "epoll_wait", wait, NULL) < 0) {
+            errno = err;
+            return 0;
         }
     }
+}
+
+void __poll_event_trigger(int fd, short event) {
+    struct epoll_item *i;
+    uint32_t ev;
+
+    if(fd < 0 || fd >= FD_SETSIZE)
+        return;
+
+    irq_disable_scoped();
 
-    mutex_unlock(&mutex);
+    LIST_FOREACH(i, &watches[fd], fd_entry) {
+        if((ev = event & ep_mask(i->event.events)))
+            ep_queue(i, ev);
+    }
+}
+
+/* Called when a file descriptor is closed. Nobody's interested in the next
+   file to get this descriptor, so forget about everyone watching it. The items
+   themselves belong to their instances, which clean them up later. */
+void __poll_fd_closed(int fd) {
+    struct epoll_item *i;
+
+    if(fd < 0 || fd >= FD_SETSIZE)
+        return;
+
+    irq_disable_scoped();
+
+    while((i = LIST_FIRST(&watches[fd]))) {
+        ep_unlink(i);
+        i->fd = -1;
+        ++i->ep->ndead;
+    }
 }
 
 int poll(struct pollfd fds[], nfds_t nfds, int timeout) {
-    struct poll_int p = { { 0 }, fds, nfds, 0, COND_INITIALIZER };
-    int tmp;
+    struct epoll_item sitems[POLL_STACK_FDS], *items = sitems;
+    struct epoll_event sevents[POLL_STACK_FDS], *events = sevents;
+    struct epoll_event ev;
+    struct epoll_inst ep;
     nfds_t i;
-    vfs_handler_t *hndl;
-    void *hnd;
+    int n = 0, rv;
 
-    if(mutex_lock_irqsafe(&mutex))
-        return -1;
-
-    /* Check if any of the fds already match */
+    /* Check if any of the fds already match, which is all that has to be
+       done if that's the case, or if we're not supposed to wait. */
     for(i = 0; i < nfds; ++i) {
-        hndl = fs_get_handler(fds[i].fd);
-        hnd = fs_get_handle(fds[i].fd);
         fds[i].revents = 0;
 
-        /* If we didn't get one of these, then assume its a bad fd. */
-        if(!hndl || !hnd) {
-            fds[i].revents = POLLNVAL;
-            ++p.nmatched;
+        if(fds[i].fd < 0)
             continue;
-        }
 
-        if(!hndl->poll) {
-            /* Assume its a regular file if there's no poll method in the
-               handler. */
-            if(fds[i].events & (POLLRDNORM | POLLWRNORM)) {
-                fds[i].revents |= (POLLRDNORM | POLLWRNORM) & fds[i].events;
-                ++p.nmatched;
-            }
+        if((fds[i].revents = ep_poll_fd(fds[i].fd,
+                                        fds[i].events | POLLERR | POLLHUP)))
+            ++n;
+    }
+
+    if(n || !timeout)
+        return n;
+
+    if(irq_inside_int()) {
+        errno = EPERM;
+        return -1;
+    }
+
+    if(nfds > POLL_STACK_FDS) {
+        items = (struct epoll_item *)malloc(nfds * sizeof(*items));
+        events = (struct epoll_event *)malloc(nfds * sizeof(*events));
+
+        if(!items || !events) {
+            free(items);
+            free(events);
+            errno = ENOMEM;
+            return -1;
         }
-        else {
-            if((fds[i].revents = hndl->poll(hnd, fds[i].events))) {
-                ++p.nmatched;
-            }
+    }
+
+    /* Watch all of them, then wait for something to happen. */
+    ep_init(&ep);
+
+    for(i = 0; i < nfds; ++i) {
+        items[i].fd = -1;
+        items[i].ready = 0;
+        items[i].ep = &ep;
+
+        if(fds[i].fd < 0)
+            continue;
+
+        ev.events = (uint16_t)fds[i].events;
+        ev.data.u32 = i;
+        ep_add(&ep, &items[i], fds[i].fd, &ev);
+    }
+
+    if((rv = ep_wait(&ep, events, (int)nfds, timeout)) > 0) {
+        for(n = 0; n < rv; ++n)
+            fds[events[n].data.u32].revents = events[n].events;
+    }
+
+    {
+        irq_disable_scoped();
+
+        for(i = 0; i < nfds; ++i)
+            ep_unlink(&items[i]);
+    }
+
+    mutex_destroy(&ep.lock);
+
+    if(items != sitems) {
+        free(items);
+        free(events);
+    }
+
+    return rv;
+}
+
+/* Get the instance behind an epoll file descriptor. */
+static struct epoll_inst *ep_get(int epfd) {
+    if(epfd < 0 || epfd >= FD_SETSIZE || !fs_get_handler(epfd)) {
+        errno = EBADF;
+        return NULL;
+    }
+
+    if(fs_get_handler(epfd) != &ep_vh) {
+        errno = EINVAL;
+        return NULL;
+    }
+
+    return (struct epoll_inst *)fs_get_handle(epfd);
+}
+
+/* Free the items of an instance whose file descriptors have been closed. The
+   instance's lock must be held. */
+static void ep_reap(struct epoll_inst *ep) {
+    struct epoll_item *i, *n;
+
+    {
+        irq_disable_scoped();
+
+        if(!ep->ndead)
+            return;
+
+        ep->ndead = 0;
+    }
+
+    LIST_FOREACH_SAFE(i, &ep->items, ep_entry, n) {
+        if(i->fd < 0) {
+            LIST_REMOVE(i, ep_entry);
+            free(i);
         }
     }
+}
+
+/* Get the instance behind an epoll file descriptor, and count ourselves as
+   using it, so that it can't be freed until ep_leave(). */
+static struct epoll_inst *ep_enter(int epfd) {
+    struct epoll_inst *ep;
+
+    irq_disable_scoped();
+
+    if(!(ep = ep_get(epfd)))
+        return NULL;
 
-    /* If the user specified a 0 timeout, or we've already matched something,
-       bail out now. */
-    if(p.nmatched || !timeout) {
-        mutex_unlock(&mutex);
-        return p.nmatched;
+    if(ep->closing) {
+        errno = EBADF;
+        return NULL;
     }
 
-    /* We can't actually wait while we're in an interrupt, so if we got this far
-       it is an error. */
-    if(irq_inside_int()) {
-        mutex_unlock(&mutex);
-        errno = EPERM;
+    ++ep->waiters;
+    return ep;
+}
+
+static void ep_leave(struct epoll_inst *ep) {
+    irq_disable_scoped();
+
+    if(!--ep->waiters && ep->closing)
+        genwait_wake_all(&ep->waiters);
+}
+
+static int ep_close(void *hnd) {
+    struct epoll_inst *ep = (struct epoll_inst *)hnd;
+    struct epoll_item *i;
+
+    /* Get anyone waiting on the instance to give up, and wait for everyone
+       using it to be done with it. */
+    {
+        irq_disable_scoped();
+
+        ep->closing = 1;
+        genwait_wake_all(ep);
+
+        while(ep->waiters)
+            genwait_wait(&ep->waiters, "epoll_close", 0, NULL);
+    }
+
+    mutex_lock(&ep->lock);
+
+    {
+        irq_disable_scoped();
+
+        LIST_FOREACH(i, &ep->items, ep_entry)
+            ep_unlink(i);
+    }
+
+    while((i = LIST_FIRST(&ep->items))) {
+        LIST_REMOVE(i, ep_entry);
+        free(i);
+    }
+
+    mutex_unlock(&ep->lock);
+    mutex_destroy(&ep->lock);
+    free(ep);
+    return 0;
+}
+
+int epoll_create1(int flags) {
+    struct epoll_inst *ep;
+    int fd;
+
+    if(flags & ~EPOLL_CLOEXEC) {
+        errno = EINVAL;
         return -1;
     }
 
-    /* Map to the value used by cond_wait_timed() */
-    if(timeout == -1)
-        timeout = 0;
+    if(!(ep = (struct epoll_inst *)malloc(sizeof(struct epoll_inst)))) {
+        errno = ENOMEM;
+        return -1;
+    }
 
-    /* Add this instance to the list */
-    LIST_INSERT_HEAD(&poll_list, &p, entry);
+    ep_init(ep);
 
-    tmp = errno;
-    if(cond_wait_timed(&p.cv, &mutex, timeout)) {
-        errno = tmp;
-        tmp = 0;
-        goto out;
+    if((fd = fs_open_handle(&ep_vh, ep)) < 0) {
+        mutex_destroy(&ep->lock);
+        free(ep);
     }
 
-    tmp = p.nmatched;
+    return fd;
+}
+
+int epoll_create(int size) {
+    if(size <= 0) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    return epoll_create1(0);
+}
+
+static int ep_ctl(struct epoll_inst *ep, int epfd, int op, int fd,
+                  struct epoll_event *event) {
+    struct epoll_item *i;
+    short ev;
+
+    if(fd < 0 || fd >= FD_SETSIZE || !fs_get_handler(fd)) {
+        errno = EBADF;
+        return -1;
+    }
+
+    if(fd == epfd || fs_get_handler(fd) == &ep_vh) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    if(op != EPOLL_CTL_DEL && !event) {
+        errno = EFAULT;
+        return -1;
+    }
+
+    mutex_lock_scoped(&ep->lock);
+    ep_reap(ep);
+
+    {
+        irq_disable_scoped();
+
+        LIST_FOREACH(i, &watches[fd], fd_entry) {
+            if(i->ep == ep)
+                break;
+        }
+    }
+
+    switch(op) {
+        case EPOLL_CTL_ADD:
+            if(i) {
+                errno = EEXIST;
+                return -1;
+            }
+
+            if(!(i = (struct epoll_item *)malloc(sizeof(struct epoll_item)))) {
+                errno = ENOMEM;
+                return -1;
+            }
+
+            LIST_INSERT_HEAD(&ep->items, i, ep_entry);
+            ep_add(ep, i, fd, event);
+            return 0;
+
+        case EPOLL_CTL_MOD:
+            if(!i) {
+                errno = ENOENT;
+                return -1;
+            }
+
+            /* Forget whatever happened before, and start over with the new
+               mask, just like it was added again. */
+            {
+                irq_disable_scoped();
+
+                if(i->ready) {
+                    TAILQ_REMOVE(&ep->ready, i, rdy_entry);
+                    i->ready = 0;
+                    --ep->nready;
+                }
+
+                i->revents = 0;
+                i->event = *event;
+                i->event.events &= ~EP_DISABLED;
+            }
+
+            if((ev = ep_poll_fd(fd, ep_mask(i->event.events)) &
+                     ep_mask(i->event.events))) {
+                irq_disable_scoped();
+                ep_queue(i, ev);
+            }
+
+            return 0;
+
+        case EPOLL_CTL_DEL:
+            if(!i) {
+                errno = ENOENT;
+                return -1;
+            }
+
+            {
+                irq_disable_scoped();
+                ep_unlink(i);
+            }
+
+            LIST_REMOVE(i, ep_entry);
+            free(i);
+            return 0;
 
-out:
-    /* Remove this instance from the list */
-    LIST_REMOVE(&p, entry);
+        default:
+            errno = EINVAL;
+            return -1;
+    }
+}
+
+int epoll_ctl(int epfd, int op, int fd, struct epoll_event *event) {
+    struct epoll_inst *ep;
+    int rv;
+
+    if(!(ep = ep_enter(epfd)))
+        return -1;
+
+    rv = ep_ctl(ep, epfd, op, fd, event);
+    ep_leave(ep);
+    return rv;
+}
+
+int epoll_wait(int epfd, struct epoll_event *events, int maxevents,
+               int timeout) {
+    struct epoll_inst *ep;
+    int rv;
+
+    if(maxevents <= 0) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    if(!(ep = ep_enter(epfd)))
+        return -1;
 
-    mutex_unlock(&mutex);
-    return tmp;
+    rv = ep_wait(ep, events, maxevents, timeout);
+    ep_leave(ep);
+    return rv;
 }
@@ -0,0 +1,375 @@
+/* KallistiOS ##version##
+
+   slab.c
+   Copyright (C) 2024 The KallistiOS Team
+*/
+
+/* A simple slab allocator. Each cache gets its memory from malloc() in slabs.
+   A slab starts with a small header, followed by as many objects as fit. Free
+   objects are kept on a list per slab, linked through a word in the object
+   itself (or just after it, if the cache has a constructor, so that the
+   constructed state survives).
+
+   For small objects, slabs are KMEM_SLAB_SIZE bytes and aligned to their own
+   size, so the slab an object is in can be found by masking its address.
+   Doing that for big objects (thread control blocks, network buffers) would
+   mean big, self-aligned slabs, which waste a lot of memory to alignment in
+   malloc(). Those get slabs just big enough for KMEM_SLAB_MIN_OBJS objects,
+   with a word in front of each object pointing back at its slab instead.
+
+   Slabs are kept on one of three lists, depending on whether all, some or none
+   of their objects are in use, so that allocating never has to look further
+   than the head of a list. Everything is protected by disabling interrupts,
+   which on our single CPU is cheaper than any lock. */
+
+#include <assert.h>
+#include <errno.h>
+#include <malloc.h>
+#include <stdlib.h>
+#include <sys/queue.h>
+
+#include <arch/irq.h>
+#include <kos/opts.h>
+#include <kos/slab.h>
+
+/* Slabs of big objects are made bigger until at least this many fit. */
+#define KMEM_SLAB_MIN_OBJS  8
+
+#define KMEM_DEFAULT_ALIGN  8
+
+#define KMEM_ROUND_UP(x, a) (((x) + (a) - 1) & ~((a) - 1))
+
+typedef struct kmem_slab {
+    LIST_ENTRY(kmem_slab) entry;
+    kmem_cache_t *cache;
+    void *free;
+    size_t inuse;
+} kmem_slab_t;
+
+LIST_HEAD(kmem_slab_list, kmem_slab);
+
+struct kmem_cache {
+    LIST_ENTRY(kmem_cache) entry;
+    struct kmem_slab_list full, partial, empty;
+    kmem_ctor_t ctor;
+    size_t link;            /* Offset of the free list link in an object */
+    size_t offset;          /* Offset of the first object in a slab */
+    size_t align;           /* Alignment of the objects */
+    size_t back;            /* Space for the slab pointer before each object,
+                               or 0 if slabs are self-aligned */
+    kmem_cache_stats_t st;
+};
+
+static LIST_HEAD(kmem_cache_list, kmem_cache) kmem_caches =
+    LIST_HEAD_INITIALIZER(kmem_caches);
+
+static inline void **kmem_link(const kmem_cache_t *c, void *obj) {
+    return (void **)((uint8_t *)obj + c->link);
+}
+
+static inline kmem_slab_t *kmem_slab_of(const kmem_cache_t *c, void *obj) {
+    if(c->back)
+        return ((kmem_slab_t **)obj)[-1];
+
+    return (kmem_slab_t *)((uintptr_t)obj & ~(c->st.slab_size - 1));
+}
+
+kmem_cache_t *kmem_cache_create(const char *name, size_t size, size_t align,
+                                kmem_ctor_t ctor) {
+    kmem_cache_t *c;
+    size_t slab_size = KMEM_SLAB_SIZE;
+
+    if(!align)
+        align = KMEM_DEFAULT_ALIGN;
+
+    if(!size || (align & (align - 1))) {
+        errno = EINVAL;
+        return NULL;
+    }
+
+    if(align < sizeof(void *))
+        align = sizeof(void *);
+
+    if(!(c = (kmem_cache_t *)calloc(1, sizeof(kmem_cache_t)))) {
+        errno = ENOMEM;
+        return NULL;
+    }
+
+    LIST_INIT(&c->full);
+    LIST_INIT(&c->partial);
+    LIST_INIT(&c->empty);
+    c->ctor = ctor;
+
+    /* Without a constructor, the link can go over the object's contents. */
+    if(ctor) {
+        c->link = KMEM_ROUND_UP(size, sizeof(void *));
+        size = c->link + sizeof(void *);
+    }
+    else if(size < sizeof(void *)) {
+        size = sizeof(void *);
+    }
+
+    size = KMEM_ROUND_UP(size, align);
+    c->offset = KMEM_ROUND_UP(sizeof(kmem_slab_t), align);
+    c->align = align;
+
+    if((slab_size - c->offset) / size < KMEM_SLAB_MIN_OBJS) {
+        c->back = KMEM_ROUND_UP(sizeof(kmem_slab_t *), align);
+        size += c->back;
+        slab_size = c->offset + KMEM_SLAB_MIN_OBJS * size;
+    }
+
+    c->st.name = name;
+    c->st.obj_size = size;
+    c->st.slab_size = slab_size;
+    c->st.objs_per_slab = (slab_size - c->offset) / size;
+
+    irq_disable_scoped();
+    LIST_INSERT_HEAD(&kmem_caches, c, entry);
+
+    return c;
+}
+
+static void kmem_free_slabs(struct kmem_slab_list *list) {
+    kmem_slab_t *s;
+
+    while((s = LIST_FIRST(list))) {
+        LIST_REMOVE(s, entry);
+        free(s);
+    }
+}
+
+void kmem_cache_destroy(kmem_cache_t *c) {
+    if(!c)
+        return;
+
+    {
+        irq_disable_scoped();
+        LIST_REMOVE(c, entry);
+    }
+
+    kmem_free_slabs(&c->full);
+    kmem_free_slabs(&c->partial);
+    kmem_free_slabs(&c->empty);
+    free(c);
+}
+
+/* Allocate a new slab and thread all of its objects onto its free list. This
+   is done without interrupts disabled (unless the caller had them disabled),
+   as the constructor could take a while. */
+static kmem_slab_t *kmem_slab_grow(kmem_cache_t *c) {
+    size_t i, align = c->back ? c->align : c->st.slab_size;
+    kmem_slab_t *s;
+    uint8_t *obj;
+
+    s = (kmem_slab_t *)memalign(align, c->st.slab_size);
+
+    if(!s && kmem_cache_reap())
+        s = (kmem_slab_t *)memalign(align, c->st.slab_size);
+
+    if(!s)
+        return NULL;
+
+    s->cache = c;
+    s->free = NULL;
+    s->inuse = 0;
+
+    /* Go backwards, so the first object ends up at the head of the list. */
+    for(i = c->st.objs_per_slab; i > 0; --i) {
+        obj = (uint8_t *)s + c->offset + (i - 1) * c->st.obj_size + c->back;
+
+        if(c->back)
+            ((kmem_slab_t **)obj)[-1] = s;
+
+        if(c->ctor)
+            c->ctor(obj);
+
+        *kmem_link(c, obj) = s->free;
+        s->free = obj;
+    }
+
+    return s;
+}
+
+void *kmem_cache_alloc(kmem_cache_t *c) {
+    kmem_slab_t *s;
+    void *obj;
+    int irqs;
+
+    irqs = irq_disable();
+
+    /* Someone else might get to a new slab before we do, hence the loop. */
+    while(!(s = LIST_FIRST(&c->partial)) && !(s = LIST_FIRST(&c->empty))) {
+        irq_restore(irqs);
+        s = kmem_slab_grow(c);
+        irqs = irq_disable();
+
+        if(!s) {
+            ++c->st.failures;
+            irq_restore(irqs);
+            errno = ENOMEM;
+            return NULL;
+        }
+
+        LIST_INSERT_HEAD(&c->empty, s, entry);
+        ++c->st.slabs;
+        ++c->st.empty_slabs;
+        ++c->st.grows;
+    }
+
+    obj = s->free;
+    s->free = *kmem_link(c, obj);
+
+    if(!s->inuse++) {
+        LIST_REMOVE(s, entry);
+        LIST_INSERT_HEAD(&c->partial, s, entry);
+        --c->st.empty_slabs;
+    }
+
+    if(s->inuse == c->st.objs_per_slab) {
+        LIST_REMOVE(s, entry);
+        LIST_INSERT_HEAD(&c->full, s, entry);
+    }
+
+    if(++c->st.active > c->st.max_active)
+        c->st.max_active = c->st.active;
+
+    ++c->st.allocs;
+
+    irq_restore(irqs);
+    return obj;
+}
+
+void kmem_cache_free(kmem_cache_t *c, void *obj) {
+    kmem_slab_t *s;
+
+    if(!obj)
+        return;
+
+    s = kmem_slab_of(c, obj);
+    assert(s->cache == c);
+
+    irq_disable_scoped();
+
+    *kmem_link(c, obj) = s->free;
+    s->free = obj;
+
+    if(s->inuse-- == c->st.objs_per_slab) {
+        LIST_REMOVE(s, entry);
+        LIST_INSERT_HEAD(&c->partial, s, entry);
+    }
+
+    if(!s->inuse) {
+        LIST_REMOVE(s, entry);
+        LIST_INSERT_HEAD(&c->empty, s, entry);
+        ++c->st.empty_slabs;
+    }
+
+    --c->st.active;
+    ++c->st.frees;
+}
+
+/* Move the empty slabs of a cache onto a list, to be freed once interrupts
+   are enabled again. Assumes interrupts are disabled. Returns the number of
+   bytes moved. */
+static size_t kmem_take_empty(kmem_cache_t *c, struct kmem_slab_list *list) {
+    kmem_slab_t *s;
+    size_t count = 0;
+
+    while((s = LIST_FIRST(&c->empty))) {
+        LIST_REMOVE(s, entry);
+        LIST_INSERT_HEAD(list, s, entry);
+        ++count;
+    }
+
+    c->st.slabs -= count;
+    c->st.empty_slabs = 0;
+    c->st.shrinks += count;
+
+    return count * c->st.slab_size;
+}
+
+size_t kmem_cache_shrink(kmem_cache_t *c) {
+    struct kmem_slab_list empty = LIST_HEAD_INITIALIZER(empty);
+    size_t rv;
+
+    {
+        irq_disable_scoped();
+        rv = kmem_take_empty(c, &empty);
+    }
+
+    kmem_free_slabs(&empty);
+    return rv;
+}
+
+size_t kmem_cache_reap(void) {
+    struct kmem_slab_list empty = LIST_HEAD_INITIALIZER(empty);
+    kmem_cache_t *c;
+    size_t rv = 0;
+
+    {
+        irq_disable_scoped();
+
+        LIST_FOREACH(c, &kmem_caches, entry)
+            rv += kmem_take_empty(c, &empty);
+    }
+
+    kmem_free_slabs(&empty);
+    return rv;
+}
+
+void kmem_cache_get_stats(kmem_cache_t *c, kmem_cache_stats_t *st) {
+    irq_disable_scoped();
+    *st = c->st;
+}
+
+void kmem_cache_print_stats(int (*pf)(const char *fmt, ...)) {
+    kmem_cache_stats_t *copy, *st;
+    kmem_cache_t *c;
+    int i, count = 0;
+
+    /* Take a snapshot, so we don't print with interrupts disabled. */
+    {
+        irq_disable_scoped();
+
+        LIST_FOREACH(c, &kmem_caches, entry)
+            ++count;
+    }
+
+    if(!(copy = (kmem_cache_stats_t *)malloc(count * sizeof(*copy))) &&
+       count) {
+        pf("Out of memory for object cache statistics.\n");
+        return;
+    }
+
+    {
+        irq_disable_scoped();
+
+        /* A cache may have come or gone since we counted them. */
+        i = 0;
+
+        LIST_FOREACH(c, &kmem_caches, entry) {
+            if(i < count)
+                copy[i++] = c->st;
+        }
+
+        count = i;
+    }
+
+    pf("Object caches:\n");
+    pf("name              size   slabs  empty  active  max act"
+       "    allocs  failures\n");
+
+    for(i = 0; i < count; ++i) {
+        st = &copy[i];
+
+        pf("%-16s %5u  %6u  %5u  %6u  %7u  %8lu  %8lu\n",
+           st->name ? st->name : "(unnamed)",
+           st->obj_size, st->slabs, st->empty_slabs, st->active,
+           st->max_active, st->allocs, st->failures);
+    }
+
+    pf("--end of list--\n");
+
+    free(copy);
+}
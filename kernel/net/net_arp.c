@@ -14,6 +14,7 @@
 #include <arch/timer.h>
 
 #include "net_ipv4.h"
+#include "net_pbuf.h"
 
 /*
 
@@ -163,8 +164,8 @@ int net_arp_insert(netif_t *nif, const uint8 mac[6], const uint8 ip[4],
    query will be sent and an error will be returned. Thus your packet send
    should also fail. Later when the transmit retries, hopefully the answer
    will have arrived. */
-int net_arp_lookup(netif_t *nif, const uint8 ip_in[4], uint8 mac_out[6],
-                   const ip_hdr_t *pkt, const uint8 *data, int data_size) {
+int net_arp_lookup_pbuf(netif_t *nif, const uint8 ip_in[4], uint8 mac_out[6],
+                        const ip_hdr_t *pkt, const net_pbuf_t *data) {
     netarp_t *cur;
 
     /* Garbage collect expired entries */
@@ -199,8 +200,8 @@ int net_arp_lookup(netif_t *nif, const uint8 ip_in[4], uint8 mac_out[6],
     cur->timestamp = timer_ms_gettime64();
 
     /* Copy our packet if we have one to copy. */
-    if(pkt && data && data_size) {
-        cur->data = (uint8 *)malloc(data_size);
+    if(pkt && data && data->tot_len) {
+        cur->data = (uint8 *)malloc(data->tot_len);
 
         if(cur->data) {
             cur->pkt = (ip_hdr_t *)malloc(sizeof(ip_hdr_t));
@@ -211,8 +212,8 @@ int net_arp_lookup(netif_t *nif, const uint8 ip_in[4], uint8 mac_out[6],
             }
             else {
                 memcpy(cur->pkt, pkt, sizeof(ip_hdr_t));
-                memcpy(cur->data, data, data_size);
-                cur->data_size = data_size;
+                cur->data_size = net_pbuf_copy_out(data, 0, cur->data,
+                                                   data->tot_len);
             }
         }
     }
@@ -227,6 +228,14 @@ int net_arp_lookup(netif_t *nif, const uint8 ip_in[4], uint8 mac_out[6],
     return -2;
 }
 
+int net_arp_lookup(netif_t *nif, const uint8 ip_in[4], uint8 mac_out[6],
+                   const ip_hdr_t *pkt, const uint8 *data, int data_size) {
+    net_pbuf_t p;
+
+    net_pbuf_init_ref(&p, data, data_size);
+    return net_arp_lookup_pbuf(nif, ip_in, mac_out, pkt, data ? &p : NULL);
+}
+
 /* Do a reverse ARP lookup: look for an IP for a given mac address; note
    that if this fails, you have no recourse. */
 int net_arp_revlookup(netif_t *nif, uint8 ip_out[4], const uint8 mac_in[6]) {
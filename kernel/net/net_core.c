@@ -16,6 +16,7 @@
 #include "net_thd.h"
 #include "net_ipv4.h"
 #include "net_ipv6.h"
+#include "net_pbuf.h"
 
 /*
 
@@ -147,6 +148,10 @@ int net_init(uint32 ip) {
     if(net_initted)
         return 0;
 
+    /* Set up the packet buffer pools, before any devices can use them */
+    if(net_pbuf_init() < 0)
+        return -1;
+
     /* Detect and potentially initialize devices */
     if(net_dev_init() < 0)
         return -1;
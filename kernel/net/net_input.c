@@ -9,6 +9,7 @@
 #include <kos/net.h>
 #include "net_ipv4.h"
 #include "net_ipv6.h"
+#include "net_pbuf.h"
 
 /*
 
@@ -16,8 +17,15 @@
 
 */
 
-static int net_default_input(netif_t *nif, const uint8 *data, int len) {
-    uint16 proto = (uint16)((data[12] << 8) | (data[13]));
+static int net_default_input_pbuf(netif_t *nif, net_pbuf_t *p) {
+    const uint8 *data = p->data;
+    uint16 proto;
+
+    /* The whole ethernet header has to be in the first buffer. */
+    if(p->len < sizeof(eth_hdr_t))
+        return -1;
+
+    proto = (uint16)((data[12] << 8) | (data[13]));
 
     /* If this is bound for a multicast address, make sure we actually care
        about the one that it gets sent to. */
@@ -30,16 +38,25 @@ static int net_default_input(netif_t *nif, const uint8 *data, int len) {
 
     switch(proto) {
         case 0x0800:
-            return net_ipv4_input(nif, data + sizeof(eth_hdr_t),
-                                  len - sizeof(eth_hdr_t),
+            return net_ipv4_input(nif, net_pbuf_pull(p, sizeof(eth_hdr_t)),
                                   (const eth_hdr_t *)data);
 
-        case 0x0806:
-            return net_arp_input(nif, data, len);
+        case 0x0806: {
+            net_pbuf_t *copy;
+            const uint8 *arp;
+            int rv;
+
+            if(!(arp = net_pbuf_flatten(p, &copy)))
+                return -1;
+
+            rv = net_arp_input(nif, arp, p->tot_len);
+            net_pbuf_free(copy);
+
+            return rv;
+        }
 
         case 0x86DD:
-            return net_ipv6_input(nif, data + sizeof(eth_hdr_t),
-                                  len - sizeof(eth_hdr_t),
+            return net_ipv6_input(nif, net_pbuf_pull(p, sizeof(eth_hdr_t)),
                                   (const eth_hdr_t *)data);
 
         default:
@@ -47,6 +64,13 @@ static int net_default_input(netif_t *nif, const uint8 *data, int len) {
     }
 }
 
+static int net_default_input(netif_t *nif, const uint8 *data, int len) {
+    net_pbuf_t p;
+
+    net_pbuf_init_ref(&p, data, len);
+    return net_default_input_pbuf(nif, &p);
+}
+
 /* Where will input packets be routed? */
 net_input_func net_input_target = net_default_input;
 
@@ -58,6 +82,28 @@ int net_input(netif_t *device, const uint8 *data, int len) {
         return 0;
 }
 
+int net_input_pbuf(netif_t *device, net_pbuf_t *p) {
+    /* Only our own input function knows what to do with packet buffers. */
+    if(net_input_target == net_default_input) {
+        return net_default_input_pbuf(device, p);
+    }
+    else if(net_input_target != NULL) {
+        net_pbuf_t *copy;
+        const uint8 *data;
+        int rv;
+
+        if(!(data = net_pbuf_flatten(p, &copy)))
+            return -1;
+
+        rv = net_input_target(device, data, p->tot_len);
+        net_pbuf_free(copy);
+
+        return rv;
+    }
+    else
+        return 0;
+}
+
 /* Setup an input target; returns the old target */
 net_input_func net_input_set_target(net_input_func t) {
     net_input_func old = net_input_target;
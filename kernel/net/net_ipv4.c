@@ -21,6 +21,7 @@
 
 #include "net_ipv4.h"
 #include "net_icmp.h"
+#include "net_pbuf.h"
 
 static net_ipv4_stats_t ipv4_stats = { 0 };
 
@@ -34,7 +35,7 @@ uint16 net_ipv4_checksum(const uint8 *data, size_t bytes, uint16 start) {
         const uint8 *ptr = data;
 
         while(i > 1) {
-            sum += *ptr | ((*ptr + 1) << 8);
+            sum += ptr[0] | (ptr[1] << 8);
             ptr += 2;
             i -= 2;
 
@@ -91,11 +92,12 @@ static int is_broadcast(const uint8 dest[4], const uint8 bc[4]) {
 }
 
 /* Send a packet on the specified network adapter */
-int net_ipv4_send_packet(netif_t *net, ip_hdr_t *hdr, const uint8 *data,
-                         size_t size) {
+int net_ipv4_send_packet_pbuf(netif_t *net, ip_hdr_t *hdr, net_pbuf_t *p) {
     uint8 dest_ip[4];
     uint8 dest_mac[6];
-    uint8 pkt[size + sizeof(ip_hdr_t) + sizeof(eth_hdr_t)];
+    uint8 hbuf[sizeof(eth_hdr_t) + 60] __attribute__((aligned(4)));
+    size_t hdrlen = 4 * (hdr->version_ihl & 0x0f);
+    net_pbuf_t hp;
     eth_hdr_t *ehdr;
     int err;
 
@@ -110,29 +112,27 @@ int net_ipv4_send_packet(netif_t *net, ip_hdr_t *hdr, const uint8 *data,
 
     net_ipv4_parse_address(ntohl(hdr->dest), dest_ip);
 
+    /* The headers go in a buffer of their own, in front of the data. Leave
+       room for the ethernet header, in case we need one. */
+    memcpy(hbuf + sizeof(eth_hdr_t), hdr, hdrlen);
+    net_pbuf_init_ref(&hp, hbuf + sizeof(eth_hdr_t), hdrlen);
+    hp.next = p;
+    hp.tot_len += p->tot_len;
+
     /* Is this a loopback address (127/8)? */
     if(dest_ip[0] == 0x7F) {
-        /* Put the IP header / data into our packet */
-        memcpy(pkt, hdr, 4 * (hdr->version_ihl & 0x0f));
-        memcpy(pkt + 4 * (hdr->version_ihl & 0x0f), data, size);
-
         ++ipv4_stats.pkt_sent;
 
         /* Send it "away" */
-        net_ipv4_input(NULL, pkt, 4 * (hdr->version_ihl & 0x0f) + size, NULL);
+        net_ipv4_input(NULL, &hp, NULL);
 
         return 0;
     }
     else if(net->flags & NETIF_NOETH) {
-        /* Put the IP header / data into our packet */
-        memcpy(pkt, hdr, 4 * (hdr->version_ihl & 0x0f));
-        memcpy(pkt + 4 * (hdr->version_ihl & 0x0f), data, size);
-
         ++ipv4_stats.pkt_sent;
 
         /* Send it away */
-        return net->if_tx(net, pkt, 4 * (hdr->version_ihl & 0x0f) + size,
-                          NETIF_BLOCK);
+        return net_pbuf_xmit(net, &hp, NETIF_BLOCK);
     }
 
     /* Are we sending a broadcast packet? */
@@ -149,7 +149,7 @@ int net_ipv4_send_packet(netif_t *net, ip_hdr_t *hdr, const uint8 *data,
         /* Get our destination's MAC address. If we do not have the MAC address
            cached, return a distinguished error to the upper-level protocol so
            that it can decide what to do. */
-        err = net_arp_lookup(net, dest_ip, dest_mac, hdr, data, size);
+        err = net_arp_lookup_pbuf(net, dest_ip, dest_mac, hdr, p);
 
         if(err == -1) {
             errno = ENETUNREACH;
@@ -164,28 +164,34 @@ int net_ipv4_send_packet(netif_t *net, ip_hdr_t *hdr, const uint8 *data,
     }
 
     /* Fill in the ethernet header */
-    ehdr = (eth_hdr_t *)pkt;
+    ehdr = (eth_hdr_t *)hbuf;
     memcpy(ehdr->dest, dest_mac, 6);
     memcpy(ehdr->src, net->mac_addr, 6);
     ehdr->type[0] = 0x08;
     ehdr->type[1] = 0x00;
 
-    /* Put the IP header / data into our ethernet packet */
-    memcpy(pkt + sizeof(eth_hdr_t), hdr, 4 * (hdr->version_ihl & 0x0f));
-    memcpy(pkt + sizeof(eth_hdr_t) + 4 * (hdr->version_ihl & 0x0f), data,
-           size);
+    hp.data = hbuf;
+    hp.len += sizeof(eth_hdr_t);
+    hp.tot_len += sizeof(eth_hdr_t);
 
     ++ipv4_stats.pkt_sent;
 
     /* Send it away */
-    net->if_tx(net, pkt, sizeof(ip_hdr_t) + size + sizeof(eth_hdr_t),
-               NETIF_BLOCK);
+    net_pbuf_xmit(net, &hp, NETIF_BLOCK);
 
     return 0;
 }
 
-int net_ipv4_send(netif_t *net, const uint8 *data, size_t size, int id, int ttl,
-                  int proto, uint32 src, uint32 dst) {
+int net_ipv4_send_packet(netif_t *net, ip_hdr_t *hdr, const uint8 *data,
+                         size_t size) {
+    net_pbuf_t p;
+
+    net_pbuf_init_ref(&p, data, size);
+    return net_ipv4_send_packet_pbuf(net, hdr, &p);
+}
+
+int net_ipv4_send_pbuf(netif_t *net, net_pbuf_t *p, int id, int ttl, int proto,
+                       uint32 src, uint32 dst) {
     ip_hdr_t hdr;
 
     /* If the ID is -1, generate a random ID value that can be used in case the
@@ -197,7 +203,7 @@ int net_ipv4_send(netif_t *net, const uint8 *data, size_t size, int id, int ttl,
     /* Fill in the IPv4 Header */
     hdr.version_ihl = 0x45;
     hdr.tos = 0;
-    hdr.length = htons(size + 20);
+    hdr.length = htons(p->tot_len + 20);
     hdr.packet_id = id;
     hdr.flags_frag_offs = 0;
     hdr.ttl = ttl;
@@ -208,27 +214,37 @@ int net_ipv4_send(netif_t *net, const uint8 *data, size_t size, int id, int ttl,
 
     hdr.checksum = net_ipv4_checksum((uint8 *)&hdr, sizeof(ip_hdr_t), 0);
 
-    return net_ipv4_frag_send(net, &hdr, data, size);
+    return net_ipv4_frag_send(net, &hdr, p);
+}
+
+int net_ipv4_send(netif_t *net, const uint8 *data, size_t size, int id, int ttl,
+                  int proto, uint32 src, uint32 dst) {
+    net_pbuf_t p;
+
+    net_pbuf_init_ref(&p, data, size);
+    return net_ipv4_send_pbuf(net, &p, id, ttl, proto, src, dst);
 }
 
-int net_ipv4_input(netif_t *src, const uint8 *pkt, size_t pktsize,
-                   const eth_hdr_t *eth) {
+int net_ipv4_input(netif_t *src, net_pbuf_t *p, const eth_hdr_t *eth) {
     const ip_hdr_t *ip;
-    const uint8 *data;
-    size_t hdrlen;
+    size_t hdrlen, len;
     uint8 ipa[4];
 
-    if(pktsize < sizeof(ip_hdr_t)) {
+    /* The whole header has to be in the first buffer. Drivers always give us
+       the whole packet in one, and so do we. */
+    if(p->len < sizeof(ip_hdr_t)) {
         /* This is obviously a bad packet, drop it */
         ++ipv4_stats.pkt_recv_bad_size;
         return -1;
     }
 
-    ip = (const ip_hdr_t *)pkt;
+    ip = (const ip_hdr_t *)p->data;
     hdrlen = (ip->version_ihl & 0x0F) << 2;
+    len = ntohs(ip->length);
 
-    if(pktsize < hdrlen) {
-        /* The packet is smaller than the listed header length, bail */
+    if(p->len < hdrlen || len < hdrlen || p->tot_len < len) {
+        /* The packet is smaller than the listed header length or than the
+           length it says it is, bail */
         ++ipv4_stats.pkt_recv_bad_size;
         return -1;
     }
@@ -240,8 +256,6 @@ int net_ipv4_input(netif_t *src, const uint8 *pkt, size_t pktsize,
         return -1;
     }
 
-    data = (const uint8 *)(pkt + hdrlen);
-
     /* Add the sender to the ARP cache, if they're not already there. */
     if(eth) {
         net_ipv4_parse_address(ntohl(ip->src), ipa);
@@ -249,22 +263,34 @@ int net_ipv4_input(netif_t *src, const uint8 *pkt, size_t pktsize,
     }
 
     /* Submit the packet for possible reassembly. */
-    return net_ipv4_reassemble(src, ip, data, ntohs(ip->length) - hdrlen);
+    p = net_pbuf_pull(p, hdrlen);
+    return net_ipv4_reassemble(src, ip, p, len - hdrlen);
 }
 
-int net_ipv4_input_proto(netif_t *src, const ip_hdr_t *ip, const uint8 *data) {
+int net_ipv4_input_proto(netif_t *src, const ip_hdr_t *ip, net_pbuf_t *p) {
     size_t hdrlen = (ip->version_ihl & 0x0F) << 2;
     size_t datalen = ntohs(ip->length) - hdrlen;
     int rv;
 
     /* Send the packet along to the appropriate protocol. */
     switch(ip->protocol) {
-        case IPPROTO_ICMP:
+        case IPPROTO_ICMP: {
+            net_pbuf_t *copy;
+            const uint8 *data;
+
+            if(!(data = net_pbuf_flatten(p, &copy)))
+                return -1;
+
             ++ipv4_stats.pkt_recv;
-            return net_icmp_input(src, ip, data, datalen);
+            rv = net_icmp_input(src, ip, data, datalen);
+            net_pbuf_free(copy);
+
+            return rv;
+        }
 
         default:
-            rv = fs_socket_input(src, AF_INET, ip->protocol, ip, data, datalen);
+            rv = fs_socket_input_pbuf(src, AF_INET, ip->protocol, ip, p,
+                                      datalen);
 
             if(rv > -2) {
                 ++ipv4_stats.pkt_recv;
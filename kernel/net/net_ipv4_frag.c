@@ -13,14 +13,35 @@
 
 #include <kos/net.h>
 #include <kos/mutex.h>
+#include <kos/lockstat.h>
 #include <arch/timer.h>
 #include <arch/irq.h>
 
 #include "net_ipv4.h"
+#include "net_pbuf.h"
 #include "net_thd.h"
 
 #define MAX(a, b) a > b ? a : b;
 
+/* Most pieces and bytes of data we'll hang on to for one datagram. Even on a
+   link with the smallest MTU anyone really uses (576 bytes), the largest
+   datagram only takes about 120 fragments. Anything sending a lot more than
+   that, or sending the same data over and over in overlapping pieces, is out
+   to use up our memory, so the whole datagram is dropped. */
+#define FRAG_MAX_PIECES     256
+#define FRAG_MAX_BYTES      (2 * 65536)
+
+/* A fragment we've received. Rather than copying the data into one big buffer,
+   we hang on to the packet buffers it came in (or a copy of them, if the
+   driver's buffer can't be kept), and chain them all together once the whole
+   datagram is here. */
+struct ip_frag_piece {
+    struct ip_frag_piece *next;
+    net_pbuf_t *data;
+    int start;
+    int end;
+};
+
 struct ip_frag {
     TAILQ_ENTRY(ip_frag) listhnd;
 
@@ -30,9 +51,10 @@ struct ip_frag {
     uint8 proto;
 
     ip_hdr_t hdr;
-    uint8 *data;
+    struct ip_frag_piece *pieces;       /* Sorted by start */
+    int piece_cnt;
+    int piece_bytes;
     uint8 bitfield[8192];
-    int cur_length;
     int total_length;
     uint64 death_time;
 };
@@ -44,6 +66,18 @@ static mutex_t frag_mutex = MUTEX_INITIALIZER;
 static int cbid = -1;
 static int initted = 0;
 
+static void frag_free(struct ip_frag *frag) {
+    struct ip_frag_piece *p, *n;
+
+    for(p = frag->pieces; p; p = n) {
+        n = p->next;
+        net_pbuf_free(p->data);
+        free(p);
+    }
+
+    free(frag);
+}
+
 /* IP fragment "thread" -- this thread is set up to delete fragments for which
    the "death_time" has passed. This is run approximately once every two
    seconds (since death_time is always on the order of seconds). */
@@ -64,8 +98,7 @@ static void frag_thd_cb(void *data) {
 
         if(f->death_time < now) {
             TAILQ_REMOVE(&frags, f, listhnd);
-            free(f->data);
-            free(f);
+            frag_free(f);
         }
 
         f = n;
@@ -123,36 +156,120 @@ static inline int all_bits_set(const uint8 *bitfield, int end) {
     return 1;
 }
 
+/* Chain together the pieces of a complete datagram, trimming off anything
+   that overlaps or runs past the end. The pieces are used up in the process. */
+static net_pbuf_t *frag_chain(struct ip_frag *frag) {
+    struct ip_frag_piece *p, *n;
+    net_pbuf_t *head = NULL, *tmp;
+    int pos = 0, end, failed = 0;
+
+    for(p = frag->pieces; p; p = n) {
+        n = p->next;
+        end = p->end < frag->total_length ? p->end : frag->total_length;
+
+        if(end > pos && !failed) {
+            /* Trim off whatever we've already got, and anything past the end.
+               The pieces are all ours already, so this doesn't copy. */
+            if(p->start > pos) {
+                /* A hole the bitfield couldn't see, it's no good. */
+                net_pbuf_free(p->data);
+                p->data = NULL;
+            }
+            else if(p->start < pos || end < p->end) {
+                tmp = net_pbuf_clone(p->data, pos - p->start, end - pos);
+                net_pbuf_free(p->data);
+                p->data = tmp;
+            }
+
+            if(!p->data)
+                failed = 1;
+            else if(head)
+                net_pbuf_cat(head, p->data);
+            else
+                head = p->data;
+
+            pos = end;
+        }
+        else {
+            net_pbuf_free(p->data);
+        }
+
+        free(p);
+    }
+
+    frag->pieces = NULL;
+
+    if(failed) {
+        net_pbuf_free(head);
+        return NULL;
+    }
+
+    return head;
+}
+
+/* Is all of the given range already covered by pieces we have? */
+static int frag_covered(const struct ip_frag *frag, int start, int end) {
+    const struct ip_frag_piece *p;
+
+    for(p = frag->pieces; p && p->start <= start; p = p->next) {
+        if(p->end > start)
+            start = p->end;
+    }
+
+    return start >= end;
+}
+
 /* Import the data for a fragment, potentially passing it onward in processing,
    if the whole datagram has arrived. */
-static int frag_import(netif_t *src, const ip_hdr_t *hdr, const uint8 *data,
+static int frag_import(netif_t *src, const ip_hdr_t *hdr, net_pbuf_t *data,
                        size_t size, uint16 flags, struct ip_frag *frag) {
-    void *tmp;
+    struct ip_frag_piece *piece, **pp;
+    net_pbuf_t *chain;
     int fo = flags & 0x1FFF;
-    int tl = ntohs(hdr->length);
     int start = (fo << 3);
-    int ihl = (hdr->version_ihl & 0x0F) << 2;
-    int end = start + tl - ihl;
+    int end = start + size;
     int rv = 0;
     uint64 now = timer_ms_gettime64();
 
-    (void)size;
-
-    /* Reallocate space for the data buffer, if needed. */
-    if(end > frag->cur_length) {
-        tmp = realloc(frag->data, end);
+    /* A duplicate of data we already have doesn't need keeping, but it still
+       counts for the flags and the timer below. */
+    if(!frag_covered(frag, start, end)) {
+        if(frag->piece_cnt == FRAG_MAX_PIECES ||
+           frag->piece_bytes + (int)size > FRAG_MAX_BYTES) {
+            TAILQ_REMOVE(&frags, frag, listhnd);
+            frag_free(frag);
+            rv = -1;
+            goto out;
+        }
 
-        if(!tmp) {
+        if(!(piece = (struct ip_frag_piece *)malloc(sizeof(*piece)))) {
             errno = ENOMEM;
             rv = -1;
             goto out;
         }
 
-        frag->data = tmp;
-    }
+        /* Keep the data, which may mean copying it if it's not ours to
+           keep. */
+        if(!(piece->data = net_pbuf_clone(data, 0, size))) {
+            free(piece);
+            rv = -1;
+            goto out;
+        }
 
-    memcpy(frag->data + start, data, end - start);
-    set_bits(frag->bitfield, fo, fo + (((tl - ihl) + 7) >> 3));
+        piece->start = start;
+        piece->end = end;
+
+        for(pp = &frag->pieces; *pp && (*pp)->start <= start;
+            pp = &(*pp)->next)
+            ;
+
+        piece->next = *pp;
+        *pp = piece;
+        ++frag->piece_cnt;
+        frag->piece_bytes += size;
+
+        set_bits(frag->bitfield, fo, fo + ((size + 7) >> 3));
+    }
 
     /* If the MF flag is not set, set the data length. */
     if(!(flags & 0x2000)) {
@@ -165,22 +282,28 @@ static int frag_import(netif_t *src, const ip_hdr_t *hdr, const uint8 *data,
     }
 
     /* If the total length is not zero, and all the bits in the bitfield are
-       set, we continue on. */
+       set, we continue on. The last block counts even if it isn't full. */
     if(frag->total_length &&
-            all_bits_set(frag->bitfield, frag->total_length >> 3)) {
+            all_bits_set(frag->bitfield, (frag->total_length + 7) >> 3)) {
         /* Set the right length. Don't worry about updating the checksum, since
            net_ipv4_input_proto doesn't check it anyway. */
         frag->hdr.length = htons(frag->total_length +
                                  ((frag->hdr.version_ihl & 0x0F) << 2));
 
-        rv = net_ipv4_input_proto(src, &frag->hdr, frag->data);
-
         /* Remove the fragment from our buffer. */
         TAILQ_REMOVE(&frags, frag, listhnd);
-        free(frag->data);
-        free(frag);
+        mutex_unlock(&frag_mutex);
 
-        goto out;
+        if((chain = frag_chain(frag))) {
+            rv = net_ipv4_input_proto(src, &frag->hdr, chain);
+            net_pbuf_free(chain);
+        }
+        else {
+            rv = -1;
+        }
+
+        frag_free(frag);
+        return rv;
     }
 
     /* Update the timer. */
@@ -192,21 +315,23 @@ out:
 }
 
 /* IPv4 fragmentation procedure. This is basically a direct implementation of
-   the example IP fragmentation procedure on pages 26-27 of RFC 791. */
-int net_ipv4_frag_send(netif_t *net, ip_hdr_t *hdr, const uint8 *data,
-                       size_t size) {
+   the example IP fragmentation procedure on pages 26-27 of RFC 791. Each
+   fragment is sent as a slice of the original chain, so nothing is copied. */
+int net_ipv4_frag_send(netif_t *net, ip_hdr_t *hdr, net_pbuf_t *p) {
     int ihl = (hdr->version_ihl & 0x0f) << 2;
+    size_t size = p->tot_len;
     int total = size + ihl;
     uint16 flags = ntohs(hdr->flags_frag_offs);
     ip_hdr_t newhdr;
-    int nfb, ds;
+    net_pbuf_t *frag;
+    int nfb, ds, rv;
 
     if(net == NULL)
         net = net_default_dev;
 
     /* If the packet doesn't need to be fragmented, send it away as is. */
     if(total < net->mtu) {
-        return net_ipv4_send_packet(net, hdr, data, size);
+        return net_ipv4_send_packet_pbuf(net, hdr, p);
     }
     /* If it needs to be fragmented and the DF flag is set, return error. */
     else if(flags & 0x4000) {
@@ -225,9 +350,14 @@ int net_ipv4_frag_send(netif_t *net, ip_hdr_t *hdr, const uint8 *data,
     newhdr.checksum = 0;
     newhdr.checksum = net_ipv4_checksum((uint8 *)&newhdr, sizeof(ip_hdr_t), 0);
 
-    if(net_ipv4_send_packet(net, &newhdr, data, ds)) {
+    if(!(frag = net_pbuf_slice(p, 0, ds)))
+        return -1;
+
+    rv = net_ipv4_send_packet_pbuf(net, &newhdr, frag);
+    net_pbuf_free(frag);
+
+    if(rv)
         return -1;
-    }
 
     /* We don't deal with options right now, so dealing with the rest of the
        fragments is pretty easy. Fix the header, and recursively call this
@@ -237,13 +367,19 @@ int net_ipv4_frag_send(netif_t *net, ip_hdr_t *hdr, const uint8 *data,
     hdr->checksum = 0;
     hdr->checksum = net_ipv4_checksum((uint8 *)hdr, sizeof(ip_hdr_t), 0);
 
-    return net_ipv4_frag_send(net, hdr, data + ds, size - ds);
+    if(!(frag = net_pbuf_slice(p, ds, size - ds)))
+        return -1;
+
+    rv = net_ipv4_frag_send(net, hdr, frag);
+    net_pbuf_free(frag);
+
+    return rv;
 }
 
 /* IPv4 fragment reassembly procedure. This (along with the frag_import function
    above are basically a direct implementation of the example IP reassembly
    routine on pages 27-29 of RFC 791. */
-int net_ipv4_reassemble(netif_t *src, const ip_hdr_t *hdr, const uint8 *data,
+int net_ipv4_reassemble(netif_t *src, const ip_hdr_t *hdr, net_pbuf_t *data,
                         size_t size) {
     uint16 flags = ntohs(hdr->flags_frag_offs);
     struct ip_frag *f;
@@ -273,6 +409,7 @@ int net_ipv4_reassemble(netif_t *src, const ip_hdr_t *hdr, const uint8 *data,
     f = (struct ip_frag *)malloc(sizeof(struct ip_frag));
 
     if(!f) {
+        mutex_unlock(&frag_mutex);
         errno = ENOMEM;
         return -1;
     }
@@ -281,9 +418,11 @@ int net_ipv4_reassemble(netif_t *src, const ip_hdr_t *hdr, const uint8 *data,
     f->dst = hdr->dest;
     f->ident = hdr->packet_id;
     f->proto = hdr->protocol;
-    f->data = NULL;
-    f->cur_length = 0;
+    f->pieces = NULL;
+    f->piece_cnt = 0;
+    f->piece_bytes = 0;
     f->total_length = 0;
+    f->death_time = 0;
     memset(f->bitfield, 0, sizeof(f->bitfield));
 
     TAILQ_INSERT_TAIL(&frags, f, listhnd);
@@ -295,6 +434,7 @@ int net_ipv4_frag_init(void) {
     if(!initted) {
         cbid = net_thd_add_callback(&frag_thd_cb, NULL, 2000);
         TAILQ_INIT(&frags);
+        lockstat_set_name(&frag_mutex, "net_ipv4_frag");
     }
 
     initted = 1;
@@ -312,8 +452,7 @@ void net_ipv4_frag_shutdown(void) {
 
         while(c) {
             n = TAILQ_NEXT(c, listhnd);
-            free(c->data);
-            free(c->bitfield);
+            frag_free(c);
             c = n;
         }
     }
@@ -14,6 +14,7 @@
 #include "net_ipv6.h"
 #include "net_icmp6.h"
 #include "net_ipv4.h"
+#include "net_pbuf.h"
 
 #if __GNUC__ >= 9
 #pragma GCC diagnostic push
@@ -60,12 +61,13 @@ static int is_in_network(netif_t *net, const struct in6_addr *ip) {
 }
 
 /* Send a packet on the specified network adapter */
-int net_ipv6_send_packet(netif_t *net, ipv6_hdr_t *hdr, const uint8 *data,
-                         size_t data_size) {
-    uint8 pkt[data_size + sizeof(ipv6_hdr_t) + sizeof(eth_hdr_t)];
+int net_ipv6_send_packet_pbuf(netif_t *net, ipv6_hdr_t *hdr, net_pbuf_t *p) {
+    uint8 hbuf[sizeof(eth_hdr_t) + sizeof(ipv6_hdr_t)]
+        __attribute__((aligned(4)));
     uint8 dst_mac[6];
     int err;
     struct in6_addr dst = hdr->dst_addr;
+    net_pbuf_t hp;
     eth_hdr_t *ehdr;
 
     if(!net) {
@@ -77,26 +79,26 @@ int net_ipv6_send_packet(netif_t *net, ipv6_hdr_t *hdr, const uint8 *data,
         }
     }
 
+    /* The headers go in a buffer of their own, in front of the data. Leave
+       room for the ethernet header, in case we need one. */
+    memcpy(hbuf + sizeof(eth_hdr_t), hdr, sizeof(ipv6_hdr_t));
+    net_pbuf_init_ref(&hp, hbuf + sizeof(eth_hdr_t), sizeof(ipv6_hdr_t));
+    hp.next = p;
+    hp.tot_len += p->tot_len;
+
     /* Are we sending a packet to loopback? */
     if(IN6_IS_ADDR_LOOPBACK(&hdr->dst_addr)) {
-        memcpy(pkt, hdr, sizeof(ipv6_hdr_t));
-        memcpy(pkt + sizeof(ipv6_hdr_t), data, data_size);
-
         ++ipv6_stats.pkt_sent;
 
         /* Send the packet "away" */
-        net_ipv6_input(NULL, pkt, sizeof(ipv6_hdr_t) + data_size, NULL);
+        net_ipv6_input(NULL, &hp, NULL);
         return 0;
     }
     else if(net->flags & NETIF_NOETH) {
-        memcpy(pkt, hdr, sizeof(ipv6_hdr_t));
-        memcpy(pkt + sizeof(ipv6_hdr_t), data, data_size);
-
         ++ipv6_stats.pkt_sent;
 
         /* Send the packet away */
-        return net->if_tx(net, pkt, sizeof(ipv6_hdr_t) + data_size,
-                          NETIF_BLOCK);
+        return net_pbuf_xmit(net, &hp, NETIF_BLOCK);
     }
     else if(IN6_IS_ADDR_MULTICAST(&hdr->dst_addr)) {
         dst_mac[0] = dst_mac[1] = 0x33;
@@ -110,7 +112,7 @@ int net_ipv6_send_packet(netif_t *net, ipv6_hdr_t *hdr, const uint8 *data,
             dst = net->ip6_gateway;
         }
 
-        err = net_ndp_lookup(net, &dst, dst_mac, hdr, data, data_size);
+        err = net_ndp_lookup_pbuf(net, &dst, dst_mac, hdr, p);
 
         if(err == -1) {
             errno = ENETUNREACH;
@@ -123,28 +125,35 @@ int net_ipv6_send_packet(netif_t *net, ipv6_hdr_t *hdr, const uint8 *data,
     }
 
     /* Fill in the ethernet header */
-    ehdr = (eth_hdr_t *)pkt;
+    ehdr = (eth_hdr_t *)hbuf;
     memcpy(ehdr->dest, dst_mac, 6);
     memcpy(ehdr->src, net->mac_addr, 6);
     ehdr->type[0] = 0x86;
     ehdr->type[1] = 0xDD;
 
-    /* Put the IP header / data into our ethernet packet */
-    memcpy(pkt + sizeof(eth_hdr_t), hdr, sizeof(ipv6_hdr_t));
-    memcpy(pkt + sizeof(eth_hdr_t) + sizeof(ipv6_hdr_t), data, data_size);
+    hp.data = hbuf;
+    hp.len += sizeof(eth_hdr_t);
+    hp.tot_len += sizeof(eth_hdr_t);
 
     ++ipv6_stats.pkt_sent;
 
     /* Send it away */
-    net->if_tx(net, pkt, sizeof(ipv6_hdr_t) + data_size + sizeof(eth_hdr_t),
-               NETIF_BLOCK);
+    net_pbuf_xmit(net, &hp, NETIF_BLOCK);
 
     return 0;
 }
 
-int net_ipv6_send(netif_t *net, const uint8 *data, size_t data_size,
-                  int hop_limit, int proto, const struct in6_addr *src,
-                  const struct in6_addr *dst) {
+int net_ipv6_send_packet(netif_t *net, ipv6_hdr_t *hdr, const uint8 *data,
+                         size_t data_size) {
+    net_pbuf_t p;
+
+    net_pbuf_init_ref(&p, data, data_size);
+    return net_ipv6_send_packet_pbuf(net, hdr, &p);
+}
+
+int net_ipv6_send_pbuf(netif_t *net, net_pbuf_t *p, int hop_limit, int proto,
+                       const struct in6_addr *src,
+                       const struct in6_addr *dst) {
     ipv6_hdr_t hdr;
 
     if(!net) {
@@ -170,9 +179,9 @@ int net_ipv6_send(netif_t *net, const uint8 *data, size_t data_size,
        send function to do the rest. Note that only V4-mapped addresses are
        supported here (::ffff:x.y.z.w) */
     if(IN6_IS_ADDR_V4MAPPED(src) && IN6_IS_ADDR_V4MAPPED(dst)) {
-        return net_ipv4_send(net, data, data_size, -1, hop_limit, proto,
-                             src->__s6_addr.__s6_addr32[3],
-                             dst->__s6_addr.__s6_addr32[3]);
+        return net_ipv4_send_pbuf(net, p, -1, hop_limit, proto,
+                                  src->__s6_addr.__s6_addr32[3],
+                                  dst->__s6_addr.__s6_addr32[3]);
     }
     else if(IN6_IS_ADDR_V4MAPPED(src) || IN6_IS_ADDR_V4MAPPED(dst) ||
             IN6_IS_ADDR_V4COMPAT(src) || IN6_IS_ADDR_V4COMPAT(dst)) {
@@ -182,34 +191,62 @@ int net_ipv6_send(netif_t *net, const uint8 *data, size_t data_size,
     hdr.version_lclass = 0x60;
     hdr.hclass_lflow = 0;
     hdr.lclass = 0;
-    hdr.length = ntohs(data_size);
+    hdr.length = ntohs(p->tot_len);
     hdr.next_header = proto;
     hdr.hop_limit = hop_limit;
     hdr.src_addr = *src;
     hdr.dst_addr = *dst;
 
     /* XXXX: Handle fragmentation... */
-    return net_ipv6_send_packet(net, &hdr, data, data_size);
+    return net_ipv6_send_packet_pbuf(net, &hdr, p);
+}
+
+int net_ipv6_send(netif_t *net, const uint8 *data, size_t data_size,
+                  int hop_limit, int proto, const struct in6_addr *src,
+                  const struct in6_addr *dst) {
+    net_pbuf_t p;
+
+    net_pbuf_init_ref(&p, data, data_size);
+    return net_ipv6_send_pbuf(net, &p, hop_limit, proto, src, dst);
 }
 
-int net_ipv6_input(netif_t *src, const uint8 *pkt, size_t pktsize,
-                   const eth_hdr_t *eth) {
+/* Tell the sender of a packet that we don't know what its next header is. The
+   message includes as much of the packet as fits, so put it back together. */
+/* Only as much of the packet as fits in the minimum MTU goes back in the
+   error, so there's no need to copy any more of it than that. */
+static int send_unk_header(netif_t *src, const ipv6_hdr_t *ip,
+                           const net_pbuf_t *p, size_t len) {
+    uint8 buf[1240];
+
+    if(len > sizeof(buf) - sizeof(ipv6_hdr_t))
+        len = sizeof(buf) - sizeof(ipv6_hdr_t);
+
+    memcpy(buf, ip, sizeof(ipv6_hdr_t));
+    len = net_pbuf_copy_out(p, 0, buf + sizeof(ipv6_hdr_t), len);
+
+    return net_icmp6_send_param_prob(src, ICMP6_PARAM_PROB_UNK_HEADER, 6, buf,
+                                     sizeof(ipv6_hdr_t) + len);
+}
+
+int net_ipv6_input(netif_t *src, net_pbuf_t *p, const eth_hdr_t *eth) {
     ipv6_hdr_t *ip;
     uint8 next_hdr;
     //int pos;
     size_t len;
     int rv;
 
-    if(pktsize < sizeof(ipv6_hdr_t)) {
+    /* The whole header has to be in the first buffer. Drivers always give us
+       the whole packet in one, and so do we. */
+    if(p->len < sizeof(ipv6_hdr_t)) {
         /* This is obviously a bad packet, drop it */
         ++ipv6_stats.pkt_recv_bad_size;
         return -1;
     }
 
-    ip = (ipv6_hdr_t *)pkt;
+    ip = (ipv6_hdr_t *)p->data;
     len = ntohs(ip->length);
 
-    if(pktsize < len + sizeof(ipv6_hdr_t)) {
+    if(p->tot_len < len + sizeof(ipv6_hdr_t)) {
         /* The packet is of size less than the payload length + the size of a
            minimal IPv6 header; it must be bad, drop it */
         ++ipv6_stats.pkt_recv_bad_size;
@@ -223,22 +260,31 @@ int net_ipv6_input(netif_t *src, const uint8 *pkt, size_t pktsize,
     if(eth)
         net_ndp_insert(src, eth->src, &ip->src_addr, 1);
 
+    p = net_pbuf_pull(p, sizeof(ipv6_hdr_t));
+
     /* XXXX: Parse options and deal with fragmentation */
     switch(next_hdr) {
-        case IPV6_HDR_ICMP:
-            return net_icmp6_input(src, ip, pkt + sizeof(ipv6_hdr_t), len);
+        case IPV6_HDR_ICMP: {
+            net_pbuf_t *copy;
+            const uint8 *data;
+
+            if(!(data = net_pbuf_flatten(p, &copy)))
+                return -1;
+
+            rv = net_icmp6_input(src, ip, data, len);
+            net_pbuf_free(copy);
+
+            return rv;
+        }
 
         default:
-            rv = fs_socket_input(src, AF_INET6, next_hdr, pkt,
-                                 pkt + sizeof(ipv6_hdr_t), len);
+            rv = fs_socket_input_pbuf(src, AF_INET6, next_hdr, ip, p, len);
 
             if(rv == -2) {
                 /* We don't know what to do with this packet, so send an ICMPv6
                    message indicating that. */
                 ++ipv6_stats.pkt_recv_bad_proto;
-                return net_icmp6_send_param_prob(src,
-                                                 ICMP6_PARAM_PROB_UNK_HEADER, 6,
-                                                 pkt, pktsize);
+                return send_unk_header(src, ip, p, len);
             }
 
             ++ipv6_stats.pkt_recv;
@@ -14,6 +14,7 @@
 #include <sys/queue.h>
 #include <kos/net.h>
 #include <kos/mutex.h>
+#include <kos/lockstat.h>
 #include <arch/irq.h>
 
 typedef struct mc_entry {
@@ -117,6 +118,7 @@ int net_multicast_check(const uint8 mac[6]) {
 }
 
 int net_multicast_init(void) {
+    lockstat_set_name(&mc_mutex, "net_multicast");
     return 0;
 }
 
@@ -15,6 +15,7 @@
 
 #include "net_ipv6.h"
 #include "net_icmp6.h"
+#include "net_pbuf.h"
 
 /* This file implements the Neighbor Discovery Protocol for IPv6. Basically, NDP
    acts much like ARP does for IPv4. It is responsible for keeping track of the
@@ -156,8 +157,9 @@ static void net_ndp_send_sol(netif_t *net, const struct in6_addr *ip) {
     net_icmp6_send_nsol(net, &dst, ip, 0);
 }
 
-int net_ndp_lookup(netif_t *net, const struct in6_addr *ip, uint8 mac_out[6],
-                   const ipv6_hdr_t *pkt, const uint8 *data, int data_size) {
+int net_ndp_lookup_pbuf(netif_t *net, const struct in6_addr *ip,
+                        uint8 mac_out[6], const ipv6_hdr_t *pkt,
+                        const net_pbuf_t *data) {
     ndp_entry_t *i;
     uint64 now = timer_ms_gettime64();
 
@@ -191,8 +193,8 @@ int net_ndp_lookup(netif_t *net, const struct in6_addr *ip, uint8 mac_out[6],
     i->state = NDP_STATE_INCOMPLETE;
 
     /* Copy our packet if we have one to copy. */
-    if(pkt && data && data_size) {
-        i->data = (uint8 *)malloc(data_size);
+    if(pkt && data && data->tot_len) {
+        i->data = (uint8 *)malloc(data->tot_len);
 
         if(i->data) {
             i->pkt = (ipv6_hdr_t *)malloc(sizeof(ipv6_hdr_t));
@@ -203,8 +205,8 @@ int net_ndp_lookup(netif_t *net, const struct in6_addr *ip, uint8 mac_out[6],
             }
             else {
                 memcpy(i->pkt, pkt, sizeof(ipv6_hdr_t));
-                memcpy(i->data, data, data_size);
-                i->data_size = data_size;
+                i->data_size = net_pbuf_copy_out(data, 0, i->data,
+                                                 data->tot_len);
             }
         }
     }
@@ -217,6 +219,14 @@ int net_ndp_lookup(netif_t *net, const struct in6_addr *ip, uint8 mac_out[6],
     return -2;
 }
 
+int net_ndp_lookup(netif_t *net, const struct in6_addr *ip, uint8 mac_out[6],
+                   const ipv6_hdr_t *pkt, const uint8 *data, int data_size) {
+    net_pbuf_t p;
+
+    net_pbuf_init_ref(&p, data, data_size);
+    return net_ndp_lookup_pbuf(net, ip, mac_out, pkt, data ? &p : NULL);
+}
+
 int net_ndp_init(void) {
     return 0;
 }
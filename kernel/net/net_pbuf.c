@@ -0,0 +1,367 @@
+/* KallistiOS ##version##
+
+   kernel/net/net_pbuf.c
+   Copyright (C) 2024 The KallistiOS Team
+
+*/
+
+/* Packet buffers. There are four kinds of these, told apart by the low bits of
+   their flags:
+
+   - Pool buffers come from an object cache, and have room for a full Ethernet
+     frame right after the header.
+   - Heap buffers are the same, but for anything bigger, and come from the
+     heap instead.
+   - Reference buffers point at memory that belongs to someone else, which is
+     only valid until the function they were handed to returns.
+   - Clones point into the storage of a pool or heap buffer (their owner), and
+     hold a reference to it so that it stays around until they're done.
+
+   A buffer is only ever in one chain at a time. Sharing data between chains
+   is done by cloning, which is why freeing a chain can simply drop a reference
+   to every buffer in it. Reference counts are touched with interrupts
+   disabled, as buffers are freed both by drivers and by sockets. */
+
+#include <errno.h>
+#include <malloc.h>
+#include <string.h>
+
+#include <kos/net.h>
+#include <kos/slab.h>
+#include <arch/irq.h>
+
+#include "net_ipv4.h"
+#include "net_pbuf.h"
+
+/* Enough for an Ethernet frame, rounded up to a multiple of 32 bytes. */
+#define PBUF_POOL_SIZE      1536
+
+/* Copies of data up to this size that are kept past the current call go in
+   heap buffers sized to fit. Small packets can sit in a socket's queue for a
+   while, and shouldn't each tie up a whole pool buffer while they do. */
+#define PBUF_SMALL_SIZE     512
+
+/* Keep the data of pool and heap buffers 32-byte aligned. */
+#define PBUF_ALIGN          32
+#define PBUF_HDR_SIZE       ((sizeof(net_pbuf_t) + PBUF_ALIGN - 1) & \
+                             ~(PBUF_ALIGN - 1))
+
+static kmem_cache_t *pbuf_pool;
+static kmem_cache_t *pbuf_hdrs;
+static net_pbuf_stats_t pbuf_stats = { 0 };
+
+static net_pbuf_t *pbuf_alloc(size_t len, int pool) {
+    net_pbuf_t *p;
+    uint16 type;
+
+    if(pool) {
+        p = (net_pbuf_t *)kmem_cache_alloc(pbuf_pool);
+        type = NET_PBUF_POOL;
+    }
+    else {
+        p = (net_pbuf_t *)memalign(PBUF_ALIGN, PBUF_HDR_SIZE + len);
+        type = NET_PBUF_HEAP;
+    }
+
+    irq_disable_scoped();
+
+    if(!p) {
+        ++pbuf_stats.alloc_failed;
+        errno = ENOMEM;
+        return NULL;
+    }
+
+    ++pbuf_stats.allocs;
+    ++pbuf_stats.in_use;
+
+    p->next = NULL;
+    p->data = (uint8 *)p + PBUF_HDR_SIZE;
+    p->len = p->tot_len = len;
+    p->ref = 1;
+    p->flags = type;
+    p->owner = NULL;
+
+    return p;
+}
+
+net_pbuf_t *net_pbuf_alloc(size_t len) {
+    return pbuf_alloc(len, len <= PBUF_POOL_SIZE);
+}
+
+static net_pbuf_t *pbuf_alloc_hdr(uint16 type, uint8 *data, size_t len,
+                                  net_pbuf_t *owner) {
+    net_pbuf_t *p;
+
+    if(!(p = (net_pbuf_t *)kmem_cache_alloc(pbuf_hdrs)))
+        return NULL;
+
+    p->next = NULL;
+    p->data = data;
+    p->len = p->tot_len = len;
+    p->ref = 1;
+    p->flags = type;
+    p->owner = owner;
+
+    return p;
+}
+
+net_pbuf_t *net_pbuf_wrap(const void *data, size_t len) {
+    return pbuf_alloc_hdr(NET_PBUF_REF, (uint8 *)data, len, NULL);
+}
+
+/* Drop one reference to a single buffer. */
+static void pbuf_put(net_pbuf_t *p) {
+    int irqs = irq_disable();
+
+    if(--p->ref) {
+        irq_restore(irqs);
+        return;
+    }
+
+    switch(p->flags & NET_PBUF_TYPE) {
+        case NET_PBUF_POOL:
+            --pbuf_stats.in_use;
+            irq_restore(irqs);
+            kmem_cache_free(pbuf_pool, p);
+            return;
+
+        case NET_PBUF_HEAP:
+            --pbuf_stats.in_use;
+            irq_restore(irqs);
+            free(p);
+            return;
+
+        case NET_PBUF_CLONE:
+            irq_restore(irqs);
+            pbuf_put(p->owner);
+            break;
+
+        default:
+            irq_restore(irqs);
+            break;
+    }
+
+    if(!(p->flags & NET_PBUF_STATIC))
+        kmem_cache_free(pbuf_hdrs, p);
+}
+
+void net_pbuf_free(net_pbuf_t *p) {
+    net_pbuf_t *n;
+
+    while(p) {
+        n = p->next;
+        pbuf_put(p);
+        p = n;
+    }
+}
+
+void net_pbuf_cat(net_pbuf_t *head, net_pbuf_t *tail) {
+    for(; head->next; head = head->next)
+        head->tot_len += tail->tot_len;
+
+    head->tot_len += tail->tot_len;
+    head->next = tail;
+}
+
+net_pbuf_t *net_pbuf_pull(net_pbuf_t *p, size_t len) {
+    if(len > p->tot_len)
+        return NULL;
+
+    while(len >= p->len && p->next) {
+        len -= p->len;
+        p = p->next;
+    }
+
+    p->data += len;
+    p->len -= len;
+    p->tot_len -= len;
+
+    return p;
+}
+
+static net_pbuf_t *pbuf_clone(const net_pbuf_t *p, size_t off, size_t len,
+                              int keep) {
+    net_pbuf_t *head = NULL, **tail = &head, *n, *owner;
+    size_t left = len, cnt;
+
+    if(off + len > p->tot_len) {
+        errno = EINVAL;
+        return NULL;
+    }
+
+    if(!len)
+        return net_pbuf_alloc(0);
+
+    /* Skip over the buffers that come before the offset. */
+    while(off >= p->len && p->next) {
+        off -= p->len;
+        p = p->next;
+    }
+
+    for(; left; p = p->next, off = 0) {
+        cnt = p->len - off < left ? p->len - off : left;
+
+        switch(p->flags & NET_PBUF_TYPE) {
+            case NET_PBUF_REF:
+                if(!keep) {
+                    n = pbuf_alloc_hdr(NET_PBUF_REF, p->data + off, cnt, NULL);
+                    break;
+                }
+
+                if((n = pbuf_alloc(cnt, cnt > PBUF_SMALL_SIZE &&
+                                   cnt <= PBUF_POOL_SIZE))) {
+                    memcpy(n->data, p->data + off, cnt);
+
+                    irq_disable_scoped();
+                    ++pbuf_stats.copies;
+                    pbuf_stats.bytes_copied += cnt;
+                }
+
+                break;
+
+            default:
+                owner = (p->flags & NET_PBUF_TYPE) == NET_PBUF_CLONE ?
+                        p->owner : (net_pbuf_t *)p;
+
+                if((n = pbuf_alloc_hdr(NET_PBUF_CLONE, p->data + off, cnt,
+                                       owner))) {
+                    irq_disable_scoped();
+                    ++owner->ref;
+                    ++pbuf_stats.clones;
+                }
+
+                break;
+        }
+
+        if(!n) {
+            net_pbuf_free(head);
+            errno = ENOMEM;
+            return NULL;
+        }
+
+        *tail = n;
+        tail = &n->next;
+        left -= cnt;
+    }
+
+    /* Now that we know how it was split up, fill in the total lengths. */
+    for(n = head; n; n = n->next) {
+        n->tot_len = len;
+        len -= n->len;
+    }
+
+    return head;
+}
+
+net_pbuf_t *net_pbuf_clone(const net_pbuf_t *p, size_t off, size_t len) {
+    return pbuf_clone(p, off, len, 1);
+}
+
+net_pbuf_t *net_pbuf_slice(const net_pbuf_t *p, size_t off, size_t len) {
+    return pbuf_clone(p, off, len, 0);
+}
+
+size_t net_pbuf_copy_out(const net_pbuf_t *p, size_t off, void *buf,
+                         size_t len) {
+    uint8 *out = (uint8 *)buf;
+    size_t cnt;
+
+    while(p && off >= p->len) {
+        off -= p->len;
+        p = p->next;
+    }
+
+    for(; p && len; p = p->next, off = 0) {
+        cnt = p->len - off < len ? p->len - off : len;
+        memcpy(out, p->data + off, cnt);
+        out += cnt;
+        len -= cnt;
+    }
+
+    return out - (uint8 *)buf;
+}
+
+const uint8 *net_pbuf_flatten(const net_pbuf_t *p, net_pbuf_t **copy) {
+    size_t len;
+
+    *copy = NULL;
+
+    if(!p->next)
+        return p->data;
+
+    /* Reassembled packets can be up to 64KB, so this can't go on the stack. */
+    if(!(*copy = net_pbuf_alloc(p->tot_len)))
+        return NULL;
+
+    len = net_pbuf_copy_out(p, 0, (*copy)->data, p->tot_len);
+
+    irq_disable_scoped();
+    ++pbuf_stats.copies;
+    pbuf_stats.bytes_copied += len;
+
+    return (*copy)->data;
+}
+
+int net_pbuf_xmit(netif_t *net, const net_pbuf_t *p, int blocking) {
+    net_pbuf_t *copy;
+    const uint8 *data;
+    int rv;
+
+    if(net->if_tx_pbuf)
+        return net->if_tx_pbuf(net, p, blocking);
+
+    if(!(data = net_pbuf_flatten(p, &copy)))
+        return -1;
+
+    rv = net->if_tx(net, data, p->tot_len, blocking);
+    net_pbuf_free(copy);
+
+    return rv;
+}
+
+uint16 net_pbuf_checksum(const net_pbuf_t *p, size_t len, uint16 start) {
+    uint32 sum = start, part;
+    size_t cnt;
+    int odd = 0;
+
+    for(; p && len; p = p->next) {
+        if(!(cnt = p->len < len ? p->len : len))
+            continue;
+
+        /* Sum this buffer by itself. If everything before it added up to an
+           odd number of bytes, its bytes are all in the other halves of the
+           16-bit words, which swapping the bytes of the sum takes care of. */
+        part = (uint16)~net_ipv4_checksum(p->data, cnt, 0);
+
+        if(odd)
+            part = ((part & 0xFF) << 8) | (part >> 8);
+
+        sum += part;
+        odd ^= cnt & 1;
+        len -= cnt;
+    }
+
+    while(sum >> 16)
+        sum = (sum >> 16) + (sum & 0xFFFF);
+
+    return sum ^ 0xFFFF;
+}
+
+net_pbuf_stats_t net_pbuf_get_stats(void) {
+    irq_disable_scoped();
+    return pbuf_stats;
+}
+
+int net_pbuf_init(void) {
+    /* Buffers can still be held by sockets after the network is shut down,
+       so these are never destroyed. */
+    if(!pbuf_pool)
+        pbuf_pool = kmem_cache_create("net_pbuf", PBUF_HDR_SIZE +
+                                      PBUF_POOL_SIZE, PBUF_ALIGN, NULL);
+
+    if(!pbuf_hdrs)
+        pbuf_hdrs = kmem_cache_create("net_pbuf_hdr", sizeof(net_pbuf_t), 0,
+                                      NULL);
+
+    return pbuf_pool && pbuf_hdrs ? 0 : -1;
+}
@@ -0,0 +1,50 @@
+/* KallistiOS ##version##
+
+   kernel/net/net_pbuf.h
+   Copyright (C) 2024 The KallistiOS Team
+
+*/
+
+#ifndef __LOCAL_NET_PBUF_H
+#define __LOCAL_NET_PBUF_H
+
+#include <kos/net.h>
+
+/* Buffer types, in the low bits of the flags. */
+#define NET_PBUF_POOL       0x0001  /* Storage after the header, from a pool */
+#define NET_PBUF_HEAP       0x0002  /* Storage after the header, from malloc */
+#define NET_PBUF_REF        0x0003  /* Data belongs to someone else */
+#define NET_PBUF_CLONE      0x0004  /* Data belongs to the owner buffer */
+#define NET_PBUF_TYPE       0x000F
+
+/* The header itself belongs to someone else (usually it's on the stack). */
+#define NET_PBUF_STATIC     0x0010
+
+/* Set up a buffer that lives on the caller's stack and points at the caller's
+   data. These never have to be freed, and can only be used until the caller
+   returns. */
+static inline void net_pbuf_init_ref(net_pbuf_t *p, const void *data,
+                                     size_t len) {
+    p->next = NULL;
+    p->data = (uint8 *)data;
+    p->len = p->tot_len = len;
+    p->ref = 1;
+    p->flags = NET_PBUF_REF | NET_PBUF_STATIC;
+    p->owner = NULL;
+}
+
+/* Like net_pbuf_clone(), but data that belongs to someone else is pointed at
+   instead of copied, so the result can't be kept past the current call. */
+net_pbuf_t *net_pbuf_slice(const net_pbuf_t *p, size_t off, size_t len);
+
+/* Send a chain on an interface, with if_tx_pbuf() if the driver has it, or by
+   copying it into one buffer for if_tx() if not. */
+int net_pbuf_xmit(netif_t *net, const net_pbuf_t *p, int blocking);
+
+/* Internet checksum of the first len bytes of a chain, like what
+   net_ipv4_checksum() does for one buffer. */
+uint16 net_pbuf_checksum(const net_pbuf_t *p, size_t len, uint16 start);
+
+int net_pbuf_init(void);
+
+#endif /* __LOCAL_NET_PBUF_H */
@@ -18,6 +18,8 @@
 #include <kos/cond.h>
 #include <kos/mutex.h>
 #include <kos/rwsem.h>
+#include <kos/slab.h>
+#include <kos/lockstat.h>
 #include <kos/fs_socket.h>
 
 #include <arch/timer.h>
@@ -27,6 +29,7 @@
 #include "net_ipv4.h"
 #include "net_ipv6.h"
 #include "net_thd.h"
+#include "net_tcp_opts.h"
 
 /* Since some of this is a bit odd in its implementation, here's a few notes on
    what my thinking was while writing all of this...
@@ -82,26 +85,32 @@
    list of sockets.
 
    On what's actually here:
-   I didn't bother implementing any TCP extensions beyond RFC 793. That means
-   that I just ignore things like the timestamp option and the selective
-   acknowledgement option. That also means that the window size maxes out at
-   65535. Some extensions may be implemented in the future, if I see fit to do
-   so. That all said, everything in here works just fine over IPv4 or IPv6, and
-   can be used just fine to communicate with "normal" TCP/IP implementations.
+   Beyond RFC 793, there's window scaling and timestamps (RFC 7323) and
+   selective acknowledgements (RFC 2018). All three are offered on every SYN we
+   send and used if the other side agrees to them. Window scaling lets the
+   buffers (and thus the window) grow past 64KB with SO_RCVBUF and SO_SNDBUF.
+   Note that the scale factor is picked when the connection is set up, so the
+   receive buffer should be made as big as it's going to get before calling
+   connect() or listen().
+
+   Segments that arrive out of order are put straight into the receive buffer
+   where they belong, and the ranges we have are kept track of so that they can
+   be reported to the other side in SACK blocks and the gaps filled in later.
+   On the sending side, the ranges the other side has SACKed are skipped over
+   when retransmitting.
+
+   The retransmission timeout comes from the measured round trip time (RFC
+   6298), using timestamps when we have them and timing one segment at a time
+   when we don't. How much we send is limited by a congestion window, which
+   does slow start and congestion avoidance (RFC 5681) and NewReno fast
+   retransmit and recovery on duplicate ACKs (RFC 6582). During recovery, any
+   holes the SACK blocks show up are resent as well, instead of one per round
+   trip. All of this can be watched with the TCP_INFO socket option.
+
+   Everything in here works just fine over IPv4 or IPv6, and can be used just
+   fine to communicate with "normal" TCP/IP implementations.
 */
 
-typedef struct tcp_hdr {
-    uint16_t src_port;
-    uint16_t dst_port;
-    uint32_t seq;
-    uint32_t ack;
-    uint16_t off_flags;
-    uint16_t wnd;
-    uint16_t checksum;
-    uint16_t urg;
-    uint8_t options[];
-} __attribute__((packed)) tcp_hdr_t;
-
 /* Listening socket. Each one of these is an incoming connection from a socket
    that is in the listen state */
 struct lsock {
@@ -111,6 +120,9 @@ struct lsock {
     uint32_t isn;
     uint32_t wnd;
     uint16_t mss;
+    uint8_t opts;
+    uint8_t wscale;
+    uint32_t ts_recent;
 };
 
 /* Send/receive variables... */
@@ -123,6 +135,12 @@ struct sndrec {
     uint32_t wl2;
     uint32_t iss;
     uint16_t mss;
+    uint8_t wscale;
+    uint32_t rxt;                           /* Next to resend after a timeout */
+    uint32_t recover;                       /* nxt when recovery started */
+    uint32_t high_rxt;                      /* End of what recovery resent */
+    uint32_t cwnd;
+    uint32_t ssthresh;
 };
 
 struct rcvrec {
@@ -130,6 +148,18 @@ struct rcvrec {
     uint32_t wnd;
     uint32_t up;
     uint32_t irs;
+    uint8_t wscale;
+};
+
+/* Counters for TCP_INFO. */
+struct tcp_stats {
+    uint32_t segs_out;
+    uint32_t segs_in;
+    uint32_t retrans;
+    uint32_t fast_retrans;
+    uint32_t timeouts;
+    uint64_t bytes_acked;
+    uint64_t bytes_received;
 };
 
 struct tcp_sock {
@@ -170,6 +200,24 @@ struct tcp_sock {
             uint32_t sndbuf_acked;
             uint32_t sndbuf_tail;
             uint64_t timer;
+            uint8_t opts;                   /* TCP_OPTF_* agreed on */
+            uint8_t ooo_cnt;
+            uint8_t sacked_cnt;
+            uint32_t ts_recent;
+            uint32_t last_ack_sent;
+            uint32_t rto_una;
+            uint32_t srtt;                  /* In microseconds */
+            uint32_t rttvar;                /* In microseconds */
+            uint32_t rto;                   /* In milliseconds */
+            uint32_t rtt_seq;               /* Segment being timed */
+            uint64_t rtt_start;             /* When it was sent, in us */
+            uint8_t rtt_timing;
+            uint8_t dupacks;
+            uint8_t recovering;             /* In fast recovery */
+            uint8_t backoff;
+            struct tcp_stats st;
+            struct tcp_range ooo[TCP_SACK_RANGES];      /* Held out of order */
+            struct tcp_range sacked[TCP_SACK_RANGES];   /* SACKed by the peer */
             condvar_t send_cv;
             condvar_t recv_cv;
         } data;
@@ -181,11 +229,21 @@ LIST_HEAD(tcp_sock_list, tcp_sock);
 static struct tcp_sock_list tcp_socks = LIST_HEAD_INITIALIZER(0);
 static rw_semaphore_t tcp_sem = RWSEM_INITIALIZER;
 static int thd_cb_id = 0;
+static kmem_cache_t *tcp_sock_cache;
 
 /* Default starting window size for connections. This should be big enough as a
    starting point, in general. If you need to adjust it, you can do so... */
 #define TCP_DEFAULT_WINDOW  8192
 
+/* Largest send or receive buffer a socket can be given with setsockopt(). */
+#define TCP_MAX_BUFFER      (1024 * 1024)
+
+/* Largest window scale factor allowed by RFC 7323. */
+#define TCP_MAX_WSCALE      14
+
+/* Most option space a TCP header can have. */
+#define TCP_MAX_OPTS        40
+
 /* Default MSS */
 #define TCP_DEFAULT_MSS     1460
 
@@ -193,22 +251,23 @@ static int thd_cb_id = 0;
    to be 15 seconds, since that's what Mac OS X does. */
 #define TCP_DEFAULT_MSL     15000
 
-/* Default retransmission timeout (in milliseconds). */
-#define TCP_DEFAULT_RTTO    2000
+/* Retransmission timeout (in milliseconds) to use until we've measured the
+   round trip time, and the limits on it after that (RFC 6298). The lower limit
+   is well under the one second the RFC asks for, as in most other stacks,
+   since a second is an eternity on a LAN. */
+#define TCP_DEFAULT_RTTO    1000
+#define TCP_MIN_RTTO        200
+#define TCP_MAX_RTTO        60000
 
-/* Default hop limit (or ttl for IPv4) for new sockets */
-#define TCP_DEFAULT_HOPS    64
+/* Number of duplicate ACKs in a row that means a segment was lost. */
+#define TCP_DUPACK_THRESH   3
 
-/* Flags that can be set in the off_flags field of the above struct */
-#define TCP_FLAG_FIN    0x01
-#define TCP_FLAG_SYN    0x02
-#define TCP_FLAG_RST    0x04
-#define TCP_FLAG_PSH    0x08
-#define TCP_FLAG_ACK    0x10
-#define TCP_FLAG_URG    0x20
+/* Largest the congestion window is allowed to get, which is also where the
+   slow start threshold starts out. */
+#define TCP_MAX_CWND        0x40000000
 
-#define TCP_GET_OFFSET(x)   (((x) & 0xF000) >> 10)
-#define TCP_OFFSET(y)       (((y) & 0x0F) << 12)
+/* Default hop limit (or ttl for IPv4) for new sockets */
+#define TCP_DEFAULT_HOPS    64
 
 #define TCP_STATE_CLOSED        0
 #define TCP_STATE_LISTEN        1
@@ -230,16 +289,6 @@ static int thd_cb_id = 0;
 #define TCP_IFLAG_QUEUEDCLOSE   0x00000002
 #define TCP_IFLAG_ACCEPTWAIT    0x00000004
 
-#define TCP_OPT_EOL             0
-#define TCP_OPT_NOP             1
-#define TCP_OPT_MSS             2
-
-/* A few macros for comparing sequence numbers */
-#define SEQ_LT(x, y)    (((int32_t)((x) - (y))) < 0)
-#define SEQ_LE(x, y)    (((int32_t)((x) - (y))) <= 0)
-#define SEQ_GT(x, y)    (((int32_t)((x) - (y))) > 0)
-#define SEQ_GE(x, y)    (((int32_t)((x) - (y))) >= 0)
-
 #define MAX(x, y)       ((x) > (y) ? (x) : (y))
 
 /* Forward declarations */
@@ -252,6 +301,74 @@ static int tcp_send_syn(struct tcp_sock *sock, int ack);
 static void tcp_send_ack(struct tcp_sock *sock);
 static void tcp_send_data(struct tcp_sock *sock, int resend);
 static void tcp_send_fin_ack(struct tcp_sock *sock);
+static void tcp_cc_init(struct tcp_sock *sock);
+
+/* Copy data into or out of one of the ring buffers, wrapping around the end
+   of it as needed. The position doesn't have to be inside the buffer. */
+static void tcp_ring_write(uint8_t *ring, uint32_t ring_sz, uint32_t pos,
+                           const uint8_t *src, uint32_t len) {
+    uint32_t tmp;
+
+    pos %= ring_sz;
+
+    if(pos + len <= ring_sz) {
+        memcpy(ring + pos, src, len);
+    }
+    else {
+        tmp = ring_sz - pos;
+        memcpy(ring + pos, src, tmp);
+        memcpy(ring, src + tmp, len - tmp);
+    }
+}
+
+static void tcp_ring_read(const uint8_t *ring, uint32_t ring_sz, uint32_t pos,
+                          uint8_t *dst, uint32_t len) {
+    uint32_t tmp;
+
+    pos %= ring_sz;
+
+    if(pos + len <= ring_sz) {
+        memcpy(dst, ring + pos, len);
+    }
+    else {
+        tmp = ring_sz - pos;
+        memcpy(dst, ring + pos, tmp);
+        memcpy(dst + tmp, ring, len - tmp);
+    }
+}
+
+/* Make a new, bigger ring buffer with the contents of the old one, rotated so
+   that whatever was at start is at the beginning of the new one. */
+static uint8_t *tcp_ring_grow(uint8_t *ring, uint32_t ring_sz, uint32_t start,
+                              uint32_t new_sz) {
+    uint8_t *rv;
+
+    if(!(rv = (uint8_t *)malloc(new_sz)))
+        return NULL;
+
+    tcp_ring_read(ring, ring_sz, start, rv, ring_sz);
+    free(ring);
+
+    return rv;
+}
+
+/* Offset of a sequence number into the unacked part of the send buffer. Until
+   our SYN is acked, it takes up the first sequence number. */
+static inline uint32_t tcp_snd_off(const struct tcp_sock *sock, uint32_t seq) {
+    return seq - sock->data.snd.una -
+        (sock->data.snd.una == sock->data.snd.iss);
+}
+
+/* Have the send and receive buffers been allocated for a socket? That happens
+   on connect() or accept(), and they go away when the socket does. */
+static inline int tcp_has_bufs(const struct tcp_sock *sock) {
+    return (sock->state & 0x0F) != TCP_STATE_LISTEN && sock->data.rcvbuf;
+}
+
+/* Our clock for timestamps, which ticks once a millisecond. */
+static inline uint32_t tcp_ts_now(void) {
+    return (uint32_t)timer_ms_gettime64();
+}
 
 /* Sockets interface... */
 static int net_tcp_socket(net_socket_t *hnd, int domain, int type, int proto) {
@@ -260,7 +377,7 @@ static int net_tcp_socket(net_socket_t *hnd, int domain, int type, int proto) {
     (void)type;
     (void)proto;
 
-    if(!(sock = (struct tcp_sock *)malloc(sizeof(struct tcp_sock)))) {
+    if(!(sock = (struct tcp_sock *)kmem_cache_alloc(tcp_sock_cache))) {
         errno = ENOMEM;
         return -1;
     }
@@ -269,7 +386,7 @@ static int net_tcp_socket(net_socket_t *hnd, int domain, int type, int proto) {
 
     if(mutex_init(&sock->mutex, MUTEX_TYPE_NORMAL)) {
         errno = ENOMEM;
-        free(sock);
+        kmem_cache_free(tcp_sock_cache, sock);
         return -1;
     }
 
@@ -280,7 +397,7 @@ static int net_tcp_socket(net_socket_t *hnd, int domain, int type, int proto) {
     sock->sndbuf_sz = TCP_DEFAULT_WINDOW;
 
     if(rwsem_write_lock_irqsafe(&tcp_sem)) {
-        free(sock);
+        kmem_cache_free(tcp_sock_cache, sock);
         return -1;
     }
 
@@ -441,7 +558,7 @@ ret_remove:
     LIST_REMOVE(sock, sock_list);
     mutex_unlock(&sock->mutex);
     mutex_destroy(&sock->mutex);
-    free(sock);
+    kmem_cache_free(tcp_sock_cache, sock);
 
     rwsem_write_unlock(&tcp_sem);
     return;
@@ -516,7 +633,7 @@ static int net_tcp_accept(net_socket_t *hnd, struct sockaddr *addr,
             LIST_REMOVE(sock, sock_list);
             mutex_unlock(&sock->mutex);
             mutex_destroy(&sock->mutex);
-            free(sock);
+            kmem_cache_free(tcp_sock_cache, sock);
 
             rwsem_write_unlock(&tcp_sem);
 
@@ -534,7 +651,7 @@ static int net_tcp_accept(net_socket_t *hnd, struct sockaddr *addr,
         sock->listen.head = 0;
 
     /* Allocate the memory we will need... */
-    if(!(sock2 = (struct tcp_sock *)malloc(sizeof(struct tcp_sock)))) {
+    if(!(sock2 = (struct tcp_sock *)kmem_cache_alloc(tcp_sock_cache))) {
         mutex_unlock(&sock->mutex);
         errno = ENOMEM;
         return -1;
@@ -545,7 +662,7 @@ static int net_tcp_accept(net_socket_t *hnd, struct sockaddr *addr,
     if(mutex_init(&sock2->mutex, MUTEX_TYPE_NORMAL)) {
         mutex_unlock(&sock->mutex);
         errno = ENOMEM;
-        free(sock2);
+        kmem_cache_free(tcp_sock_cache, sock2);
         return -1;
     }
 
@@ -553,7 +670,7 @@ static int net_tcp_accept(net_socket_t *hnd, struct sockaddr *addr,
         errno = ENOMEM;
         mutex_unlock(&sock->mutex);
         mutex_destroy(&sock2->mutex);
-        free(sock2);
+        kmem_cache_free(tcp_sock_cache, sock2);
         return -1;
     }
 
@@ -562,7 +679,7 @@ static int net_tcp_accept(net_socket_t *hnd, struct sockaddr *addr,
         mutex_unlock(&sock->mutex);
         free(sock2->data.rcvbuf);
         mutex_destroy(&sock2->mutex);
-        free(sock2);
+        kmem_cache_free(tcp_sock_cache, sock2);
         return -1;
     }
 
@@ -572,7 +689,7 @@ static int net_tcp_accept(net_socket_t *hnd, struct sockaddr *addr,
         free(sock2->data.sndbuf);
         free(sock2->data.rcvbuf);
         mutex_destroy(&sock2->mutex);
-        free(sock2);
+        kmem_cache_free(tcp_sock_cache, sock2);
         return -1;
     }
 
@@ -583,7 +700,7 @@ static int net_tcp_accept(net_socket_t *hnd, struct sockaddr *addr,
         free(sock2->data.sndbuf);
         free(sock2->data.rcvbuf);
         mutex_destroy(&sock2->mutex);
-        free(sock2);
+        kmem_cache_free(tcp_sock_cache, sock2);
         return -1;
     }
 
@@ -595,7 +712,7 @@ static int net_tcp_accept(net_socket_t *hnd, struct sockaddr *addr,
         free(sock2->data.sndbuf);
         free(sock2->data.rcvbuf);
         mutex_destroy(&sock2->mutex);
-        free(sock2);
+        kmem_cache_free(tcp_sock_cache, sock2);
         return -1;
     }
 
@@ -659,7 +776,7 @@ static int net_tcp_accept(net_socket_t *hnd, struct sockaddr *addr,
             free(sock2->data.sndbuf);
             free(sock2->data.rcvbuf);
             mutex_destroy(&sock2->mutex);
-            free(sock2);
+            kmem_cache_free(tcp_sock_cache, sock2);
             errno = EWOULDBLOCK;
             return -1;
         }
@@ -705,17 +822,34 @@ static int net_tcp_accept(net_socket_t *hnd, struct sockaddr *addr,
     sock2->data.snd.nxt = sock2->data.snd.iss + 1;
     sock2->data.snd.una = sock2->data.snd.iss;
     sock2->data.snd.wnd = lsock.wnd;
-    sock2->data.snd.wl1 = sock2->data.snd.iss;
+    sock2->data.snd.wl1 = lsock.isn;
+    sock2->data.snd.wl2 = sock2->data.snd.iss;
     sock2->data.snd.mss = lsock.mss;
     sock2->data.rcv.nxt = lsock.isn + 1;
     sock2->data.rcv.irs = lsock.isn;
 
+    /* Use whatever options they offered on their <SYN>. */
+    sock2->data.opts = lsock.opts;
+    sock2->data.ts_recent = lsock.ts_recent;
+
+    if(lsock.opts & TCP_OPTF_WSCALE) {
+        sock2->data.snd.wscale = lsock.wscale;
+        sock2->data.rcv.wscale = tcp_wscale(sock2->rcvbuf_sz);
+    }
+
+    tcp_cc_init(sock2);
+    sock2->data.rto = TCP_DEFAULT_RTTO;
+
     /* Since nothing else has a pointer to this socket, this will not fail. */
     mutex_trylock(&sock2->mutex);
 
-    /* Send the <SYN,ACK> packet now, add it to the list, and clean up. */
+    /* Send the <SYN,ACK> packet now (timing it), add it to the list, and
+       clean up. */
     tcp_send_syn(sock2, 1);
     sock2->data.timer = timer_ms_gettime64();
+    sock2->data.rtt_timing = 1;
+    sock2->data.rtt_seq = sock2->data.snd.iss;
+    sock2->data.rtt_start = timer_us_gettime64();
     fd = sock2->sock;
     LIST_INSERT_HEAD(&tcp_socks, sock2, sock_list);
     mutex_unlock(&sock2->mutex);
@@ -1044,20 +1178,27 @@ static int net_tcp_connect(net_socket_t *hnd, const struct sockaddr *addr,
     }
 
     sock->data.rcv.wnd = sock->rcvbuf_sz;
+    sock->data.rcv.wscale = tcp_wscale(sock->rcvbuf_sz);
     sock->data.rcvbuf_head = sock->data.rcvbuf_tail = 0;
     sock->data.net = net_default_dev;
     sock->data.snd.iss = timer_us_gettime64() >> 2;
     sock->data.snd.una = sock->data.snd.iss;
     sock->data.snd.nxt = sock->data.snd.iss + 1;
+    sock->data.rto = TCP_DEFAULT_RTTO;
     sock->state = TCP_STATE_SYN_SENT;
 
-    /* Send a <SYN> packet */
+    /* Send a <SYN> packet, and time it */
     if(tcp_send_syn(sock, 0) == -1) {
         rwsem_write_unlock(&tcp_sem);
         mutex_unlock(&sock->mutex);
         return -1;
     }
 
+    sock->data.timer = timer_ms_gettime64();
+    sock->data.rtt_timing = 1;
+    sock->data.rtt_seq = sock->data.snd.iss;
+    sock->data.rtt_start = timer_us_gettime64();
+
     /* Release the write lock... */
     rwsem_write_unlock(&tcp_sem);
 
@@ -1275,8 +1416,9 @@ static ssize_t net_tcp_recvfrom(net_socket_t *hnd, void *buffer, size_t length,
             sock->data.rcvbuf_head = size - tmp;
     }
 
-    /* If we've got nothing left, move the pointers back to the beginning */
-    if(!sock->data.rcvbuf_cur_sz) {
+    /* If we've got nothing left, move the pointers back to the beginning
+       (unless there's out of order data past the tail). */
+    if(!sock->data.rcvbuf_cur_sz && !sock->data.ooo_cnt) {
         sock->data.rcvbuf_head = sock->data.rcvbuf_tail = 0;
     }
 
@@ -1467,10 +1609,55 @@ static int net_tcp_shutdownsock(net_socket_t *hnd, int how) {
     return 0;
 }
 
+/* Fill in what TCP_INFO tells about a connection. */
+static void tcp_get_info(const struct tcp_sock *sock, struct tcp_info *info) {
+    memset(info, 0, sizeof(struct tcp_info));
+    info->tcpi_state = sock->state & 0x0F;
+
+    /* A listening socket doesn't have any of the rest. */
+    if(info->tcpi_state == TCP_STATE_LISTEN)
+        return;
+
+    if(sock->data.opts & TCP_OPTF_TS)
+        info->tcpi_options |= TCPI_OPT_TIMESTAMPS;
+
+    if(sock->data.opts & TCP_OPTF_SACK)
+        info->tcpi_options |= TCPI_OPT_SACK;
+
+    if(sock->data.opts & TCP_OPTF_WSCALE)
+        info->tcpi_options |= TCPI_OPT_WSCALE;
+
+    info->tcpi_snd_wscale = sock->data.snd.wscale;
+    info->tcpi_rcv_wscale = sock->data.rcv.wscale;
+    info->tcpi_backoff = sock->data.backoff;
+    info->tcpi_ca_state = sock->data.recovering;
+    info->tcpi_snd_mss = sock->data.snd.mss;
+
+    info->tcpi_rto = sock->data.rto * 1000;
+    info->tcpi_rtt = sock->data.srtt;
+    info->tcpi_rttvar = sock->data.rttvar;
+
+    info->tcpi_snd_cwnd = sock->data.snd.cwnd;
+    info->tcpi_snd_ssthresh = sock->data.snd.ssthresh;
+    info->tcpi_snd_wnd = sock->data.snd.wnd;
+    info->tcpi_rcv_wnd = sock->data.rcv.wnd;
+    info->tcpi_unacked = sock->data.snd.nxt - sock->data.snd.una;
+    info->tcpi_sacked = sock->data.sacked_cnt;
+
+    info->tcpi_segs_out = sock->data.st.segs_out;
+    info->tcpi_segs_in = sock->data.st.segs_in;
+    info->tcpi_total_retrans = sock->data.st.retrans;
+    info->tcpi_fast_retrans = sock->data.st.fast_retrans;
+    info->tcpi_timeouts = sock->data.st.timeouts;
+    info->tcpi_bytes_acked = sock->data.st.bytes_acked;
+    info->tcpi_bytes_received = sock->data.st.bytes_received;
+}
+
 static int net_tcp_getsockopt(net_socket_t *hnd, int level, int option_name,
                               void *option_value, socklen_t *option_len) {
     int tmp;
     struct tcp_sock *sock;
+    struct tcp_info info;
 
     if(!option_value || !option_len) {
         errno = EFAULT;
@@ -1540,6 +1727,15 @@ static int net_tcp_getsockopt(net_socket_t *hnd, int level, int option_name,
                 case TCP_NODELAY:
                     tmp = 1;
                     goto copy_int;
+
+                case TCP_INFO:
+                    tcp_get_info(sock, &info);
+
+                    if(*option_len > sizeof(struct tcp_info))
+                        *option_len = sizeof(struct tcp_info);
+
+                    memcpy(option_value, &info, *option_len);
+                    goto simply_return;
             }
 
             break;
@@ -1576,7 +1772,8 @@ static int net_tcp_setsockopt(net_socket_t *hnd, int level, int option_name,
                               const void *option_value, socklen_t option_len) {
     struct tcp_sock *sock;
     int tmp;
-    uint8_t *new_ptr;
+    uint32_t bufsz;
+    uint8_t *buf;
 
     if(!option_value || !option_len) {
         errno = EFAULT;
@@ -1598,39 +1795,68 @@ static int net_tcp_setsockopt(net_socket_t *hnd, int level, int option_name,
                     if(option_len != sizeof(uint32_t))
                         goto ret_inval;
 
-                    tmp = *(uint32_t *)option_value;
-                    /* Receive buffer size must be in the range 256 - 65535 */
-                    if(tmp < 256)
-                        tmp = 256;
-                    else if(tmp > 65535)
-                        tmp = 65535;
+                    bufsz = *(uint32_t *)option_value;
+
+                    /* Receive buffer size must be in the range 256 - 1MB */
+                    if(bufsz < 256)
+                        bufsz = 256;
+                    else if(bufsz > TCP_MAX_BUFFER)
+                        bufsz = TCP_MAX_BUFFER;
 
-                    new_ptr = realloc(sock->data.rcvbuf, tmp);
-                    if(!new_ptr)
-                        goto ret_nomem;
+                    /* If the socket isn't connected yet, the buffer will be
+                       allocated when it is. Otherwise, it can only grow, since
+                       we can't take back window we've already offered. */
+                    if(!tcp_has_bufs(sock)) {
+                        sock->rcvbuf_sz = bufsz;
+                    }
+                    else if(bufsz > sock->rcvbuf_sz) {
+                        buf = tcp_ring_grow(sock->data.rcvbuf, sock->rcvbuf_sz,
+                                            sock->data.rcvbuf_head, bufsz);
+
+                        if(!buf)
+                            goto ret_nomem;
+
+                        sock->data.rcvbuf = buf;
+                        sock->data.rcvbuf_head = 0;
+                        sock->data.rcvbuf_tail = sock->data.rcvbuf_cur_sz;
+                        sock->data.rcv.wnd += bufsz - sock->rcvbuf_sz;
+                        sock->rcvbuf_sz = bufsz;
+                    }
 
-                    sock->data.rcvbuf = new_ptr;
-                    sock->rcvbuf_sz = tmp;
                     goto ret_success;
 
                 case SO_SNDBUF:
                     if(option_len != sizeof(uint32_t))
                         goto ret_inval;
 
-                    tmp = *(uint32_t *)option_value;
-                    /* Send buffer size must be in the range 2048 - 65535 */
-                    if(tmp < 2048)
-                        tmp = 2048;
-                    else if(tmp > 65535)
-                        tmp = 65535;
+                    bufsz = *(uint32_t *)option_value;
 
-                    new_ptr = realloc(sock->data.sndbuf, tmp);
-                    if(!new_ptr) {
-                        goto ret_nomem;
+                    /* Send buffer size must be in the range 2048 - 1MB */
+                    if(bufsz < 2048)
+                        bufsz = 2048;
+                    else if(bufsz > TCP_MAX_BUFFER)
+                        bufsz = TCP_MAX_BUFFER;
+
+                    /* Same deal as above, since there might be data in the
+                       buffer that we've already sent. */
+                    if(!tcp_has_bufs(sock)) {
+                        sock->sndbuf_sz = bufsz;
+                    }
+                    else if(bufsz > sock->sndbuf_sz) {
+                        buf = tcp_ring_grow(sock->data.sndbuf, sock->sndbuf_sz,
+                                            sock->data.sndbuf_acked, bufsz);
+
+                        if(!buf)
+                            goto ret_nomem;
+
+                        sock->data.sndbuf = buf;
+                        sock->data.sndbuf_head =
+                            tcp_snd_off(sock, sock->data.snd.nxt);
+                        sock->data.sndbuf_acked = 0;
+                        sock->data.sndbuf_tail = sock->data.sndbuf_cur_sz;
+                        sock->sndbuf_sz = bufsz;
                     }
 
-                    sock->data.sndbuf = new_ptr;
-                    sock->sndbuf_sz = tmp;
                     goto ret_success;
             }
 
@@ -2058,177 +2284,557 @@ static void tcp_bpkt_rst(netif_t *net, const struct in6_addr *src,
                   dst, src);
 }
 
-static int tcp_send_syn(struct tcp_sock *sock, int ack) {
-    uint8_t rawpkt[sizeof(tcp_hdr_t) + 4];
-    tcp_hdr_t *hdr = (tcp_hdr_t *)rawpkt;
-    uint16_t cs;
+/* Figure out what to put in the window field of an outgoing segment. The
+   window in a <SYN> is never scaled. */
+static uint16_t tcp_adv_wnd(const struct tcp_sock *sock, int syn) {
+    uint32_t wnd = sock->data.rcv.wnd;
 
-    /* Fill in the base packet */
-    hdr->src_port = sock->local_addr.sin6_port;
-    hdr->dst_port = sock->remote_addr.sin6_port;
-    hdr->seq = htonl(sock->data.snd.iss);
-    hdr->ack = htonl(sock->data.rcv.nxt);
+    if(!syn)
+        wnd >>= sock->data.rcv.wscale;
 
-    if(ack) {
-        hdr->off_flags = htons(TCP_FLAG_SYN | TCP_FLAG_ACK | TCP_OFFSET(6));
-    }
-    else {
-        hdr->off_flags = htons(TCP_FLAG_SYN | TCP_OFFSET(6));
+    return htons(wnd > 65535 ? 65535 : wnd);
+}
+
+/* Fill in the header of an outgoing segment on a synchronized connection,
+   along with the options that go on all of them: a timestamp, and the ranges
+   of data we're holding out of order, if there are any. Returns the length of
+   the header, options included. */
+static int tcp_fill_hdr(struct tcp_sock *sock, tcp_hdr_t *hdr, uint32_t seq,
+                        uint16_t flags) {
+    uint8_t *opt = hdr->options;
+    int len = 0, i, cnt;
+
+    if(sock->data.opts & TCP_OPTF_TS) {
+        opt[0] = TCP_OPT_NOP;
+        opt[1] = TCP_OPT_NOP;
+        opt[2] = TCP_OPT_TS;
+        opt[3] = 10;
+        tcp_put32(opt + 4, tcp_ts_now());
+        tcp_put32(opt + 8, sock->data.ts_recent);
+        len = 12;
+    }
+
+    if((sock->data.opts & TCP_OPTF_SACK) && sock->data.ooo_cnt) {
+        cnt = (TCP_MAX_OPTS - len - 4) / 8;
+
+        if(cnt > sock->data.ooo_cnt)
+            cnt = sock->data.ooo_cnt;
+
+        opt[len] = TCP_OPT_NOP;
+        opt[len + 1] = TCP_OPT_NOP;
+        opt[len + 2] = TCP_OPT_SACK;
+        opt[len + 3] = 2 + cnt * 8;
+        len += 4;
+
+        for(i = 0; i < cnt; ++i) {
+            tcp_put32(opt + len, sock->data.ooo[i].start);
+            tcp_put32(opt + len + 4, sock->data.ooo[i].end);
+            len += 8;
+        }
     }
 
-    hdr->wnd = htons(sock->data.rcv.wnd);
+    hdr->src_port = sock->local_addr.sin6_port;
+    hdr->dst_port = sock->remote_addr.sin6_port;
+    hdr->seq = htonl(seq);
+    hdr->ack = htonl(sock->data.rcv.nxt);
+    hdr->off_flags = htons(flags | TCP_OFFSET(5 + len / 4));
+    hdr->wnd = tcp_adv_wnd(sock, 0);
     hdr->checksum = 0;
     hdr->urg = 0;
 
-    /* Fill in our SYN options. The only one we worry about right now is MSS. */
-    hdr->options[0] = TCP_OPT_MSS;
-    hdr->options[1] = 4;
-    hdr->options[2] = (TCP_DEFAULT_MSS >> 8) & 0xFF;
-    hdr->options[3] = TCP_DEFAULT_MSS & 0xFF;
+    sock->data.last_ack_sent = sock->data.rcv.nxt;
+
+    return sizeof(tcp_hdr_t) + len;
+}
+
+/* Checksum and send off a segment on a connection. */
+static int tcp_send_pkt(struct tcp_sock *sock, uint8_t *rawpkt, int sz) {
+    tcp_hdr_t *hdr = (tcp_hdr_t *)rawpkt;
+    uint16_t cs;
 
-    /* Calculate the real checksum */
     cs = net_ipv6_checksum_pseudo(&sock->local_addr.sin6_addr,
-                                  &sock->remote_addr.sin6_addr,
-                                  sizeof(tcp_hdr_t) + 4, IPPROTO_TCP);
-    hdr->checksum = net_ipv4_checksum(rawpkt, sizeof(tcp_hdr_t) + 4, cs);
+                                  &sock->remote_addr.sin6_addr, sz,
+                                  IPPROTO_TCP);
+    hdr->checksum = net_ipv4_checksum(rawpkt, sz, cs);
+    ++sock->data.st.segs_out;
 
-    return net_ipv6_send(sock->data.net, rawpkt, sizeof(tcp_hdr_t) + 4,
-                         sock->hop_limit, IPPROTO_TCP,
-                         &sock->local_addr.sin6_addr,
+    return net_ipv6_send(sock->data.net, rawpkt, sz, sock->hop_limit,
+                         IPPROTO_TCP, &sock->local_addr.sin6_addr,
                          &sock->remote_addr.sin6_addr);
 }
 
-static void tcp_send_fin_ack(struct tcp_sock *sock) {
-    uint8_t rawpkt[sizeof(tcp_hdr_t)];
+static int tcp_send_syn(struct tcp_sock *sock, int ack) {
+    uint8_t rawpkt[sizeof(tcp_hdr_t) + 24];
     tcp_hdr_t *hdr = (tcp_hdr_t *)rawpkt;
-    uint16_t cs;
+    uint8_t *opt = hdr->options;
+    int len;
+
+    /* Fill in our SYN options. On a <SYN>, we offer everything we support,
+       and on a <SYN,ACK> we only answer with what they offered. The window
+       scale is always sent last, so the padding for it goes in front. */
+    opt[0] = TCP_OPT_MSS;
+    opt[1] = 4;
+    opt[2] = (TCP_DEFAULT_MSS >> 8) & 0xFF;
+    opt[3] = TCP_DEFAULT_MSS & 0xFF;
+    len = 4;
+
+    if(!ack || (sock->data.opts & TCP_OPTF_SACK)) {
+        opt[len] = TCP_OPT_NOP;
+        opt[len + 1] = TCP_OPT_NOP;
+        opt[len + 2] = TCP_OPT_SACK_PERM;
+        opt[len + 3] = 2;
+        len += 4;
+    }
+
+    if(!ack || (sock->data.opts & TCP_OPTF_TS)) {
+        opt[len] = TCP_OPT_NOP;
+        opt[len + 1] = TCP_OPT_NOP;
+        opt[len + 2] = TCP_OPT_TS;
+        opt[len + 3] = 10;
+        tcp_put32(opt + len + 4, tcp_ts_now());
+        tcp_put32(opt + len + 8, ack ? sock->data.ts_recent : 0);
+        len += 12;
+    }
+
+    if(!ack || (sock->data.opts & TCP_OPTF_WSCALE)) {
+        opt[len] = TCP_OPT_NOP;
+        opt[len + 1] = TCP_OPT_WSCALE;
+        opt[len + 2] = 3;
+        opt[len + 3] = sock->data.rcv.wscale;
+        len += 4;
+    }
 
     /* Fill in the base packet */
     hdr->src_port = sock->local_addr.sin6_port;
     hdr->dst_port = sock->remote_addr.sin6_port;
-    hdr->seq = htonl(sock->data.snd.nxt);
+    hdr->seq = htonl(sock->data.snd.iss);
     hdr->ack = htonl(sock->data.rcv.nxt);
-    hdr->off_flags = htons(TCP_FLAG_FIN | TCP_FLAG_ACK | TCP_OFFSET(5));
-    hdr->wnd = htons(sock->data.rcv.wnd);
+
+    if(ack) {
+        hdr->off_flags = htons(TCP_FLAG_SYN | TCP_FLAG_ACK |
+                               TCP_OFFSET(5 + len / 4));
+    }
+    else {
+        hdr->off_flags = htons(TCP_FLAG_SYN | TCP_OFFSET(5 + len / 4));
+    }
+
+    hdr->wnd = tcp_adv_wnd(sock, 1);
     hdr->checksum = 0;
     hdr->urg = 0;
 
-    /* Calculate the real checksum */
-    cs = net_ipv6_checksum_pseudo(&sock->local_addr.sin6_addr,
-                                  &sock->remote_addr.sin6_addr,
-                                  sizeof(tcp_hdr_t), IPPROTO_TCP);
-    hdr->checksum = net_ipv4_checksum(rawpkt, sizeof(tcp_hdr_t), cs);
+    sock->data.last_ack_sent = sock->data.rcv.nxt;
 
-    net_ipv6_send(sock->data.net, rawpkt, sizeof(tcp_hdr_t), sock->hop_limit,
-                  IPPROTO_TCP, &sock->local_addr.sin6_addr,
-                  &sock->remote_addr.sin6_addr);
+    return tcp_send_pkt(sock, rawpkt, sizeof(tcp_hdr_t) + len);
+}
+
+static void tcp_send_fin_ack(struct tcp_sock *sock) {
+    uint8_t rawpkt[sizeof(tcp_hdr_t) + TCP_MAX_OPTS];
+    int sz;
+
+    sz = tcp_fill_hdr(sock, (tcp_hdr_t *)rawpkt, sock->data.snd.nxt,
+                      TCP_FLAG_FIN | TCP_FLAG_ACK);
+    tcp_send_pkt(sock, rawpkt, sz);
 }
 
 static void tcp_send_ack(struct tcp_sock *sock) {
-    tcp_hdr_t hdr;
-    uint16_t c;
+    uint8_t rawpkt[sizeof(tcp_hdr_t) + TCP_MAX_OPTS];
+    int sz;
 
-    /* Fill in the base packet */
-    hdr.src_port = sock->local_addr.sin6_port;
-    hdr.dst_port = sock->remote_addr.sin6_port;
-    hdr.seq = htonl(sock->data.snd.nxt);
-    hdr.ack = htonl(sock->data.rcv.nxt);
-    hdr.off_flags = htons(TCP_FLAG_ACK | TCP_OFFSET(5));
-    hdr.wnd = htons(sock->data.rcv.wnd);
-    hdr.checksum = 0;
-    hdr.urg = 0;
-
-    /* Calculate the real checksum */
-    c = net_ipv6_checksum_pseudo(&sock->local_addr.sin6_addr,
-                                 &sock->remote_addr.sin6_addr,
-                                 sizeof(tcp_hdr_t), IPPROTO_TCP);
-    hdr.checksum = net_ipv4_checksum((const uint8 *)&hdr, sizeof(tcp_hdr_t), c);
-
-    net_ipv6_send(sock->data.net, (const uint8 *)&hdr, sizeof(tcp_hdr_t),
-                  sock->hop_limit, IPPROTO_TCP, &sock->local_addr.sin6_addr,
-                  &sock->remote_addr.sin6_addr);
+    sz = tcp_fill_hdr(sock, (tcp_hdr_t *)rawpkt, sock->data.snd.nxt,
+                      TCP_FLAG_ACK);
+    tcp_send_pkt(sock, rawpkt, sz);
 }
 
-static void tcp_send_data(struct tcp_sock *sock, int resend) {
-    uint32_t wnd = sock->data.snd.wnd, snd;
-    int sz = sizeof(tcp_hdr_t);
+/* Send one segment of data out of the send buffer. */
+static void tcp_send_seg(struct tcp_sock *sock, uint32_t seq, uint32_t len) {
     uint8_t rawpkt[1500];
-    tcp_hdr_t *hdr = (tcp_hdr_t *)rawpkt;
-    uint16_t cs;
-    uint8_t *sb, *buf;
-    uint32_t seq, unacked, head;
+    int sz;
+
+    sz = tcp_fill_hdr(sock, (tcp_hdr_t *)rawpkt, seq, TCP_FLAG_ACK);
+    tcp_ring_read(sock->data.sndbuf, sock->sndbuf_sz,
+                  sock->data.sndbuf_acked + tcp_snd_off(sock, seq),
+                  rawpkt + sz, len);
+    tcp_send_pkt(sock, rawpkt, sz + len);
+}
 
-    if(!resend) {
-        seq = sock->data.snd.nxt;
-        unacked = sock->data.snd.nxt - sock->data.snd.una;
-        wnd -= unacked;
-        head = sock->data.sndbuf_head;
+/* Most data we can put in one segment, leaving room for the options. */
+static uint32_t tcp_seg_max(const struct tcp_sock *sock) {
+    int rv = sock->data.snd.mss - sizeof(tcp_hdr_t);
+
+    if((sock->data.opts & TCP_OPTF_SACK) && sock->data.ooo_cnt)
+        rv -= TCP_MAX_OPTS;
+    else if(sock->data.opts & TCP_OPTF_TS)
+        rv -= 12;
+
+    return rv > 0 ? rv : 1;
+}
+
+/* Size of a full segment when we've got no SACK blocks to send, which is what
+   the congestion window is counted in (SMSS in the RFCs). */
+static uint32_t tcp_smss(const struct tcp_sock *sock) {
+    int rv = sock->data.snd.mss - sizeof(tcp_hdr_t);
+
+    if(sock->data.opts & TCP_OPTF_TS)
+        rv -= 12;
+
+    return rv > 0 ? rv : 1;
+}
+
+/* Find the first part of [seq, end) that the other side hasn't SACKed. Moves
+   seq up to the start of it, and returns its length (0 if there isn't any). */
+static uint32_t tcp_unsacked(const struct tcp_sock *sock, uint32_t *seq,
+                             uint32_t end) {
+    const struct tcp_range *r;
+    uint32_t len;
+    int i;
+
+    for(i = 0; i < sock->data.sacked_cnt && SEQ_LT(*seq, end); ++i) {
+        r = &sock->data.sacked[i];
+
+        /* Skip over SACKed data, and start looking again from its end. */
+        if(SEQ_LE(r->start, *seq) && SEQ_GT(r->end, *seq)) {
+            *seq = r->end;
+            i = -1;
+        }
     }
-    else {
-        seq = sock->data.snd.una;
-        unacked = 0;
-        head = sock->data.sndbuf_acked;
+
+    if(!SEQ_LT(*seq, end))
+        return 0;
+
+    /* Stop short of the next bit they have. */
+    len = end - *seq;
+
+    for(i = 0; i < sock->data.sacked_cnt; ++i) {
+        r = &sock->data.sacked[i];
+
+        if(SEQ_GT(r->start, *seq) && SEQ_LT(r->start, *seq + len))
+            len = r->start - *seq;
     }
 
-    if(!wnd)
+    return len;
+}
+
+/* Send one segment of the first part of [seq, end) the other side hasn't
+   SACKed again. Returns where what was sent ends, or end if nothing was. */
+static uint32_t tcp_resend_seg(struct tcp_sock *sock, uint32_t seq,
+                               uint32_t end) {
+    uint32_t len = tcp_unsacked(sock, &seq, end), mss = tcp_seg_max(sock);
+
+    if(!len)
+        return end;
+
+    if(len > mss)
+        len = mss;
+
+    tcp_send_seg(sock, seq, len);
+    ++sock->data.st.retrans;
+
+    /* Karn's algorithm: an ACK for a segment that's been sent more than once
+       can't be used to time the round trip. */
+    sock->data.rtt_timing = 0;
+
+    return seq + len;
+}
+
+/* Send whatever the windows let us send. Everything from snd.rxt up to snd.nxt
+   is taken to be lost after a timeout, so that goes out again first (other
+   than anything the other side has told us it already has with SACK), then
+   anything new. When resending, a zero window is probed with a single byte. */
+static void tcp_send_data(struct tcp_sock *sock, int resend) {
+    uint32_t wnd = sock->data.snd.wnd, mss = tcp_seg_max(sock);
+    uint32_t una = sock->data.snd.una, nxt = sock->data.snd.nxt;
+    uint32_t seq, len, unsent;
+
+    if(wnd > sock->data.snd.cwnd)
+        wnd = sock->data.snd.cwnd;
+
+    if(resend && !wnd)
         wnd = 1;
 
-    /* Fill in the base packet */
-    hdr->src_port = sock->local_addr.sin6_port;
-    hdr->dst_port = sock->remote_addr.sin6_port;
-    hdr->ack = htonl(sock->data.rcv.nxt);
-    hdr->off_flags = htons(TCP_FLAG_ACK | TCP_OFFSET(5));
-    hdr->wnd = htons(sock->data.rcv.wnd);
-    hdr->urg = 0;
+    /* Nothing after snd.rxt counts as being in flight while we resend. */
+    seq = sock->data.snd.rxt;
+
+    while(SEQ_LT(seq, nxt) && seq - una < wnd) {
+        if(!(len = tcp_unsacked(sock, &seq, nxt))) {
+            seq = nxt;
+            break;
+        }
+
+        if(seq - una >= wnd)
+            break;
+
+        if(len > wnd - (seq - una))
+            len = wnd - (seq - una);
+
+        if(len > mss)
+            len = mss;
+
+        tcp_send_seg(sock, seq, len);
+        ++sock->data.st.retrans;
+        sock->data.rtt_timing = 0;
+        seq += len;
+    }
+
+    sock->data.snd.rxt = seq;
+
+    if(SEQ_LT(seq, nxt))
+        return;
+
+    /* Now send anything new that fits in the window. */
+    len = tcp_snd_off(sock, seq);
+    unsent = sock->data.sndbuf_cur_sz > len ?
+        sock->data.sndbuf_cur_sz - len : 0;
+    len = seq - una;
+    wnd = wnd > len ? wnd - len : 0;
 
-    /* Put on some data if we should do so */
-    while(sock->data.sndbuf_cur_sz - unacked && wnd) {
-        hdr->seq = htonl(seq);
-        hdr->checksum = 0;
-        buf = rawpkt + sizeof(tcp_hdr_t);
-        sb = sock->data.sndbuf + head;
-        snd = wnd;
+    /* If nothing was in flight, the retransmission timer starts now. */
+    if(unsent && wnd && una == nxt)
+        sock->data.timer = timer_ms_gettime64();
 
-        if(snd > sock->data.snd.mss - sizeof(tcp_hdr_t))
-            snd = sock->data.snd.mss - sizeof(tcp_hdr_t);
+    while(unsent && wnd) {
+        len = unsent;
 
-        if(snd > sock->data.sndbuf_cur_sz - unacked)
-            snd = sock->data.sndbuf_cur_sz - unacked;
+        if(len > wnd)
+            len = wnd;
 
-        /* Copy in the data */
-        if(head + snd <= sock->sndbuf_sz) {
-            memcpy(buf, sb, snd);
-            head += snd;
+        if(len > mss)
+            len = mss;
 
-            if(head == sock->sndbuf_sz)
-                head = 0;
+        /* Without timestamps, time one segment at a time. */
+        if(!sock->data.rtt_timing && !(sock->data.opts & TCP_OPTF_TS)) {
+            sock->data.rtt_timing = 1;
+            sock->data.rtt_seq = seq;
+            sock->data.rtt_start = timer_us_gettime64();
+        }
+
+        tcp_send_seg(sock, seq, len);
+        seq += len;
+        unsent -= len;
+        wnd -= len;
+    }
+
+    sock->data.snd.nxt = sock->data.snd.rxt = seq;
+    sock->data.sndbuf_head = (sock->data.sndbuf_acked +
+                              tcp_snd_off(sock, seq)) % sock->sndbuf_sz;
+}
+
+/* Fold a round trip time measurement (in microseconds) into the smoothed round
+   trip time and its variation, and work out the retransmission timeout from
+   them (RFC 6298, section 2). */
+static void tcp_rtt_update(struct tcp_sock *sock, uint64_t rtt) {
+    uint32_t r, delta, rto;
+
+    /* Keep it above zero, so that srtt is only zero before the first one. */
+    if(rtt > TCP_MAX_RTTO * 1000ULL)
+        r = TCP_MAX_RTTO * 1000;
+    else
+        r = rtt ? (uint32_t)rtt : 1;
+
+    if(!sock->data.srtt) {
+        sock->data.srtt = r;
+        sock->data.rttvar = r / 2;
+    }
+    else {
+        delta = sock->data.srtt > r ? sock->data.srtt - r :
+            r - sock->data.srtt;
+        sock->data.rttvar = (3 * sock->data.rttvar + delta) / 4;
+        sock->data.srtt = (7 * sock->data.srtt + r) / 8;
+    }
+
+    /* The clock granularity (G in the RFC) is a millisecond. */
+    rto = (sock->data.srtt + MAX(1000, 4 * sock->data.rttvar) + 999) / 1000;
+
+    if(rto < TCP_MIN_RTTO)
+        rto = TCP_MIN_RTTO;
+    else if(rto > TCP_MAX_RTTO)
+        rto = TCP_MAX_RTTO;
+
+    sock->data.rto = rto;
+    sock->data.backoff = 0;
+}
+
+/* Double the retransmission timeout, after it's gone off. */
+static void tcp_backoff(struct tcp_sock *sock) {
+    sock->data.rto *= 2;
+
+    if(sock->data.rto > TCP_MAX_RTTO)
+        sock->data.rto = TCP_MAX_RTTO;
+
+    if(sock->data.backoff < 255)
+        ++sock->data.backoff;
+
+    ++sock->data.st.timeouts;
+}
+
+/* Set up the congestion window once we know the other side's MSS, starting
+   with the initial window from RFC 5681, section 3.1. */
+static void tcp_cc_init(struct tcp_sock *sock) {
+    uint32_t smss = tcp_smss(sock);
+
+    if(smss > 2190)
+        sock->data.snd.cwnd = 2 * smss;
+    else if(smss > 1095)
+        sock->data.snd.cwnd = 3 * smss;
+    else
+        sock->data.snd.cwnd = 4 * smss;
+
+    sock->data.snd.ssthresh = TCP_MAX_CWND;
+    sock->data.snd.rxt = sock->data.snd.nxt;
+    sock->data.snd.recover = sock->data.snd.una;
+}
+
+/* Take a round trip time sample from an ACK of new data. Timestamps give us
+   one on every such ACK (resent segments get new timestamps, so Karn's
+   algorithm doesn't come into it), otherwise only the segment being timed
+   does. */
+static void tcp_rtt_sample(struct tcp_sock *sock, const struct tcp_opts *o) {
+    if((sock->data.opts & TCP_OPTF_TS) && (o->flags & TCP_OPTF_TS) &&
+            o->tsecr) {
+        tcp_rtt_update(sock, (uint64_t)(tcp_ts_now() - o->tsecr) * 1000);
+        sock->data.rtt_timing = 0;
+    }
+    else if(sock->data.rtt_timing &&
+            SEQ_GT(sock->data.snd.una, sock->data.rtt_seq)) {
+        tcp_rtt_update(sock, timer_us_gettime64() - sock->data.rtt_start);
+        sock->data.rtt_timing = 0;
+    }
+}
+
+/* Deal with an ACK of new data (acked bytes of it, not counting our SYN), once
+   snd.una has been moved up: restart the retransmission timer and open up the
+   congestion window, or deal with an ACK during fast recovery. */
+static void tcp_new_ack(struct tcp_sock *sock, uint32_t acked,
+                        const struct tcp_opts *o) {
+    uint32_t smss = tcp_smss(sock), cwnd = sock->data.snd.cwnd, out;
+
+    tcp_rtt_sample(sock, o);
+    sock->data.timer = timer_ms_gettime64();
+    sock->data.st.bytes_acked += acked;
+    sock->data.dupacks = 0;
+
+    if(sock->data.recovering) {
+        if(SEQ_GE(sock->data.snd.una, sock->data.snd.recover)) {
+            /* Everything that was out when recovery started has been acked,
+               so we're done (RFC 6582, section 3.2, step 3). */
+            out = sock->data.snd.nxt - sock->data.snd.una;
+            cwnd = MAX(out, smss) + smss;
+
+            if(cwnd > sock->data.snd.ssthresh)
+                cwnd = sock->data.snd.ssthresh;
+
+            sock->data.recovering = 0;
         }
         else {
-            sz = sock->sndbuf_sz - head;
-            memcpy(buf, sb, sz);
-            memcpy(buf + sz, sock->data.sndbuf, snd - sz);
-            head = snd - sz;
+            /* A partial ACK means the segment after it was lost too, so send
+               it now, unless we already have. Take what was acked back off
+               the window, since it's left the network (step 4). */
+            if(SEQ_GE(sock->data.snd.una, sock->data.snd.high_rxt))
+                sock->data.snd.high_rxt =
+                    tcp_resend_seg(sock, sock->data.snd.una,
+                                   sock->data.snd.nxt);
+
+            cwnd = cwnd > acked ? cwnd - acked : 0;
+
+            if(acked >= smss)
+                cwnd += smss;
+
+            if(cwnd < smss)
+                cwnd = smss;
         }
+    }
+    else if(sock->data.snd.nxt - sock->data.snd.una + acked + smss < cwnd) {
+        /* Something else held us back (their window, or there just wasn't
+           that much to send), so this says nothing about a bigger window. */
+    }
+    else if(cwnd < sock->data.snd.ssthresh) {
+        /* Slow start */
+        cwnd += acked < smss ? acked : smss;
+    }
+    else {
+        /* Congestion avoidance */
+        cwnd += MAX(smss * smss / cwnd, 1);
+    }
+
+    sock->data.snd.cwnd = cwnd < TCP_MAX_CWND ? cwnd : TCP_MAX_CWND;
+}
+
+/* Deal with a duplicate ACK. After a few in a row, take it that the segment
+   they're waiting on was lost, so send it again and go into fast recovery
+   (RFC 5681, section 3.2 and RFC 6582). */
+static void tcp_dup_ack(struct tcp_sock *sock) {
+    uint32_t smss = tcp_smss(sock), seq, end, out;
+    int i;
+
+    if(sock->data.recovering) {
+        /* Anything between what we've already resent and the end of what
+           they've SACKed is lost as well. Otherwise, every duplicate ACK means
+           another segment has left the network, so one more can go out. */
+        seq = sock->data.snd.high_rxt;
+        end = seq;
+
+        if(SEQ_LT(seq, sock->data.snd.una))
+            seq = sock->data.snd.una;
+
+        for(i = 0; i < sock->data.sacked_cnt; ++i) {
+            if(SEQ_GT(sock->data.sacked[i].end, end))
+                end = sock->data.sacked[i].end;
+        }
+
+        if(SEQ_LT(seq, end) && tcp_unsacked(sock, &seq, end))
+            sock->data.snd.high_rxt = tcp_resend_seg(sock, seq, end);
+        else
+            sock->data.snd.cwnd += smss;
+
+        return;
+    }
 
-        sz = snd + sizeof(tcp_hdr_t);
-        wnd -= snd;
-        seq += snd;
-        unacked += snd;
+    if(sock->data.dupacks < 255)
+        ++sock->data.dupacks;
 
-        /* Calculate the checksum */
-        cs = net_ipv6_checksum_pseudo(&sock->local_addr.sin6_addr,
-                                      &sock->remote_addr.sin6_addr, sz,
-                                      IPPROTO_TCP);
-        hdr->checksum = net_ipv4_checksum(rawpkt, sz, cs);
+    /* Don't start recovery again for a loss from before the last one. */
+    if(sock->data.dupacks != TCP_DUPACK_THRESH ||
+            !SEQ_GT(sock->data.snd.una, sock->data.snd.recover))
+        return;
+
+    out = sock->data.snd.nxt - sock->data.snd.una;
+    sock->data.snd.ssthresh = MAX(out / 2, 2 * smss);
+    sock->data.snd.recover = sock->data.snd.nxt;
+    sock->data.snd.high_rxt = tcp_resend_seg(sock, sock->data.snd.una,
+                                             sock->data.snd.nxt);
+    sock->data.snd.cwnd = sock->data.snd.ssthresh + 3 * smss;
+    sock->data.recovering = 1;
+    ++sock->data.st.fast_retrans;
+}
+
+/* The retransmission timer went off with data still unacked. Back off the
+   timer, drop back to slow start, and start sending everything from the
+   first unacked byte again (RFC 5681, section 3.1 and RFC 6298, section 5). */
+static void tcp_timeout(struct tcp_sock *sock) {
+    uint32_t out = sock->data.snd.nxt - sock->data.snd.una;
+
+    /* If nothing got through since the last timeout, the other side might
+       have thrown out data it SACKed, so stop trusting that (RFC 2018, section
+       8). */
+    if(sock->data.snd.una == sock->data.rto_una)
+        sock->data.sacked_cnt = 0;
 
-        net_ipv6_send(sock->data.net, rawpkt, sz, sock->hop_limit, IPPROTO_TCP,
-                      &sock->local_addr.sin6_addr,
-                      &sock->remote_addr.sin6_addr);
+    sock->data.rto_una = sock->data.snd.una;
+
+    /* Probing a zero window doesn't say anything about congestion. */
+    if(sock->data.snd.wnd) {
+        sock->data.snd.ssthresh = MAX(out / 2, 2 * tcp_smss(sock));
+        sock->data.snd.cwnd = tcp_smss(sock);
     }
 
+    sock->data.snd.recover = sock->data.snd.nxt;
+    sock->data.snd.rxt = sock->data.snd.una;
+    sock->data.recovering = 0;
+    sock->data.dupacks = 0;
+    sock->data.rtt_timing = 0;
+
+    tcp_backoff(sock);
+    tcp_send_data(sock, 1);
     sock->data.timer = timer_ms_gettime64();
-    sock->data.sndbuf_head = head;
-    sock->data.snd.nxt = seq;
 }
 
 #define ADDR_EQUAL(a1, a2) \
@@ -2283,6 +2889,17 @@ static struct tcp_sock *find_sock(const struct in6_addr *src,
 
 extern void __poll_event_trigger(int fd, short event);
 
+/* Save what we need from an incoming <SYN> for when we send our <SYN,ACK>. */
+static void lsock_set_syn(struct lsock *ls, const tcp_hdr_t *tcp, uint16_t mss,
+                          const struct tcp_opts *opts) {
+    ls->isn = ntohl(tcp->seq);
+    ls->mss = mss;
+    ls->wnd = ntohs(tcp->wnd);
+    ls->opts = opts->flags;
+    ls->wscale = opts->wscale;
+    ls->ts_recent = opts->tsval;
+}
+
 /* This function is basically a direct implementation of the first two and a
    half steps of the SEGMENT ARRIVES event processing defined in RFC 793 on
    pages 65 and 66. There are a few parts that are omitted and some are put off
@@ -2290,9 +2907,10 @@ extern void __poll_event_trigger(int fd, short event);
 static int listen_pkt(netif_t *src, const struct in6_addr *srca,
                       const struct in6_addr *dsta, const tcp_hdr_t *tcp,
                       struct tcp_sock *s, uint16_t flags, int size) {
-    int j = 0;
-    int end_of_opts;
+    struct tcp_opts opts;
+    struct lsock *ls;
     uint16_t mss = 576;
+    int j;
 
     (void)size;
 
@@ -2305,35 +2923,11 @@ static int listen_pkt(netif_t *src, const struct in6_addr *srca,
         return -1;
 
     /* Parse options now, in case we need to update the max segment size. */
-    end_of_opts = TCP_GET_OFFSET(flags) - 20;
-
-    while(j < end_of_opts) {
-        switch(tcp->options[j]) {
-            case TCP_OPT_EOL:
-                j = end_of_opts;
-                break;
-
-            case TCP_OPT_NOP:
-                ++j;
-                break;
-
-            case TCP_OPT_MSS:
-                if(j + 4 > end_of_opts || tcp->options[j + 1] != 4)
-                    return -1;
-
-                mss = (tcp->options[j + 2] << 8) | tcp->options[j + 3];
-                j += 4;
-                break;
-
-            default:
+    if(tcp_parse_opts(tcp, flags, &opts))
+        return -1;
 
-                /* Skip unknown options */
-                if(j + 1 > end_of_opts || j + tcp->options[j + 1] > end_of_opts)
-                    return -1;
-
-                j += tcp->options[j + 1];
-        }
-    }
+    if(opts.mss)
+        mss = opts.mss;
 
     /* Silently cap the MSS... */
     if(mss > 1460)
@@ -2347,8 +2941,7 @@ static int listen_pkt(netif_t *src, const struct in6_addr *srca,
         if(ADDR_EQUAL(s->listen.queue[j].remote_addr.sin6_addr, *srca) &&
                 ADDR_EQUAL(s->listen.queue[j].local_addr.sin6_addr, *dsta) &&
                 s->listen.queue[j].remote_addr.sin6_port == tcp->src_port) {
-            s->listen.queue[j].isn = ntohl(tcp->seq);
-            s->listen.queue[j].mss = mss;
+            lsock_set_syn(&s->listen.queue[j], tcp, mss, &opts);
             return 0;
         }
     }
@@ -2359,14 +2952,13 @@ static int listen_pkt(netif_t *src, const struct in6_addr *srca,
 
     /* The rest of the processing is put off until the program does an accept().
        Save the connection in the list of incoming sockets. */
-    s->listen.queue[s->listen.tail].net = src;
-    s->listen.queue[s->listen.tail].remote_addr.sin6_addr = *srca;
-    s->listen.queue[s->listen.tail].remote_addr.sin6_port = tcp->src_port;
-    s->listen.queue[s->listen.tail].local_addr.sin6_addr = *dsta;
-    s->listen.queue[s->listen.tail].local_addr.sin6_port = tcp->dst_port;
-    s->listen.queue[s->listen.tail].isn = ntohl(tcp->seq);
-    s->listen.queue[s->listen.tail].mss = mss;
-    s->listen.queue[s->listen.tail].wnd = ntohs(tcp->wnd);
+    ls = &s->listen.queue[s->listen.tail];
+    ls->net = src;
+    ls->remote_addr.sin6_addr = *srca;
+    ls->remote_addr.sin6_port = tcp->src_port;
+    ls->local_addr.sin6_addr = *dsta;
+    ls->local_addr.sin6_port = tcp->dst_port;
+    lsock_set_syn(ls, tcp, mss, &opts);
     ++s->listen.count;
     ++s->listen.tail;
 
@@ -2388,7 +2980,7 @@ static int synsent_pkt(netif_t *src, const struct in6_addr *srca,
                        struct tcp_sock *s, uint16_t flags, int size) {
     uint32_t ack, seq;
     int sz = size - TCP_GET_OFFSET(flags), gotack = 0;
-    int j = 0, end_of_opts, mss = 536;
+    struct tcp_opts opts;
 
     (void)src;
 
@@ -2424,43 +3016,31 @@ static int synsent_pkt(netif_t *src, const struct in6_addr *srca,
         s->data.rcv.nxt = seq + 1;
         s->data.rcv.irs = seq;
 
-        end_of_opts = TCP_GET_OFFSET(flags) - 20;
-
-        while(j < end_of_opts) {
-            switch(tcp->options[j]) {
-                case TCP_OPT_EOL:
-                    j = end_of_opts;
-                    break;
-
-                case TCP_OPT_NOP:
-                    ++j;
-                    break;
-
-                case TCP_OPT_MSS:
-
-                    if(j + 4 > end_of_opts || tcp->options[j + 1] != 4)
-                        return -1;
+        if(tcp_parse_opts(tcp, flags, &opts))
+            return -1;
 
-                    mss = (tcp->options[j + 2] << 8) | tcp->options[j + 3];
-                    j += 4;
-                    break;
+        if(!opts.mss)
+            opts.mss = 536;
 
-                default:
+        s->data.snd.mss = opts.mss > 1460 ? 1460 : opts.mss;
+        s->data.snd.wnd = ntohs(tcp->wnd);
+        s->data.snd.wl1 = seq;
+        s->data.snd.wl2 = ack;
 
-                    /* Skip unknown options */
-                    if(j + 1 > end_of_opts ||
-                            j + tcp->options[j + 1] > end_of_opts)
-                        return -1;
+        /* We offered everything on our <SYN>, so use whatever they want to
+           use. Window scaling only works if both sides agree to it. */
+        s->data.opts = opts.flags;
+        s->data.ts_recent = opts.tsval;
+        s->data.snd.wscale = opts.wscale;
 
-                    j += tcp->options[j + 1];
-            }
-        }
+        if(!(opts.flags & TCP_OPTF_WSCALE))
+            s->data.rcv.wscale = 0;
 
-        s->data.snd.mss = mss > 1460 ? 1460 : mss;
-        s->data.snd.wnd = htons(tcp->wnd);
+        tcp_cc_init(s);
 
         if(gotack) {
             s->data.snd.una = ack;
+            tcp_rtt_sample(s, &opts);
 
             /* If the ack covers our iss, then we've established the connection.
                Update the state and ack it. */
@@ -2487,11 +3067,11 @@ static int synsent_pkt(netif_t *src, const struct in6_addr *srca,
 static int process_pkt(netif_t *src, const struct in6_addr *srca,
                        const struct in6_addr *dsta, const tcp_hdr_t *tcp,
                        struct tcp_sock *s, uint16_t flags, size_t size) {
-    uint32_t seq, ack, up;
+    uint32_t seq, ack, up, off, acked = 0, nxt, wnd;
     size_t sz;
-    int bad_pkt = 0, tmp, acksyn = 0;
+    int bad_pkt = 0, acksyn = 0, newack = 0, dupack = 0, i;
     const uint8_t *buf = (const uint8_t *)tcp;
-    uint8_t *rb;
+    struct tcp_opts opts;
 
     (void)src;
 
@@ -2503,6 +3083,18 @@ static int process_pkt(netif_t *src, const struct in6_addr *srca,
     sz = size - TCP_GET_OFFSET(flags);
     buf += TCP_GET_OFFSET(flags);
 
+    ++s->data.st.segs_in;
+
+    /* Malformed options get the whole segment thrown out. */
+    if(tcp_parse_opts(tcp, flags, &opts))
+        return 0;
+
+    /* Throw out old duplicates, as told by their timestamps. */
+    if(tcp_paws_reject(s->data.opts, &opts, flags, s->data.ts_recent)) {
+        tcp_send_ack(s);
+        return 0;
+    }
+
     if(s->data.rcv.wnd == 0) {
         if(sz || seq != s->data.rcv.nxt)
             bad_pkt = 1;
@@ -2514,8 +3106,11 @@ static int process_pkt(netif_t *src, const struct in6_addr *srca,
                 bad_pkt = 1;
         }
         else {
+            /* Either end of the segment has to be in the window. */
             if(!(SEQ_GE(seq, s->data.rcv.nxt) &&
-                    SEQ_LT(seq, s->data.rcv.nxt + s->data.rcv.wnd)))
+                    SEQ_LT(seq, s->data.rcv.nxt + s->data.rcv.wnd)) &&
+                    !(SEQ_GE(seq + sz - 1, s->data.rcv.nxt) &&
+                      SEQ_LT(seq + sz - 1, s->data.rcv.nxt + s->data.rcv.wnd)))
                 bad_pkt = 1;
         }
     }
@@ -2532,6 +3127,11 @@ static int process_pkt(netif_t *src, const struct in6_addr *srca,
         return 0;
     }
 
+    /* Remember their timestamp to echo back, if this segment is the one we're
+       expecting next (or covers it). */
+    if((opts.flags & TCP_OPTF_TS) && SEQ_LE(seq, s->data.last_ack_sent))
+        s->data.ts_recent = opts.tsval;
+
     /* See if we have a reset, and process it */
     if(flags & TCP_FLAG_RST) {
         if(s->state == TCP_STATE_SYN_SENT) {
@@ -2582,22 +3182,66 @@ static int process_pkt(netif_t *src, const struct in6_addr *srca,
     }
 
     /* Check the ack number for validity */
-    if(SEQ_LT(s->data.snd.una, ack) && SEQ_LE(ack, s->data.snd.nxt)) {
-        s->data.sndbuf_acked += (int32_t)(ack - s->data.snd.una - acksyn);
-        s->data.sndbuf_cur_sz -= (int32_t)(ack - s->data.snd.una - acksyn);
-        s->data.snd.una = ack;
-        __poll_event_trigger(s->sock, POLLWRNORM | POLLWRBAND);
-        cond_signal(&s->data.send_cv);
+    if(SEQ_LE(s->data.snd.una, ack) && SEQ_LE(ack, s->data.snd.nxt)) {
+        wnd = ntohs(tcp->wnd) << s->data.snd.wscale;
+
+        if(SEQ_LT(s->data.snd.una, ack)) {
+            /* Don't count our SYN as data, if this is acking it. */
+            acked = ack - s->data.snd.una - acksyn;
+            newack = 1;
+
+            if(acked > s->data.sndbuf_cur_sz)
+                acked = s->data.sndbuf_cur_sz;
+
+            s->data.sndbuf_acked += acked;
+            s->data.sndbuf_cur_sz -= acked;
+            s->data.snd.una = ack;
+            __poll_event_trigger(s->sock, POLLWRNORM | POLLWRBAND);
+            cond_signal(&s->data.send_cv);
+
+            if(s->data.sndbuf_acked >= s->sndbuf_sz)
+                s->data.sndbuf_acked -= s->sndbuf_sz;
+
+            tcp_range_trim(s->data.sacked, &s->data.sacked_cnt, ack);
 
-        if(s->data.sndbuf_acked >= s->sndbuf_sz)
-            s->data.sndbuf_acked -= s->sndbuf_sz;
+            if(SEQ_LT(s->data.snd.rxt, ack))
+                s->data.snd.rxt = ack;
+        }
+        else if(ack != s->data.snd.nxt && !sz && !(flags & TCP_FLAG_FIN) &&
+                wnd == s->data.snd.wnd) {
+            /* Nothing new acked, no data and no change to the window, with
+               data still out, is a duplicate ACK (RFC 5681, section 2). */
+            dupack = 1;
+        }
+
+        /* Keep track of what they've told us they have beyond the ack. */
+        if(s->data.opts & TCP_OPTF_SACK) {
+            for(i = 0; i < opts.sack_cnt; ++i) {
+                if(SEQ_LT(ack, opts.sack[i].start) &&
+                        SEQ_LT(opts.sack[i].start, opts.sack[i].end) &&
+                        SEQ_LE(opts.sack[i].end, s->data.snd.nxt))
+                    tcp_range_add(s->data.sacked, &s->data.sacked_cnt,
+                                  opts.sack[i].start, opts.sack[i].end);
+            }
+        }
 
         if(SEQ_LT(s->data.snd.wl1, seq) ||
                 (s->data.snd.wl1 == seq && SEQ_LE(s->data.snd.wl2, ack))) {
-            s->data.snd.wnd = ntohs(tcp->wnd);
+            s->data.snd.wnd = wnd;
             s->data.snd.wl1 = seq;
             s->data.snd.wl2 = ack;
         }
+
+        if(newack)
+            tcp_new_ack(s, acked, &opts);
+        else if(dupack)
+            tcp_dup_ack(s);
+
+        /* Whatever the ACK did to the windows, there might be more that can
+           go out now. */
+        if((newack || dupack) && (s->state == TCP_STATE_ESTABLISHED ||
+                                  s->state == TCP_STATE_CLOSE_WAIT))
+            tcp_send_data(s, 0);
     }
     else if(SEQ_GT(ack, s->data.snd.nxt)) {
         /* This ACKs something we haven't sent, so try to correct the other side
@@ -2658,36 +3302,58 @@ static int process_pkt(netif_t *src, const struct in6_addr *srca,
 
     if(s->state == TCP_STATE_ESTABLISHED || s->state == TCP_STATE_FIN_WAIT_1 ||
             s->state == TCP_STATE_FIN_WAIT_2) {
+        /* Drop anything we already have off the front of the segment. */
+        if(SEQ_LT(seq, s->data.rcv.nxt)) {
+            off = s->data.rcv.nxt - seq;
+
+            if(off > sz)
+                off = sz;
+
+            buf += off;
+            sz -= off;
+            seq += off;
+        }
+
         /* Next, check the data size versus our window. If its more than the
            window, truncate the data and copy out what we can. */
-        if(sz > s->data.rcv.wnd) {
-            sz = s->data.rcv.wnd;
+        off = seq - s->data.rcv.nxt;
+
+        if(off + sz > s->data.rcv.wnd) {
+            sz = off < s->data.rcv.wnd ? s->data.rcv.wnd - off : 0;
             bad_pkt = 1;
         }
 
-        /* Copy the data out */
+        /* Copy the data out. Whether it's in order or not, it goes straight to
+           where it belongs in the receive buffer. */
         if(sz) {
-            rb = s->data.rcvbuf + s->data.rcvbuf_tail;
-            s->data.rcv.nxt += sz;
-            s->data.rcv.wnd -= sz;
-            s->data.rcvbuf_cur_sz += sz;
-
-            if(s->data.rcvbuf_tail + sz <= s->rcvbuf_sz) {
-                memcpy(rb, buf, sz);
-                s->data.rcvbuf_tail += sz;
+            tcp_ring_write(s->data.rcvbuf, s->rcvbuf_sz,
+                           s->data.rcvbuf_tail + off, buf, sz);
+
+            if(!off) {
+                /* This might have filled a gap before data we got earlier. */
+                nxt = tcp_range_trim(s->data.ooo, &s->data.ooo_cnt,
+                                     seq + sz);
+                off = nxt - s->data.rcv.nxt;
+                s->data.rcv.nxt = nxt;
+                s->data.st.bytes_received += off;
+                s->data.rcv.wnd -= off;
+                s->data.rcvbuf_cur_sz += off;
+                s->data.rcvbuf_tail = (s->data.rcvbuf_tail + off) %
+                                      s->rcvbuf_sz;
+
+                /* Signal any waiting thread */
+                __poll_event_trigger(s->sock, POLLRDNORM);
+                cond_signal(&s->data.recv_cv);
             }
             else {
-                tmp = s->rcvbuf_sz - s->data.rcvbuf_tail;
-                memcpy(rb, buf, tmp);
-                sz -= tmp;
-                buf += tmp;
-                memcpy(s->data.rcvbuf, buf, sz);
-                s->data.rcvbuf_tail = sz;
+                /* Hold on to it until the gap is filled. We don't look at the
+                   FIN on an out of order segment, it'll be sent again. */
+                tcp_range_add(s->data.ooo, &s->data.ooo_cnt, seq, seq + sz);
+                bad_pkt = 1;
             }
 
-            /* Signal any waiting thread and send an ack for what we read */
-            __poll_event_trigger(s->sock, POLLRDNORM);
-            cond_signal(&s->data.recv_cv);
+            /* Send an ack for what we have. If this was out of order, that's
+               a duplicate ack, with the SACK blocks telling them about it. */
             tcp_send_ack(s);
         }
     }
@@ -2698,8 +3364,8 @@ static int process_pkt(netif_t *src, const struct in6_addr *srca,
     }
 
     /* Finally, check the FIN bit. We don't try to ack it if the packet had too
-       much data. */
-    if(!bad_pkt && (flags & TCP_FLAG_FIN)) {
+       much data, or if it isn't the next thing we're expecting. */
+    if(!bad_pkt && (flags & TCP_FLAG_FIN) && seq + sz == s->data.rcv.nxt) {
         /* ACK the FIN */
         ++s->data.rcv.nxt;
         tcp_send_ack(s);
@@ -2857,9 +3523,11 @@ static void tcp_thd_cb(void *arg) {
 
                 /* If our last <SYN> was sent more than one  retransmission
                    timeout period ago and we are still in the SYN-SENT state,
-                   send another one. */
-                if(i->data.timer + TCP_DEFAULT_RTTO <= timer) {
+                   send another one and back off. */
+                if(i->data.timer + i->data.rto <= timer) {
                     tcp_send_syn(i, 0);
+                    tcp_backoff(i);
+                    i->data.rtt_timing = 0;
                     i->data.timer = timer;
                 }
 
@@ -2869,9 +3537,11 @@ static void tcp_thd_cb(void *arg) {
 
                 /* If our last <SYN,ACK> was sent more than one  retransmission
                    timeout period ago and we are still in the SYN-RECEIVED
-                   state, send another one. */
-                if(i->data.timer + TCP_DEFAULT_RTTO <= timer) {
+                   state, send another one and back off. */
+                if(i->data.timer + i->data.rto <= timer) {
                     tcp_send_syn(i, 1);
+                    tcp_backoff(i);
+                    i->data.rtt_timing = 0;
                     i->data.timer = timer;
                 }
 
@@ -2891,8 +3561,8 @@ static void tcp_thd_cb(void *arg) {
             case TCP_STATE_CLOSE_WAIT:
 
                 if(i->data.sndbuf_cur_sz &&
-                        i->data.timer + TCP_DEFAULT_RTTO <= timer) {
-                    tcp_send_data(i, 1);
+                        i->data.timer + i->data.rto <= timer) {
+                    tcp_timeout(i);
                 }
                 else if(!i->data.sndbuf_cur_sz &&
                         (i->intflags & TCP_IFLAG_QUEUEDCLOSE)) {
@@ -2929,7 +3599,7 @@ static void tcp_thd_cb(void *arg) {
             mutex_destroy(&i->mutex);
             free(i->data.sndbuf);
             free(i->data.rcvbuf);
-            free(i);
+            kmem_cache_free(tcp_sock_cache, i);
         }
 
         i = tmp;
@@ -2959,10 +3629,20 @@ static fs_socket_proto_t proto = {
     net_tcp_getsockname,                /* getsockname */
     net_tcp_getpeername,                /* getpeername */
     net_tcp_fcntl,                      /* fcntl */
-    net_tcp_poll                        /* poll */
+    net_tcp_poll,                       /* poll */
+    NULL,                               /* input_pbuf */
+    NULL,                               /* recvmmsg */
+    NULL                                /* sendmmsg */
 };
 
 int net_tcp_init(void) {
+    lockstat_set_name(&tcp_sem, "net_tcp");
+
+    if(!tcp_sock_cache &&
+       !(tcp_sock_cache = kmem_cache_create("tcp_sock", sizeof(struct tcp_sock),
+                                            0, NULL)))
+        return -1;
+
     if((thd_cb_id = net_thd_add_callback(tcp_thd_cb, NULL, 50)) < 0)
         return -1;
 
@@ -2995,7 +3675,7 @@ void net_tcp_shutdown(void) {
             mutex_destroy(&i->mutex);
             free(i->data.sndbuf);
             free(i->data.rcvbuf);
-            free(i);
+            kmem_cache_free(tcp_sock_cache, i);
         }
 
         i = tmp;
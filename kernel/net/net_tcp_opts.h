@@ -0,0 +1,264 @@
+/* KallistiOS ##version##
+
+   kernel/net/net_tcp_opts.h
+   Copyright (C) 2024 The KallistiOS Team
+*/
+
+/* The parts of TCP that only look at the bytes of a segment: the header,
+   parsing its options, the PAWS test and the lists of sequence number ranges
+   kept for SACK. None of it touches a socket, so it lives in a header of its
+   own that can be built and checked on the host (see utils/tcpopttest). */
+
+#ifndef __LOCAL_NET_TCP_OPTS_H
+#define __LOCAL_NET_TCP_OPTS_H
+
+#include <stdint.h>
+#include <string.h>
+
+typedef struct tcp_hdr {
+    uint16_t src_port;
+    uint16_t dst_port;
+    uint32_t seq;
+    uint32_t ack;
+    uint16_t off_flags;
+    uint16_t wnd;
+    uint16_t checksum;
+    uint16_t urg;
+    uint8_t options[];
+} __attribute__((packed)) tcp_hdr_t;
+
+/* Flags that can be set in the off_flags field of the above struct */
+#define TCP_FLAG_FIN    0x01
+#define TCP_FLAG_SYN    0x02
+#define TCP_FLAG_RST    0x04
+#define TCP_FLAG_PSH    0x08
+#define TCP_FLAG_ACK    0x10
+#define TCP_FLAG_URG    0x20
+
+#define TCP_GET_OFFSET(x)   (((x) & 0xF000) >> 10)
+#define TCP_OFFSET(y)       (((y) & 0x0F) << 12)
+
+#define TCP_OPT_EOL             0
+#define TCP_OPT_NOP             1
+#define TCP_OPT_MSS             2
+#define TCP_OPT_WSCALE          3
+#define TCP_OPT_SACK_PERM       4
+#define TCP_OPT_SACK            5
+#define TCP_OPT_TS              8
+
+/* Options seen on a segment, or agreed on for a connection */
+#define TCP_OPTF_WSCALE         0x01
+#define TCP_OPTF_SACK           0x02
+#define TCP_OPTF_TS             0x04
+
+/* Largest window scale factor allowed by RFC 7323. */
+#define TCP_MAX_WSCALE      14
+
+/* Number of ranges of sequence space we keep track of for SACK, both for data
+   we've received out of order and for what the other side has SACKed. */
+#define TCP_SACK_RANGES     16
+
+/* Most SACK blocks that fit in a segment's options. */
+#define TCP_SACK_BLOCKS     4
+
+/* A few macros for comparing sequence numbers */
+#define SEQ_LT(x, y)    (((int32_t)((x) - (y))) < 0)
+#define SEQ_LE(x, y)    (((int32_t)((x) - (y))) <= 0)
+#define SEQ_GT(x, y)    (((int32_t)((x) - (y))) > 0)
+#define SEQ_GE(x, y)    (((int32_t)((x) - (y))) >= 0)
+
+/* A range of sequence space, from start up to (but not including) end. */
+struct tcp_range {
+    uint32_t start;
+    uint32_t end;
+};
+
+/* The options we care about from an incoming segment. */
+struct tcp_opts {
+    uint8_t flags;
+    uint8_t wscale;
+    uint16_t mss;
+    uint32_t tsval;
+    uint32_t tsecr;
+    int sack_cnt;
+    struct tcp_range sack[TCP_SACK_BLOCKS];
+};
+
+static inline void tcp_put32(uint8_t *p, uint32_t v) {
+    p[0] = (uint8_t)(v >> 24);
+    p[1] = (uint8_t)(v >> 16);
+    p[2] = (uint8_t)(v >> 8);
+    p[3] = (uint8_t)v;
+}
+
+static inline uint32_t tcp_get32(const uint8_t *p) {
+    return ((uint32_t)p[0] << 24) | (p[1] << 16) | (p[2] << 8) | p[3];
+}
+
+/* Pull the options we care about out of an incoming segment. The flags are
+   the off_flags field in host byte order. Returns -1 if the options are
+   malformed. */
+static inline int tcp_parse_opts(const tcp_hdr_t *tcp, uint16_t flags,
+                                 struct tcp_opts *o) {
+    const uint8_t *opt = tcp->options;
+    int j = 0, len, i;
+    int end_of_opts = TCP_GET_OFFSET(flags) - 20;
+
+    memset(o, 0, sizeof(struct tcp_opts));
+
+    while(j < end_of_opts) {
+        if(opt[j] == TCP_OPT_EOL)
+            break;
+
+        if(opt[j] == TCP_OPT_NOP) {
+            ++j;
+            continue;
+        }
+
+        /* Everything else has a length byte, which includes the kind and
+           length bytes themselves. */
+        if(j + 1 >= end_of_opts)
+            return -1;
+
+        len = opt[j + 1];
+
+        if(len < 2 || j + len > end_of_opts)
+            return -1;
+
+        switch(opt[j]) {
+            case TCP_OPT_MSS:
+                if(len != 4)
+                    return -1;
+
+                o->mss = (opt[j + 2] << 8) | opt[j + 3];
+                break;
+
+            case TCP_OPT_WSCALE:
+                if(len != 3)
+                    return -1;
+
+                o->flags |= TCP_OPTF_WSCALE;
+                o->wscale = opt[j + 2] > TCP_MAX_WSCALE ? TCP_MAX_WSCALE :
+                            opt[j + 2];
+                break;
+
+            case TCP_OPT_SACK_PERM:
+                if(len != 2)
+                    return -1;
+
+                o->flags |= TCP_OPTF_SACK;
+                break;
+
+            case TCP_OPT_SACK:
+                if((len - 2) % 8)
+                    return -1;
+
+                for(i = 2; i < len && o->sack_cnt < TCP_SACK_BLOCKS; i += 8) {
+                    o->sack[o->sack_cnt].start = tcp_get32(opt + j + i);
+                    o->sack[o->sack_cnt].end = tcp_get32(opt + j + i + 4);
+                    ++o->sack_cnt;
+                }
+
+                break;
+
+            case TCP_OPT_TS:
+                if(len != 10)
+                    return -1;
+
+                o->flags |= TCP_OPTF_TS;
+                o->tsval = tcp_get32(opt + j + 2);
+                o->tsecr = tcp_get32(opt + j + 6);
+                break;
+
+            /* Anything else gets skipped */
+        }
+
+        j += len;
+    }
+
+    return 0;
+}
+
+/* Should a segment be thrown out as an old duplicate, as told by its
+   timestamp? This is PAWS, as described in RFC 7323. It only applies when
+   timestamps were agreed on for the connection (agreed is its TCP_OPTF_*),
+   and never to a <RST>. */
+static inline int tcp_paws_reject(uint8_t agreed, const struct tcp_opts *o,
+                                  uint16_t flags, uint32_t ts_recent) {
+    return (agreed & TCP_OPTF_TS) && (o->flags & TCP_OPTF_TS) &&
+           !(flags & TCP_FLAG_RST) && SEQ_LT(o->tsval, ts_recent);
+}
+
+/* Add a range to a list of them, merging it with any that it overlaps or
+   touches. The most recently added range is always kept first (which is the
+   order RFC 2018 wants SACK blocks sent in). If the list is full, the oldest
+   range is forgotten, which does no harm other than maybe causing some data
+   to be sent again. */
+static inline void tcp_range_add(struct tcp_range *r, uint8_t *cnt,
+                                 uint32_t start, uint32_t end) {
+    int i = 0, n = *cnt;
+
+    while(i < n) {
+        if(SEQ_LE(start, r[i].end) && SEQ_GE(end, r[i].start)) {
+            if(SEQ_LT(r[i].start, start))
+                start = r[i].start;
+
+            if(SEQ_GT(r[i].end, end))
+                end = r[i].end;
+
+            memmove(r + i, r + i + 1, (n - i - 1) * sizeof(struct tcp_range));
+            --n;
+        }
+        else {
+            ++i;
+        }
+    }
+
+    if(n == TCP_SACK_RANGES)
+        --n;
+
+    memmove(r + 1, r, n * sizeof(struct tcp_range));
+    r[0].start = start;
+    r[0].end = end;
+    *cnt = n + 1;
+}
+
+/* Drop everything before seq from a list of ranges. If that leaves seq inside
+   (or at the start of) a range, seq is moved up to the end of it, and the new
+   value is returned. */
+static inline uint32_t tcp_range_trim(struct tcp_range *r, uint8_t *cnt,
+                                      uint32_t seq) {
+    int i = 0, n = *cnt;
+
+    while(i < n) {
+        if(SEQ_LE(r[i].start, seq)) {
+            if(SEQ_GT(r[i].end, seq))
+                seq = r[i].end;
+
+            memmove(r + i, r + i + 1, (n - i - 1) * sizeof(struct tcp_range));
+            --n;
+
+            /* Moving seq up might have reached a range we've already passed */
+            i = 0;
+        }
+        else {
+            ++i;
+        }
+    }
+
+    *cnt = n;
+    return seq;
+}
+
+/* Pick the smallest window scale that lets us advertise the whole of a receive
+   buffer of the given size. */
+static inline uint8_t tcp_wscale(uint32_t bufsz) {
+    uint8_t rv = 0;
+
+    while(rv < TCP_MAX_WSCALE && (65535U << rv) < bufsz)
+        ++rv;
+
+    return rv;
+}
+
+#endif /* !__LOCAL_NET_TCP_OPTS_H */
@@ -14,16 +14,21 @@
 #include <arpa/inet.h>
 #include <kos/net.h>
 #include <kos/mutex.h>
+#include <kos/lockstat.h>
 #include <kos/genwait.h>
+#include <kos/slab.h>
 #include <sys/queue.h>
 #include <kos/fs_socket.h>
 #include <arch/irq.h>
+#include <arch/timer.h>
 #include <sys/socket.h>
+#include <sys/uio.h>
 #include <netinet/udp.h>
 #include <netinet/udplite.h>
 
 #include "net_ipv4.h"
 #include "net_ipv6.h"
+#include "net_pbuf.h"
 
 #if __GNUC__ >= 9
 #pragma GCC diagnostic push
@@ -33,6 +38,9 @@
 /* Default hop limit (or ttl for IPv4) for new sockets */
 #define UDP_DEFAULT_HOPS    64
 
+/* How many pieces of a message sendmmsg() puts together on the stack. */
+#define UDP_MMSG_IOVS       8
+
 #define packed __attribute__((packed))
 typedef struct {
     uint16 src_port    packed;
@@ -45,7 +53,7 @@ typedef struct {
 struct udp_pkt {
     TAILQ_ENTRY(udp_pkt) pkt_queue;
     struct sockaddr_in6 from;
-    uint8 *data;
+    net_pbuf_t *data;
     uint16 datasize;
 };
 
@@ -79,11 +87,12 @@ LIST_HEAD(udp_sock_list, udp_sock);
 static struct udp_sock_list net_udp_sockets = LIST_HEAD_INITIALIZER(0);
 static mutex_t udp_mutex = MUTEX_INITIALIZER;
 static net_udp_stats_t udp_stats = { 0 };
+static kmem_cache_t *udp_pkt_cache;
 
 static int net_udp_send_raw(netif_t *net, const struct sockaddr_in6 *src,
-                            const struct sockaddr_in6 *dst, const uint8 *data,
-                            size_t size, uint32_t flags, int hops,
-                            uint32_t iflags, int proto, uint16_t cscov);
+                            const struct sockaddr_in6 *dst, net_pbuf_t *data,
+                            uint32_t flags, int hops, uint32_t iflags,
+                            int proto, uint16_t cscov);
 
 static int net_udp_accept(net_socket_t *hnd, struct sockaddr *addr,
                           socklen_t *addr_len) {
@@ -307,6 +316,122 @@ static int net_udp_listen(net_socket_t *hnd, int backlog) {
     return -1;
 }
 
+/* Give a sender's address back to the user in the socket's family. */
+static void net_udp_fill_addr(int domain, const struct sockaddr_in6 *from,
+                              struct sockaddr *addr, socklen_t *addr_len) {
+    if(domain == AF_INET) {
+        struct sockaddr_in realaddr;
+
+        memset(&realaddr, 0, sizeof(struct sockaddr_in));
+        realaddr.sin_family = AF_INET;
+        realaddr.sin_addr.s_addr = from->sin6_addr.__s6_addr.__s6_addr32[3];
+        realaddr.sin_port = from->sin6_port;
+
+        if(*addr_len < sizeof(struct sockaddr_in)) {
+            memcpy(addr, &realaddr, *addr_len);
+        }
+        else {
+            memcpy(addr, &realaddr, sizeof(struct sockaddr_in));
+            *addr_len = sizeof(struct sockaddr_in);
+        }
+    }
+    else if(domain == AF_INET6) {
+        struct sockaddr_in6 realaddr6;
+
+        memset(&realaddr6, 0, sizeof(struct sockaddr_in6));
+        realaddr6.sin6_family = AF_INET6;
+        realaddr6.sin6_addr = from->sin6_addr;
+        realaddr6.sin6_port = from->sin6_port;
+
+        if(*addr_len < sizeof(struct sockaddr_in6)) {
+            memcpy(addr, &realaddr6, *addr_len);
+        }
+        else {
+            memcpy(addr, &realaddr6, sizeof(struct sockaddr_in6));
+            *addr_len = sizeof(struct sockaddr_in6);
+        }
+    }
+}
+
+/* Work out where a datagram is going, from the address given to send it to
+   and the one the socket is connected to (if any). IPv4 addresses come out
+   mapped into IPv6 ones. */
+static int net_udp_dest(int domain, const struct sockaddr_in6 *remote,
+                        const struct sockaddr *addr, socklen_t addr_len,
+                        struct sockaddr_in6 *dst) {
+    const struct sockaddr_in *realaddr;
+
+    if(!IN6_IS_ADDR_UNSPECIFIED(&remote->sin6_addr) &&
+       remote->sin6_port != 0) {
+        if(addr) {
+            errno = EISCONN;
+            return -1;
+        }
+
+        *dst = *remote;
+    }
+    else if(addr == NULL) {
+        errno = EDESTADDRREQ;
+        return -1;
+    }
+    else if(addr->sa_family != domain) {
+        errno = EAFNOSUPPORT;
+        return -1;
+    }
+    else if(domain == AF_INET6) {
+        if(addr_len != sizeof(struct sockaddr_in6)) {
+            errno = EINVAL;
+            return -1;
+        }
+
+        *dst = *((const struct sockaddr_in6 *)addr);
+    }
+    else if(domain == AF_INET) {
+        if(addr_len != sizeof(struct sockaddr_in)) {
+            errno = EINVAL;
+            return -1;
+        }
+
+        realaddr = (const struct sockaddr_in *)addr;
+        memset(dst, 0, sizeof(struct sockaddr_in6));
+        dst->sin6_family = AF_INET6;
+        dst->sin6_addr.__s6_addr.__s6_addr16[5] = 0xFFFF;
+        dst->sin6_addr.__s6_addr.__s6_addr32[3] = realaddr->sin_addr.s_addr;
+        dst->sin6_port = realaddr->sin_port;
+    }
+    else {
+        /* Shouldn't be able to get here... */
+        errno = EBADF;
+        return -1;
+    }
+
+    return 0;
+}
+
+/* Give a socket that's sending without being bound a port to send from. This
+   must be called with udp_mutex held. */
+static void net_udp_pick_port(struct udp_sock *udpsock) {
+    uint16 port = 1024, tmp = 0;
+    struct udp_sock *iter;
+
+    if(udpsock->local_addr.sin6_port != 0)
+        return;
+
+    /* Grab the first unused port >= 1024. This is, unfortunately, O(n^2) */
+    while(tmp != port) {
+        tmp = port;
+
+        LIST_FOREACH(iter, &net_udp_sockets, sock_list) {
+            if(iter->local_addr.sin6_port == port) {
+                ++port;
+                break;
+            }
+        }
+    }
+
+    udpsock->local_addr.sin6_port = htons(port);
+}
+
 static ssize_t net_udp_recvfrom(net_socket_t *hnd, void *buffer, size_t length,
                                 int flags, struct sockaddr *addr,
                                 socklen_t *addr_len) {
@@ -351,55 +476,19 @@ static ssize_t net_udp_recvfrom(net_socket_t *hnd, void *buffer, size_t length,
 
     pkt = TAILQ_FIRST(&udpsock->packets);
 
-    if(pkt->datasize > length) {
-        memcpy(buffer, pkt->data, length);
-    }
-    else {
-        memcpy(buffer, pkt->data, pkt->datasize);
+    if(pkt->datasize < length)
         length = pkt->datasize;
-    }
-
-    if(addr != NULL) {
-        if(udpsock->domain == AF_INET) {
-            struct sockaddr_in realaddr;
-
-            memset(&realaddr, 0, sizeof(struct sockaddr_in));
-            realaddr.sin_family = AF_INET;
-            realaddr.sin_addr.s_addr =
-                pkt->from.sin6_addr.__s6_addr.__s6_addr32[3];
-            realaddr.sin_port = pkt->from.sin6_port;
 
-            if(*addr_len < sizeof(struct sockaddr_in)) {
-                memcpy(addr, &realaddr, *addr_len);
-            }
-            else {
-                memcpy(addr, &realaddr, sizeof(struct sockaddr_in));
-                *addr_len = sizeof(struct sockaddr_in);
-            }
-        }
-        else if(udpsock->domain == AF_INET6) {
-            struct sockaddr_in6 realaddr6;
+    net_pbuf_copy_out(pkt->data, 0, buffer, length);
 
-            memset(&realaddr6, 0, sizeof(struct sockaddr_in6));
-            realaddr6.sin6_family = AF_INET6;
-            realaddr6.sin6_addr = pkt->from.sin6_addr;
-            realaddr6.sin6_port = pkt->from.sin6_port;
-
-            if(*addr_len < sizeof(struct sockaddr_in6)) {
-                memcpy(addr, &realaddr6, *addr_len);
-            }
-            else {
-                memcpy(addr, &realaddr6, sizeof(struct sockaddr_in6));
-                *addr_len = sizeof(struct sockaddr_in6);
-            }
-        }
-    }
+    if(addr != NULL)
+        net_udp_fill_addr(udpsock->domain, &pkt->from, addr, addr_len);
 
     /* Remove the packet if we're pulling data out of the queue. */
     if(!(flags & MSG_PEEK)) {
         TAILQ_REMOVE(&udpsock->packets, pkt, pkt_queue);
-        free(pkt->data);
-        free(pkt);
+        net_pbuf_free(pkt->data);
+        kmem_cache_free(udp_pkt_cache, pkt);
     }
 
     mutex_unlock(&udp_mutex);
@@ -411,12 +500,12 @@ static ssize_t net_udp_sendto(net_socket_t *hnd, const void *message,
                               size_t length, int flags,
                               const struct sockaddr *addr, socklen_t addr_len) {
     struct udp_sock *udpsock;
-    struct sockaddr_in *realaddr;
     struct sockaddr_in6 realaddr6;
     uint32_t sflags, iflags;
     int hops, proto;
     uint16_t cscov;
     struct sockaddr_in6 local_addr;
+    net_pbuf_t dp;
 
     (void)flags;
 
@@ -435,76 +524,208 @@ static ssize_t net_udp_sendto(net_socket_t *hnd, const void *message,
         goto err;
     }
 
-    if(!IN6_IS_ADDR_UNSPECIFIED(&udpsock->remote_addr.sin6_addr) &&
-       udpsock->remote_addr.sin6_port != 0) {
-        if(addr) {
-            errno = EISCONN;
-            goto err;
-        }
-
-        realaddr6 = udpsock->remote_addr;
-    }
-    else if(addr == NULL) {
-        errno = EDESTADDRREQ;
+    if(net_udp_dest(udpsock->domain, &udpsock->remote_addr, addr, addr_len,
+                    &realaddr6))
         goto err;
-    }
-    else if(addr->sa_family != udpsock->domain) {
-        errno = EAFNOSUPPORT;
+
+    if(message == NULL) {
+        errno = EFAULT;
         goto err;
     }
-    else if(udpsock->domain == AF_INET6) {
-        if(addr_len != sizeof(struct sockaddr_in6)) {
-            errno = EINVAL;
-            goto err;
-        }
 
-        realaddr6 = *((struct sockaddr_in6 *)addr);
-    }
-    else if(udpsock->domain == AF_INET) {
-        if(addr_len != sizeof(struct sockaddr_in)) {
-            errno = EINVAL;
-            goto err;
-        }
+    net_udp_pick_port(udpsock);
 
-        realaddr = (struct sockaddr_in *)addr;
-        memset(&realaddr6, 0, sizeof(struct sockaddr_in6));
-        realaddr6.sin6_family = AF_INET6;
-        realaddr6.sin6_addr.__s6_addr.__s6_addr16[5] = 0xFFFF;
-        realaddr6.sin6_addr.__s6_addr.__s6_addr32[3] =
-            realaddr->sin_addr.s_addr;
-        realaddr6.sin6_port = realaddr->sin_port;
-    }
-    else {
-        /* Shouldn't be able to get here... */
+    local_addr = udpsock->local_addr;
+    sflags = udpsock->flags;
+    iflags = udpsock->int_flags;
+    hops = udpsock->hop_limit;
+    proto = udpsock->proto;
+    cscov = udpsock->udp_lite.send_cscov;
+    mutex_unlock(&udp_mutex);
+
+    net_pbuf_init_ref(&dp, message, length);
+
+    return net_udp_send_raw(NULL, &local_addr, &realaddr6, &dp, sflags, hops,
+                            iflags, proto, cscov);
+err:
+    mutex_unlock(&udp_mutex);
+    return -1;
+}
+
+static int net_udp_recvmmsg(net_socket_t *hnd, struct mmsghdr *msgvec,
+                            unsigned int vlen, int flags, int timeout) {
+    struct udp_sock *udpsock;
+    struct udp_pkt *pkt, *next;
+    struct msghdr *msg;
+    unsigned int i;
+    size_t off, n;
+    uint64 deadline = 0, now;
+    int j, rv, wait = 0;
+
+    if(mutex_lock_irqsafe(&udp_mutex))
+        return -1;
+
+    udpsock = (struct udp_sock *)hnd->data;
+
+    if(udpsock == NULL) {
+        mutex_unlock(&udp_mutex);
         errno = EBADF;
-        goto err;
+        return -1;
     }
 
-    if(message == NULL) {
+    if(udpsock->flags & (SHUT_RD << 24)) {
+        mutex_unlock(&udp_mutex);
+        return 0;
+    }
+
+    if(msgvec == NULL) {
+        mutex_unlock(&udp_mutex);
         errno = EFAULT;
-        goto err;
+        return -1;
     }
 
-    if(udpsock->local_addr.sin6_port == 0) {
-        uint16 port = 1024, tmp = 0;
-        struct udp_sock *iter;
+    if(vlen > UIO_MAXIOV)
+        vlen = UIO_MAXIOV;
 
-        /* Grab the first unused port >= 1024. This is, unfortunately, O(n^2) */
-        while(tmp != port) {
-            tmp = port;
+    if(!vlen) {
+        mutex_unlock(&udp_mutex);
+        return 0;
+    }
 
-            LIST_FOREACH(iter, &net_udp_sockets, sock_list) {
-                if(iter->local_addr.sin6_port == port) {
-                    ++port;
-                    break;
-                }
+    if(TAILQ_EMPTY(&udpsock->packets) &&
+       ((udpsock->flags & FS_SOCKET_NONBLOCK) || (flags & MSG_DONTWAIT) ||
+        irq_inside_int())) {
+        mutex_unlock(&udp_mutex);
+        errno = EWOULDBLOCK;
+        return -1;
+    }
+
+    /* Only wait for the first one, then take whatever else has arrived.
+       Being woken without anything to show for it doesn't start the timeout
+       over again. */
+    if(timeout > 0)
+        deadline = timer_ms_gettime64() + timeout;
+
+    while(TAILQ_EMPTY(&udpsock->packets)) {
+        if(timeout > 0) {
+            if((now = timer_ms_gettime64()) >= deadline) {
+                mutex_unlock(&udp_mutex);
+                errno = EAGAIN;
+                return -1;
             }
+
+            wait = (int)(deadline - now);
         }
 
-        udpsock->local_addr.sin6_port = htons(port);
+        {
+            irq_disable_scoped();
+            mutex_unlock(&udp_mutex);
+            rv = genwait_wait(udpsock, "net_udp_recvmmsg", wait, NULL);
+        }
+
+        mutex_lock(&udp_mutex);
+
+        if(rv < 0 && TAILQ_EMPTY(&udpsock->packets)) {
+            mutex_unlock(&udp_mutex);
+            errno = EAGAIN;
+            return -1;
+        }
     }
 
+    pkt = TAILQ_FIRST(&udpsock->packets);
+
+    for(i = 0; i < vlen && pkt; ++i, pkt = next) {
+        msg = &msgvec[i].msg_hdr;
+        next = TAILQ_NEXT(pkt, pkt_queue);
+
+        if(msg->msg_iovlen < 0 || msg->msg_iovlen > UIO_MAXIOV) {
+            errno = EINVAL;
+            break;
+        }
+
+        if(msg->msg_iovlen && !msg->msg_iov) {
+            errno = EFAULT;
+            break;
+        }
+
+        /* Scatter the datagram over the buffers, dropping whatever doesn't
+           fit. */
+        for(j = 0, off = 0; j < msg->msg_iovlen && off < pkt->datasize; ++j) {
+            n = pkt->datasize - off;
+
+            if(msg->msg_iov[j].iov_len < n)
+                n = msg->msg_iov[j].iov_len;
+
+            net_pbuf_copy_out(pkt->data, off, msg->msg_iov[j].iov_base, n);
+            off += n;
+        }
+
+        msgvec[i].msg_len = off;
+        msg->msg_flags = off < pkt->datasize ? MSG_TRUNC : 0;
+        msg->msg_controllen = 0;
+
+        if(msg->msg_name)
+            net_udp_fill_addr(udpsock->domain, &pkt->from, msg->msg_name,
+                              &msg->msg_namelen);
+
+        if(!(flags & MSG_PEEK)) {
+            TAILQ_REMOVE(&udpsock->packets, pkt, pkt_queue);
+            net_pbuf_free(pkt->data);
+            kmem_cache_free(udp_pkt_cache, pkt);
+        }
+    }
+
+    mutex_unlock(&udp_mutex);
+
+    /* A bad message after the first just ends the batch early. */
+    return i ? (int)i : -1;
+}
+
+static int net_udp_sendmmsg(net_socket_t *hnd, struct mmsghdr *msgvec,
+                            unsigned int vlen, int flags) {
+    struct udp_sock *udpsock;
+    struct sockaddr_in6 local_addr, remote_addr, dst;
+    uint32_t sflags, iflags;
+    int hops, proto, domain;
+    uint16_t cscov;
+    net_pbuf_t stack_iovs[UDP_MMSG_IOVS], *iovs;
+    struct msghdr *msg;
+    unsigned int i;
+    size_t len;
+    int j, rv = 0;
+
+    (void)flags;
+
+    if(mutex_lock_irqsafe(&udp_mutex))
+        return -1;
+
+    udpsock = (struct udp_sock *)hnd->data;
+
+    if(udpsock == NULL) {
+        mutex_unlock(&udp_mutex);
+        errno = EBADF;
+        return -1;
+    }
+
+    if(udpsock->flags & (SHUT_WR << 24)) {
+        mutex_unlock(&udp_mutex);
+        errno = EPIPE;
+        return -1;
+    }
+
+    if(msgvec == NULL) {
+        mutex_unlock(&udp_mutex);
+        errno = EFAULT;
+        return -1;
+    }
+
+    /* Everything about the socket that the batch needs is grabbed here, so
+       the lock is only taken once for all of it. */
+    net_udp_pick_port(udpsock);
+
     local_addr = udpsock->local_addr;
+    remote_addr = udpsock->remote_addr;
+    domain = udpsock->domain;
     sflags = udpsock->flags;
     iflags = udpsock->int_flags;
     hops = udpsock->hop_limit;
@@ -512,12 +733,86 @@ static ssize_t net_udp_sendto(net_socket_t *hnd, const void *message,
     cscov = udpsock->udp_lite.send_cscov;
     mutex_unlock(&udp_mutex);
 
-    return net_udp_send_raw(NULL, &local_addr, &realaddr6,
-                            (const uint8 *)message, length, sflags, hops,
-                            iflags, proto, cscov);
-err:
-    mutex_unlock(&udp_mutex);
-    return -1;
+    if(vlen > UIO_MAXIOV)
+        vlen = UIO_MAXIOV;
+
+    for(i = 0; i < vlen; ++i) {
+        msg = &msgvec[i].msg_hdr;
+
+        if(net_udp_dest(domain, &remote_addr, msg->msg_name,
+                        msg->msg_namelen, &dst))
+            break;
+
+        if(msg->msg_iovlen < 0 || msg->msg_iovlen > UIO_MAXIOV) {
+            errno = EINVAL;
+            break;
+        }
+
+        if(msg->msg_iovlen && !msg->msg_iov) {
+            errno = EFAULT;
+            break;
+        }
+
+        /* Each piece is checked against what's left of the limit, so adding
+           them up can't wrap around. */
+        for(j = 0, len = 0; j < msg->msg_iovlen; ++j) {
+            if(!msg->msg_iov[j].iov_base && msg->msg_iov[j].iov_len) {
+                errno = EFAULT;
+                break;
+            }
+
+            if(msg->msg_iov[j].iov_len > 0xFFFF - sizeof(udp_hdr_t) - len) {
+                errno = EMSGSIZE;
+                break;
+            }
+
+            len += msg->msg_iov[j].iov_len;
+        }
+
+        if(j < msg->msg_iovlen)
+            break;
+
+        /* Chain the pieces of the message together where they are. There's
+           always at least one link, even for an empty datagram. */
+        if(msg->msg_iovlen <= UDP_MMSG_IOVS) {
+            iovs = stack_iovs;
+        }
+        else if(!(iovs = (net_pbuf_t *)malloc(msg->msg_iovlen *
+                                              sizeof(net_pbuf_t)))) {
+            errno = ENOMEM;
+            break;
+        }
+
+        net_pbuf_init_ref(&iovs[0], NULL, 0);
+
+        for(j = 0; j < msg->msg_iovlen; ++j) {
+            net_pbuf_init_ref(&iovs[j], msg->msg_iov[j].iov_base,
+                              msg->msg_iov[j].iov_len);
+
+            if(j)
+                iovs[j - 1].next = &iovs[j];
+        }
+
+        for(j = msg->msg_iovlen - 2; j >= 0; --j)
+            iovs[j].tot_len += iovs[j + 1].tot_len;
+
+        rv = net_udp_send_raw(NULL, &local_addr, &dst, iovs, sflags, hops,
+                              iflags, proto, cscov);
+
+        if(iovs != stack_iovs)
+            free(iovs);
+
+        if(rv < 0)
+            break;
+
+        msgvec[i].msg_len = rv;
+    }
+
+    /* Let the driver put out anything it was holding on to for the batch. */
+    if(i && net_default_dev && net_default_dev->if_tx_commit)
+        net_default_dev->if_tx_commit(net_default_dev);
+
+    return i ? (int)i : -1;
 }
 
 static int net_udp_shutdownsock(net_socket_t *hnd, int how) {
@@ -608,9 +903,9 @@ static void net_udp_close(net_socket_t *hnd) {
         pkt = it;
         it = it->pkt_queue.tqe_next;
 
-        free(pkt->data);
+        net_pbuf_free(pkt->data);
         TAILQ_REMOVE(&udpsock->packets, pkt, pkt_queue);
-        free(pkt);
+        kmem_cache_free(udp_pkt_cache, pkt);
     }
 
     LIST_REMOVE(udpsock, sock_list);
@@ -1103,9 +1398,9 @@ static short net_udp_poll(net_socket_t *hnd, short events) {
 
 extern void __poll_event_trigger(int fd, short event);
 
-static int net_udp_input4(netif_t *src, const ip_hdr_t *ip, const uint8 *data,
+static int net_udp_input4(netif_t *src, const ip_hdr_t *ip, net_pbuf_t *data,
                           size_t size) {
-    udp_hdr_t *hdr = (udp_hdr_t *)data;
+    udp_hdr_t *hdr = (udp_hdr_t *)data->data;
     uint16 cs, cscov = 0;
     int partial = 1;
     struct udp_sock *sock;
@@ -1113,8 +1408,9 @@ static int net_udp_input4(netif_t *src, const ip_hdr_t *ip, const uint8 *data,
 
     (void)src;
 
-    if(size <= sizeof(udp_hdr_t)) {
-        /* Discard the packet, since it is too short to be of any interest. */
+    if(size <= sizeof(udp_hdr_t) || data->len < sizeof(udp_hdr_t)) {
+        /* Discard the packet, since it is too short to be of any interest (or
+           its header is split up, which nobody would do to us). */
         ++udp_stats.pkt_recv_bad_size;
         return -1;
     }
@@ -1129,7 +1425,7 @@ static int net_udp_input4(netif_t *src, const ip_hdr_t *ip, const uint8 *data,
 
             /* If the checksum is right, we'll get zero back from the checksum
                function */
-            if(net_ipv4_checksum(data, size, cs)) {
+            if(net_pbuf_checksum(data, size, cs)) {
                 /* The checksum was wrong, bail out */
                 ++udp_stats.pkt_recv_bad_chksum;
                 return -1;
@@ -1156,7 +1452,7 @@ static int net_udp_input4(netif_t *src, const ip_hdr_t *ip, const uint8 *data,
 
         /* If the checksum is right, we'll get zero back from the checksum
            function. */
-        if(net_ipv4_checksum(data, cscov, cs)) {
+        if(net_pbuf_checksum(data, cscov, cs)) {
             ++udp_stats.pkt_recv_bad_chksum;
             return -1;
         }
@@ -1204,7 +1500,7 @@ static int net_udp_input4(netif_t *src, const ip_hdr_t *ip, const uint8 *data,
             return 0;
         }
 
-        if(!(pkt = (struct udp_pkt *)malloc(sizeof(struct udp_pkt)))) {
+        if(!(pkt = (struct udp_pkt *)kmem_cache_alloc(udp_pkt_cache))) {
             mutex_unlock(&udp_mutex);
             return -1;
         }
@@ -1213,8 +1509,11 @@ static int net_udp_input4(netif_t *src, const ip_hdr_t *ip, const uint8 *data,
 
         pkt->datasize = size - sizeof(udp_hdr_t);
 
-        if(!(pkt->data = (uint8 *)malloc(pkt->datasize))) {
-            free(pkt);
+        /* Hang on to the data, which only copies it if it isn't in a buffer
+           that can be kept. */
+        if(!(pkt->data = net_pbuf_clone(data, sizeof(udp_hdr_t),
+                                        pkt->datasize))) {
+            kmem_cache_free(udp_pkt_cache, pkt);
             mutex_unlock(&udp_mutex);
             return -1;
         }
@@ -1224,8 +1523,6 @@ static int net_udp_input4(netif_t *src, const ip_hdr_t *ip, const uint8 *data,
         pkt->from.sin6_addr.__s6_addr.__s6_addr32[3] = ip->src;
         pkt->from.sin6_port = hdr->src_port;
 
-        memcpy(pkt->data, data + sizeof(udp_hdr_t), pkt->datasize);
-
         TAILQ_INSERT_TAIL(&sock->packets, pkt, pkt_queue);
 
         ++udp_stats.pkt_recv;
@@ -1242,9 +1539,9 @@ static int net_udp_input4(netif_t *src, const ip_hdr_t *ip, const uint8 *data,
     return -1;
 }
 
-static int net_udp_input6(netif_t *src, const ipv6_hdr_t *ip, const uint8 *data,
-                          size_t size) {
-    udp_hdr_t *hdr = (udp_hdr_t *)data;
+static int net_udp_input6(netif_t *src, const ipv6_hdr_t *ip,
+                          net_pbuf_t *data, size_t size) {
+    udp_hdr_t *hdr = (udp_hdr_t *)data->data;
     uint16 cs, cscov = 0;
     int partial = 1;
     struct udp_sock *sock;
@@ -1252,8 +1549,9 @@ static int net_udp_input6(netif_t *src, const ipv6_hdr_t *ip, const uint8 *data,
 
     (void)src;
 
-    if(size <= sizeof(udp_hdr_t)) {
-        /* Discard the packet, since it is too short to be of any interest. */
+    if(size <= sizeof(udp_hdr_t) || data->len < sizeof(udp_hdr_t)) {
+        /* Discard the packet, since it is too short to be of any interest (or
+           its header is split up, which nobody would do to us). */
         ++udp_stats.pkt_recv_bad_size;
         return -1;
     }
@@ -1266,7 +1564,7 @@ static int net_udp_input6(netif_t *src, const ipv6_hdr_t *ip, const uint8 *data,
 
         /* If the checksum is right, we'll get zero back from the checksum
            function. */
-        if(net_ipv4_checksum(data, size, cs)) {
+        if(net_pbuf_checksum(data, size, cs)) {
             /* The checksum was wrong, bail out */
             ++udp_stats.pkt_recv_bad_chksum;
             return -1;
@@ -1293,7 +1591,7 @@ static int net_udp_input6(netif_t *src, const ipv6_hdr_t *ip, const uint8 *data,
 
         /* If the checksum is right, we'll get zero back from the checksum
            function. */
-        if(net_ipv4_checksum(data, cscov, cs)) {
+        if(net_pbuf_checksum(data, cscov, cs)) {
             ++udp_stats.pkt_recv_bad_chksum;
             return -1;
         }
@@ -1341,7 +1639,7 @@ static int net_udp_input6(netif_t *src, const ipv6_hdr_t *ip, const uint8 *data,
             return 0;
         }
 
-        if(!(pkt = (struct udp_pkt *)malloc(sizeof(struct udp_pkt)))) {
+        if(!(pkt = (struct udp_pkt *)kmem_cache_alloc(udp_pkt_cache))) {
             mutex_unlock(&udp_mutex);
             return -1;
         }
@@ -1350,8 +1648,11 @@ static int net_udp_input6(netif_t *src, const ipv6_hdr_t *ip, const uint8 *data,
 
         pkt->datasize = size - sizeof(udp_hdr_t);
 
-        if(!(pkt->data = (uint8 *)malloc(pkt->datasize))) {
-            free(pkt);
+        /* Hang on to the data, which only copies it if it isn't in a buffer
+           that can be kept. */
+        if(!(pkt->data = net_pbuf_clone(data, sizeof(udp_hdr_t),
+                                        pkt->datasize))) {
+            kmem_cache_free(udp_pkt_cache, pkt);
             mutex_unlock(&udp_mutex);
             return -1;
         }
@@ -1360,8 +1661,6 @@ static int net_udp_input6(netif_t *src, const ipv6_hdr_t *ip, const uint8 *data,
         pkt->from.sin6_addr = ip->src_addr;
         pkt->from.sin6_port = hdr->src_port;
 
-        memcpy(pkt->data, data + sizeof(udp_hdr_t), pkt->datasize);
-
         TAILQ_INSERT_TAIL(&sock->packets, pkt, pkt_queue);
 
         ++udp_stats.pkt_recv;
@@ -1378,26 +1677,35 @@ static int net_udp_input6(netif_t *src, const ipv6_hdr_t *ip, const uint8 *data,
     return -1;
 }
 
-static int net_udp_input(netif_t *src, int domain, const void *hdr,
-                         const uint8 *data, size_t size) {
+static int net_udp_input_pbuf(netif_t *src, int domain, const void *hdr,
+                              net_pbuf_t *p, size_t size) {
     switch(domain) {
         case AF_INET:
-            return net_udp_input4(src, (const ip_hdr_t *)hdr, data, size);
+            return net_udp_input4(src, (const ip_hdr_t *)hdr, p, size);
 
         case AF_INET6:
-            return net_udp_input6(src, (const ipv6_hdr_t *)hdr, data, size);
+            return net_udp_input6(src, (const ipv6_hdr_t *)hdr, p, size);
     }
 
     return -1;
 }
 
+static int net_udp_input(netif_t *src, int domain, const void *hdr,
+                         const uint8 *data, size_t size) {
+    net_pbuf_t p;
+
+    net_pbuf_init_ref(&p, data, size);
+    return net_udp_input_pbuf(src, domain, hdr, &p, size);
+}
+
 /* XXX */
 static int net_udp_send_raw(netif_t *net, const struct sockaddr_in6 *src,
-                            const struct sockaddr_in6 *dst, const uint8 *data,
-                            size_t size, uint32_t flags, int hops,
-                            uint32_t iflags, int proto, uint16_t cscov) {
-    uint8 buf[size + sizeof(udp_hdr_t)];
-    udp_hdr_t *hdr = (udp_hdr_t *)buf;
+                            const struct sockaddr_in6 *dst, net_pbuf_t *data,
+                            uint32_t flags, int hops, uint32_t iflags,
+                            int proto, uint16_t cscov) {
+    udp_hdr_t hdr;
+    net_pbuf_t hp;
+    size_t size = data->tot_len;
     uint16 cs;
     int err;
     struct in6_addr srcaddr = src->sin6_addr;
@@ -1440,39 +1748,42 @@ static int net_udp_send_raw(netif_t *net, const struct sockaddr_in6 *src,
         }
     }
 
-    memcpy(buf + sizeof(udp_hdr_t), data, size);
+    /* The header goes out from here and the data from where it already is,
+       rather than copying them together. */
+    net_pbuf_init_ref(&hp, &hdr, sizeof(udp_hdr_t));
     size += sizeof(udp_hdr_t);
+    hp.next = data;
+    hp.tot_len = size;
 
-    hdr->src_port = src->sin6_port;
-    hdr->dst_port = dst->sin6_port;
-    hdr->checksum = 0;
+    hdr.src_port = src->sin6_port;
+    hdr.dst_port = dst->sin6_port;
+    hdr.checksum = 0;
 
     /* Is this UDP or UDP-Lite? */
     if(proto == IPPROTO_UDP) {
-        hdr->length = htons(size);
+        hdr.length = htons(size);
 
         if(!(iflags & UDPSOCK_NO_CHECKSUM)) {
             cs = net_ipv6_checksum_pseudo(&srcaddr, &dst->sin6_addr, size,
                                           proto);
-            hdr->checksum = net_ipv4_checksum(buf, size, cs);
+            hdr.checksum = net_pbuf_checksum(&hp, size, cs);
         }
     }
     else {
-        if(cscov <= size) {
-            hdr->length = htons(cscov);
+        if(cscov && cscov <= size) {
+            hdr.length = htons(cscov);
         }
         else {
-            hdr->length = 0;
+            hdr.length = 0;
             cscov = size;
         }
 
         cs = net_ipv6_checksum_pseudo(&srcaddr, &dst->sin6_addr, size, proto);
-        hdr->checksum = net_ipv4_checksum(buf, size, cs);
+        hdr.checksum = net_pbuf_checksum(&hp, cscov, cs);
     }
 
     /* Pass everything off to the network layer to do the rest. */
-    err = net_ipv6_send(net, buf, size, hops, proto, &srcaddr,
-                        &dst->sin6_addr);
+    err = net_ipv6_send_pbuf(net, &hp, hops, proto, &srcaddr, &dst->sin6_addr);
 
     if(err < 0) {
         ++udp_stats.pkt_send_failed;
@@ -1509,7 +1820,10 @@ static fs_socket_proto_t proto = {
     net_udp_getsockname,
     net_udp_getpeername,
     net_udp_fcntl,
-    net_udp_poll
+    net_udp_poll,
+    net_udp_input_pbuf,
+    net_udp_recvmmsg,
+    net_udp_sendmmsg
 };
 
 static fs_socket_proto_t proto_lite = {
@@ -1532,10 +1846,20 @@ static fs_socket_proto_t proto_lite = {
     net_udp_getsockname,
     net_udp_getpeername,
     net_udp_fcntl,
-    net_udp_poll
+    net_udp_poll,
+    net_udp_input_pbuf,
+    net_udp_recvmmsg,
+    net_udp_sendmmsg
 };
 
 int net_udp_init(void) {
+    lockstat_set_name(&udp_mutex, "net_udp");
+
+    if(!udp_pkt_cache &&
+       !(udp_pkt_cache = kmem_cache_create("udp_pkt", sizeof(struct udp_pkt),
+                                           0, NULL)))
+        return -1;
+
     return fs_socket_proto_add(&proto) | fs_socket_proto_add(&proto_lite);
 }
 
@@ -18,6 +18,7 @@
 #include <kos/genwait.h>
 
 #include <kos/dbglog.h>
+#include <kos/lockstat.h>
 
 /**************************************/
 
@@ -58,6 +59,7 @@ int cond_destroy(condvar_t *cv) {
 }
 
 int cond_wait_timed(condvar_t *cv, mutex_t *m, int timeout) {
+    uint64_t wait_start;
     int rv;
 
     if(irq_inside_int()) {
@@ -78,8 +80,10 @@ int cond_wait_timed(condvar_t *cv, mutex_t *m, int timeout) {
     mutex_unlock(m);
 
     /* Now block us until we're signaled */
+    wait_start = lockstat_wait_start();
     rv = genwait_wait(cv, timeout ? "cond_wait_timed" : "cond_wait", timeout,
                       NULL);
+    lockstat_acquire(cv, LOCKSTAT_COND, wait_start);
 
     if(rv < 0 && errno == EAGAIN)
         errno = ETIMEDOUT;
@@ -35,36 +35,111 @@ static TAILQ_HEAD(slpquehead, kthread) slpque[TABLESIZE];
    ready to run at a later time will be placed here. Note that this doesn't
    deal with pre-emptive timeslice context switching, only things that are
    specifically blocked for a timed event (thd_sleep, genwait_wait, etc).
-   This queue is sorted by remaining time (smallest at the front). */
-static struct ktqueue timer_queue;
 
-/* Internal function to insert a thread on the timer queue. Maintains
-   sorting order by wait time. */
-static void tq_insert(kthread_t * thd) {
-    kthread_t * t;
+   This used to be a list sorted by wait time, which made every insert walk
+   the list with interrupts disabled. Now it's a pairing heap keyed on the
+   wait time (smallest at the root). The links live in the threads
+   themselves, so there's nothing to allocate. Inserting is constant time,
+   and removing a thread (whether it timed out or was woken early) is
+   logarithmic time, amortized. */
+static kthread_t *timer_queue;
+
+/* Join two heaps, returning the new root. Both must be detached from any
+   sibling list. A thread with the same timeout as the existing root goes
+   under it, so that it will generally time out after it. */
+static kthread_t *tq_meld(kthread_t *a, kthread_t *b) {
+    kthread_t *t;
+
+    if(!a)
+        return b;
+    if(!b)
+        return a;
+
+    if(b->wait_timeout < a->wait_timeout) {
+        t = a;
+        a = b;
+        b = t;
+    }
 
-    /* Search for its place; note that new threads will be placed at
-       the end of a group with the same timeout. */
-    TAILQ_FOREACH_REVERSE(t, &timer_queue, slpquehead, timerq) {
-        if(thd->wait_timeout >= t->wait_timeout) {
-            TAILQ_INSERT_AFTER(&timer_queue, t, thd, timerq);
-            return;
+    /* b becomes the first child of a. */
+    b->timerq.prev = a;
+    b->timerq.next = a->timerq.child;
+
+    if(a->timerq.child)
+        a->timerq.child->timerq.prev = b;
+
+    a->timerq.child = b;
+    return a;
+}
+
+/* Turn a list of siblings into one heap, by melding them in pairs from left
+   to right, then melding the pairs together from right to left. */
+static kthread_t *tq_merge_pairs(kthread_t *first) {
+    kthread_t *a, *b, *pairs = NULL, *rv = NULL;
+
+    while(first) {
+        a = first;
+        b = a->timerq.next;
+        first = b ? b->timerq.next : NULL;
+
+        a->timerq.next = a->timerq.prev = NULL;
+
+        if(b) {
+            b->timerq.next = b->timerq.prev = NULL;
+            a = tq_meld(a, b);
         }
+
+        /* Stack up the pairs, so we can go back from the right. */
+        a->timerq.next = pairs;
+        pairs = a;
+    }
+
+    while(pairs) {
+        a = pairs;
+        pairs = a->timerq.next;
+        a->timerq.next = NULL;
+        rv = tq_meld(rv, a);
     }
 
-    /* Couldn't find anything scheduled earlier, put this at the start. */
-    TAILQ_INSERT_HEAD(&timer_queue, thd, timerq);
+    return rv;
+}
+
+/* Internal function to insert a thread on the timer queue. */
+static void tq_insert(kthread_t * thd) {
+    thd->timerq.child = thd->timerq.next = thd->timerq.prev = NULL;
+    timer_queue = tq_meld(timer_queue, thd);
 }
 
 /* Internal function to remove a thread from the timer queue. */
 static void tq_remove(kthread_t * thd) {
-    TAILQ_REMOVE(&timer_queue, thd, timerq);
+    kthread_t *p = thd->timerq.prev, *children;
+
+    children = tq_merge_pairs(thd->timerq.child);
+
+    if(thd == timer_queue) {
+        timer_queue = children;
+    }
+    else {
+        /* Cut it out of its sibling list. prev is either the parent (if
+           this is the first child) or the previous sibling. */
+        if(p->timerq.child == thd)
+            p->timerq.child = thd->timerq.next;
+        else
+            p->timerq.next = thd->timerq.next;
+
+        if(thd->timerq.next)
+            thd->timerq.next->timerq.prev = p;
+
+        timer_queue = tq_meld(timer_queue, children);
+    }
+
+    thd->timerq.child = thd->timerq.next = thd->timerq.prev = NULL;
 }
 
 /* Returns the top thread on the timer queue (next event). If nothing is
    queued, we'll return NULL. */
 static kthread_t * tq_next(void) {
-    return TAILQ_FIRST(&timer_queue);
+    return timer_queue;
 }
 
 int genwait_wait(void * obj, const char * mesg, int timeout, void (*callback)(void *)) {
@@ -263,7 +338,7 @@ int genwait_init(void) {
     for(i = 0; i < TABLESIZE; i++)
         TAILQ_INIT(&slpque[i]);
 
-    TAILQ_INIT(&timer_queue);
+    timer_queue = NULL;
     return 0;
 }
 
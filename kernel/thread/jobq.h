@@ -0,0 +1,158 @@
+/* KallistiOS ##version##
+
+   kernel/thread/jobq.h
+   Copyright (C) 2024 The KallistiOS Team
+*/
+
+/* The queueing and counter logic of the job system (see jobs.c). This lives
+   in its own header, without any threads, interrupts or genwait in it, so
+   that it can be built and checked on the host (see utils/jobtest).
+
+   Whoever includes it must already have kos_job_t and kos_job_counter_t (as
+   <kos/jobs.h> provides them), and must define these two functions:
+
+     static int jobq_self(kos_job_pool_t *pool);
+       The index of the worker of the pool running the current thread, or -1
+       if it isn't one of them.
+
+     static void jobq_wake(kos_job_pool_t *pool, int worker);
+       Get the given worker to look at its queues, as a job has just been
+       queued for it.
+
+   None of this does any locking of its own. In the kernel, it is all called
+   with interrupts disabled. */
+
+#ifndef __KERNEL_THREAD_JOBQ_H
+#define __KERNEL_THREAD_JOBQ_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <sys/queue.h>
+
+typedef struct jobq_worker {
+    kos_job_pool_t *pool;
+
+    /* The thread running the jobs (a kthread_worker_t in the kernel). */
+    void *thread;
+
+    /* Set while the worker is running a job. */
+    bool busy;
+
+    STAILQ_HEAD(jobq_lane, kos_job) lanes[KOS_JOB_LANE_COUNT];
+} jobq_worker_t;
+
+struct kos_job_pool {
+    jobq_worker_t *workers;
+    int count;
+
+    /* Worker to give the next job submitted from outside the pool to. */
+    int next;
+
+    /* Number of workers waiting in kos_job_wait() for a job or a counter. */
+    int helpers;
+};
+
+static int jobq_self(kos_job_pool_t *pool);
+static void jobq_wake(kos_job_pool_t *pool, int worker);
+
+static inline void jobq_init(kos_job_pool_t *pool, jobq_worker_t *workers,
+                             int count) {
+    int i, lane;
+
+    pool->workers = workers;
+    pool->count = count;
+    pool->next = 0;
+    pool->helpers = 0;
+
+    for(i = 0; i < count; ++i) {
+        workers[i].pool = pool;
+        workers[i].thread = NULL;
+        workers[i].busy = false;
+
+        for(lane = 0; lane < KOS_JOB_LANE_COUNT; ++lane)
+            STAILQ_INIT(&workers[i].lanes[lane]);
+    }
+}
+
+/* Grab the next job for a worker to run, lane by lane in priority order,
+   first from its own queue and then stealing from the others. */
+static inline kos_job_t *jobq_next(kos_job_pool_t *pool, int self) {
+    jobq_worker_t *o;
+    kos_job_t *job;
+    int lane, i;
+
+    for(lane = 0; lane < KOS_JOB_LANE_COUNT; ++lane) {
+        for(i = 0; i < pool->count; ++i) {
+            o = &pool->workers[(self + i) % pool->count];
+
+            if((job = STAILQ_FIRST(&o->lanes[lane]))) {
+                STAILQ_REMOVE_HEAD(&o->lanes[lane], entry);
+                return job;
+            }
+        }
+    }
+
+    return NULL;
+}
+
+/* Put a job that's ready to run on a queue and get a worker to it. */
+static inline void jobq_push(kos_job_t *job) {
+    kos_job_pool_t *pool = job->pool;
+    int w, i;
+
+    /* Jobs spawned by a job stay with that worker, as whatever they work on
+       is probably related. Others are dealt out in turn. */
+    if((w = jobq_self(pool)) < 0) {
+        w = pool->next;
+        pool->next = (pool->next + 1) % pool->count;
+    }
+
+    STAILQ_INSERT_TAIL(&pool->workers[w].lanes[job->lane], job, entry);
+
+    /* If that worker is busy, see if there's an idle one to steal it. */
+    if(pool->workers[w].busy) {
+        for(i = 0; i < pool->count; ++i) {
+            if(!pool->workers[i].busy) {
+                w = i;
+                break;
+            }
+        }
+    }
+
+    jobq_wake(pool, w);
+}
+
+/* Count a job on its done counter, and queue it or hold it back until its
+   after counter drops to zero. */
+static inline void jobq_submit(kos_job_pool_t *pool, kos_job_t *job,
+                               kos_job_counter_t *done,
+                               kos_job_counter_t *after) {
+    job->pool = pool;
+    job->done = done;
+
+    if(done)
+        ++done->count;
+
+    if(after && after->count)
+        SLIST_INSERT_HEAD(&after->waiting, job, wait_entry);
+    else
+        jobq_push(job);
+}
+
+/* Note that a job counted on a counter is done, and queue anything that was
+   waiting for it. Returns true if the counter dropped to zero. */
+static inline bool jobq_counter_dec(kos_job_counter_t *c) {
+    kos_job_t *job;
+
+    if(--c->count)
+        return false;
+
+    while((job = SLIST_FIRST(&c->waiting))) {
+        SLIST_REMOVE_HEAD(&c->waiting, wait_entry);
+        jobq_push(job);
+    }
+
+    return true;
+}
+
+#endif /* !__KERNEL_THREAD_JOBQ_H */
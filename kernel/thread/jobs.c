@@ -0,0 +1,205 @@
+/* KallistiOS ##version##
+
+   jobs.c
+   Copyright (C) 2024 The KallistiOS Team
+*/
+
+/* This is a small job system built on top of the threaded workers. Each
+   worker of a pool has one queue per priority lane. A worker looks for the
+   next job to run lane by lane, in priority order, first in its own queue and
+   then in those of the other workers, so no lower priority job ever runs
+   while a higher priority one is waiting anywhere in the pool. The queues and
+   counters themselves are handled in jobq.h.
+
+   Everything here is protected by disabling interrupts, just like the worker
+   job queues are. */
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <assert.h>
+
+#include <arch/irq.h>
+#include <kos/genwait.h>
+#include <kos/jobs.h>
+#include <kos/worker_thread.h>
+
+#include "jobq.h"
+
+/* Find the worker of the pool running the current thread, if any. */
+static int jobq_self(kos_job_pool_t *pool) {
+    int i;
+
+    for(i = 0; i < pool->count; ++i) {
+        if(pool->workers[i].thread &&
+           thd_worker_get_thread(pool->workers[i].thread) == thd_current)
+            return i;
+    }
+
+    return -1;
+}
+
+static void jobq_wake(kos_job_pool_t *pool, int worker) {
+    thd_worker_wakeup(pool->workers[worker].thread);
+
+    if(pool->helpers)
+        genwait_wake_all(pool);
+}
+
+static void job_run(kos_job_t *job) {
+    kos_job_counter_t *done = job->done;
+    kos_job_pool_t *pool = job->pool;
+
+    /* The job may be resubmitted (or freed) by its routine, so don't touch it
+       once it has run. */
+    job->routine(job->data);
+
+    if(done) {
+        irq_disable_scoped();
+
+        if(jobq_counter_dec(done)) {
+            genwait_wake_all(done);
+
+            if(pool->helpers)
+                genwait_wake_all(pool);
+        }
+    }
+}
+
+static void job_worker_routine(void *d) {
+    jobq_worker_t *w = (jobq_worker_t *)d;
+    kos_job_t *job;
+    irq_mask_t flags;
+
+    for(;;) {
+        flags = irq_disable();
+        job = jobq_next(w->pool, w - w->pool->workers);
+        w->busy = job != NULL;
+        irq_restore(flags);
+
+        if(!job)
+            break;
+
+        job_run(job);
+    }
+}
+
+kos_job_pool_t *kos_job_pool_create(int workers, const kthread_attr_t *attr) {
+    kthread_attr_t real_attr = { 0 };
+    kos_job_pool_t *pool;
+    jobq_worker_t *w;
+    char label[KTHREAD_LABEL_SIZE];
+    int i;
+
+    if(workers <= 0) {
+        errno = EINVAL;
+        return NULL;
+    }
+
+    if(attr)
+        real_attr = *attr;
+
+    if(!(pool = (kos_job_pool_t *)malloc(sizeof(kos_job_pool_t)))) {
+        errno = ENOMEM;
+        return NULL;
+    }
+
+    if(!(w = (jobq_worker_t *)malloc(workers * sizeof(jobq_worker_t)))) {
+        free(pool);
+        errno = ENOMEM;
+        return NULL;
+    }
+
+    jobq_init(pool, w, workers);
+
+    for(i = 0; i < workers; ++i) {
+        snprintf(label, sizeof(label), "%s %d",
+                 attr && attr->label ? attr->label : "[job worker]", i);
+        real_attr.label = label;
+
+        w[i].thread = thd_worker_create_ex(&real_attr, job_worker_routine,
+                                           &w[i]);
+
+        if(!w[i].thread) {
+            kos_job_pool_destroy(pool);
+            errno = ENOMEM;
+            return NULL;
+        }
+    }
+
+    return pool;
+}
+
+void kos_job_pool_destroy(kos_job_pool_t *pool) {
+    int i;
+
+    for(i = 0; i < pool->count; ++i) {
+        if(pool->workers[i].thread)
+            thd_worker_destroy(pool->workers[i].thread);
+    }
+
+    free(pool->workers);
+    free(pool);
+}
+
+void kos_job_counter_init(kos_job_counter_t *counter) {
+    counter->count = 0;
+    SLIST_INIT(&counter->waiting);
+}
+
+void kos_job_init(kos_job_t *job, void (*routine)(void *), void *data,
+                  int lane) {
+    assert(routine != NULL);
+
+    job->routine = routine;
+    job->data = data;
+    job->lane = lane;
+    job->pool = NULL;
+    job->done = NULL;
+}
+
+int kos_job_submit(kos_job_pool_t *pool, kos_job_t *job,
+                   kos_job_counter_t *done, kos_job_counter_t *after) {
+    if(job->lane < 0 || job->lane >= KOS_JOB_LANE_COUNT) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    irq_disable_scoped();
+    jobq_submit(pool, job, done, after);
+
+    return 0;
+}
+
+void kos_job_wait(kos_job_pool_t *pool, kos_job_counter_t *counter) {
+    int self = jobq_self(pool);
+    kos_job_t *job;
+    irq_mask_t flags;
+
+    flags = irq_disable();
+
+    if(self < 0) {
+        while(counter->count)
+            genwait_wait(counter, "kos_job_wait", 0, NULL);
+
+        irq_restore(flags);
+        return;
+    }
+
+    /* We're a worker, so help out with whatever there is to do while we
+       wait, and only sleep if there's nothing. */
+    while(counter->count) {
+        if((job = jobq_next(pool, self))) {
+            irq_restore(flags);
+            job_run(job);
+            flags = irq_disable();
+        }
+        else {
+            ++pool->helpers;
+            genwait_wait(pool, "kos_job_wait", 0, NULL);
+            --pool->helpers;
+        }
+    }
+
+    irq_restore(flags);
+}
@@ -0,0 +1,290 @@
+/* KallistiOS ##version##
+
+   lockstat.c
+   Copyright (C) 2024 The KallistiOS Team
+*/
+
+/* Lock contention statistics. The hooks get called from the locking
+   primitives with interrupts disabled, so everything they touch lives in a
+   fixed size open addressing hash table that is allocated up front. Lock
+   names are kept on their own list, so they can be given before statistics
+   are enabled (like the kernel's own locks are, at init time). */
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/queue.h>
+
+#include <arch/irq.h>
+#include <kos/lockstat.h>
+#include <kos/opts.h>
+
+typedef struct lockstat_name {
+    SLIST_ENTRY(lockstat_name) entry;
+    const void *lock;
+    const char *name;
+} lockstat_name_t;
+
+static SLIST_HEAD(lockstat_names, lockstat_name) lockstat_names =
+    SLIST_HEAD_INITIALIZER(lockstat_names);
+
+bool __lockstat_enabled;
+
+static lockstat_t *lockstat_table;
+static uint32_t lockstat_dropped;
+
+static const char *const lockstat_types[] = {
+    "mutex", "sem", "cond", "rwsem"
+};
+
+static inline uint32_t lockstat_hash(const void *lock) {
+    /* Locks are at least word aligned, so drop the low bits. */
+    return ((uintptr_t)lock >> 2) * 2654435761U;
+}
+
+static const char *lockstat_name_of(const void *lock) {
+    lockstat_name_t *n;
+
+    SLIST_FOREACH(n, &lockstat_names, entry) {
+        if(n->lock == lock)
+            return n->name;
+    }
+
+    return NULL;
+}
+
+/* Find the entry for a lock, making one if need be. Assumes interrupts are
+   disabled. */
+static lockstat_t *lockstat_find(const void *lock, int create) {
+    uint32_t i, h = lockstat_hash(lock);
+    lockstat_t *st;
+
+    for(i = 0; i < LOCKSTAT_MAX_LOCKS; ++i) {
+        st = &lockstat_table[(h + i) & (LOCKSTAT_MAX_LOCKS - 1)];
+
+        if(st->lock == lock)
+            return st;
+
+        if(!st->lock) {
+            if(!create)
+                return NULL;
+
+            st->lock = lock;
+            st->name = lockstat_name_of(lock);
+            return st;
+        }
+    }
+
+    if(create)
+        ++lockstat_dropped;
+
+    return NULL;
+}
+
+static void lockstat_add_wait(lockstat_t *st, uint64_t now,
+                              uint64_t wait_start) {
+    uint64_t wait = now - wait_start;
+
+    st->wait_ns += wait;
+
+    if(wait > st->max_wait_ns)
+        st->max_wait_ns = wait;
+}
+
+void __lockstat_acquire(const void *lock, int type, uint64_t wait_start) {
+    lockstat_t *st;
+    uint64_t now;
+
+    if(!(st = lockstat_find(lock, 1)))
+        return;
+
+    now = timer_ns_gettime64();
+
+    st->type = type;
+    ++st->acquired;
+    st->hold_start = now;
+
+    if(wait_start) {
+        ++st->contended;
+        lockstat_add_wait(st, now, wait_start);
+    }
+}
+
+void __lockstat_timeout(const void *lock, int type, uint64_t wait_start) {
+    lockstat_t *st;
+
+    if(!(st = lockstat_find(lock, 1)))
+        return;
+
+    st->type = type;
+    ++st->timeouts;
+
+    if(wait_start)
+        lockstat_add_wait(st, timer_ns_gettime64(), wait_start);
+}
+
+void __lockstat_release(const void *lock) {
+    lockstat_t *st;
+    uint64_t hold;
+
+    /* If the lock was taken before statistics were enabled, we don't know
+       how long it was held. */
+    if(!(st = lockstat_find(lock, 0)) || !st->hold_start)
+        return;
+
+    hold = timer_ns_gettime64() - st->hold_start;
+    st->hold_start = 0;
+    st->hold_ns += hold;
+
+    if(hold > st->max_hold_ns)
+        st->max_hold_ns = hold;
+}
+
+int lockstat_enable(bool enable) {
+    lockstat_t *table;
+
+    if(enable && !lockstat_table) {
+        if(!(table = (lockstat_t *)calloc(LOCKSTAT_MAX_LOCKS,
+                                          sizeof(lockstat_t)))) {
+            errno = ENOMEM;
+            return -1;
+        }
+
+        lockstat_table = table;
+    }
+
+    __lockstat_enabled = enable;
+    return 0;
+}
+
+int lockstat_set_name(const void *lock, const char *name) {
+    lockstat_name_t *n, *nn = NULL, *unused;
+    lockstat_t *st;
+
+    /* Allocate up front, as we can't do it with interrupts disabled. */
+    if(name && !(nn = (lockstat_name_t *)malloc(sizeof(lockstat_name_t)))) {
+        errno = ENOMEM;
+        return -1;
+    }
+
+    unused = nn;
+
+    {
+        irq_disable_scoped();
+
+        SLIST_FOREACH(n, &lockstat_names, entry) {
+            if(n->lock == lock)
+                break;
+        }
+
+        if(n && name) {
+            n->name = name;
+        }
+        else if(n) {
+            SLIST_REMOVE(&lockstat_names, n, lockstat_name, entry);
+            unused = n;
+        }
+        else if(name) {
+            nn->lock = lock;
+            nn->name = name;
+            SLIST_INSERT_HEAD(&lockstat_names, nn, entry);
+            unused = NULL;
+        }
+
+        if(lockstat_table && (st = lockstat_find(lock, 0)))
+            st->name = name;
+    }
+
+    free(unused);
+    return 0;
+}
+
+int lockstat_get(const void *lock, lockstat_t *st) {
+    lockstat_t *rv;
+
+    irq_disable_scoped();
+
+    if(!lockstat_table || !(rv = lockstat_find(lock, 0)))
+        return -1;
+
+    *st = *rv;
+    return 0;
+}
+
+void lockstat_reset(void) {
+    irq_disable_scoped();
+
+    if(lockstat_table)
+        memset(lockstat_table, 0, LOCKSTAT_MAX_LOCKS * sizeof(lockstat_t));
+
+    lockstat_dropped = 0;
+}
+
+static int lockstat_cmp(const void *a, const void *b) {
+    const lockstat_t *la = (const lockstat_t *)a;
+    const lockstat_t *lb = (const lockstat_t *)b;
+
+    if(la->wait_ns != lb->wait_ns)
+        return la->wait_ns < lb->wait_ns ? 1 : -1;
+
+    if(la->acquired != lb->acquired)
+        return la->acquired < lb->acquired ? 1 : -1;
+
+    return 0;
+}
+
+int lockstat_print(int (*pf)(const char *fmt, ...)) {
+    lockstat_t *copy, *st;
+    uint32_t dropped;
+    int i, count = 0;
+
+    if(!lockstat_table) {
+        pf("Lock statistics are not enabled.\n");
+        return 0;
+    }
+
+    /* Take a snapshot, so we don't print with interrupts disabled. */
+    copy = (lockstat_t *)malloc(LOCKSTAT_MAX_LOCKS * sizeof(lockstat_t));
+
+    if(!copy) {
+        errno = ENOMEM;
+        return -1;
+    }
+
+    {
+        irq_disable_scoped();
+
+        for(i = 0; i < LOCKSTAT_MAX_LOCKS; ++i) {
+            if(lockstat_table[i].lock)
+                copy[count++] = lockstat_table[i];
+        }
+
+        dropped = lockstat_dropped;
+    }
+
+    qsort(copy, count, sizeof(lockstat_t), lockstat_cmp);
+
+    pf("Lock statistics (times in microseconds):\n");
+    pf("lock      type   acquired contended  timeouts   wait total    wait max"
+       "   hold total    hold max  name\n");
+
+    for(i = 0; i < count; ++i) {
+        st = &copy[i];
+
+        pf("%08lx  %-5s  %8lu  %8lu  %8lu  %11llu  %10llu  %11llu  %10llu  "
+           "%s\n", (uint32_t)st->lock, lockstat_types[st->type], st->acquired,
+           st->contended, st->timeouts, st->wait_ns / 1000,
+           st->max_wait_ns / 1000,
+           st->hold_ns / 1000, st->max_hold_ns / 1000,
+           st->name ? st->name : "");
+    }
+
+    if(dropped)
+        pf("(%lu acquisitions of locks beyond the first %d dropped)\n",
+           dropped, LOCKSTAT_MAX_LOCKS);
+
+    pf("--end of list--\n");
+
+    free(copy);
+    return 0;
+}
@@ -7,12 +7,14 @@
 */
 
 #include <stdlib.h>
+#include <string.h>
 #include <errno.h>
 #include <limits.h>
 
 #include <kos/mutex.h>
 #include <kos/genwait.h>
 #include <kos/dbglog.h>
+#include <kos/lockstat.h>
 
 #include <arch/irq.h>
 #include <arch/timer.h>
@@ -20,6 +22,50 @@
 /* Thread pseudo-ptr representing an active IRQ context. */
 #define IRQ_THREAD  ((kthread_t *)0xFFFFFFFF)
 
+/* How many times to let the holder of a mutex run before going to sleep on
+   it (see mutex_spin()). */
+#define MUTEX_SPIN_PASSES   2
+
+/* Take a free mutex. Assumes interrupts are disabled. */
+static inline void mutex_take(mutex_t *m, uint64_t wait_start) {
+    m->count = 1;
+    m->holder = thd_current;
+    thd_pi_acquire(&m->pi, thd_current);
+    lockstat_acquire(m, LOCKSTAT_MUTEX, wait_start);
+}
+
+/* There's only the one CPU, so actually spinning on a mutex can't ever work:
+   the holder can't run to let go of it while we spin. What we can do instead
+   is step aside for the holder if it was only preempted by us, as it'll
+   often be done with the mutex by the time we come back, which costs a lot
+   less than going through genwait. This only helps if the holder has the same
+   priority as us; a lower priority holder wouldn't get to run, and is boosted
+   by priority inheritance once we block anyway. Gives up once deadline (if
+   not 0) has passed, as each pass can take up to a whole timeslice. Assumes
+   interrupts are disabled. Returns true if the mutex was freed up. */
+static bool mutex_spin(mutex_t *m, uint64_t deadline) {
+    kthread_t *holder;
+    int i;
+
+    for(i = 0; i < MUTEX_SPIN_PASSES; ++i) {
+        if(deadline && timer_ms_gettime64() >= deadline)
+            return false;
+
+        holder = m->holder;
+
+        if(holder == IRQ_THREAD || holder->state != STATE_READY ||
+           holder->prio != thd_current->prio)
+            return false;
+
+        thd_pass();
+
+        if(!m->count)
+            return true;
+    }
+
+    return false;
+}
+
 mutex_t *mutex_create(void) {
     mutex_t *rv;
 
@@ -35,6 +81,7 @@ mutex_t *mutex_create(void) {
     rv->dynamic = 1;
     rv->holder = NULL;
     rv->count = 0;
+    memset(&rv->pi, 0, sizeof(rv->pi));
 
     return rv;
 }
@@ -51,6 +98,7 @@ int mutex_init(mutex_t *m, int mtype) {
     m->dynamic = 0;
     m->holder = NULL;
     m->count = 0;
+    memset(&m->pi, 0, sizeof(m->pi));
 
     return 0;
 }
@@ -92,7 +140,7 @@ int mutex_lock_irqsafe(mutex_t *m) {
 }
 
 int mutex_lock_timed(mutex_t *m, int timeout) {
-    uint64_t deadline = 0;
+    uint64_t deadline = 0, wait_start;
     int rv = 0;
 
     if((rv = irq_inside_int())) {
@@ -115,9 +163,8 @@ int mutex_lock_timed(mutex_t *m, int timeout) {
         errno = EINVAL;
         rv = -1;
     }
-    else if(!m->count) {
-        m->count = 1;
-        m->holder = thd_current;
+    else if(__likely(!m->count)) {
+        mutex_take(m, 0);
     }
     else if(m->type == MUTEX_TYPE_RECURSIVE && m->holder == thd_current) {
         if(m->count == INT_MAX) {
@@ -133,39 +180,52 @@ int mutex_lock_timed(mutex_t *m, int timeout) {
         rv = -1;
     }
     else {
+        wait_start = lockstat_wait_start();
+
+        /* Time spent stepping aside for the holder counts against the
+           timeout too. */
         if(timeout)
             deadline = timer_ms_gettime64() + timeout;
 
-        for(;;) {
-            /* Check whether we should boost priority. */
-            if (m->holder->prio >= thd_current->prio) {
-                m->holder->prio = thd_current->prio;
-
-                /* Reschedule if currently scheduled. */
-                if(m->holder->state == STATE_READY) {
-                    /* Thread list is sorted by priority, update the position
-                     * of the thread holding the lock */
-                    thd_remove_from_runnable(m->holder);
-                    thd_add_to_runnable(m->holder, true);
-                }
+        if(mutex_spin(m, deadline)) {
+            mutex_take(m, wait_start);
+            return 0;
+        }
+
+        if(timeout) {
+            timeout = deadline - timer_ms_gettime64();
+            if(timeout <= 0) {
+                lockstat_timeout(m, LOCKSTAT_MUTEX, wait_start);
+                errno = ETIMEDOUT;
+                return -1;
             }
+        }
+
+        for(;;) {
+            /* Lend our priority to the holder (and whatever it's waiting on)
+               while we wait. */
+            thd_pi_block(&m->pi);
 
             rv = genwait_wait(m, timeout ? "mutex_lock_timed" : "mutex_lock",
                               timeout, NULL);
+
+            thd_pi_unblock(thd_current);
+
             if(rv < 0) {
+                lockstat_timeout(m, LOCKSTAT_MUTEX, wait_start);
                 errno = ETIMEDOUT;
                 break;
             }
 
             if(!m->holder) {
-                m->holder = thd_current;
-                m->count = 1;
+                mutex_take(m, wait_start);
                 break;
             }
 
             if(timeout) {
                 timeout = deadline - timer_ms_gettime64();
                 if(timeout <= 0) {
+                    lockstat_timeout(m, LOCKSTAT_MUTEX, wait_start);
                     errno = ETIMEDOUT;
                     rv = -1;
                     break;
@@ -226,6 +286,13 @@ int mutex_trylock(mutex_t *m) {
             break;
     }
 
+    /* An interrupt can't inherit anything, as it's not a thread. */
+    if(m->count == 1 && thd != IRQ_THREAD)
+        thd_pi_acquire(&m->pi, thd);
+
+    if(m->count == 1)
+        lockstat_acquire(m, LOCKSTAT_MUTEX, 0);
+
     return 0;
 }
 
@@ -272,11 +339,15 @@ static int mutex_unlock_common(mutex_t *m, kthread_t *thd) {
 
     /* If we need to wake up a thread, do so. */
     if(wakeup) {
-        /* Restore real priority in case we were dynamically boosted. */
-        if (thd != IRQ_THREAD)
-            thd->prio = thd->real_prio;
-
-        genwait_wake_one(m);
+        /* Drop any priority we inherited through this mutex. */
+        thd_pi_release(&m->pi);
+        lockstat_release(m);
+
+        /* Every thread sleeping on the mutex is on its list of waiters, from
+           before it goes to sleep until after it's woken up, so don't bother
+           genwait if that's empty. */
+        if(!LIST_EMPTY(&m->pi.waiters))
+            genwait_wake_one(m);
     }
 
     return 0;
@@ -0,0 +1,114 @@
+/* KallistiOS ##version##
+
+   kernel/thread/runq.h
+   Copyright (C) 2024 The KallistiOS Team
+*/
+
+/* The scheduler's run queue. This lives in its own header so that it can be
+   built and checked against the old single sorted list on the host (see
+   utils/schedtest). Whoever includes it must already have kthread_t, prio_t
+   and struct ktqueue, as <kos/thread.h> provides them.
+
+   There is one queue (bucket) for each of the priorities that threads are
+   normally run at, and one more shared by everything from RUNQ_BUCKETS - 1
+   up to PRIO_MAX (the idle thread lives there). Each bucket is kept sorted
+   by priority, so the thread at the front of the first non-empty bucket is
+   the one that should run next. Only the shared bucket can ever hold more
+   than one priority, so for the others insertion never walks the queue.
+
+   A bitmap with one bit per non-empty bucket makes finding that bucket a
+   couple of count-trailing-zeroes operations. */
+
+#ifndef __KERNEL_THREAD_RUNQ_H
+#define __KERNEL_THREAD_RUNQ_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <sys/queue.h>
+
+#define RUNQ_BUCKETS    64
+
+typedef struct runq {
+    struct ktqueue bucket[RUNQ_BUCKETS];
+    uint32_t bits[RUNQ_BUCKETS / 32];
+} runq_t;
+
+static inline int runq_bucket(prio_t prio) {
+    return prio < RUNQ_BUCKETS - 1 ? (int)prio : RUNQ_BUCKETS - 1;
+}
+
+static inline void runq_init(runq_t *rq) {
+    int i;
+
+    for(i = 0; i < RUNQ_BUCKETS; ++i)
+        TAILQ_INIT(&rq->bucket[i]);
+
+    for(i = 0; i < RUNQ_BUCKETS / 32; ++i)
+        rq->bits[i] = 0;
+}
+
+/* Find the first non-empty bucket at or after b, or -1 if there is none. */
+static inline int runq_next(const runq_t *rq, int b) {
+    uint32_t bits;
+
+    for(; b < RUNQ_BUCKETS; b = (b | 31) + 1) {
+        if((bits = rq->bits[b >> 5] >> (b & 31)))
+            return b + __builtin_ctz(bits);
+    }
+
+    return -1;
+}
+
+/* The thread that should run next, or NULL if the run queue is empty. */
+static inline kthread_t *runq_first(const runq_t *rq) {
+    int b = runq_next(rq, 0);
+
+    return b < 0 ? NULL : TAILQ_FIRST(&rq->bucket[b]);
+}
+
+/* Queue a thread in front of (front_of_line) or behind all the threads of
+   the same priority. The bucket is remembered in the thread, so that it can
+   still be removed if its ->prio is changed while it's queued. */
+static inline void runq_add(runq_t *rq, kthread_t *t, bool front_of_line) {
+    int b = runq_bucket(t->prio);
+    struct ktqueue *q = &rq->bucket[b];
+    kthread_t *i;
+
+    t->queue_bucket = b;
+
+    if(TAILQ_EMPTY(q)) {
+        rq->bits[b >> 5] |= 1UL << (b & 31);
+        TAILQ_INSERT_HEAD(q, t, thdq);
+    }
+    else if(front_of_line) {
+        TAILQ_FOREACH(i, q, thdq) {
+            if(i->prio >= t->prio) {
+                TAILQ_INSERT_BEFORE(i, t, thdq);
+                return;
+            }
+        }
+
+        TAILQ_INSERT_TAIL(q, t, thdq);
+    }
+    else {
+        TAILQ_FOREACH_REVERSE(i, q, ktqueue, thdq) {
+            if(i->prio <= t->prio) {
+                TAILQ_INSERT_AFTER(q, i, t, thdq);
+                return;
+            }
+        }
+
+        TAILQ_INSERT_HEAD(q, t, thdq);
+    }
+}
+
+static inline void runq_remove(runq_t *rq, kthread_t *t) {
+    int b = t->queue_bucket;
+
+    TAILQ_REMOVE(&rq->bucket[b], t, thdq);
+
+    if(TAILQ_EMPTY(&rq->bucket[b]))
+        rq->bits[b >> 5] &= ~(1UL << (b & 31));
+}
+
+#endif /* !__KERNEL_THREAD_RUNQ_H */
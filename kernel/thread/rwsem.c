@@ -8,10 +8,12 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <errno.h>
 
 #include <kos/rwsem.h>
 #include <kos/genwait.h>
+#include <kos/lockstat.h>
 
 /* Allocate a new reader/writer semaphore */
 rw_semaphore_t *rwsem_create(void) {
@@ -29,6 +31,7 @@ rw_semaphore_t *rwsem_create(void) {
     s->read_count = 0;
     s->write_lock = NULL;
     s->reader_waiting = NULL;
+    memset(&s->pi, 0, sizeof(s->pi));
 
     return s;
 }
@@ -38,6 +41,7 @@ int rwsem_init(rw_semaphore_t *s) {
     s->read_count = 0;
     s->write_lock = NULL;
     s->reader_waiting = NULL;
+    memset(&s->pi, 0, sizeof(s->pi));
 
     return 0;
 }
@@ -61,6 +65,7 @@ int rwsem_destroy(rw_semaphore_t *s) {
 
 /* Lock a reader/writer semaphore for reading */
 int rwsem_read_lock_timed(rw_semaphore_t *s, int timeout) {
+    uint64_t wait_start;
     int rv = 0;
 
     if((rv = irq_inside_int())) {
@@ -82,19 +87,26 @@ int rwsem_read_lock_timed(rw_semaphore_t *s, int timeout) {
     /* If the write lock is not held, let the thread proceed */
     if(!s->write_lock) {
         ++s->read_count;
+        lockstat_acquire(s, LOCKSTAT_RWSEM, 0);
     }
     else {
         /* Block until the write lock is not held any more */
+        wait_start = lockstat_wait_start();
+        thd_pi_block(&s->pi);
         rv = genwait_wait(s, timeout ? "rwsem_read_lock_timed" :
                           "rwsem_read_lock", timeout, NULL);
+        thd_pi_unblock(thd_current);
 
         if(rv < 0) {
             rv = -1;
+            lockstat_timeout(s, LOCKSTAT_RWSEM, wait_start);
+
             if(errno == EAGAIN)
                 errno = ETIMEDOUT;
         }
         else {
             ++s->read_count;
+            lockstat_acquire(s, LOCKSTAT_RWSEM, wait_start);
         }
     }
 
@@ -114,6 +126,7 @@ int rwsem_read_lock_irqsafe(rw_semaphore_t *s) {
 
 /* Lock a reader/writer semaphore for writing */
 int rwsem_write_lock_timed(rw_semaphore_t *s, int timeout) {
+    uint64_t wait_start;
     int rv = 0;
 
     if(irq_inside_int()) {
@@ -134,20 +147,29 @@ int rwsem_write_lock_timed(rw_semaphore_t *s, int timeout) {
        sections, let the thread proceed. */
     if(!s->write_lock && !s->read_count) {
         s->write_lock = thd_current;
+        thd_pi_acquire(&s->pi, thd_current);
+        lockstat_acquire(s, LOCKSTAT_RWSEM, 0);
     }
     else {
         /* Block until the write lock is not held and there are no readers
            inside their critical sections */
+        wait_start = lockstat_wait_start();
+        thd_pi_block(&s->pi);
         rv = genwait_wait(&s->write_lock, timeout ? "rwsem_write_lock_timed" :
                           "rwsem_write_lock", timeout, NULL);
+        thd_pi_unblock(thd_current);
 
         if(rv < 0) {
             rv = -1;
+            lockstat_timeout(s, LOCKSTAT_RWSEM, wait_start);
+
             if(errno == EAGAIN)
                 errno = ETIMEDOUT;
         }
         else {
             s->write_lock = thd_current;
+            thd_pi_acquire(&s->pi, thd_current);
+            lockstat_acquire(s, LOCKSTAT_RWSEM, wait_start);
         }
     }
 
@@ -202,6 +224,8 @@ int rwsem_write_unlock(rw_semaphore_t *s) {
     }
 
     s->write_lock = NULL;
+    thd_pi_release(&s->pi);
+    lockstat_release(s);
 
     /* Give writers priority, attempt to wake any writers first. */
     woken = genwait_wake_cnt(&s->write_lock, 1, 0);
@@ -241,6 +265,7 @@ int rwsem_read_trylock(rw_semaphore_t *s) {
     }
 
     ++s->read_count;
+    lockstat_acquire(s, LOCKSTAT_RWSEM, 0);
     return 0;
 }
 
@@ -256,11 +281,14 @@ int rwsem_write_trylock(rw_semaphore_t *s) {
     }
 
     s->write_lock = thd_current;
+    thd_pi_acquire(&s->pi, thd_current);
+    lockstat_acquire(s, LOCKSTAT_RWSEM, 0);
     return 0;
 }
 
 /* "Upgrade" a read lock to a write lock. */
 int rwsem_read_upgrade_timed(rw_semaphore_t *s, int timeout) {
+    uint64_t wait_start = 0;
     int rv;
 
     if(irq_inside_int()) {
@@ -289,14 +317,18 @@ int rwsem_read_upgrade_timed(rw_semaphore_t *s, int timeout) {
 
         --s->read_count;
         s->reader_waiting = thd_current;
+        wait_start = lockstat_wait_start();
+        thd_pi_block(&s->pi);
         rv = genwait_wait(&s->write_lock, timeout ?
                           "rwsem_read_upgrade_timed" : "rwsem_read_upgrade",
                           timeout, NULL);
+        thd_pi_unblock(thd_current);
 
         if(rv < 0) {
             /* The only way we can error out is if there are still readers
                with the lock, so we can safely re-grab the lock here. */
             ++s->read_count;
+            lockstat_timeout(s, LOCKSTAT_RWSEM, wait_start);
 
             if(errno == EAGAIN)
                 errno = ETIMEDOUT;
@@ -311,6 +343,8 @@ int rwsem_read_upgrade_timed(rw_semaphore_t *s, int timeout) {
         s->write_lock = thd_current;
     }
 
+    thd_pi_acquire(&s->pi, thd_current);
+    lockstat_acquire(s, LOCKSTAT_RWSEM, wait_start);
     return 0;
 }
 
@@ -334,6 +368,8 @@ int rwsem_read_tryupgrade(rw_semaphore_t *s) {
 
     s->read_count = 0;
     s->write_lock = thd_current;
+    thd_pi_acquire(&s->pi, thd_current);
+    lockstat_acquire(s, LOCKSTAT_RWSEM, 0);
 
     return 0;
 }
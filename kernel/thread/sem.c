@@ -18,6 +18,7 @@
 #include <kos/thread.h>
 #include <kos/sem.h>
 #include <kos/genwait.h>
+#include <kos/lockstat.h>
 
 /**************************************/
 
@@ -82,6 +83,7 @@ int sem_destroy(semaphore_t *sm) {
 
 /* Wait on a semaphore, with timeout (in milliseconds) */
 int sem_wait_timed(semaphore_t *sem, int timeout) {
+    uint64_t wait_start;
     int rv = 0;
 
     /* Make sure we're not inside an interrupt */
@@ -109,10 +111,12 @@ int sem_wait_timed(semaphore_t *sem, int timeout) {
     /* If there's enough count left, then let the thread proceed */
     else if(sem->count > 0) {
         sem->count--;
+        lockstat_acquire(sem, LOCKSTAT_SEM, 0);
     }
     else {
         /* Block us until we're signaled */
         sem->count--;
+        wait_start = lockstat_wait_start();
         rv = genwait_wait(sem, timeout ? "sem_wait_timed" : "sem_wait", timeout,
                           NULL);
 
@@ -120,10 +124,14 @@ int sem_wait_timed(semaphore_t *sem, int timeout) {
         if(rv < 0) {
             rv = -1;
             ++sem->count;
+            lockstat_timeout(sem, LOCKSTAT_SEM, wait_start);
 
             if(errno == EAGAIN)
                 errno = ETIMEDOUT;
         }
+        else {
+            lockstat_acquire(sem, LOCKSTAT_SEM, wait_start);
+        }
     }
 
     return rv;
@@ -147,6 +155,7 @@ int sem_trywait(semaphore_t *sm) {
     /* Is there enough count left? */
     else if(sm->count > 0) {
         sm->count--;
+        lockstat_acquire(sm, LOCKSTAT_SEM, 0);
     }
     else {
         rv = -1;
@@ -24,11 +24,14 @@
 #include <kos/rwsem.h>
 #include <kos/cond.h>
 #include <kos/genwait.h>
+#include <kos/slab.h>
 #include <arch/irq.h>
 #include <arch/timer.h>
 #include <dc/perfctr.h>
 #include <arch/arch.h>
 
+#include "runq.h"
+
 /*
 
 This module supports thread scheduling in KOS. The timer interrupt is used
@@ -62,17 +65,33 @@ static alignas(8) uint8_t thd_idle_stack[64];
 /* Scheduler timer interrupt frequency (Hertz) */
 static unsigned int thd_sched_ms = 1000 / THD_SCHED_HZ;
 
+/* When the current time slice is up, and when the primary timer is set to go
+   off next (0 if it isn't running). The timer goes off early if a timed wait
+   is due before the end of the time slice. */
+static uint64_t thd_slice_end;
+static uint64_t thd_wakeup_at;
+
+/* In tickless mode, the end of the time slice is only of interest if there's
+   another thread waiting to run at the same priority as the current one (or
+   better). Otherwise, the timer only goes off for timed waits, or after
+   THD_TICKLESS_MAX_MS at most, just in case. */
+static bool thd_tickless = false;
+#define THD_TICKLESS_MAX_MS 1000
+
+/* Set while a thread is giving up the CPU of its own accord, so that the
+   context switch is counted as voluntary. */
+static bool thd_yielding = false;
+
 /* Thread list. This includes all threads except dead ones. */
 static struct ktlist thd_list;
 
 /* Run queue. This is more like on a standard time sharing system than the
-   previous versions. The top element of this priority queue should be the
-   thread that is ready to run next. When a thread is scheduled, it will be
-   removed from this queue. When it's de-scheduled, it will be re-inserted
-   by its priority value at the end of its priority group. Note that right
-   now this condition is being broken because sleeping threads are on the
-   same queue. We deal with those in thd_switch below. */
-static struct ktqueue run_queue;
+   previous versions. The thread at the front of it is the one that is ready
+   to run next. When a thread is scheduled, it will be removed from the
+   queue. When it's de-scheduled, it will be re-inserted behind the others of
+   its priority (or in front of them, see thd_schedule). See runq.h for how
+   it is organised. */
+static runq_t run_queue;
 
 /* The currently executing thread. This thread should not be on any queues. */
 kthread_t *thd_current = NULL;
@@ -89,6 +108,45 @@ static size_t thd_count = 0;
 /* The idle task */
 static kthread_t *thd_idle_thd = NULL;
 
+/* Where thread control blocks are allocated from. */
+static kmem_cache_t *thd_cache;
+
+/* Set the primary timer to go off at the end of the time slice, or when the
+   next timed wait is due, whichever is first. */
+static void thd_set_wakeup(uint64_t now) {
+    uint64_t next = 0, tm = genwait_next_timeout();
+    kthread_t *thd;
+
+    if(!thd_tickless) {
+        next = thd_slice_end;
+    }
+    else if((thd = runq_first(&run_queue)) && thd->prio <= thd_current->prio) {
+        /* Somebody's waiting for a turn. If the current thread has had the
+           CPU to itself for a while, start its time slice now. */
+        if(thd_slice_end <= now)
+            thd_slice_end = now + thd_sched_ms;
+
+        next = thd_slice_end;
+    }
+
+    if(tm && (!next || tm < next))
+        next = tm;
+
+    if(!next) {
+        /* Nothing to wake up for. Leave any existing wakeup alone. */
+        if(thd_wakeup_at > now)
+            return;
+
+        next = now + THD_TICKLESS_MAX_MS;
+    }
+
+    if(next == thd_wakeup_at)
+        return;
+
+    thd_wakeup_at = next;
+    timer_primary_wakeup(next > now ? (uint32_t)(next - now) : 1);
+}
+
 /*****************************************************************************/
 /* Debug */
 
@@ -161,22 +219,27 @@ int thd_pslist(int (*pf)(const char *fmt, ...)) {
 
 int thd_pslist_queue(int (*pf)(const char *fmt, ...)) {
     kthread_t *cur;
+    int b;
 
     pf("Queued threads:\n");
     pf("addr\t\ttid\tprio\tflags\twait_timeout\tstate     name\n");
-    TAILQ_FOREACH(cur, &run_queue, thdq) {
-        pf("%08lx\t", CONTEXT_PC(cur->context));
-        pf("%d\t", cur->tid);
 
-        if(cur->prio == PRIO_MAX)
-            pf("MAX\t");
-        else
-            pf("%d\t", cur->prio);
+    for(b = runq_next(&run_queue, 0); b >= 0;
+        b = runq_next(&run_queue, b + 1)) {
+        TAILQ_FOREACH(cur, &run_queue.bucket[b], thdq) {
+            pf("%08lx\t", CONTEXT_PC(cur->context));
+            pf("%d\t", cur->tid);
+
+            if(cur->prio == PRIO_MAX)
+                pf("MAX\t");
+            else
+                pf("%d\t", cur->prio);
 
-        pf("%08lx\t", cur->flags);
-        pf("%ld\t\t", (uint32_t)cur->wait_timeout);
-        pf("%10s", thd_state_to_str(cur));
-        pf("%s\n", cur->label);
+            pf("%08lx\t", cur->flags);
+            pf("%ld\t\t", (uint32_t)cur->wait_timeout);
+            pf("%10s", thd_state_to_str(cur));
+            pf("%s\n", cur->label);
+        }
     }
 
     return 0;
@@ -310,44 +373,18 @@ void thd_exit(void *rv) {
    right before the process group of the same priority (front_of_line!=0).
    See thd_schedule for why this is helpful. */
 void thd_add_to_runnable(kthread_t *t, bool front_of_line) {
-    kthread_t *i;
-    int done;
-
     if(t->flags & THD_QUEUED)
         return;
 
-    done = 0;
-
-    if(!front_of_line) {
-        /* Look for a thread of lower priority and insert
-           before it. If there is nothing on the run queue, we'll
-           fall through to the bottom. */
-        TAILQ_FOREACH(i, &run_queue, thdq) {
-            if(i->prio > t->prio) {
-                TAILQ_INSERT_BEFORE(i, t, thdq);
-                done = 1;
-                break;
-            }
-        }
-    }
-    else {
-        /* Look for a thread of the same or lower priority and
-           insert before it. If there is nothing on the run queue,
-           we'll fall through to the bottom. */
-        TAILQ_FOREACH(i, &run_queue, thdq) {
-            if(i->prio >= t->prio) {
-                TAILQ_INSERT_BEFORE(i, t, thdq);
-                done = 1;
-                break;
-            }
-        }
-    }
-
-    /* Didn't find one, put it at the end */
-    if(!done)
-        TAILQ_INSERT_TAIL(&run_queue, t, thdq);
-
+    runq_add(&run_queue, t, front_of_line);
     t->flags |= THD_QUEUED;
+
+    /* In tickless mode, the timer may not be set to go off at the end of the
+       time slice, as the current thread had nobody to share the CPU with. If
+       it does now, fix that. */
+    if(thd_tickless && thd_current && t != thd_current &&
+       t->prio <= thd_current->prio && thd_wakeup_at > thd_slice_end)
+        thd_set_wakeup(timer_ms_gettime64());
 }
 
 /* Removes a thread from the runnable queue, if it's there. */
@@ -355,7 +392,8 @@ int thd_remove_from_runnable(kthread_t *thd) {
     if(!(thd->flags & THD_QUEUED)) return 0;
 
     thd->flags &= ~THD_QUEUED;
-    TAILQ_REMOVE(&run_queue, thd, thdq);
+    runq_remove(&run_queue, thd);
+
     return 0;
 }
 
@@ -474,7 +512,7 @@ kthread_t *thd_create_ex(const kthread_attr_t *restrict attr,
 
     if(tid >= 0) {
         /* Create a new thread structure */
-        nt = memalign(32, sizeof(kthread_t));
+        nt = kmem_cache_alloc(thd_cache);
 
         if(nt != NULL) {
             /* Clear out potentially unused stuff */
@@ -488,7 +526,7 @@ kthread_t *thd_create_ex(const kthread_attr_t *restrict attr,
                 nt->stack = (uint32_t*)malloc(real_attr.stack_size);
 
                 if(!nt->stack) {
-                    free(nt);
+                    kmem_cache_free(thd_cache, nt);
                     return NULL;
                 }
 
@@ -541,6 +579,7 @@ kthread_t *thd_create_ex(const kthread_attr_t *restrict attr,
 
             /* Initialize thread-local storage. */
             LIST_INIT(&nt->tls_list);
+            LIST_INIT(&nt->pi_held);
 
             /* Insert it into the thread list */
             LIST_INSERT_HEAD(&thd_list, nt, t_list);
@@ -581,6 +620,15 @@ int thd_destroy(kthread_t *thd) {
     /* De-schedule the thread if it's scheduled. */
     thd_remove_from_runnable(thd);
 
+    /* Forget about any priority inheriting locks it was involved with. Locks
+       it still holds stay locked, but nobody will inherit from them. */
+    thd_pi_unblock(thd);
+
+    while(!LIST_EMPTY(&thd->pi_held)) {
+        LIST_FIRST(&thd->pi_held)->owner = NULL;
+        LIST_REMOVE(LIST_FIRST(&thd->pi_held), held);
+    }
+
     /* Remove it from the thread list. */
     LIST_REMOVE(thd, t_list);
 
@@ -607,7 +655,7 @@ int thd_destroy(kthread_t *thd) {
     free(thd->tcbhead);
 
     /* Free the thread */
-    free(thd);
+    kmem_cache_free(thd_cache, thd);
 
     /* Remove it from the count */
     --thd_count;
@@ -618,6 +666,95 @@ int thd_destroy(kthread_t *thd) {
 /*****************************************************************************/
 /* Thread attribute functions */
 
+/* Change a thread's dynamic priority, moving it to the right queue if it's
+   waiting to run. A boosted thread goes to the front of its new queue. */
+static void thd_change_prio(kthread_t *thd, prio_t prio) {
+    bool boost = prio < thd->prio;
+
+    if(thd->flags & THD_QUEUED) {
+        thd_remove_from_runnable(thd);
+        thd->prio = prio;
+        thd_add_to_runnable(thd, boost);
+    }
+    else {
+        thd->prio = prio;
+    }
+}
+
+/* Work out what a thread's dynamic priority should be, from its static
+   priority and the threads blocked on the locks it holds. */
+static prio_t thd_pi_prio(kthread_t *thd) {
+    prio_t prio = thd->real_prio;
+    kthread_pi_t *pi;
+    kthread_t *w;
+
+    LIST_FOREACH(pi, &thd->pi_held, held) {
+        LIST_FOREACH(w, &pi->waiters, pi_waitq) {
+            if(w->prio < prio)
+                prio = w->prio;
+        }
+    }
+
+    return prio;
+}
+
+/* Bring a thread's dynamic priority up to date, and carry the change on down
+   the chain of lock holders it's blocked on. The depth limit keeps a deadlock
+   cycle from hanging us here. */
+#define THD_PI_MAX_DEPTH    32
+
+static void thd_pi_update(kthread_t *thd) {
+    prio_t prio;
+    int depth;
+
+    for(depth = 0; thd && depth < THD_PI_MAX_DEPTH; ++depth) {
+        if((prio = thd_pi_prio(thd)) == thd->prio)
+            break;
+
+        thd_change_prio(thd, prio);
+        thd = thd->pi_blocked ? thd->pi_blocked->owner : NULL;
+    }
+}
+
+void thd_pi_acquire(kthread_pi_t *pi, kthread_t *thd) {
+    pi->owner = thd;
+    LIST_INSERT_HEAD(&thd->pi_held, pi, held);
+
+    /* Anyone still waiting on the lock is now waiting on us. */
+    if(!LIST_EMPTY(&pi->waiters))
+        thd_pi_update(thd);
+}
+
+void thd_pi_release(kthread_pi_t *pi) {
+    kthread_t *thd = pi->owner;
+
+    if(!thd)
+        return;
+
+    LIST_REMOVE(pi, held);
+    pi->owner = NULL;
+
+    if(!LIST_EMPTY(&pi->waiters))
+        thd_pi_update(thd);
+}
+
+void thd_pi_block(kthread_pi_t *pi) {
+    thd_current->pi_blocked = pi;
+    LIST_INSERT_HEAD(&pi->waiters, thd_current, pi_waitq);
+    thd_pi_update(pi->owner);
+}
+
+void thd_pi_unblock(kthread_t *thd) {
+    kthread_pi_t *pi = thd->pi_blocked;
+
+    if(!pi)
+        return;
+
+    LIST_REMOVE(thd, pi_waitq);
+    thd->pi_blocked = NULL;
+    thd_pi_update(pi->owner);
+}
+
 /* Set a thread's priority */
 int thd_set_prio(kthread_t *thd, prio_t prio) {
     if(thd == NULL)
@@ -626,9 +763,12 @@ int thd_set_prio(kthread_t *thd, prio_t prio) {
     if((prio < 0) || (prio > PRIO_MAX))
         return -2;
 
-    /* Set the new priority */
-    thd->prio = prio;
+    /* Set the new priority. It may still be boosted above that by the locks
+       it holds, and anything it's blocked on may need to know about it. */
+    irq_disable_scoped();
+
     thd->real_prio = prio;
+    thd_pi_update(thd);
     return 0;
 }
 
@@ -683,14 +823,10 @@ void thd_schedule(bool front_of_line, uint64_t now) {
     /* Look for timed out waits */
     genwait_check_timeouts(now);
 
-    /* Search downwards through the run queue for a runnable thread; if
-       we don't find a normal runnable thread, the idle process will
+    /* Grab the first thread on the run queue. Only ready threads are ever
+       queued, and if there's no normal runnable thread, the idle process will
        always be there at the bottom. */
-    TAILQ_FOREACH(thd, &run_queue, thdq) {
-        /* Is it runnable? If not, keep going */
-        if(thd->state == STATE_READY)
-            break;
-    }
+    thd = runq_first(&run_queue);
 
     /* If we didn't already re-enqueue the thread and we are supposed to do so,
        do it now. */
@@ -714,6 +850,13 @@ void thd_schedule(bool front_of_line, uint64_t now) {
        run queue and switch to it. */
     thd_remove_from_runnable(thd);
 
+    if(thd != thd_current) {
+        if(thd_yielding || thd_current->state != STATE_READY)
+            ++thd_current->switches.voluntary;
+        else
+            ++thd_current->switches.involuntary;
+    }
+
     thd_update_cpu_time(thd);
 
     thd_current = thd;
@@ -729,6 +872,7 @@ void thd_schedule(bool front_of_line, uint64_t now) {
         }
     }
 
+    thd_set_wakeup(now);
     irq_set_context(&thd_current->context);
 }
 
@@ -760,11 +904,16 @@ void thd_schedule_next(kthread_t *thd) {
 
     thd_remove_from_runnable(thd);
 
+    ++thd_current->switches.involuntary;
     thd_update_cpu_time(thd);
 
     thd_current = thd;
     _impure_ptr = &thd->thd_reent;
     thd_current->state = STATE_RUNNING;
+
+    if(thd_tickless)
+        thd_set_wakeup(timer_ms_gettime64());
+
     irq_set_context(&thd_current->context);
 }
 
@@ -774,8 +923,11 @@ irq_context_t *thd_choose_new(void) {
 
     //printf("thd_choose_new() woken at %d\n", (uint32_t)now);
 
-    /* Do any re-scheduling */
+    /* Do any re-scheduling. The current thread is giving up the CPU (by
+       blocking, exiting or passing), so this is a voluntary switch. */
+    thd_yielding = true;
     thd_schedule(0, now);
+    thd_yielding = false;
 
     /* Return the new IRQ context back to the caller */
     return &thd_current->context;
@@ -795,8 +947,18 @@ static void thd_timer_hnd(irq_context_t *context) {
 
     //printf("timer woke at %d\n", (uint32_t)now);
 
-    thd_schedule(0, now);
-    timer_primary_wakeup(thd_sched_ms);
+    /* The timer is stopped once it goes off. */
+    thd_wakeup_at = 0;
+
+    if(now >= thd_slice_end) {
+        thd_slice_end = now + thd_sched_ms;
+        thd_schedule(0, now);
+    }
+    else {
+        /* Woken for a timeout. Only switch away from the current thread if
+           a higher priority one is now ready to run. */
+        thd_schedule(1, now);
+    }
 }
 
 /*****************************************************************************/
@@ -991,6 +1153,23 @@ unsigned thd_get_hz(void) {
     return 1000 / thd_sched_ms;
 }
 
+int thd_set_tickless(bool enable) {
+    bool old;
+
+    irq_disable_scoped();
+
+    old = thd_tickless;
+    thd_tickless = enable;
+
+    /* Make sure the timer is set for the new mode. */
+    if(thd_mode != THD_MODE_NONE) {
+        thd_wakeup_at = 0;
+        thd_set_wakeup(timer_ms_gettime64());
+    }
+
+    return old;
+}
+
 int thd_set_hz(unsigned int hertz) {
     if(!hertz || hertz > 1000)
         return -1;
@@ -1070,6 +1249,11 @@ int thd_init(void) {
     if(thd_mode != THD_MODE_NONE)
         return -1;
 
+    /* The cache outlives a shutdown, as the kernel thread is never freed. */
+    if(!thd_cache &&
+       !(thd_cache = kmem_cache_create("kthread", sizeof(kthread_t), 32, NULL)))
+        return -1;
+
     /* Setup our mode as appropriate */
     thd_mode = THD_MODE_PREEMPT;
 
@@ -1080,7 +1264,7 @@ int thd_init(void) {
     LIST_INIT(&thd_list);
 
     /* Initialize the run queue */
-    TAILQ_INIT(&run_queue);
+    runq_init(&run_queue);
 
     /* Start off with no "current" thread */
     thd_current = NULL;
@@ -1123,7 +1307,9 @@ int thd_init(void) {
     timer_primary_set_callback(thd_timer_hnd);
 
     /* Schedule our first wakeup */
-    timer_primary_wakeup(thd_sched_ms);
+    thd_slice_end = timer_ms_gettime64() + thd_sched_ms;
+    thd_wakeup_at = 0;
+    thd_set_wakeup(thd_slice_end - thd_sched_ms);
 
     dbglog(DBG_DEBUG, "thd: pre-emption enabled, HZ=%u\n", thd_get_hz());
 
@@ -118,7 +118,8 @@ kthread_job_t *thd_worker_dequeue_job(kthread_worker_t *worker) {
     irq_disable_scoped();
 
     job = STAILQ_FIRST(&worker->jobs);
-    STAILQ_REMOVE_HEAD(&worker->jobs, entry);
+    if (job)
+        STAILQ_REMOVE_HEAD(&worker->jobs, entry);
 
     return job;
 }
@@ -0,0 +1,738 @@
+/* KallistiOS ##version##
+
+   ext2bench.c
+   Copyright (C) 2024 The KallistiOS Team
+
+   Benchmark for libkosext2fs that runs on a PC, against an ext2 image file.
+   It is built against the library with Makefile.nonkos, so it exercises the
+   same block cache and block mapping code that KOS uses.
+
+   The cache test reads blocks of one file in a random order, with most of the
+   reads going to a small part of the file, once for each of a range of block
+   cache sizes. For each size it reports the hit rate from the block cache's
+   own counters along with the time per read, which should stay flat as the
+   cache grows rather than growing with it.
+
+   The sequential test reads the whole file twice: once a block at a time
+   through the block cache, and once the way fs_ext2_read() does it, reading
+   runs of contiguous blocks straight into the buffer. Since the image is most
+   likely in the host's page cache, each request to the "device" can be made
+   to take some extra time with -l, to stand in for the command overhead of a
+   real SD card or hard drive.
+
+   The thread test (-t) reads several files at once from separate threads,
+   with the same locks fs_ext2_read() uses: one for each open file, one for
+   the filesystem and one for the device. The first thread streams the first
+   file in big aligned reads, which go straight from the device, while the
+   others each do small random reads of a file of their own, which come from
+   the block cache. It is run with the filesystem lock held for the whole of
+   each read (as one global lock did), held for each block or run of blocks
+   including the copy or the device read (as fs_ext2 did at first), and held
+   only to find each block or run (as fs_ext2_read() does now). Every read is
+   checked against the file's contents. -r sets how fast the device moves
+   data, so the streaming thread spends its time waiting on it like it would
+   on real hardware.
+
+   To make an image to test with:
+     dd if=/dev/urandom of=files/big bs=1M count=32
+     for i in 1 2 3 4 5 6 7; do
+       dd if=/dev/urandom of=files/small$i bs=1K count=64
+     done
+     mke2fs -b 1024 -d files ext2.img 64M
+*/
+
+#include <time.h>
+#include <stdio.h>
+#include <errno.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <inttypes.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#include "ext2fs.h"
+#include "inode.h"
+#include "ext2internal.h"
+
+/* Requests that made it to the "device", to compare with the cache stats. */
+static uint64_t dev_reqs, dev_blocks;
+
+/* Extra time each request takes, in nanoseconds, and how fast the device
+   moves data, in KB/s (0 for as fast as the host can). */
+static long dev_latency;
+static long dev_rate;
+
+/* Only one request goes to the device at a time, like with the device lock
+   that fs_ext2 wraps the block device with. */
+static pthread_mutex_t dev_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static int blockdev_dummy(kos_blockdev_t *d) {
+    (void)d;
+    return 0;
+}
+
+static int blockdev_read(kos_blockdev_t *d, uint32_t block, size_t count,
+                         void *buf) {
+    FILE *fp = (FILE *)d->dev_data;
+    size_t len = count << d->l_block_size;
+    uint64_t ns = dev_latency;
+    struct timespec ts;
+    int rv = 0;
+
+    pthread_mutex_lock(&dev_lock);
+
+    ++dev_reqs;
+    dev_blocks += count;
+
+    if(dev_rate)
+        ns += (uint64_t)len * 1000000000ULL / ((uint64_t)dev_rate * 1024);
+
+    if(ns) {
+        ts.tv_sec = ns / 1000000000ULL;
+        ts.tv_nsec = ns % 1000000000ULL;
+        nanosleep(&ts, NULL);
+    }
+
+    if(pread(fileno(fp), buf, len, (off_t)block << d->l_block_size) !=
+       (ssize_t)len)
+        rv = -1;
+
+    pthread_mutex_unlock(&dev_lock);
+    return rv;
+}
+
+static int blockdev_write(kos_blockdev_t *d, uint32_t block, size_t count,
+                          const void *buf) {
+    (void)d;
+    (void)block;
+    (void)count;
+    (void)buf;
+
+    /* Everything is mounted read-only. */
+    return -1;
+}
+
+static uint32_t blockdev_count(kos_blockdev_t *d) {
+    FILE *fp = (FILE *)d->dev_data;
+    off_t len;
+
+    fseeko(fp, 0, SEEK_END);
+    len = ftello(fp);
+    fseeko(fp, 0, SEEK_SET);
+
+    return (uint32_t)(len >> d->l_block_size);
+}
+
+static kos_blockdev_t the_bd = {
+    NULL,
+    9,
+
+    &blockdev_dummy,
+    &blockdev_dummy,
+
+    &blockdev_read,
+    &blockdev_write,
+    &blockdev_count
+};
+
+static uint64_t now_ns(void) {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static uint32_t rnd_state = 12345;
+
+static uint32_t rnd_r(uint32_t *state) {
+    *state ^= *state << 13;
+    *state ^= *state >> 17;
+    *state ^= *state << 5;
+    return *state;
+}
+
+static uint32_t rnd(void) {
+    return rnd_r(&rnd_state);
+}
+
+static ext2_fs_t *mount_image(int cache_sz, const char *path,
+                              ext2_inode_t **inode, uint32_t *nblocks) {
+    ext2_fs_t *fs;
+    uint32_t inode_num;
+    int rv;
+
+    if(!(fs = ext2_fs_init_ex(&the_bd, EXT2FS_MNT_FLAG_RO, cache_sz))) {
+        fprintf(stderr, "Cannot mount the image\n");
+        return NULL;
+    }
+
+    if((rv = ext2_inode_by_path(fs, path, inode, &inode_num, 1, NULL))) {
+        fprintf(stderr, "Cannot find %s: %s\n", path, strerror(-rv));
+        ext2_fs_shutdown(fs);
+        return NULL;
+    }
+
+    *nblocks = (uint32_t)((ext2_inode_size(*inode) + ext2_block_size(fs) - 1)
+                          >> ext2_log_block_size(fs));
+
+    if(!*nblocks) {
+        fprintf(stderr, "%s is empty\n", path);
+        ext2_inode_put(*inode);
+        ext2_fs_shutdown(fs);
+        return NULL;
+    }
+
+    return fs;
+}
+
+static int cache_test(const char *path, int reads) {
+    static const int sizes[] = { 16, 64, 256, 1024, 4096, 8192 };
+    ext2_fs_t *fs;
+    ext2_inode_t *inode;
+    blockcache_stats_t st;
+    uint32_t nblocks, hot, bn, blk;
+    uint64_t start, ns;
+    size_t i;
+    int j, err;
+
+    printf("Random reads of %s, %d per cache size\n", path, reads);
+    printf("%6s %10s %10s %7s %10s %9s\n", "cache", "hits", "misses", "hit%",
+           "evictions", "ns/read");
+
+    for(i = 0; i < sizeof(sizes) / sizeof(sizes[0]); ++i) {
+        if(!(fs = mount_image(sizes[i], path, &inode, &nblocks)))
+            return -1;
+
+        /* Three quarters of the reads go to the first eighth of the file. */
+        hot = nblocks / 8 ? nblocks / 8 : 1;
+        rnd_state = 12345;
+        blockcache_reset_stats(fs->bcache);
+
+        start = now_ns();
+
+        for(j = 0; j < reads; ++j) {
+            blk = (rnd() & 3) ? rnd() % hot : rnd() % nblocks;
+
+            if(!ext2_inode_read_block(fs, inode, blk, &bn, &err)) {
+                fprintf(stderr, "Read of block %" PRIu32 " failed: %s\n", blk,
+                        strerror(err));
+                ext2_inode_put(inode);
+                ext2_fs_shutdown(fs);
+                return -1;
+            }
+        }
+
+        ns = now_ns() - start;
+        blockcache_get_stats(fs->bcache, &st);
+
+        printf("%6d %10" PRIu32 " %10" PRIu32 " %6.2f%% %10" PRIu32 " %9.1f\n",
+               sizes[i], st.hits, st.misses,
+               100.0 * st.hits / (st.hits + st.misses), st.evictions,
+               (double)ns / reads);
+
+        ext2_inode_put(inode);
+        ext2_fs_shutdown(fs);
+    }
+
+    return 0;
+}
+
+/* Size of each read the sequential test does, like an application would. */
+#define SEQ_CHUNK   (256 * 1024)
+
+static int seq_pass(const char *path, int direct, uint32_t *sum) {
+    ext2_fs_t *fs;
+    ext2_inode_t *inode;
+    uint8_t *buf, *block;
+    uint32_t nblocks, bs, per_chunk, blk, bn, i, cnt;
+    uint64_t start, ns;
+    int n, err = 0;
+
+    if(!(fs = mount_image(EXT2_CACHE_BLOCKS, path, &inode, &nblocks)))
+        return -1;
+
+    bs = ext2_block_size(fs);
+    per_chunk = SEQ_CHUNK / bs;
+
+    if(posix_memalign((void **)&buf, 32, SEQ_CHUNK)) {
+        ext2_inode_put(inode);
+        ext2_fs_shutdown(fs);
+        return -1;
+    }
+
+    dev_reqs = dev_blocks = 0;
+    *sum = 0;
+    start = now_ns();
+
+    for(blk = 0; blk < nblocks; blk += cnt) {
+        cnt = nblocks - blk < per_chunk ? nblocks - blk : per_chunk;
+
+        for(i = 0; i < cnt; i += n) {
+            n = 0;
+
+            if(direct &&
+               (n = ext2_inode_read_blocks(fs, inode, blk + i, cnt - i,
+                                           buf + i * bs, &err)) < 0)
+                goto fail;
+
+            if(!n) {
+                if(!(block = ext2_inode_read_block(fs, inode, blk + i, &bn,
+                                                   &err)))
+                    goto fail;
+
+                memcpy(buf + i * bs, block, bs);
+                n = 1;
+            }
+        }
+
+        /* Make sure both ways of reading give back the same data. */
+        for(i = 0; i < cnt * bs; i += 4)
+            *sum = *sum * 31 + *(uint32_t *)(buf + i);
+    }
+
+    ns = now_ns() - start;
+
+    printf("%-7s %9.2f MB/s, %8" PRIu64 " requests, %6.1f blocks/request\n",
+           direct ? "direct" : "cached",
+           (double)nblocks * bs * 1000.0 / ns, dev_reqs,
+           (double)dev_blocks / dev_reqs / (bs >> 9));
+
+    free(buf);
+    ext2_inode_put(inode);
+    ext2_fs_shutdown(fs);
+    return 0;
+
+fail:
+    fprintf(stderr, "Read of block %" PRIu32 " failed: %s\n", blk + i,
+            strerror(err));
+    free(buf);
+    ext2_inode_put(inode);
+    ext2_fs_shutdown(fs);
+    return -1;
+}
+
+static int seq_test(const char *path) {
+    uint32_t sum1, sum2;
+
+    printf("Sequential read of %s, %ld us per request\n", path,
+           dev_latency / 1000);
+
+    if(seq_pass(path, 0, &sum1) || seq_pass(path, 1, &sum2))
+        return -1;
+
+    if(sum1 != sum2) {
+        fprintf(stderr, "Data read directly does not match the cache!\n");
+        return -1;
+    }
+
+    return 0;
+}
+
+/* How the filesystem lock is held in the thread test. */
+enum { LOCK_WHOLE, LOCK_PIECE, LOCK_SPLIT };
+static const char *lock_names[] = { "whole", "piece", "split" };
+
+/* Size of each read the small readers do. */
+#define SMALL_READ  64
+
+/* Block cache size for the thread test, enough to hold the small files. */
+#define THREAD_CACHE    4096
+
+typedef struct bench_file {
+    const char *path;
+    ext2_inode_t *inode;
+    uint64_t size;
+    uint8_t *data;              /* The whole file, to check reads against */
+} bench_file_t;
+
+/* An open file, like one of fs_ext2's file handles. */
+typedef struct bench_fh {
+    pthread_mutex_t lock;
+    bench_file_t *file;
+    uint64_t ptr;
+} bench_fh_t;
+
+typedef struct bench_thd {
+    pthread_t thd;
+    bench_fh_t fh;
+    uint32_t seed;
+    uint64_t reads;
+    uint64_t ns;
+    int failed;
+} bench_thd_t;
+
+static ext2_fs_t *tfs;
+static pthread_mutex_t fs_lock = PTHREAD_MUTEX_INITIALIZER;
+static int lock_mode;
+static int stop;
+
+/* The read loop of fs_ext2_read(), with the filesystem lock let go of where
+   lock_mode says. */
+static ssize_t bench_read(bench_fh_t *fh, uint8_t *buf, size_t cnt) {
+    uint32_t bs = ext2_block_size(tfs), lbs = ext2_log_block_size(tfs);
+    uint32_t bo, len, first, freed;
+    uint8_t *block;
+    ssize_t rv;
+    int n, err;
+
+    pthread_mutex_lock(&fh->lock);
+    pthread_mutex_lock(&fs_lock);
+
+    if(fh->ptr >= fh->file->size)
+        cnt = 0;
+    else if(fh->ptr + cnt > fh->file->size)
+        cnt = fh->file->size - fh->ptr;
+
+    rv = (ssize_t)cnt;
+
+    while(cnt) {
+        bo = fh->ptr & (bs - 1);
+        freed = ext2_blocks_freed(tfs);
+        n = 0;
+
+        if(!bo && cnt >= bs && !((uintptr_t)buf & 31) &&
+           (n = ext2_inode_map_run(tfs, fh->file->inode, fh->ptr >> lbs,
+                                   cnt >> lbs, &first, &err)) < 0)
+            goto fail;
+
+        if(n > 0) {
+            len = (uint32_t)n << lbs;
+
+            if(lock_mode == LOCK_SPLIT)
+                pthread_mutex_unlock(&fs_lock);
+
+            err = -ext2_block_read_run_nc(tfs, first, (uint32_t)n, buf);
+
+            if(lock_mode == LOCK_SPLIT)
+                pthread_mutex_lock(&fs_lock);
+
+            if(err)
+                goto fail;
+        }
+        else {
+            len = bs - bo < cnt ? bs - bo : (uint32_t)cnt;
+
+            if(!(block = ext2_inode_pin_block(tfs, fh->file->inode,
+                                              fh->ptr >> lbs, &err)))
+                goto fail;
+
+            if(lock_mode == LOCK_SPLIT)
+                pthread_mutex_unlock(&fs_lock);
+
+            memcpy(buf, block + bo, len);
+
+            if(lock_mode == LOCK_SPLIT)
+                pthread_mutex_lock(&fs_lock);
+
+            ext2_block_unpin(tfs, block);
+        }
+
+        if(ext2_blocks_freed(tfs) != freed)
+            continue;
+
+        fh->ptr += len;
+        cnt -= len;
+        buf += len;
+
+        /* Give everyone else a go between pieces. */
+        if(lock_mode == LOCK_PIECE) {
+            pthread_mutex_unlock(&fs_lock);
+            pthread_mutex_lock(&fs_lock);
+        }
+    }
+
+    pthread_mutex_unlock(&fs_lock);
+    pthread_mutex_unlock(&fh->lock);
+    return rv;
+
+fail:
+    pthread_mutex_unlock(&fs_lock);
+    pthread_mutex_unlock(&fh->lock);
+    fprintf(stderr, "Read of %s failed: %s\n", fh->file->path, strerror(err));
+    return -1;
+}
+
+static void *stream_thd(void *arg) {
+    bench_thd_t *t = (bench_thd_t *)arg;
+    bench_file_t *f = t->fh.file;
+    uint64_t start = now_ns(), off = 0;
+    uint8_t *buf;
+    ssize_t n;
+
+    if(posix_memalign((void **)&buf, 32, SEQ_CHUNK)) {
+        t->failed = 1;
+        __atomic_store_n(&stop, 1, __ATOMIC_RELAXED);
+        return NULL;
+    }
+
+    t->fh.ptr = 0;
+
+    while((n = bench_read(&t->fh, buf, SEQ_CHUNK)) > 0) {
+        if(memcmp(buf, f->data + off, n)) {
+            fprintf(stderr, "Streamed data of %s is wrong at %" PRIu64 "\n",
+                    f->path, off);
+            t->failed = 1;
+            break;
+        }
+
+        off += n;
+        ++t->reads;
+    }
+
+    if(n < 0)
+        t->failed = 1;
+
+    t->ns = now_ns() - start;
+    __atomic_store_n(&stop, 1, __ATOMIC_RELAXED);
+    free(buf);
+    return NULL;
+}
+
+static void *small_thd(void *arg) {
+    bench_thd_t *t = (bench_thd_t *)arg;
+    bench_file_t *f = t->fh.file;
+    uint8_t buf[SMALL_READ];
+    uint64_t off;
+
+    while(!__atomic_load_n(&stop, __ATOMIC_RELAXED)) {
+        off = rnd_r(&t->seed) % (f->size - SMALL_READ);
+
+        pthread_mutex_lock(&t->fh.lock);
+        t->fh.ptr = off;
+        pthread_mutex_unlock(&t->fh.lock);
+
+        if(bench_read(&t->fh, buf, SMALL_READ) != SMALL_READ ||
+           memcmp(buf, f->data + off, SMALL_READ)) {
+            fprintf(stderr, "Small read of %s at %" PRIu64 " is wrong\n",
+                    f->path, off);
+            t->failed = 1;
+            break;
+        }
+
+        ++t->reads;
+    }
+
+    return NULL;
+}
+
+static int thread_run(bench_file_t *files, int nfiles, int nthreads) {
+    bench_thd_t *t;
+    uint64_t small = 0;
+    int i, failed = 0;
+
+    if(!(t = (bench_thd_t *)calloc(nthreads, sizeof(bench_thd_t))))
+        return -1;
+
+    stop = 0;
+
+    for(i = 0; i < nthreads; ++i) {
+        pthread_mutex_init(&t[i].fh.lock, NULL);
+        t[i].fh.file = i ? &files[1 + (i - 1) % (nfiles - 1)] : &files[0];
+        t[i].seed = 12345 + i;
+    }
+
+    /* Start the small readers first, so they're all going by the time the
+       stream starts. */
+    for(i = nthreads - 1; i >= 0; --i)
+        pthread_create(&t[i].thd, NULL, i ? small_thd : stream_thd, &t[i]);
+
+    for(i = 0; i < nthreads; ++i) {
+        pthread_join(t[i].thd, NULL);
+        pthread_mutex_destroy(&t[i].fh.lock);
+        failed |= t[i].failed;
+
+        if(i)
+            small += t[i].reads;
+    }
+
+    if(!failed) {
+        printf("%7d  %-7s %12.2f", nthreads, lock_names[lock_mode],
+               (double)files[0].size * 1000.0 / t[0].ns);
+
+        if(nthreads > 1)
+            printf(" %14.0f\n", small * 1e9 / t[0].ns);
+        else
+            printf(" %14s\n", "-");
+    }
+
+    free(t);
+    return failed ? -1 : 0;
+}
+
+static int thread_test(char *paths[], int nfiles, int max_threads) {
+    bench_file_t *files;
+    bench_fh_t fh;
+    uint32_t inode_num;
+    int i, n, rv = -1;
+
+    if(nfiles < 2) {
+        fprintf(stderr, "The thread test needs a file to stream and at least "
+                "one more for the small reads\n");
+        return -1;
+    }
+
+    if(!(tfs = ext2_fs_init_ex(&the_bd, EXT2FS_MNT_FLAG_RO, THREAD_CACHE))) {
+        fprintf(stderr, "Cannot mount the image\n");
+        return -1;
+    }
+
+    if(!(files = (bench_file_t *)calloc(nfiles, sizeof(bench_file_t))))
+        goto out;
+
+    /* Load every file up front, through the same read loop. The streamed file
+       goes into an aligned buffer, so it is read straight from the device and
+       stays out of the cache. The small files go into a misaligned one, so
+       they go through (and fill) the cache. */
+    lock_mode = LOCK_SPLIT;
+    pthread_mutex_init(&fh.lock, NULL);
+
+    for(i = 0; i < nfiles; ++i) {
+        files[i].path = paths[i];
+
+        if((n = ext2_inode_by_path(tfs, paths[i], &files[i].inode, &inode_num,
+                                   1, NULL))) {
+            fprintf(stderr, "Cannot find %s: %s\n", paths[i], strerror(-n));
+            goto out_files;
+        }
+
+        files[i].size = ext2_inode_size(files[i].inode);
+
+        if(i && files[i].size <= SMALL_READ) {
+            fprintf(stderr, "%s is too small\n", paths[i]);
+            goto out_files;
+        }
+
+        if(posix_memalign((void **)&files[i].data, 32, files[i].size + 1)) {
+            files[i].data = NULL;
+            goto out_files;
+        }
+
+        fh.file = &files[i];
+        fh.ptr = 0;
+
+        if(bench_read(&fh, files[i].data + !!i, files[i].size) !=
+           (ssize_t)files[i].size)
+            goto out_files;
+
+        if(i)
+            memmove(files[i].data, files[i].data + 1, files[i].size);
+    }
+
+    printf("Streaming %s alongside small reads of other files, %ld us + "
+           "%ld KB/s per request\n", paths[0], dev_latency / 1000, dev_rate);
+    printf("%7s  %-7s %12s %14s\n", "threads", "locking", "stream MB/s",
+           "small reads/s");
+
+    /* Double the number of threads each time, finishing with the most. */
+    for(n = 1; ; n *= 2) {
+        if(n > max_threads)
+            n = max_threads;
+
+        for(lock_mode = LOCK_WHOLE; lock_mode <= LOCK_SPLIT; ++lock_mode) {
+            if(thread_run(files, nfiles, n))
+                goto out_files;
+        }
+
+        if(n == max_threads)
+            break;
+    }
+
+    rv = 0;
+
+out_files:
+    for(i = 0; i < nfiles; ++i) {
+        if(files[i].inode)
+            ext2_inode_put(files[i].inode);
+
+        free(files[i].data);
+    }
+
+    pthread_mutex_destroy(&fh.lock);
+    free(files);
+out:
+    ext2_fs_shutdown(tfs);
+    return rv;
+}
+
+static void usage(const char *prog) {
+    fprintf(stderr, "Usage: %s [-cs] [-n reads] [-l usec] image path\n",
+            prog);
+    fprintf(stderr, "       %s -t threads [-l usec] [-r KB/s] image path "
+            "path...\n\n", prog);
+    fprintf(stderr, "  -c         Only run the cache test\n");
+    fprintf(stderr, "  -s         Only run the sequential test\n");
+    fprintf(stderr, "  -t threads Only run the thread test, with up to this "
+            "many threads\n");
+    fprintf(stderr, "  -n reads   Number of random reads per cache size "
+            "(default 200000)\n");
+    fprintf(stderr, "  -l usec    Extra time for each device request "
+            "(default 0)\n");
+    fprintf(stderr, "  -r KB/s    How fast the device moves data "
+            "(default unlimited)\n");
+    fprintf(stderr, "  image      An ext2 filesystem image\n");
+    fprintf(stderr, "  path       A file in the image to read, like /big\n");
+    exit(EXIT_FAILURE);
+}
+
+int main(int argc, char *argv[]) {
+    int reads = 200000, tests = 3, threads = 0;
+    int opt, rv = 0;
+
+    while((opt = getopt(argc, argv, "cst:n:l:r:")) != -1) {
+        switch(opt) {
+            case 'c':
+                tests = 1;
+                break;
+
+            case 's':
+                tests = 2;
+                break;
+
+            case 't':
+                tests = 4;
+                threads = atoi(optarg);
+                break;
+
+            case 'n':
+                reads = atoi(optarg);
+                break;
+
+            case 'l':
+                dev_latency = atol(optarg) * 1000;
+                break;
+
+            case 'r':
+                dev_rate = atol(optarg);
+                break;
+
+            default:
+                usage(argv[0]);
+        }
+    }
+
+    if(argc - optind < 2 || (tests != 4 && argc - optind != 2) ||
+       reads <= 0 || (tests == 4 && threads <= 0))
+        usage(argv[0]);
+
+    if(!(the_bd.dev_data = fopen(argv[optind], "rb"))) {
+        perror(argv[optind]);
+        return EXIT_FAILURE;
+    }
+
+    if(tests & 1)
+        rv = cache_test(argv[optind + 1], reads);
+
+    if(!rv && (tests & 2)) {
+        if(tests & 1)
+            printf("\n");
+
+        rv = seq_test(argv[optind + 1]);
+    }
+
+    if(tests & 4)
+        rv = thread_test(argv + optind + 1, argc - optind - 1, threads);
+
+    fclose((FILE *)the_bd.dev_data);
+    return rv ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -56,6 +56,12 @@
  * -A N,/name force named file(s) (shell globbing applied against the filenames)
  *       to be aligned on N bytes boundary
  * In both cases, N must be a power of two.
+ * -I    add a path index for KallistiOS' fs_romdisk, so that it doesn't have
+ *       to build one when the image is mounted
+ * -z    compress regular files for KallistiOS' fs_romdisk (in blocks of
+ *       8 KB, or the size given with -Z N)
+ * -U PATTERN leave files matching the pattern uncompressed (so that they can
+ *       be mmapped, for instance)
  */
 
 /*
@@ -74,6 +80,7 @@
 #include <unistd.h> /* Userland prototypes of the Unix std system calls    */
 #include <fcntl.h>  /* Flag value for file handling functions              */
 #include <time.h>
+#include <ctype.h>
 #if defined(_WIN32) && !defined(__CYGWIN__)
 #   include <getopt.h>
 #   include <winsock2.h>
@@ -138,6 +145,8 @@ struct filenode {
     unsigned int offset;
     unsigned int size;
     unsigned int pad;
+    char *data;
+    int spec;
 };
 
 struct aligns {
@@ -200,6 +209,7 @@ static int atoffs = 0;
 static int align = 16;
 struct aligns *alignlist = NULL;
 struct excludes *excludelist = NULL;
+struct excludes *rawlist = NULL;
 int realbase;
 
 /* helper function to match an exclusion or align pattern */
@@ -380,17 +390,27 @@ int dumpnode(struct filenode *node, FILE *f) {
     else if(S_ISREG(node->modes)) {
         int offset, len, fd, max, avail;
         ri.nextfh |= htonl(ROMFH_REG);
+        ri.spec = htonl(node->spec);
         dumpri(&ri, node, f);
         offset = 0;
         max = node->size;
-        /* XXX warn about size mismatch */
-        fd = open(node->realname, O_RDONLY
+
+        /* Compressed and generated files are already in memory */
+        if(node->data) {
+            dumpdata(node->data, max, f);
+            offset = max;
+            fd = -1;
+        }
+        else {
+            /* XXX warn about size mismatch */
+            fd = open(node->realname, O_RDONLY
 #ifdef O_BINARY
-                  | O_BINARY
+                      | O_BINARY
 #endif
-                 );
+                     );
+        }
 
-        if(fd) {
+        if(fd >= 0) {
             while(offset < max) {
                 avail = max - offset < sizeof(bigbuf) ? max - offset : sizeof(bigbuf);
                 len = read(fd, bigbuf, avail);
@@ -542,6 +562,8 @@ struct filenode *newnode(const char *base, const char *name, int curroffset) {
     node->orig_link = NULL;
     node->offset = curroffset;
     node->pad = 0;
+    node->data = NULL;
+    node->spec = 0;
 
     return node;
 }
@@ -592,12 +614,176 @@ int alignnode(struct filenode *node, int curroffset, int extraspace) {
     return curroffset;
 }
 
+/* Compressed files for KallistiOS' fs_romdisk. Regular files are split into
+ * blocks which are compressed separately with LZ4, so that they can be read
+ * from anywhere without decompressing everything before. See
+ * kernel/fs/fs_romdisk.c for the format.
+ */
+
+#define ZSPEC_LZ4   1
+#define ZMAGIC      "-rdzlz4-"
+
+#define LZ4_HASHLOG 12
+#define LZ4_MINMATCH 4
+#define LZ4_MFLIMIT 12      /* No match may start in the last 12 bytes */
+#define LZ4_LASTLITERALS 5  /* The last 5 bytes are always literals */
+
+static int compress = 0;
+static int zblock = 8192;
+static long long zin = 0, zout = 0;
+
+static uint32_t read32(const uint8_t *p) {
+    uint32_t v;
+    memcpy(&v, p, 4);
+    return v;
+}
+
+static uint8_t *lz4_len(uint8_t *op, int len) {
+    while(len >= 255) {
+        *op++ = 255;
+        len -= 255;
+    }
+
+    *op++ = len;
+    return op;
+}
+
+static uint8_t *lz4_seq(uint8_t *op, const uint8_t *lit, int litlen, int off,
+                        int mlen) {
+    uint8_t *tok = op++;
+
+    *tok = (litlen >= 15 ? 15 : litlen) << 4;
+
+    if(litlen >= 15)
+        op = lz4_len(op, litlen - 15);
+
+    memcpy(op, lit, litlen);
+    op += litlen;
+
+    if(mlen) {
+        *op++ = off & 0xff;
+        *op++ = off >> 8;
+        mlen -= LZ4_MINMATCH;
+        *tok |= mlen >= 15 ? 15 : mlen;
+
+        if(mlen >= 15)
+            op = lz4_len(op, mlen - 15);
+    }
+
+    return op;
+}
+
+/* Compress a block with a simple greedy LZ4 compressor. dst must have room for
+ * at least len + len / 255 + 16 bytes. Returns the compressed size. */
+int lz4_compress(const uint8_t *src, int len, uint8_t *dst) {
+    int table[1 << LZ4_HASHLOG];
+    int ip = 0, anchor = 0, ref, mlen, i;
+    uint32_t seq, h;
+    uint8_t *op = dst;
+
+    for(i = 0; i < (1 << LZ4_HASHLOG); i++)
+        table[i] = -1;
+
+    while(ip < len - LZ4_MFLIMIT) {
+        seq = read32(src + ip);
+        h = (seq * 2654435761U) >> (32 - LZ4_HASHLOG);
+        ref = table[h];
+        table[h] = ip;
+
+        if(ref < 0 || ip - ref > 65535 || read32(src + ref) != seq) {
+            ip++;
+            continue;
+        }
+
+        mlen = LZ4_MINMATCH;
+
+        while(ip + mlen < len - LZ4_LASTLITERALS &&
+                src[ref + mlen] == src[ip + mlen])
+            mlen++;
+
+        op = lz4_seq(op, src + anchor, ip - anchor, ip - ref, mlen);
+        ip += mlen;
+        anchor = ip;
+    }
+
+    op = lz4_seq(op, src + anchor, len - anchor, 0, 0);
+    return op - dst;
+}
+
+static void put32(uint8_t *p, uint32_t v) {
+    v = htonl(v);
+    memcpy(p, &v, 4);
+}
+
+/* Read a file and compress it. Returns the compressed data (and its size in
+ * *outlen) or NULL if compressing it doesn't save anything. */
+char *compressfile(const char *name, int size, int *outlen) {
+    uint8_t *in, *out, *p;
+    int blocks = (size + zblock - 1) / zblock, i, raw, clen, total;
+    FILE *f;
+
+    in = malloc(size);
+    out = malloc(20 + blocks * 4 + size + blocks * (zblock / 255 + 24));
+
+    if(!in || !out) {
+        fprintf(stderr, "out of memory\n");
+        exit(1);
+    }
+
+    if(!(f = fopen(name, "rb")) || fread(in, 1, size, f) != (size_t)size) {
+        fprintf(stderr, "can't read '%s', not compressing it\n", name);
+
+        if(f)
+            fclose(f);
+
+        free(in);
+        free(out);
+        return NULL;
+    }
+
+    fclose(f);
+
+    memcpy(out, ZMAGIC, 8);
+    put32(out + 8, size);
+    put32(out + 12, zblock);
+    put32(out + 16, blocks);
+    p = out + 20 + blocks * 4;
+
+    for(i = 0; i < blocks; i++) {
+        raw = size - i * zblock < zblock ? size - i * zblock : zblock;
+        put32(out + 20 + i * 4, p - out);
+        put32(p, raw);
+        clen = lz4_compress(in + i * zblock, raw, p + 8);
+
+        /* Store the block as is if it didn't get any smaller */
+        if(clen >= raw) {
+            memcpy(p + 8, in + i * zblock, raw);
+            clen = raw;
+        }
+
+        put32(p + 4, clen);
+        p += 8 + clen;
+    }
+
+    free(in);
+    total = p - out;
+
+    if(total >= size) {
+        free(out);
+        return NULL;
+    }
+
+    *outlen = total;
+    return (char *)out;
+}
+
 int processdir(int level, const char *base, const char *dirname, struct stat *sb,
                struct filenode *dir, struct filenode *root, int curroffset) {
     DIR *dirfd;
     struct dirent *dp;
     struct filenode *n, *link;
     struct excludes *pe;
+    int zsize;
 
     if(level <= 1) {
         /* Ok, to make sure . and .. are handled correctly
@@ -744,6 +930,21 @@ int processdir(int level, const char *base, const char *dirname, struct stat *sb
         if(S_ISREG(sb->st_mode)) {
             curroffset = alignnode(n, curroffset, spaceneeded(n));
             n->size = sb->st_size;
+
+            if(compress && n->size) {
+                for(pe = rawlist; pe; pe = pe->next) {
+                    if(!nodematch(pe->pattern, n))
+                        break;
+                }
+
+                if(!pe && (n->data = compressfile(n->realname, n->size,
+                                                  &zsize))) {
+                    zin += n->size;
+                    zout += zsize;
+                    n->size = zsize;
+                    n->spec = ZSPEC_LZ4;
+                }
+            }
         }
         else
             curroffset = alignnode(n, curroffset, 0);
@@ -779,6 +980,146 @@ int processdir(int level, const char *base, const char *dirname, struct stat *sb
     return curroffset;
 }
 
+/* Path index for KallistiOS' fs_romdisk. This is a file in the root directory
+ * holding a table of hashes of the full (lowercased) paths of every file and
+ * directory, sorted by hash, so that fs_romdisk can find things without
+ * walking the directories. See kernel/fs/fs_romdisk.c for the format.
+ */
+
+#define INDEX_NAME  ".romdisk_index"
+#define INDEX_MAGIC "-rdindex"
+#define INDEX_HASH  1
+#define INDEX_ROOT  0xffffffff
+
+#define FNV_BASIS   2166136261U
+#define FNV_PRIME   16777619U
+
+struct indexent {
+    uint32_t hash;
+    uint32_t offset;
+    uint32_t parent;
+    uint32_t order;
+};
+
+uint32_t indexhash(uint32_t h, const char *s) {
+    while(*s) {
+        h ^= (uint8_t)tolower((unsigned char)*s++);
+        h *= FNV_PRIME;
+    }
+
+    return h;
+}
+
+/* Returns the romfs type of the node (masked to the bits fs_romdisk looks at
+   when finding things) or 0 if it doesn't go in the index. */
+int indextype(struct filenode *node) {
+    if(node->orig_link ||
+            !strcmp(node->name, ".") || !strcmp(node->name, ".."))
+        return 0;
+
+    if(S_ISDIR(node->modes))
+        return ROMFH_DIR;
+    else if(S_ISREG(node->modes))
+        return ROMFH_REG;
+#if !defined(_WIN32) || defined(__CYGWIN__)
+    else if(S_ISCHR(node->modes))
+        return ROMFH_CHR & 3;
+    else if(S_ISSOCK(node->modes))
+        return ROMFH_SCK & 3;
+#endif
+
+    return 0;
+}
+
+int countindex(struct filenode *node) {
+    struct filenode *p;
+    int rv = 0;
+
+    for(p = node->dirlist.head; p->next; p = p->next) {
+        if(indextype(p))
+            rv += 1 + countindex(p);
+    }
+
+    return rv;
+}
+
+int cmpindex(const void *a, const void *b) {
+    const struct indexent *x = a, *y = b;
+
+    if(x->hash != y->hash)
+        return x->hash < y->hash ? -1 : 1;
+
+    return x->order < y->order ? -1 : (x->order > y->order);
+}
+
+/* Build the contents of the index file. This has to be done after the offsets
+ * of everything are known. Directories are visited breadth first, which keeps
+ * entries with the same hash in the order fs_romdisk would find them in. */
+char *makeindex(struct filenode *root, int count) {
+    struct indexent *ents;
+    struct filenode **nodes, *dir, *p;
+    uint32_t *pos, *out, h;
+    int n = 0, i = -1, j, type;
+    char *rv;
+
+    ents = malloc(count * sizeof(*ents) + 1);
+    nodes = malloc(count * sizeof(*nodes) + 1);
+    pos = malloc(count * sizeof(*pos) + 1);
+    rv = malloc(16 + count * 12);
+
+    if(!ents || !nodes || !pos || !rv) {
+        fprintf(stderr, "out of memory\n");
+        exit(1);
+    }
+
+    dir = root;
+
+    for(;;) {
+        for(p = dir->dirlist.head; p->next; p = p->next) {
+            if(!(type = indextype(p)))
+                continue;
+
+            h = i < 0 ? FNV_BASIS : indexhash(ents[i].hash, "/");
+            ents[n].hash = indexhash(h, p->name);
+            ents[n].offset = p->offset | type;
+            ents[n].parent = i < 0 ? INDEX_ROOT : (uint32_t)i;
+            ents[n].order = n;
+            nodes[n++] = p;
+        }
+
+        do {
+            if(++i >= n)
+                goto done;
+        } while(!S_ISDIR(nodes[i]->modes));
+
+        dir = nodes[i];
+    }
+
+done:
+    qsort(ents, n, sizeof(*ents), cmpindex);
+
+    for(j = 0; j < n; j++)
+        pos[ents[j].order] = j;
+
+    memcpy(rv, INDEX_MAGIC, 8);
+    out = (uint32_t *)(rv + 8);
+    *out++ = htonl(n);
+    *out++ = htonl(INDEX_HASH);
+
+    for(j = 0; j < n; j++) {
+        *out++ = htonl(ents[j].hash);
+        *out++ = htonl(ents[j].offset);
+        *out++ = htonl(ents[j].parent == INDEX_ROOT ? INDEX_ROOT :
+                       pos[ents[j].parent]);
+    }
+
+    free(ents);
+    free(nodes);
+    free(pos);
+
+    return rv;
+}
+
 void showhelp(const char *argv0) {
     printf("genromfs %s\n", VERSION);
     printf("Usage: %s [OPTIONS] -f IMAGE\n", argv0);
@@ -791,6 +1132,10 @@ void showhelp(const char *argv0) {
     printf("  -a ALIGN               Align regular file data to ALIGN bytes\n");
     printf("  -A ALIGN,PATTERN       Align all objects matching pattern to at least ALIGN bytes\n");
     printf("  -x PATTERN             Exclude all objects matching pattern\n");
+    printf("  -I                     Add a path index for KallistiOS' fs_romdisk\n");
+    printf("  -z                     Compress files for KallistiOS' fs_romdisk\n");
+    printf("  -Z SIZE                Compress files in blocks of SIZE bytes (default 8192)\n");
+    printf("  -U PATTERN             Leave all files matching pattern uncompressed\n");
     printf("  -h                     Show this help\n");
     printf("\n");
     printf("Report bugs to chexum@shadow.banki.hu\n");
@@ -802,8 +1147,9 @@ int main(int argc, char *argv[]) {
     char *outf = NULL;
     char *volname = NULL;
     int verbose = 0;
+    int index = 0;
     char buf[256];
-    struct filenode *root;
+    struct filenode *root, *idx, *p2;
     struct stat sb;
     int lastoff;
     int i;
@@ -812,7 +1158,7 @@ int main(int argc, char *argv[]) {
     struct excludes *pe, *pe2;
     FILE *f;
 
-    while((c = getopt(argc, argv, "V:vd:f:ha:A:x:")) != EOF) {
+    while((c = getopt(argc, argv, "V:vd:f:ha:A:x:IzZ:U:")) != EOF) {
         switch(c) {
             case 'd':
                 dir = optarg;
@@ -826,6 +1172,28 @@ int main(int argc, char *argv[]) {
             case 'v':
                 verbose = 1;
                 break;
+            case 'I':
+                index = 1;
+                break;
+            case 'z':
+                compress = 1;
+                break;
+            case 'Z':
+                compress = 1;
+                zblock = strtoul(optarg, NULL, 0);
+
+                if(zblock < 1024 || zblock > 1048576 || (zblock & (zblock - 1))) {
+                    fprintf(stderr, "Block size has to be a power of two between 1024 and 1048576 bytes\n");
+                    exit(1);
+                }
+
+                break;
+            case 'U':
+                pe = (struct excludes *)malloc(sizeof(*pe) + strlen(optarg) + 1);
+                pe->next = rawlist;
+                strcpy(pe->pattern, optarg);
+                rawlist = pe;
+                break;
             case 'h':
                 showhelp(argv[0]);
                 exit(0);
@@ -918,9 +1286,34 @@ int main(int argc, char *argv[]) {
         return 1;
     }
 
+    if(index) {
+        for(p2 = root->dirlist.head; p2->next; p2 = p2->next) {
+            if(!strcmp(p2->name, INDEX_NAME)) {
+                fprintf(stderr, "%s already exists, can't add an index\n",
+                        p2->realname);
+                return 1;
+            }
+        }
+
+        /* The index goes at the end of the root directory, as the last
+         * thing in the image. */
+        i = countindex(root);
+        idx = newnode(dir, INDEX_NAME, lastoff);
+        setnode(idx, -1, -1, S_IFREG | 0444);
+        lastoff = alignnode(idx, lastoff, spaceneeded(idx));
+        idx->size = 16 + i * 12;
+        lastoff += spaceneeded(idx);
+        idx->data = makeindex(root, i);
+        append(&root->dirlist, idx);
+    }
+
     if(verbose)
         shownode(0, root, stderr);
 
+    if(compress && zin)
+        fprintf(stderr, "compressed %lld bytes of files to %lld bytes (%lld bytes saved)\n",
+                zin, zout, zin - zout);
+
     if(dumpall(root, lastoff, f)) {
         fprintf(stderr, "Error while dumping!\n");
         return 1;
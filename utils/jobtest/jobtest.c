@@ -0,0 +1,321 @@
+/* KallistiOS ##version##
+
+   jobtest.c
+   Copyright (C) 2024 The KallistiOS Team
+
+   Checks the queueing and counter logic of the KOS job system
+   (kernel/thread/jobq.h) on a PC. There are no real threads here: a loop
+   plays the part of the workers, randomly submitting jobs (from outside the
+   pool or from inside a running job), having idle workers pick up jobs and
+   having busy ones finish them. After each step it checks that:
+
+     - jobs submitted from a job go on the queue of the worker running it,
+       and others are dealt out to the workers in turn,
+     - a job queued for a busy worker wakes an idle one, if there is one,
+     - a worker always picks a job from the highest priority lane that has
+       anything in it, trying its own queue first,
+     - a job held back on a counter isn't queued until the counter drops to
+       zero, and is queued as soon as it does,
+     - every job submitted runs exactly once, and every counter gets back to
+       zero once everything has run.
+
+   Counters are only ever waited on by jobs counted on a later counter, so
+   there are no cycles of jobs waiting on each other.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <sys/queue.h>
+
+#define KOS_JOB_LANE_COUNT  3
+
+typedef struct kos_job_pool kos_job_pool_t;
+
+/* These match the ones in <kos/jobs.h>. */
+typedef struct kos_job_counter {
+    volatile int count;
+    SLIST_HEAD(kos_job_waiters, kos_job) waiting;
+} kos_job_counter_t;
+
+typedef struct kos_job {
+    void (*routine)(void *data);
+    void *data;
+    int lane;
+    kos_job_pool_t *pool;
+    kos_job_counter_t *done;
+    STAILQ_ENTRY(kos_job) entry;
+    SLIST_ENTRY(kos_job) wait_entry;
+} kos_job_t;
+
+#include "../../kernel/thread/jobq.h"
+
+#define WORKERS     4
+#define JOBS        64
+#define COUNTERS    6
+
+enum { FREE, HELD, QUEUED, RUNNING };
+
+static kos_job_pool_t pool;
+static jobq_worker_t workers[WORKERS];
+static kos_job_t jobs[JOBS];
+static int state[JOBS];
+static int held_on[JOBS];
+static int submits[JOBS], runs[JOBS];
+static kos_job_counter_t counters[COUNTERS];
+static kos_job_t *running[WORKERS];
+
+/* The worker the current "thread" is, or -1. */
+static int current = -1;
+static int last_wake;
+static long step;
+
+static int jobq_self(kos_job_pool_t *p) {
+    return p == &pool ? current : -1;
+}
+
+static void jobq_wake(kos_job_pool_t *p, int worker) {
+    (void)p;
+    last_wake = worker;
+}
+
+static void fail(const char *msg) {
+    fprintf(stderr, "step %ld: %s\n", step, msg);
+    exit(1);
+}
+
+static void nop(void *data) {
+    (void)data;
+}
+
+static kos_job_t *queue_tail(int w, int lane) {
+    kos_job_t *job, *last = NULL;
+
+    STAILQ_FOREACH(job, &workers[w].lanes[lane], entry)
+        last = job;
+
+    return last;
+}
+
+static int first_idle(void) {
+    int i;
+
+    for(i = 0; i < WORKERS; ++i) {
+        if(!workers[i].busy)
+            return i;
+    }
+
+    return -1;
+}
+
+static void submit(void) {
+    int i, j = rand() % JOBS, d, a, w, expect, idle;
+    kos_job_counter_t *done, *after;
+
+    /* Find a free job. */
+    for(i = 0; i < JOBS && state[j] != FREE; ++i)
+        j = (j + 1) % JOBS;
+
+    if(state[j] != FREE)
+        return;
+
+    /* Submit from outside the pool, or from one of the running jobs. */
+    current = -1;
+    w = rand() % WORKERS;
+
+    if(rand() & 1 && running[w])
+        current = w;
+
+    d = rand() % (COUNTERS + 1);
+    a = d > 1 ? rand() % d : 0;
+    done = d ? &counters[d - 1] : NULL;
+    after = a ? &counters[a - 1] : NULL;
+    expect = current >= 0 ? current : pool.next;
+    idle = first_idle();
+
+    jobs[j].routine = nop;
+    jobs[j].lane = rand() % KOS_JOB_LANE_COUNT;
+    ++submits[j];
+    last_wake = -1;
+
+    if(after && after->count) {
+        jobq_submit(&pool, &jobs[j], done, after);
+        state[j] = HELD;
+        held_on[j] = a - 1;
+
+        if(SLIST_FIRST(&after->waiting) != &jobs[j])
+            fail("held job isn't waiting on its counter");
+
+        if(last_wake != -1)
+            fail("a worker was woken for a held job");
+    }
+    else {
+        jobq_submit(&pool, &jobs[j], done, after);
+        state[j] = QUEUED;
+
+        if(queue_tail(expect, jobs[j].lane) != &jobs[j])
+            fail("job was queued for the wrong worker");
+
+        if(current < 0 && pool.next != (expect + 1) % WORKERS)
+            fail("jobs from outside aren't dealt out in turn");
+
+        if(last_wake != (workers[expect].busy && idle >= 0 ? idle : expect))
+            fail("the wrong worker was woken");
+    }
+
+    current = -1;
+}
+
+static void pick(int w) {
+    int lane, i, best = KOS_JOB_LANE_COUNT, from = -1;
+    kos_job_t *job, *expect = NULL;
+
+    /* Work out what should come next: the highest priority lane first, and
+       our own queue before the others. */
+    for(lane = 0; lane < KOS_JOB_LANE_COUNT && best == KOS_JOB_LANE_COUNT;
+        ++lane) {
+        for(i = 0; i < WORKERS; ++i) {
+            from = (w + i) % WORKERS;
+
+            if((expect = STAILQ_FIRST(&workers[from].lanes[lane]))) {
+                best = lane;
+                break;
+            }
+        }
+    }
+
+    job = jobq_next(&pool, w);
+
+    if(job != expect)
+        fail("worker picked the wrong job");
+
+    if(!job)
+        return;
+
+    if(state[job - jobs] != QUEUED)
+        fail("worker picked a job that wasn't queued");
+
+    state[job - jobs] = RUNNING;
+    ++runs[job - jobs];
+    running[w] = job;
+    workers[w].busy = true;
+}
+
+static void finish(int w) {
+    kos_job_t *job = running[w];
+    kos_job_counter_t *done = job->done;
+    int i, c;
+
+    running[w] = NULL;
+    workers[w].busy = false;
+    state[job - jobs] = FREE;
+
+    if(!done)
+        return;
+
+    current = w;
+
+    if(jobq_counter_dec(done) != !done->count)
+        fail("counter_dec got the count wrong");
+
+    if(done->count < 0)
+        fail("counter went negative");
+
+    current = -1;
+    c = done - counters;
+
+    for(i = 0; i < JOBS; ++i) {
+        if(state[i] != HELD || held_on[i] != c)
+            continue;
+
+        if(!done->count)
+            state[i] = QUEUED;
+    }
+
+    if(!done->count && !SLIST_EMPTY(&done->waiting))
+        fail("counter reached zero with jobs still waiting on it");
+}
+
+/* Check that every job the test thinks is queued is on exactly one queue,
+   and nothing else is. */
+static void check_queues(void) {
+    int w, lane, i, seen[JOBS] = { 0 };
+    kos_job_t *job;
+
+    for(w = 0; w < WORKERS; ++w) {
+        for(lane = 0; lane < KOS_JOB_LANE_COUNT; ++lane) {
+            STAILQ_FOREACH(job, &workers[w].lanes[lane], entry) {
+                if(job->lane != lane)
+                    fail("job is in the wrong lane");
+
+                ++seen[job - jobs];
+            }
+        }
+    }
+
+    for(i = 0; i < JOBS; ++i) {
+        if(seen[i] != (state[i] == QUEUED))
+            fail("queues don't match what was submitted");
+    }
+}
+
+int main(int argc, char *argv[]) {
+    long steps = argc > 1 ? atol(argv[1]) : 1000000, ran = 0;
+    int i, w, op;
+
+    srand(argc > 2 ? atoi(argv[2]) : 1);
+    jobq_init(&pool, workers, WORKERS);
+
+    for(i = 0; i < COUNTERS; ++i)
+        SLIST_INIT(&counters[i].waiting);
+
+    for(step = 0; step < steps; ++step) {
+        op = rand() % 3;
+        w = rand() % WORKERS;
+
+        if(op == 0)
+            submit();
+        else if(op == 1 && !running[w])
+            pick(w);
+        else if(op == 2 && running[w])
+            finish(w);
+
+        if(!(step % 100))
+            check_queues();
+    }
+
+    /* Let everything run to the end. */
+    for(;;) {
+        for(w = 0; w < WORKERS; ++w) {
+            if(running[w])
+                finish(w);
+        }
+
+        for(w = 0; w < WORKERS; ++w)
+            pick(w);
+
+        for(w = 0; w < WORKERS && !running[w]; ++w)
+            ;
+
+        if(w == WORKERS)
+            break;
+    }
+
+    check_queues();
+
+    for(i = 0; i < JOBS; ++i) {
+        if(state[i] != FREE || runs[i] != submits[i])
+            fail("a job didn't run exactly once for each time it was "
+                 "submitted");
+
+        ran += runs[i];
+    }
+
+    for(i = 0; i < COUNTERS; ++i) {
+        if(counters[i].count)
+            fail("a counter didn't get back to zero");
+    }
+
+    printf("%ld steps, %ld jobs run, all checks passed\n", steps, ran);
+    return 0;
+}
@@ -0,0 +1,577 @@
+/* KallistiOS ##version##
+
+   mutexbench.c
+   Copyright (C) 2024 The KallistiOS Team
+
+   Runs the same measurements as examples/dreamcast/basic/threading/mutex_bench
+   on a PC, against the real kernel/thread/mutex.c (or whichever version of it
+   MUTEX_C names, so an older one can be compared with the current one).
+
+   There's only one host thread. A small scheduler stands in for the KOS one:
+   threads are switched with ucontext, the highest priority ready thread runs,
+   ones of equal priority take turns, and a timer signal preempts the running
+   thread THD_SCHED_HZ times per second unless "interrupts" are disabled, in
+   which case the switch happens once they're enabled again. genwait and the
+   priority inheritance calls are simple versions of the kernel ones, enough
+   for a single mutex.
+
+   The figures are host nanoseconds, including the cost of switching contexts
+   with the C library (which makes system calls to swap signal masks), so only
+   compare them with each other, not with the ones from a Dreamcast. A PC gets
+   through a lock/unlock pair many times faster than a Dreamcast does, so the
+   timer runs faster than the usual THD_SCHED_HZ to preempt about as many
+   critical sections.
+
+   Finally, mutex_lock_timed() is given a short timeout on a mutex that a
+   thread of the same priority holds for a long time, to check how long it
+   really takes to give up.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <time.h>
+#include <ucontext.h>
+#include <sys/time.h>
+#include <sys/queue.h>
+
+#define UNUSED __attribute__((unused))
+
+#define ITERATIONS      1000000
+#define THREADS         4
+#define WORK            16
+
+#define THD_SCHED_HZ    1000
+#define THD_STACK_SIZE  65536
+#define PRIO_DEFAULT    10
+
+/* What mutex.c needs from <kos/thread.h> and friends. The real headers are
+   found on the include path, but their guards are defined here so they don't
+   bring in the rest of KOS. */
+#define __KOS_MUTEX_H
+#define __KOS_GENWAIT_H
+#define __KOS_DBGLOG_H
+#define __KOS_LOCKSTAT_H
+#define __ARCH_IRQ_H
+#define __ARCH_TIMER_H
+
+#define __likely(x)     __builtin_expect(!!(x), 1)
+
+typedef int prio_t;
+
+typedef enum {
+    STATE_RUNNING,
+    STATE_READY,
+    STATE_WAIT,
+    STATE_FINISHED
+} kthread_state_t;
+
+typedef struct kthread {
+    TAILQ_ENTRY(kthread) thdq;
+    LIST_ENTRY(kthread) pi_waiter;
+    struct kthread_pi *pi_blocked;
+    ucontext_t context;
+    void *stack;
+    kthread_state_t state;
+    prio_t prio, base_prio;
+    const void *wait_obj;
+    uint64_t wait_deadline;
+    bool timed_out;
+    void *(*routine)(void *param);
+    void *param, *rv;
+} kthread_t;
+
+typedef struct kthread_pi {
+    kthread_t *owner;
+    LIST_HEAD(kthread_pi_waiters, kthread) waiters;
+} kthread_pi_t;
+
+typedef struct {
+    int type;
+    int dynamic;
+    kthread_t *holder;
+    int count;
+    kthread_pi_t pi;
+} mutex_t;
+
+#define MUTEX_TYPE_NORMAL       0
+#define MUTEX_TYPE_OLDNORMAL    1
+#define MUTEX_TYPE_ERRORCHECK   2
+#define MUTEX_TYPE_RECURSIVE    3
+
+#define MUTEX_INITIALIZER   { MUTEX_TYPE_NORMAL, 0, NULL, 0, { NULL, { NULL } } }
+
+int mutex_lock(mutex_t *m);
+int mutex_lock_timed(mutex_t *m, int timeout);
+int mutex_is_locked(mutex_t *m);
+int mutex_trylock(mutex_t *m);
+int mutex_unlock(mutex_t *m);
+
+#define DBG_WARNING     4
+#define dbglog(level, ...)  fprintf(stderr, __VA_ARGS__)
+
+#define LOCKSTAT_MUTEX  0
+
+static inline uint64_t lockstat_wait_start(void) {
+    return 0;
+}
+
+static inline void lockstat_acquire(const void *lock UNUSED, int type UNUSED,
+                                    uint64_t wait_start UNUSED) {
+}
+
+static inline void lockstat_timeout(const void *lock UNUSED, int type UNUSED,
+                                    uint64_t wait_start UNUSED) {
+}
+
+static inline void lockstat_release(const void *lock UNUSED) {
+}
+
+static kthread_t *thd_current;
+
+/* Set while "interrupts" are disabled, and whether a timer tick came in while
+   they were. */
+static volatile sig_atomic_t irq_off, tick_pending;
+
+static void thd_schedule(void);
+
+static inline int irq_disable(void) {
+    int old = irq_off;
+
+    irq_off = 1;
+    __asm__ __volatile__("" : : : "memory");
+    return old;
+}
+
+static inline void irq_restore(int old) {
+    __asm__ __volatile__("" : : : "memory");
+
+    if(!old && tick_pending) {
+        tick_pending = 0;
+        thd_schedule();
+    }
+
+    irq_off = old;
+}
+
+static inline void __irq_scoped_cleanup(int *state) {
+    irq_restore(*state);
+}
+
+#define ___irq_disable_scoped(l) \
+    int __scoped_irq_##l __attribute__((cleanup(__irq_scoped_cleanup))) = \
+        irq_disable()
+#define __irq_disable_scoped(l) ___irq_disable_scoped(l)
+#define irq_disable_scoped() __irq_disable_scoped(__LINE__)
+
+static inline int irq_inside_int(void) {
+    return 0;
+}
+
+static uint64_t timer_ns_gettime64(void) {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static uint64_t timer_ms_gettime64(void) {
+    return timer_ns_gettime64() / 1000000;
+}
+
+static void thd_pass(void);
+static void thd_pi_acquire(kthread_pi_t *pi, kthread_t *thd);
+static void thd_pi_release(kthread_pi_t *pi);
+static void thd_pi_block(kthread_pi_t *pi);
+static void thd_pi_unblock(kthread_t *thd);
+static int genwait_wait(void *obj, const char *mesg, int timeout,
+                        void (*callback)(void *));
+static int genwait_wake_one(void *obj);
+
+#ifndef MUTEX_C
+#define MUTEX_C "../../kernel/thread/mutex.c"
+#endif
+
+#include MUTEX_C
+
+/* The scheduler. Threads that are ready to run are on runq, and ones waiting
+   on something (including a timeout) are on waitq, both in the order they got
+   there. Everything here assumes interrupts are disabled. */
+static TAILQ_HEAD(, kthread) runq = TAILQ_HEAD_INITIALIZER(runq);
+static TAILQ_HEAD(, kthread) waitq = TAILQ_HEAD_INITIALIZER(waitq);
+static kthread_t main_thd;
+
+static void thd_make_ready(kthread_t *thd) {
+    thd->state = STATE_READY;
+    TAILQ_INSERT_TAIL(&runq, thd, thdq);
+}
+
+static void thd_wake(kthread_t *thd, bool timed_out) {
+    TAILQ_REMOVE(&waitq, thd, thdq);
+    thd->wait_obj = NULL;
+    thd->timed_out = timed_out;
+    thd_make_ready(thd);
+}
+
+static void thd_check_timeouts(void) {
+    kthread_t *thd, *next;
+    uint64_t now = timer_ms_gettime64();
+
+    for(thd = TAILQ_FIRST(&waitq); thd; thd = next) {
+        next = TAILQ_NEXT(thd, thdq);
+
+        if(thd->wait_deadline && thd->wait_deadline <= now)
+            thd_wake(thd, true);
+    }
+}
+
+/* Put the current thread at the back of the line (unless it's waiting or
+   done) and switch to the highest priority one that's ready. If nothing is,
+   idle until some timeout runs out. */
+static void thd_schedule(void) {
+    kthread_t *me = thd_current, *thd, *next;
+
+    if(me->state == STATE_RUNNING)
+        thd_make_ready(me);
+
+    for(;;) {
+        thd_check_timeouts();
+        next = NULL;
+
+        TAILQ_FOREACH(thd, &runq, thdq) {
+            if(!next || thd->prio < next->prio)
+                next = thd;
+        }
+
+        if(next)
+            break;
+
+        if(TAILQ_EMPTY(&waitq)) {
+            fprintf(stderr, "Every thread is blocked for good\n");
+            exit(1);
+        }
+    }
+
+    TAILQ_REMOVE(&runq, next, thdq);
+    next->state = STATE_RUNNING;
+    thd_current = next;
+
+    if(next != me)
+        swapcontext(&me->context, &next->context);
+}
+
+static void thd_tick(int sig UNUSED) {
+    if(irq_off) {
+        tick_pending = 1;
+        return;
+    }
+
+    irq_off = 1;
+    thd_schedule();
+    irq_off = 0;
+}
+
+static void thd_pass(void) {
+    irq_disable_scoped();
+    thd_schedule();
+}
+
+static void thd_entry(void) {
+    kthread_t *me = thd_current;
+
+    irq_off = 0;
+    me->rv = me->routine(me->param);
+
+    irq_disable();
+    me->state = STATE_FINISHED;
+
+    while(genwait_wake_one(me))
+        ;
+
+    thd_schedule();
+}
+
+static kthread_t *thd_create_prio(prio_t prio, void *(*routine)(void *),
+                                  void *param) {
+    kthread_t *thd = calloc(1, sizeof(kthread_t));
+
+    thd->stack = malloc(THD_STACK_SIZE);
+    thd->prio = thd->base_prio = prio;
+    thd->routine = routine;
+    thd->param = param;
+
+    getcontext(&thd->context);
+    thd->context.uc_stack.ss_sp = thd->stack;
+    thd->context.uc_stack.ss_size = THD_STACK_SIZE;
+    thd->context.uc_link = NULL;
+    makecontext(&thd->context, thd_entry, 0);
+
+    irq_disable_scoped();
+    thd_make_ready(thd);
+    return thd;
+}
+
+static void thd_join(kthread_t *thd) {
+    {
+        irq_disable_scoped();
+
+        while(thd->state != STATE_FINISHED)
+            genwait_wait(thd, "thd_join", 0, NULL);
+    }
+
+    free(thd->stack);
+    free(thd);
+}
+
+static int thd_sleep_obj;
+
+static void thd_sleep(int ms) {
+    irq_disable_scoped();
+    genwait_wait(&thd_sleep_obj, "thd_sleep", ms, NULL);
+}
+
+static int genwait_wait(void *obj, const char *mesg UNUSED, int timeout,
+                        void (*callback)(void *) UNUSED) {
+    kthread_t *me = thd_current;
+
+    me->state = STATE_WAIT;
+    me->wait_obj = obj;
+    me->wait_deadline = timeout ? timer_ms_gettime64() + timeout : 0;
+    me->timed_out = false;
+    TAILQ_INSERT_TAIL(&waitq, me, thdq);
+
+    thd_schedule();
+
+    if(me->timed_out) {
+        errno = EAGAIN;
+        return -1;
+    }
+
+    return 0;
+}
+
+static int genwait_wake_one(void *obj) {
+    kthread_t *thd;
+
+    TAILQ_FOREACH(thd, &waitq, thdq) {
+        if(thd->wait_obj == obj) {
+            thd_wake(thd, false);
+            return 1;
+        }
+    }
+
+    return 0;
+}
+
+/* Only one level of inheritance, which is all a single mutex needs. */
+static void thd_pi_acquire(kthread_pi_t *pi, kthread_t *thd) {
+    kthread_t *w;
+
+    pi->owner = thd;
+
+    LIST_FOREACH(w, &pi->waiters, pi_waiter) {
+        if(w->prio < thd->prio)
+            thd->prio = w->prio;
+    }
+}
+
+static void thd_pi_release(kthread_pi_t *pi) {
+    pi->owner->prio = pi->owner->base_prio;
+    pi->owner = NULL;
+}
+
+static void thd_pi_block(kthread_pi_t *pi) {
+    kthread_t *me = thd_current;
+
+    LIST_INSERT_HEAD(&pi->waiters, me, pi_waiter);
+    me->pi_blocked = pi;
+
+    if(pi->owner && pi->owner->prio > me->prio)
+        pi->owner->prio = me->prio;
+}
+
+static void thd_pi_unblock(kthread_t *thd) {
+    if(thd->pi_blocked) {
+        LIST_REMOVE(thd, pi_waiter);
+        thd->pi_blocked = NULL;
+    }
+}
+
+static void timer_spin_delay_us(unsigned short us) {
+    uint64_t end = timer_ns_gettime64() + us * 1000ULL;
+
+    while(timer_ns_gettime64() < end)
+        ;
+}
+
+/* Below here is mutex_bench, as close to the Dreamcast one as possible. */
+static mutex_t lock = MUTEX_INITIALIZER;
+static volatile uint32_t counter;
+
+static void report(const char *test, uint32_t pairs, uint64_t ns) {
+    printf("%-14s %8lu pairs in %8llu us: %6llu ns/pair\n", test,
+           (unsigned long)pairs, (unsigned long long)(ns / 1000),
+           (unsigned long long)(ns / pairs));
+}
+
+static void bench_uncontended(void) {
+    uint64_t start;
+    int i;
+
+    start = timer_ns_gettime64();
+
+    for(i = 0; i < ITERATIONS; ++i) {
+        mutex_lock(&lock);
+        mutex_unlock(&lock);
+    }
+
+    report("uncontended", ITERATIONS, timer_ns_gettime64() - start);
+}
+
+static void *contend_thd(void *param UNUSED) {
+    int i, j;
+
+    for(i = 0; i < ITERATIONS / THREADS; ++i) {
+        mutex_lock(&lock);
+
+        /* Hold on to it for a little while, so that we get preempted with it
+           held every now and then. */
+        for(j = 0; j < WORK; ++j)
+            ++counter;
+
+        mutex_unlock(&lock);
+    }
+
+    return NULL;
+}
+
+static void bench_contended(void) {
+    kthread_t *thds[THREADS];
+    uint64_t start;
+    int i;
+
+    counter = 0;
+    start = timer_ns_gettime64();
+
+    for(i = 0; i < THREADS; ++i)
+        thds[i] = thd_create_prio(PRIO_DEFAULT, contend_thd, NULL);
+
+    for(i = 0; i < THREADS; ++i)
+        thd_join(thds[i]);
+
+    report("contended", ITERATIONS / THREADS * THREADS,
+           timer_ns_gettime64() - start);
+
+    if(counter != ITERATIONS / THREADS * THREADS * WORK) {
+        printf("Counter is %lu, the mutex doesn't work!\n",
+               (unsigned long)counter);
+        exit(1);
+    }
+}
+
+static volatile int holding = 1;
+
+static void *holder_thd(void *param UNUSED) {
+    while(holding) {
+        mutex_lock(&lock);
+        timer_spin_delay_us(50);
+        mutex_unlock(&lock);
+        thd_sleep(1);
+    }
+
+    return NULL;
+}
+
+static void bench_blocking(void) {
+    kthread_t *holder;
+    uint64_t start;
+    int i;
+
+    holder = thd_create_prio(PRIO_DEFAULT + 1, holder_thd, NULL);
+
+    start = timer_ns_gettime64();
+
+    for(i = 0; i < ITERATIONS / 10; ++i) {
+        mutex_lock(&lock);
+        mutex_unlock(&lock);
+    }
+
+    report("lower holder", ITERATIONS / 10, timer_ns_gettime64() - start);
+
+    holding = 0;
+    thd_join(holder);
+}
+
+#define TIMED_HOLD      100
+#define TIMED_TIMEOUT   5
+
+static void *long_holder_thd(void *param UNUSED) {
+    uint64_t end;
+
+    mutex_lock(&lock);
+
+    /* Keep running with it held, rather than sleeping. */
+    end = timer_ms_gettime64() + TIMED_HOLD;
+    while(timer_ms_gettime64() < end)
+        ;
+
+    mutex_unlock(&lock);
+
+    return NULL;
+}
+
+static void bench_timed(void) {
+    kthread_t *holder;
+    uint64_t start;
+    int rv;
+
+    holder = thd_create_prio(PRIO_DEFAULT, long_holder_thd, NULL);
+
+    while(!mutex_is_locked(&lock))
+        thd_pass();
+
+    start = timer_ns_gettime64();
+    rv = mutex_lock_timed(&lock, TIMED_TIMEOUT);
+
+    printf("timed          %d ms timeout %s after %llu us\n", TIMED_TIMEOUT,
+           rv ? "ran out" : "got the lock",
+           (unsigned long long)((timer_ns_gettime64() - start) / 1000));
+
+    if(!rv)
+        mutex_unlock(&lock);
+
+    thd_join(holder);
+}
+
+int main(void) {
+    struct sigaction sa;
+    struct itimerval it;
+
+    thd_current = &main_thd;
+    main_thd.state = STATE_RUNNING;
+    main_thd.prio = main_thd.base_prio = PRIO_DEFAULT;
+
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = thd_tick;
+    sigemptyset(&sa.sa_mask);
+    sigaction(SIGALRM, &sa, NULL);
+
+    it.it_interval.tv_sec = 0;
+    it.it_interval.tv_usec = 1000000 / THD_SCHED_HZ;
+    it.it_value = it.it_interval;
+    setitimer(ITIMER_REAL, &it, NULL);
+
+    printf("KallistiOS mutex benchmark (host, %s)\n", MUTEX_C);
+
+    bench_uncontended();
+    bench_contended();
+    bench_blocking();
+    bench_timed();
+
+    printf("Done!\n");
+    return 0;
+}
@@ -0,0 +1,80 @@
+#!/usr/bin/env python3
+
+# profsym.py
+# Copyright (C) 2024 The KallistiOS Team
+#
+# Symbolizes the collapsed stacks written by profiler_write() (see
+# dc/profiler.h), so they can be fed to flamegraph.pl, speedscope or pprof.
+# Each raw address is replaced with the name of the function containing it,
+# as found by addr2line in the ELF file of the profiled program.
+#
+# usage: profsym.py <program.elf> <profile.txt> [output.txt]
+#
+# The addr2line to use is taken from $KOS_ADDR2LINE, then derived from
+# $KOS_CC_PREFIX, and otherwise defaults to sh-elf-addr2line.
+
+import os
+import re
+import subprocess
+import sys
+
+ADDR = re.compile(r'0x[0-9a-fA-F]{8}')
+
+
+def addr2line():
+    if 'KOS_ADDR2LINE' in os.environ:
+        return os.environ['KOS_ADDR2LINE']
+
+    if 'KOS_CC_PREFIX' in os.environ:
+        return os.environ['KOS_CC_PREFIX'] + '-addr2line'
+
+    return 'sh-elf-addr2line'
+
+
+def symbolize(elf, addrs):
+    # Ask for all of the addresses in one go, as running addr2line once per
+    # address is painfully slow on big profiles.
+    out = subprocess.run([addr2line(), '-f', '-C', '-e', elf] + addrs,
+                         stdout=subprocess.PIPE, check=True,
+                         universal_newlines=True).stdout.splitlines()
+    names = {}
+
+    # Output is two lines per address: the function, then file:line.
+    for addr, func in zip(addrs, out[0::2]):
+        names[addr] = addr if func == '??' else func
+
+    return names
+
+
+def main():
+    if len(sys.argv) < 3:
+        print('usage: profsym.py <program.elf> <profile.txt> [output.txt]')
+        sys.exit(1)
+
+    with open(sys.argv[2]) as f:
+        lines = f.read().splitlines()
+
+    addrs = sorted(set(a for l in lines for a in ADDR.findall(l)))
+    names = symbolize(sys.argv[1], addrs) if addrs else {}
+
+    # Frames are separated by semicolons, which C++ names don't contain, but
+    # they may contain spaces. The count is always after the last space.
+    # Different addresses in the same function end up as the same stack, so
+    # add those up.
+    counts = {}
+
+    for l in lines:
+        stack, _, count = l.rpartition(' ')
+        frames = stack.split(';')
+        frames = frames[:1] + [names.get(a, a) for a in frames[1:]]
+        stack = ';'.join(frames)
+        counts[stack] = counts.get(stack, 0) + int(count)
+
+    out = open(sys.argv[3], 'w') if len(sys.argv) > 3 else sys.stdout
+
+    for stack, count in counts.items():
+        out.write('%s %d\n' % (stack, count))
+
+
+if __name__ == '__main__':
+    main()
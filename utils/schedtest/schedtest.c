@@ -0,0 +1,193 @@
+/* KallistiOS ##version##
+
+   schedtest.c
+   Copyright (C) 2024 The KallistiOS Team
+
+   Checks the scheduler's run queue (kernel/thread/runq.h) on a PC, against a
+   model of the single sorted run queue that KOS used before it. Both are fed
+   the same random mix of queueing (front and back of the line), removing,
+   scheduling and priority changes, and after every step the thread each one
+   would run next must be the same. Every so often the whole queue order is
+   compared as well.
+
+   Most threads get priorities close to the default, where they share the
+   one-priority buckets, and the rest are spread out up to PRIO_MAX so the
+   shared bucket at the bottom gets exercised too.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <sys/queue.h>
+
+#define PRIO_MAX 4096
+
+typedef int prio_t;
+
+typedef struct kthread {
+    TAILQ_ENTRY(kthread) thdq;
+    prio_t prio;
+    int queue_bucket;
+
+    /* The model's own queue. */
+    TAILQ_ENTRY(kthread) oldq;
+    bool queued;
+    int id;
+} kthread_t;
+
+TAILQ_HEAD(ktqueue, kthread);
+
+#include "../../kernel/thread/runq.h"
+
+#define NTHREADS    256
+
+static kthread_t threads[NTHREADS];
+static runq_t rq;
+static struct ktqueue old_rq;
+
+/* This is what thd_add_to_runnable() did before the run queue was split. */
+static void old_add(kthread_t *t, bool front_of_line) {
+    kthread_t *i;
+
+    TAILQ_FOREACH(i, &old_rq, oldq) {
+        if(front_of_line ? i->prio >= t->prio : i->prio > t->prio) {
+            TAILQ_INSERT_BEFORE(i, t, oldq);
+            return;
+        }
+    }
+
+    TAILQ_INSERT_TAIL(&old_rq, t, oldq);
+}
+
+static void add(kthread_t *t, bool front_of_line) {
+    old_add(t, front_of_line);
+    runq_add(&rq, t, front_of_line);
+    t->queued = true;
+}
+
+static void remove_thd(kthread_t *t) {
+    TAILQ_REMOVE(&old_rq, t, oldq);
+    runq_remove(&rq, t);
+    t->queued = false;
+}
+
+static prio_t random_prio(void) {
+    int r = rand() % 100;
+
+    if(r < 80)
+        return 5 + rand() % 10;
+    else if(r < 90)
+        return rand() % (RUNQ_BUCKETS + 8);
+    else
+        return rand() % (PRIO_MAX + 1);
+}
+
+static kthread_t *random_thread(bool queued) {
+    int i, start = rand() % NTHREADS;
+
+    for(i = 0; i < NTHREADS; ++i) {
+        kthread_t *t = &threads[(start + i) % NTHREADS];
+
+        if(t->queued == queued)
+            return t;
+    }
+
+    return NULL;
+}
+
+static int check_order(void) {
+    kthread_t *o = TAILQ_FIRST(&old_rq), *n;
+    int b;
+
+    for(b = runq_next(&rq, 0); b >= 0; b = runq_next(&rq, b + 1)) {
+        TAILQ_FOREACH(n, &rq.bucket[b], thdq) {
+            if(n != o)
+                return -1;
+
+            o = TAILQ_NEXT(o, oldq);
+        }
+
+        if(TAILQ_EMPTY(&rq.bucket[b]))
+            return -1;
+    }
+
+    return o ? -1 : 0;
+}
+
+int main(int argc, char *argv[]) {
+    long i, steps = argc > 1 ? atol(argv[1]) : 5000000;
+    kthread_t *t, *o, *n;
+    bool front;
+    int op;
+
+    srand(argc > 2 ? atoi(argv[2]) : 1);
+
+    runq_init(&rq);
+    TAILQ_INIT(&old_rq);
+
+    for(i = 0; i < NTHREADS; ++i) {
+        threads[i].id = i;
+        threads[i].prio = random_prio();
+    }
+
+    for(i = 0; i < steps; ++i) {
+        op = rand() % 100;
+        front = rand() & 1;
+
+        if(op < 35) {
+            /* A thread becomes ready. */
+            if((t = random_thread(false)))
+                add(t, front);
+        }
+        else if(op < 60) {
+            /* A queued thread goes off to wait for something. */
+            if((t = random_thread(true)))
+                remove_thd(t);
+        }
+        else if(op < 90) {
+            /* Schedule: run the first thread, then put it back. */
+            if((t = runq_first(&rq))) {
+                remove_thd(t);
+                add(t, front);
+            }
+        }
+        else if(op < 95) {
+            /* A queued thread's priority changes, as thd_change_prio()
+               does it. */
+            if((t = random_thread(true))) {
+                prio_t prio = random_prio();
+
+                front = prio < t->prio;
+                remove_thd(t);
+                t->prio = prio;
+                add(t, front);
+            }
+        }
+        else {
+            if((t = random_thread(false)))
+                t->prio = random_prio();
+        }
+
+        o = TAILQ_FIRST(&old_rq);
+        n = runq_first(&rq);
+
+        if(o != n) {
+            fprintf(stderr, "step %ld: old picks %d, new picks %d\n", i,
+                    o ? o->id : -1, n ? n->id : -1);
+            return 1;
+        }
+
+        if(!(i % 1000) && check_order()) {
+            fprintf(stderr, "step %ld: queue order differs\n", i);
+            return 1;
+        }
+    }
+
+    if(check_order()) {
+        fprintf(stderr, "queue order differs at the end\n");
+        return 1;
+    }
+
+    printf("%ld steps, same thread picked every time\n", steps);
+    return 0;
+}
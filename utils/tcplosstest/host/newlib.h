@@ -0,0 +1,19 @@
+/* KallistiOS ##version##
+
+   utils/tcplosstest/host/newlib.h
+   Copyright (C) 2024 The KallistiOS Team
+
+   Just enough of newlib's <newlib.h> for the KOS headers that net_tcp.c
+   pulls in to build against the host's C library.
+*/
+
+#ifndef __TCPLOSSTEST_NEWLIB_H
+#define __TCPLOSSTEST_NEWLIB_H
+
+typedef long long _off64_t;
+typedef long _off_t;
+typedef int _ssize_t;
+
+#define __RESTRICT __restrict
+
+#endif /* !__TCPLOSSTEST_NEWLIB_H */
@@ -0,0 +1,17 @@
+/* KallistiOS ##version##
+
+   utils/tcplosstest/host/sys/fcntl.h
+   Copyright (C) 2024 The KallistiOS Team
+
+   The host's <sys/fcntl.h>, less the O_ASYNC that <kos/fs.h> defines for
+   itself.
+*/
+
+#ifndef __TCPLOSSTEST_SYS_FCNTL_H
+#define __TCPLOSSTEST_SYS_FCNTL_H
+
+#include_next <sys/fcntl.h>
+
+#undef O_ASYNC
+
+#endif /* !__TCPLOSSTEST_SYS_FCNTL_H */
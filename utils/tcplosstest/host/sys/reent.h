@@ -0,0 +1,17 @@
+/* KallistiOS ##version##
+
+   utils/tcplosstest/host/sys/reent.h
+   Copyright (C) 2024 The KallistiOS Team
+
+   Stands in for newlib's <sys/reent.h>, which <kos/thread.h> needs for the
+   per-thread reentrancy structure.
+*/
+
+#ifndef __TCPLOSSTEST_SYS_REENT_H
+#define __TCPLOSSTEST_SYS_REENT_H
+
+struct _reent {
+    int _errno;
+};
+
+#endif /* !__TCPLOSSTEST_SYS_REENT_H */
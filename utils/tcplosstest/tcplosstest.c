@@ -0,0 +1,535 @@
+/* KallistiOS ##version##
+
+   tcplosstest.c
+   Copyright (C) 2024 The KallistiOS Team
+
+   Runs the KOS TCP stack (kernel/net/net_tcp.c) on a PC, with two sockets
+   connected to each other over a simulated link that drops and reorders
+   segments. Everything net_tcp.c needs from the rest of the kernel is
+   stubbed out below, and there are no threads: one loop sends, moves
+   segments across the link, and reads. Whenever the link is idle and there
+   is nothing to read, the clock moves on 10ms and the TCP timer callback is
+   run, so the times reported are simulated ones and come out the same on
+   every run.
+
+   Each transfer is checked byte for byte, and the test fails if one of them
+   gets stuck or takes much longer than it should. For each one, it prints
+   how long it took and a few of the counters from TCP_INFO. Only segments
+   carrying data are ever dropped, and a reordered segment is held back
+   behind at most four others.
+
+   With -s, SACK is turned off on both ends once the connection is up. With
+   -o, the options are stripped from the client's <SYN>, so the connection
+   has no window scaling, timestamps or SACK at all.
+*/
+
+#include "net_tcp.c"
+
+#include <stdio.h>
+#include <unistd.h>
+
+/* The simulated clock. */
+static uint64_t now_ms = 1000;
+
+uint64_t timer_ms_gettime64(void) {
+    return now_ms;
+}
+
+uint64_t timer_us_gettime64(void) {
+    return now_ms * 1000;
+}
+
+/* Everything runs in one thread, so none of the locks have to do
+   anything. */
+int irq_inside_int(void) {
+    return 0;
+}
+
+irq_mask_t irq_disable(void) {
+    return 0;
+}
+
+void irq_restore(irq_mask_t old) {
+    (void)old;
+}
+
+int mutex_init(mutex_t *m, int mtype) {
+    (void)m;
+    (void)mtype;
+    return 0;
+}
+
+int mutex_destroy(mutex_t *m) {
+    (void)m;
+    return 0;
+}
+
+int mutex_lock(mutex_t *m) {
+    (void)m;
+    return 0;
+}
+
+int mutex_lock_irqsafe(mutex_t *m) {
+    (void)m;
+    return 0;
+}
+
+int mutex_trylock(mutex_t *m) {
+    (void)m;
+    return 0;
+}
+
+int mutex_unlock(mutex_t *m) {
+    (void)m;
+    return 0;
+}
+
+int cond_init(condvar_t *cv) {
+    (void)cv;
+    return 0;
+}
+
+int cond_destroy(condvar_t *cv) {
+    (void)cv;
+    return 0;
+}
+
+int cond_signal(condvar_t *cv) {
+    (void)cv;
+    return 0;
+}
+
+/* All the sockets are non-blocking, so nothing should ever wait. */
+int cond_wait(condvar_t *cv, mutex_t *m) {
+    (void)cv;
+    (void)m;
+    abort();
+}
+
+int cond_wait_timed(condvar_t *cv, mutex_t *m, int timeout) {
+    (void)cv;
+    (void)m;
+    (void)timeout;
+    abort();
+}
+
+int rwsem_read_lock(rw_semaphore_t *s) {
+    (void)s;
+    return 0;
+}
+
+int rwsem_read_lock_irqsafe(rw_semaphore_t *s) {
+    (void)s;
+    return 0;
+}
+
+int rwsem_read_trylock(rw_semaphore_t *s) {
+    (void)s;
+    return 0;
+}
+
+int rwsem_read_unlock(rw_semaphore_t *s) {
+    (void)s;
+    return 0;
+}
+
+int rwsem_write_lock(rw_semaphore_t *s) {
+    (void)s;
+    return 0;
+}
+
+int rwsem_write_lock_irqsafe(rw_semaphore_t *s) {
+    (void)s;
+    return 0;
+}
+
+int rwsem_write_trylock(rw_semaphore_t *s) {
+    (void)s;
+    return 0;
+}
+
+int rwsem_write_unlock(rw_semaphore_t *s) {
+    (void)s;
+    return 0;
+}
+
+void thd_pass(void) {
+}
+
+void dbglog(int level, const char *fmt, ...) {
+    (void)level;
+    (void)fmt;
+}
+
+int lockstat_set_name(const void *lock, const char *name) {
+    (void)lock;
+    (void)name;
+    return 0;
+}
+
+kmem_cache_t *kmem_cache_create(const char *name, size_t size, size_t align,
+                                kmem_ctor_t ctor) {
+    (void)name;
+    (void)size;
+    (void)align;
+    (void)ctor;
+    return (kmem_cache_t *)1;
+}
+
+void *kmem_cache_alloc(kmem_cache_t *c) {
+    (void)c;
+    return malloc(sizeof(struct tcp_sock));
+}
+
+void kmem_cache_free(kmem_cache_t *c, void *obj) {
+    (void)c;
+    free(obj);
+}
+
+/* The timer callback is run by hand instead. */
+int net_thd_add_callback(void (*cb)(void *), void *data, uint64 timeout) {
+    (void)cb;
+    (void)data;
+    (void)timeout;
+    return 1;
+}
+
+int net_thd_del_callback(int cbid) {
+    (void)cbid;
+    return 0;
+}
+
+void __poll_event_trigger(int fd, short event) {
+    (void)fd;
+    (void)event;
+}
+
+int fs_socket_proto_add(fs_socket_proto_t *p) {
+    (void)p;
+    return 0;
+}
+
+int fs_socket_proto_remove(fs_socket_proto_t *p) {
+    (void)p;
+    return 0;
+}
+
+static int next_fd = 10;
+
+net_socket_t *fs_socket_open_sock(fs_socket_proto_t *p) {
+    net_socket_t *hnd = calloc(1, sizeof(net_socket_t));
+
+    hnd->fd = next_fd++;
+    hnd->protocol = p;
+    return hnd;
+}
+
+int fs_close(file_t fd) {
+    (void)fd;
+    return 0;
+}
+
+/* The link never corrupts anything, so checksums are left out. */
+uint16 net_ipv4_checksum(const uint8 *data, size_t bytes, uint16 start) {
+    (void)data;
+    (void)bytes;
+    (void)start;
+    return 0;
+}
+
+uint16 net_ipv6_checksum_pseudo(const struct in6_addr *src,
+                                const struct in6_addr *dst, uint32 upper_len,
+                                uint8 next_hdr) {
+    (void)src;
+    (void)dst;
+    (void)upper_len;
+    (void)next_hdr;
+    return 0;
+}
+
+uint32 net_ipv4_address(const uint8 addr[4]) {
+    return (addr[0] << 24) | (addr[1] << 16) | (addr[2] << 8) | addr[3];
+}
+
+static netif_t dev = { .ip_addr = { 10, 0, 0, 1 } };
+netif_t *net_default_dev = &dev;
+const struct in6_addr in6addr_any;
+
+static void fail(const char *msg) {
+    fprintf(stderr, "%s\n", msg);
+    exit(1);
+}
+
+/* The link: a queue of segments in flight. */
+typedef struct {
+    uint8_t data[1500];
+    size_t len;
+    struct in6_addr src, dst;
+} seg_t;
+
+#define LINK_SEGS   4096
+
+static seg_t link_q[LINK_SEGS];
+static int link_cnt;
+static int drop_pct, reorder_pct;
+static int sent_segs, dropped_segs;
+static int no_sack, no_opts;
+
+/* xorshift, so the same segments get dropped on every PC. */
+static uint32_t rnd_state = 12345;
+
+static uint32_t rnd(void) {
+    rnd_state ^= rnd_state << 13;
+    rnd_state ^= rnd_state >> 17;
+    rnd_state ^= rnd_state << 5;
+    return rnd_state;
+}
+
+/* Everything net_tcp.c sends comes through here, IPv4 included. */
+int net_ipv6_send(netif_t *net, const uint8 *data, size_t size, int hop_limit,
+                  int proto, const struct in6_addr *src,
+                  const struct in6_addr *dst) {
+    const tcp_hdr_t *tcp = (const tcp_hdr_t *)data;
+    uint16_t flags = ntohs(tcp->off_flags);
+    size_t off = TCP_GET_OFFSET(flags);
+    static uint8_t bare[sizeof(tcp_hdr_t)];
+
+    (void)net;
+    (void)hop_limit;
+    (void)proto;
+
+    if(size > 1500 || off < 20 || off > 60 || size < off)
+        fail("bad segment sent");
+
+    ++sent_segs;
+
+    if(no_opts && (flags & (TCP_FLAG_SYN | TCP_FLAG_ACK)) == TCP_FLAG_SYN) {
+        memcpy(bare, data, sizeof(tcp_hdr_t));
+        ((tcp_hdr_t *)bare)->off_flags = htons(TCP_FLAG_SYN | TCP_OFFSET(5));
+        data = bare;
+        size = off = sizeof(tcp_hdr_t);
+    }
+
+    if(link_cnt == LINK_SEGS ||
+       (drop_pct && (int)(rnd() % 100) < drop_pct && size > off)) {
+        ++dropped_segs;
+        return 0;
+    }
+
+    memcpy(link_q[link_cnt].data, data, size);
+    link_q[link_cnt].len = size;
+    link_q[link_cnt].src = *src;
+    link_q[link_cnt].dst = *dst;
+    ++link_cnt;
+
+    return 0;
+}
+
+/* Hand one segment from the link to the other end. Returns 0 if the link was
+   empty. */
+static int deliver(void) {
+    ip_hdr_t ip = { 0 };
+    int i = 0, n;
+    seg_t s;
+
+    if(!link_cnt)
+        return 0;
+
+    if(reorder_pct && link_cnt > 1 && (int)(rnd() % 100) < reorder_pct) {
+        n = link_cnt - 1 < 4 ? link_cnt - 1 : 4;
+        i = 1 + rnd() % n;
+    }
+
+    s = link_q[i];
+    memmove(link_q + i, link_q + i + 1, (link_cnt - i - 1) * sizeof(seg_t));
+    --link_cnt;
+
+    /* Both ends are IPv4, in IPv4-mapped IPv6 addresses. */
+    ip.src = s.src.__s6_addr.__s6_addr32[3];
+    ip.dest = s.dst.__s6_addr.__s6_addr32[3];
+    net_tcp_input(NULL, AF_INET, &ip, s.data, s.len);
+
+    return 1;
+}
+
+static net_socket_t *make_sock(uint32_t bufsz) {
+    net_socket_t *hnd = calloc(1, sizeof(net_socket_t));
+
+    hnd->fd = next_fd++;
+
+    if(net_tcp_socket(hnd, AF_INET, SOCK_STREAM, 0))
+        fail("socket() failed");
+
+    ((struct tcp_sock *)hnd->data)->flags |= FS_SOCKET_NONBLOCK;
+
+    if(net_tcp_setsockopt(hnd, SOL_SOCKET, SO_SNDBUF, &bufsz, sizeof(bufsz)) ||
+       net_tcp_setsockopt(hnd, SOL_SOCKET, SO_RCVBUF, &bufsz, sizeof(bufsz)))
+        fail("setsockopt() failed");
+
+    return hnd;
+}
+
+/* Send total bytes from a client to a server with buffers of bufsz bytes. If
+   grow is set, both buffers are made that big halfway through. The transfer
+   has to be done within max_ms of simulated time. */
+static void run(const char *name, uint32_t bufsz, int drop, int reorder,
+                size_t total, uint32_t grow, uint64_t max_ms) {
+    static uint16_t port = 80;
+    struct sockaddr_in addr = { 0 };
+    net_socket_t *lsock, *cl, *sv;
+    size_t sent = 0, rcvd = 0, i;
+    uint8_t *src, *dst;
+    uint64_t start;
+    long iters = 0;
+    ssize_t n;
+    struct tcp_info ti;
+    socklen_t len = sizeof(ti);
+
+    link_cnt = 0;
+    drop_pct = reorder_pct = 0;
+    sent_segs = dropped_segs = 0;
+
+    lsock = make_sock(bufsz);
+    cl = make_sock(bufsz);
+
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port++);
+
+    if(net_tcp_bind(lsock, (struct sockaddr *)&addr, sizeof(addr)) ||
+       net_tcp_listen(lsock, 4))
+        fail("couldn't listen");
+
+    addr.sin_addr.s_addr = htonl(0x0a000002);
+
+    if(net_tcp_connect(cl, (struct sockaddr *)&addr, sizeof(addr)) != -1 ||
+       errno != EINPROGRESS)
+        fail("connect() didn't start connecting");
+
+    while(deliver())
+        ;
+
+    if(net_tcp_accept(lsock, NULL, NULL) < 0)
+        fail("accept() failed");
+
+    /* The accepted socket is the newest one. */
+    sv = calloc(1, sizeof(net_socket_t));
+    sv->data = LIST_FIRST(&tcp_socks);
+    ((struct tcp_sock *)sv->data)->flags |= FS_SOCKET_NONBLOCK;
+
+    while(deliver())
+        ;
+
+    if(((struct tcp_sock *)cl->data)->state != TCP_STATE_ESTABLISHED ||
+       ((struct tcp_sock *)sv->data)->state != TCP_STATE_ESTABLISHED)
+        fail("connection wasn't established");
+
+    if(no_sack) {
+        ((struct tcp_sock *)cl->data)->data.opts &= ~TCP_OPTF_SACK;
+        ((struct tcp_sock *)sv->data)->data.opts &= ~TCP_OPTF_SACK;
+    }
+
+    src = malloc(total);
+    dst = malloc(total);
+
+    for(i = 0; i < total; ++i)
+        src[i] = rnd();
+
+    drop_pct = drop;
+    reorder_pct = reorder;
+    start = now_ms;
+
+    while(rcvd < total) {
+        if(++iters > 5000000)
+            fail("transfer got stuck");
+
+        if(sent < total) {
+            n = net_tcp_sendto(cl, src + sent, total - sent > 3000 ? 3000 :
+                               total - sent, 0, NULL, 0);
+
+            if(n > 0)
+                sent += n;
+            else if(errno != EWOULDBLOCK)
+                fail("send() failed");
+        }
+
+        for(i = 0; i < 8 && deliver(); ++i)
+            ;
+
+        n = net_tcp_recvfrom(sv, dst + rcvd, total - rcvd, 0, NULL, NULL);
+
+        if(n > 0) {
+            if(memcmp(src + rcvd, dst + rcvd, n))
+                fail("data received doesn't match what was sent");
+
+            rcvd += n;
+
+            /* Let the sender know about the space that was just freed up,
+               as reading more would eventually do. */
+            tcp_send_ack((struct tcp_sock *)sv->data);
+
+            if(grow && rcvd > total / 2) {
+                net_tcp_setsockopt(sv, SOL_SOCKET, SO_RCVBUF, &grow,
+                                   sizeof(grow));
+                net_tcp_setsockopt(cl, SOL_SOCKET, SO_SNDBUF, &grow,
+                                   sizeof(grow));
+                grow = 0;
+            }
+        }
+        else if(!link_cnt) {
+            now_ms += 10;
+            tcp_thd_cb(NULL);
+        }
+    }
+
+    if(net_tcp_getsockopt(cl, IPPROTO_TCP, TCP_INFO, &ti, &len))
+        fail("getsockopt(TCP_INFO) failed");
+
+    printf("%-34s %6llu ms  %5d segs  %4d dropped  %4u resent  %3u fast  "
+           "%3u timeouts\n", name, (unsigned long long)(now_ms - start),
+           sent_segs, dropped_segs, ti.tcpi_total_retrans,
+           ti.tcpi_fast_retrans, ti.tcpi_timeouts);
+
+    free(src);
+    free(dst);
+
+    if(now_ms - start > max_ms)
+        fail("transfer took too long");
+}
+
+int main(int argc, char *argv[]) {
+    int c;
+
+    while((c = getopt(argc, argv, "so")) != -1) {
+        switch(c) {
+            case 's':
+                no_sack = 1;
+                break;
+
+            case 'o':
+                no_opts = 1;
+                break;
+
+            default:
+                fprintf(stderr, "usage: %s [-s] [-o]\n", argv[0]);
+                return 1;
+        }
+    }
+
+    net_tcp_init();
+
+    /* The later transfers depend on how many random numbers the earlier ones
+       used, so changing these changes all the numbers after them. The time
+       limits leave a lot of room, but recovering from losses by timeouts
+       alone takes well over them. */
+    run("200KB, 8KB buffers, clean", 8192, 0, 0, 200000, 0, 1000);
+    run("2MB, 256KB buffers, clean", 262144, 0, 0, 2000000, 0, 1000);
+    run("2MB, 256KB, 5% drop, 20% reorder", 262144, 5, 20, 2000000, 0,
+        6000);
+    run("1MB, 64KB, 10% drop, 30% reorder", 65536, 10, 30, 1000000, 300000,
+        15000);
+    run("300KB, 2KB, 10% drop, 30% reorder", 2048, 10, 30, 300000, 0,
+        75000);
+
+    printf("all transfers complete and intact\n");
+    return 0;
+}
@@ -0,0 +1,474 @@
+/* KallistiOS ##version##
+
+   tcpopttest.c
+   Copyright (C) 2024 The KallistiOS Team
+
+   Checks the option parsing, PAWS test and SACK range lists of the KOS TCP
+   stack (kernel/net/net_tcp_opts.h) on a PC. Most of it is made up of the
+   edge cases: options that run off the end of the header, lengths that are
+   wrong for their kind, window scales past the RFC 7323 limit, timestamps and
+   ranges on either side of where the sequence space wraps around, and range
+   lists that fill up.
+
+   After those, random ranges are added to a list and checked against a
+   bitmap of the sequence space they cover, with the list placed so that it
+   straddles the wraparound.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "../../kernel/net/net_tcp_opts.h"
+
+static const char *section;
+static int checks;
+
+static void check(int ok, const char *what) {
+    ++checks;
+
+    if(!ok) {
+        fprintf(stderr, "%s: %s\n", section, what);
+        exit(1);
+    }
+}
+
+/* A segment with room for a full 40 bytes of options. */
+static union {
+    tcp_hdr_t hdr;
+    uint8_t raw[60];
+} seg;
+
+/* Parse the given option bytes, as a header of 20 + optlen bytes. The option
+   length has to be a multiple of 4, as the data offset counts words. */
+static int parse(const uint8_t *opts, int optlen, struct tcp_opts *o) {
+    memset(&seg, 0xAA, sizeof(seg));
+
+    if(optlen)
+        memcpy(seg.hdr.options, opts, optlen);
+
+    return tcp_parse_opts(&seg.hdr, TCP_OFFSET((20 + optlen) / 4) |
+                          TCP_FLAG_ACK, o);
+}
+
+static void test_parse(void) {
+    struct tcp_opts o;
+
+    section = "parse";
+
+    check(!parse(NULL, 0, &o) && !o.flags && !o.mss && !o.sack_cnt,
+          "no options");
+
+    {
+        const uint8_t b[] = { 2, 4, 0x05, 0xB4 };
+        check(!parse(b, 4, &o) && o.mss == 1460 && !o.flags, "MSS");
+    }
+    {
+        const uint8_t b[] = { 2, 3, 0x05, 1 };
+        check(parse(b, 4, &o) == -1, "MSS with a length of 3");
+    }
+
+    /* Window scale: 14 is the largest allowed, and anything past it is taken
+       as 14 (RFC 7323, section 2.3). */
+    {
+        const uint8_t b[] = { 1, 3, 3, 14 };
+        check(!parse(b, 4, &o) && o.flags == TCP_OPTF_WSCALE &&
+              o.wscale == 14, "window scale of 14");
+    }
+    {
+        const uint8_t b[] = { 1, 3, 3, 15 };
+        check(!parse(b, 4, &o) && o.wscale == 14, "window scale of 15");
+    }
+    {
+        const uint8_t b[] = { 1, 3, 3, 255 };
+        check(!parse(b, 4, &o) && o.wscale == 14, "window scale of 255");
+    }
+    {
+        const uint8_t b[] = { 1, 3, 3, 0 };
+        check(!parse(b, 4, &o) && o.flags == TCP_OPTF_WSCALE &&
+              o.wscale == 0, "window scale of 0");
+    }
+    {
+        const uint8_t b[] = { 3, 4, 7, 0 };
+        check(parse(b, 4, &o) == -1, "window scale with a length of 4");
+    }
+    {
+        const uint8_t b[] = { 1, 1, 3, 2 };
+        check(parse(b, 4, &o) == -1, "window scale with a length of 2");
+    }
+
+    {
+        const uint8_t b[] = { 1, 1, 4, 2 };
+        check(!parse(b, 4, &o) && o.flags == TCP_OPTF_SACK, "SACK permitted");
+    }
+    {
+        const uint8_t b[] = { 1, 4, 3, 0 };
+        check(parse(b, 4, &o) == -1, "SACK permitted with a length of 3");
+    }
+
+    /* Timestamps, including values with the top bit set. */
+    {
+        const uint8_t b[] = { 1, 1, 8, 10, 0x80, 0, 0, 1, 0xFF, 0xFF, 0xFF,
+                              0xFE };
+        check(!parse(b, 12, &o) && o.flags == TCP_OPTF_TS &&
+              o.tsval == 0x80000001 && o.tsecr == 0xFFFFFFFE, "timestamps");
+    }
+    {
+        const uint8_t b[] = { 1, 1, 8, 8, 0, 0, 0, 1, 0, 0, 0, 2 };
+        check(parse(b, 12, &o) == -1, "timestamps with a length of 8");
+    }
+    {
+        /* Says 10 bytes, but the header ends after 8 of them. */
+        const uint8_t b[] = { 1, 1, 8, 10, 0, 0, 0, 1 };
+        check(parse(b, 8, &o) == -1, "timestamps running off the end");
+    }
+
+    /* Everything the stack sends on a <SYN>, all at once. */
+    {
+        const uint8_t b[] = { 2, 4, 0x02, 0x18, 1, 3, 3, 7, 4, 2, 8, 10,
+                              0, 0, 0, 9, 0, 0, 0, 0, 0, 0, 0, 0 };
+        check(!parse(b, 24, &o) && o.mss == 536 &&
+              o.flags == (TCP_OPTF_WSCALE | TCP_OPTF_SACK | TCP_OPTF_TS) &&
+              o.wscale == 7 && o.tsval == 9 && !o.tsecr, "all of the above");
+    }
+
+    /* Nothing after an end of options is looked at, even if it's bad. */
+    {
+        const uint8_t b[] = { 0, 3, 3, 9, 2, 3, 0, 0 };
+        check(!parse(b, 8, &o) && !o.flags && !o.mss, "end of options");
+    }
+
+    /* A kind with no room left for its length byte. */
+    {
+        const uint8_t b[] = { 1, 1, 1, 3 };
+        check(parse(b, 4, &o) == -1, "missing length byte");
+    }
+
+    /* Lengths of 0 and 1 can't be skipped over. */
+    {
+        const uint8_t b[] = { 99, 0, 1, 1 };
+        check(parse(b, 4, &o) == -1, "length of 0");
+    }
+    {
+        const uint8_t b[] = { 99, 1, 1, 1 };
+        check(parse(b, 4, &o) == -1, "length of 1");
+    }
+
+    /* Unknown options are skipped, as long as they fit. */
+    {
+        const uint8_t b[] = { 99, 6, 1, 2, 3, 4, 1, 3, 3, 5, 0, 0 };
+        check(!parse(b, 12, &o) && o.flags == TCP_OPTF_WSCALE &&
+              o.wscale == 5, "unknown option");
+    }
+    {
+        const uint8_t b[] = { 1, 1, 99, 3 };
+        check(parse(b, 4, &o) == -1, "unknown option running off the end");
+    }
+    {
+        /* Exactly fills all 40 bytes. */
+        uint8_t b[40] = { 99, 40 };
+        check(!parse(b, 40, &o) && !o.flags, "unknown option of 40 bytes");
+    }
+}
+
+static int parse_sack(int blocks, int extra, struct tcp_opts *o) {
+    uint8_t b[40];
+    int i, len = 2 + blocks * 8 + extra;
+
+    memset(b, TCP_OPT_NOP, sizeof(b));
+    b[2] = TCP_OPT_SACK;
+    b[3] = len;
+
+    for(i = 0; i < blocks && 4 + i * 8 + 8 <= 40; ++i) {
+        tcp_put32(b + 4 + i * 8, 0xFFFFFF00 + i * 0x100);
+        tcp_put32(b + 8 + i * 8, 0xFFFFFF80 + i * 0x100);
+    }
+
+    return parse(b, 40, o);
+}
+
+static void test_sack(void) {
+    struct tcp_opts o;
+    int i;
+
+    section = "sack";
+
+    check(!parse_sack(0, 0, &o) && !o.sack_cnt, "no blocks");
+
+    /* 4 blocks is all that fits beside the two NOPs. */
+    for(i = 1; i <= TCP_SACK_BLOCKS; ++i) {
+        check(!parse_sack(i, 0, &o) && o.sack_cnt == i, "block count");
+        check(o.sack[i - 1].start == 0xFFFFFF00 + (i - 1) * 0x100U &&
+              o.sack[i - 1].end == 0xFFFFFF80 + (i - 1) * 0x100U,
+              "block contents");
+    }
+
+    check(parse_sack(5, 0, &o) == -1, "5 blocks don't fit");
+    check(parse_sack(1, 4, &o) == -1, "length that isn't 2 + 8n");
+    check(parse_sack(1, 1, &o) == -1, "length that isn't 2 + 8n");
+    check(parse_sack(0, -1, &o) == -1, "length of 1");
+
+    /* A block that starts at the last byte of the options. */
+    {
+        uint8_t b[40];
+
+        memset(b, TCP_OPT_NOP, sizeof(b));
+        b[39] = TCP_OPT_SACK;
+        check(parse(b, 40, &o) == -1, "SACK with no length byte");
+    }
+}
+
+static void test_paws(void) {
+    struct tcp_opts o;
+
+    section = "paws";
+
+    memset(&o, 0, sizeof(o));
+    o.flags = TCP_OPTF_TS;
+    o.tsval = 99;
+
+    check(tcp_paws_reject(TCP_OPTF_TS, &o, TCP_FLAG_ACK, 100),
+          "older timestamp");
+    check(!tcp_paws_reject(TCP_OPTF_TS, &o, TCP_FLAG_ACK, 99),
+          "same timestamp");
+    check(!tcp_paws_reject(TCP_OPTF_TS, &o, TCP_FLAG_ACK, 98),
+          "newer timestamp");
+    check(!tcp_paws_reject(TCP_OPTF_TS, &o, TCP_FLAG_RST | TCP_FLAG_ACK, 100),
+          "older timestamp on a <RST>");
+    check(!tcp_paws_reject(TCP_OPTF_SACK | TCP_OPTF_WSCALE, &o, TCP_FLAG_ACK,
+                           100), "timestamps not agreed on");
+
+    o.flags = TCP_OPTF_SACK;
+    check(!tcp_paws_reject(TCP_OPTF_TS, &o, TCP_FLAG_ACK, 100),
+          "no timestamp on the segment");
+
+    /* Across the wraparound, in both directions. */
+    o.flags = TCP_OPTF_TS;
+    o.tsval = 5;
+    check(!tcp_paws_reject(TCP_OPTF_TS, &o, TCP_FLAG_ACK, 0xFFFFFFF0),
+          "newer timestamp past the wraparound");
+
+    o.tsval = 0xFFFFFFF0;
+    check(tcp_paws_reject(TCP_OPTF_TS, &o, TCP_FLAG_ACK, 5),
+          "older timestamp before the wraparound");
+
+    /* Half the space away is as far as "newer" goes. */
+    o.tsval = 0x7FFFFFFF;
+    check(!tcp_paws_reject(TCP_OPTF_TS, &o, TCP_FLAG_ACK, 0),
+          "timestamp 2^31 - 1 ahead");
+
+    o.tsval = 0x80000001;
+    check(tcp_paws_reject(TCP_OPTF_TS, &o, TCP_FLAG_ACK, 0),
+          "timestamp 2^31 - 1 behind");
+}
+
+static int range_is(const struct tcp_range *r, uint32_t start, uint32_t end) {
+    return r->start == start && r->end == end;
+}
+
+static void test_range_add(void) {
+    struct tcp_range r[TCP_SACK_RANGES];
+    uint8_t cnt = 0;
+    int i;
+
+    section = "range_add";
+
+    tcp_range_add(r, &cnt, 100, 200);
+    check(cnt == 1 && range_is(r, 100, 200), "first range");
+
+    /* Touching on either side merges. */
+    tcp_range_add(r, &cnt, 200, 300);
+    check(cnt == 1 && range_is(r, 100, 300), "touching the end");
+
+    tcp_range_add(r, &cnt, 50, 100);
+    check(cnt == 1 && range_is(r, 50, 300), "touching the start");
+
+    /* Inside or covering it. */
+    tcp_range_add(r, &cnt, 60, 70);
+    check(cnt == 1 && range_is(r, 50, 300), "inside");
+
+    tcp_range_add(r, &cnt, 40, 310);
+    check(cnt == 1 && range_is(r, 40, 310), "covering");
+
+    /* A gap of one keeps them apart, and the newest goes first. */
+    tcp_range_add(r, &cnt, 311, 400);
+    check(cnt == 2 && range_is(r, 311, 400) && range_is(r + 1, 40, 310),
+          "gap of one");
+
+    tcp_range_add(r, &cnt, 500, 600);
+    check(cnt == 3 && range_is(r, 500, 600) && range_is(r + 1, 311, 400) &&
+          range_is(r + 2, 40, 310), "newest first");
+
+    /* Filling the gaps pulls everything together, and it moves to the
+       front. */
+    tcp_range_add(r, &cnt, 310, 311);
+    check(cnt == 2 && range_is(r, 40, 400) && range_is(r + 1, 500, 600),
+          "filling a gap");
+
+    tcp_range_add(r, &cnt, 0, 1000);
+    check(cnt == 1 && range_is(r, 0, 1000), "covering them all");
+
+    /* Across the wraparound. */
+    cnt = 0;
+    tcp_range_add(r, &cnt, 0xFFFFFF00, 0x100);
+    tcp_range_add(r, &cnt, 0x100, 0x200);
+    check(cnt == 1 && range_is(r, 0xFFFFFF00, 0x200), "joined after wrap");
+
+    tcp_range_add(r, &cnt, 0xFFFFFE00, 0xFFFFFF00);
+    check(cnt == 1 && range_is(r, 0xFFFFFE00, 0x200), "joined before wrap");
+
+    tcp_range_add(r, &cnt, 0xFFFFFFF0, 0x10);
+    check(cnt == 1 && range_is(r, 0xFFFFFE00, 0x200), "inside across wrap");
+
+    /* A full list forgets the oldest range. */
+    cnt = 0;
+
+    for(i = 0; i < TCP_SACK_RANGES; ++i)
+        tcp_range_add(r, &cnt, i * 10, i * 10 + 5);
+
+    check(cnt == TCP_SACK_RANGES && range_is(r, 150, 155) &&
+          range_is(r + TCP_SACK_RANGES - 1, 0, 5), "filled up");
+
+    tcp_range_add(r, &cnt, 1000, 1005);
+    check(cnt == TCP_SACK_RANGES && range_is(r, 1000, 1005) &&
+          range_is(r + 1, 150, 155) &&
+          range_is(r + TCP_SACK_RANGES - 1, 10, 15), "oldest forgotten");
+
+    /* But not if the new one merges with something. */
+    tcp_range_add(r, &cnt, 12, 14);
+    check(cnt == TCP_SACK_RANGES && range_is(r, 10, 15) &&
+          range_is(r + 1, 1000, 1005) &&
+          range_is(r + TCP_SACK_RANGES - 1, 20, 25), "merged when full");
+
+    /* Or if it joins two, which leaves room. */
+    tcp_range_add(r, &cnt, 15, 20);
+    check(cnt == TCP_SACK_RANGES - 1 && range_is(r, 10, 25) &&
+          range_is(r + 1, 1000, 1005) &&
+          range_is(r + TCP_SACK_RANGES - 2, 30, 35), "joined two when full");
+}
+
+static void test_range_trim(void) {
+    struct tcp_range r[TCP_SACK_RANGES];
+    uint8_t cnt;
+
+    section = "range_trim";
+
+    /* Nothing at or below seq. */
+    cnt = 2;
+    r[0].start = 300; r[0].end = 400;
+    r[1].start = 101; r[1].end = 200;
+    check(tcp_range_trim(r, &cnt, 100) == 100 && cnt == 2, "below them all");
+
+    /* Starting right at seq moves it. */
+    check(tcp_range_trim(r, &cnt, 101) == 200 && cnt == 1 &&
+          range_is(r, 300, 400), "at the start");
+
+    /* Wholly below seq is just dropped. */
+    cnt = 2;
+    r[0].start = 300; r[0].end = 400;
+    r[1].start = 10; r[1].end = 20;
+    check(tcp_range_trim(r, &cnt, 50) == 50 && cnt == 1 &&
+          range_is(r, 300, 400), "below seq");
+
+    /* Ending at seq doesn't move it. */
+    check(tcp_range_trim(r, &cnt, 400) == 400 && !cnt, "ending at seq");
+
+    /* Moving seq up reaches ranges that were looked at before. */
+    cnt = 3;
+    r[0].start = 30; r[0].end = 40;
+    r[1].start = 10; r[1].end = 20;
+    r[2].start = 20; r[2].end = 30;
+    check(tcp_range_trim(r, &cnt, 15) == 40 && !cnt, "chained");
+
+    /* Across the wraparound. */
+    cnt = 2;
+    r[0].start = 0x10; r[0].end = 0x20;
+    r[1].start = 0xFFFFFFF8; r[1].end = 8;
+    check(tcp_range_trim(r, &cnt, 0xFFFFFFF0) == 0xFFFFFFF0 && cnt == 2,
+          "below the wrap");
+    check(tcp_range_trim(r, &cnt, 0xFFFFFFF8) == 8 && cnt == 1 &&
+          range_is(r, 0x10, 0x20), "at the wrap");
+    check(tcp_range_trim(r, &cnt, 0x18) == 0x20 && !cnt, "after the wrap");
+}
+
+static void test_wscale(void) {
+    section = "wscale";
+
+    check(tcp_wscale(0) == 0, "0 bytes");
+    check(tcp_wscale(65535) == 0, "65535 bytes");
+    check(tcp_wscale(65536) == 1, "65536 bytes");
+    check(tcp_wscale(131070) == 1, "131070 bytes");
+    check(tcp_wscale(131071) == 2, "131071 bytes");
+    check(tcp_wscale(1024 * 1024) == 5, "1MB");
+    check(tcp_wscale(0xFFFFFFFF) == TCP_MAX_WSCALE, "4GB");
+}
+
+/* Random ranges against a bitmap, in a window of sequence space that starts
+   just before the wraparound. Few enough are added each round that the list
+   never fills up, so it has to cover exactly what the bitmap does. */
+#define SPACE   2048
+
+static void test_range_random(long rounds) {
+    static uint8_t bits[SPACE];
+    struct tcp_range r[TCP_SACK_RANGES];
+    uint32_t base = 0xFFFFFC00, s, e;
+    uint8_t cnt;
+    int i, j, k, adds;
+    long round;
+
+    section = "random";
+
+    for(round = 0; round < rounds; ++round) {
+        memset(bits, 0, sizeof(bits));
+        cnt = 0;
+        adds = 1 + rand() % 8;
+
+        for(k = 0; k < adds; ++k) {
+            i = rand() % (SPACE - 64);
+            j = i + 1 + rand() % 64;
+            s = base + i;
+            e = base + j;
+            memset(bits + i, 1, j - i);
+            tcp_range_add(r, &cnt, s, e);
+
+            check(SEQ_LE(r[0].start, s) && SEQ_GE(r[0].end, e),
+                  "newest range isn't first");
+        }
+
+        for(i = 0; i < cnt; ++i) {
+            check(SEQ_LT(r[i].start, r[i].end), "empty range");
+
+            /* No two can overlap or touch. */
+            for(j = i + 1; j < cnt; ++j)
+                check(SEQ_GT(r[i].start, r[j].end) ||
+                      SEQ_LT(r[i].end, r[j].start), "ranges overlap");
+
+            for(s = r[i].start; s != r[i].end; ++s)
+                check(bits[s - base] == 1, "range covers too much");
+
+            for(s = r[i].start; s != r[i].end; ++s)
+                bits[s - base] = 2;
+        }
+
+        for(i = 0; i < SPACE; ++i)
+            check(bits[i] != 1, "range missing");
+    }
+}
+
+int main(int argc, char *argv[]) {
+    long rounds = argc > 1 ? atol(argv[1]) : 100000;
+
+    srand(argc > 2 ? atoi(argv[2]) : 1);
+
+    test_parse();
+    test_sack();
+    test_paws();
+    test_range_add();
+    test_range_trim();
+    test_wscale();
+    test_range_random(rounds);
+
+    printf("%d checks, %ld random rounds, all passed\n", checks, rounds);
+    return 0;
+}